@@ -0,0 +1,1352 @@
+/*
+ ============================================================================
+ Name        : liblightmanager.c
+ Copyright   : GPL
+ Description : liblightmanager - USB transport of the jbmedia Light Manager
+               Pro(+): RF transmit pacing, fair scheduling of all clients
+               and the device requests (clock, temperature)
+ ============================================================================
+ */
+
+// timegm()
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <time.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <libusb-1.0/libusb.h>
+
+#include "lightmanager.h"
+
+
+/* ======================================================================== */
+/* Defines */
+/* ======================================================================== */
+
+#define LM_VENDOR_ID		0x16c0		/* jbmedia Light-Manager (Pro) USB vendor */
+#define LM_PRODUCT_ID		0x0a32		/* jbmedia Light-Manager (Pro) USB product ID */
+
+#define USB_MAX_RETRY		5			/* max number of retries on usb error */
+#define USB_TIMEOUT			250			/* timeout in ms for usb transfer */
+#define USB_WAIT_ON_ERROR	250			/* delay between unsuccessful usb retries */
+
+/* 	RF airtime of one frame incl. device repeats (us) and allowed duty cycle
+	(permille). The airtimes are estimates from the telegram lengths, not
+	measured on a Light Manager, which is why pacing is off unless enabled
+	by lm_set_paced() */
+#define FS20_AIRTIME		175000		/* 868.35 MHz, 3 x 58 bit telegram */
+#define FS20_DUTY			10			/* 1% (868.0-868.6 MHz sub-band) */
+#define IT_AIRTIME			250000		/* 433.92 MHz, 4+ x 12/32 bit telegram */
+#define IT_DUTY				100			/* 10% (433.05-434.79 MHz band) */
+#define IKEA_AIRTIME		200000
+#define IKEA_DUTY			100
+#define UNI_AIRTIME			150000
+#define UNI_DUTY			100
+#define PACER_WINDOW		3600		/* duty cycle observation period (s) */
+
+#define USB_QUANTUM			250000		/* scheduler quantum per client and round (us airtime) */
+#define USB_COST			5000		/* scheduler cost of a non RF frame (us) */
+
+#define RT_STACK_SIZE		(256*1024)	/* stack of the transport thread if memory is locked */
+#define RT_STACK_PREFAULT	(64*1024)	/* part of it touched before locking */
+#define JITTER_BUCKETS		5
+
+#define SIM_USB_TIME		1000		/* simulated device: time per USB transfer (us) */
+#define SIM_TEMP			43			/* simulated device: temperature (0.5 C units) */
+
+
+/* ======================================================================== */
+/* Types */
+/* ======================================================================== */
+
+/* Transmit pacer of one RF protocol family (token bucket of airtime) */
+struct pacer {
+	const char *name;
+	unsigned char frametype;	/* device frame byte 0 */
+	long airtime;				/* on-air time per frame (us) */
+	int  duty;					/* duty cycle (permille) */
+	double tokens;				/* available airtime budget (us) */
+	long long updated;			/* time_us() of last refill */
+	unsigned long frames;		/* frames sent */
+	unsigned long delayed;		/* frames delayed by the pacer */
+	long long waited;			/* total delay (us) */
+};
+
+/* Scheduling lateness of the transport thread against a known deadline */
+struct jitter {
+	const char *name;
+	unsigned long count;
+	long long total;			/* us */
+	long long max;
+	unsigned long late[JITTER_BUCKETS];	/* more than jitter_limits[i] late */
+};
+
+/* One device transfer waiting for the USB scheduler */
+struct usb_request {
+	unsigned char *data;		/* 8 byte frame, receives device data if fexpectdata */
+	bool fexpectdata;
+	int  result;				/* usb_transfer() result */
+	int  retries;				/* repeated USB transfers */
+	long long paced;			/* delay by the RF pacer (us) */
+	bool done;
+	long long submitted;		/* time_us() timestamps */
+	long long started;
+	long long finished;
+	struct usb_request *next;
+};
+
+/* Submission queue of one client, served by the USB scheduler */
+struct lm_queue {
+	struct usb_request *head;
+	struct usb_request *tail;
+	long deficit;				/* deficit round robin credit (us airtime) */
+	bool inturn;				/* quantum for the current round granted */
+	struct lm_timing timing;	/* time spent by the served requests */
+	long long finished;			/* time_us() the last request was done */
+	struct usb_request *reqs;	/* burst requests of lm_submit(), reused */
+	int reqsize;
+	pthread_cond_t cond;		/* signaled on request completion */
+	struct lm_queue *next;		/* next active queue */
+};
+
+/* Burst of lm_submit_start(), owned by the caller until lm_submit_finish() */
+struct lm_burst {
+	struct lm_queue *queue;
+	int count;
+	struct usb_request reqs[];
+};
+
+/* The opened Light Manager */
+struct lm_device {
+	libusb_context *context;
+	libusb_device_handle *handle;
+	bool open;
+	bool simulated;				/* no hardware, see lm_open_sim() */
+	bool paced;					/* RF pacing applies */
+	time_t simclock;			/* simulated clock offset to the host local time (s) */
+	lm_frame_fn hook;
+	void *hookarg;
+};
+
+
+/* ======================================================================== */
+/* Global vars */
+/* ======================================================================== */
+
+static lm_log_fn lm_log_function;
+
+/* There is only one Light Manager, device access is protected by mutex_usb */
+static pthread_mutex_t mutex_usb = PTHREAD_MUTEX_INITIALIZER;
+static struct lm_device device;
+
+/* RF transmit pacing, protected by mutex_usb */
+static struct pacer pacers[] = {
+	{ "FS20", 0x01, FS20_AIRTIME, FS20_DUTY },
+	{ "IT",   0x05, IT_AIRTIME,   IT_DUTY   },
+	{ "IKEA", 0x13, IKEA_AIRTIME, IKEA_DUTY },
+	{ "UNI",  0x15, UNI_AIRTIME,  UNI_DUTY  },
+	{ NULL }
+};
+static long long radio_busy_until;		/* time_us() the last frame is still on air */
+
+/* USB scheduler, protected by mutex_sched */
+static pthread_mutex_t mutex_sched = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  cond_sched  = PTHREAD_COND_INITIALIZER;
+static struct lm_queue *sched_active;		/* round robin list of queues with pending requests */
+static struct lm_queue *sched_active_tail;
+static struct lm_queue default_queue = { .cond = PTHREAD_COND_INITIALIZER };
+static unsigned long sched_served;
+static bool sched_running;
+static bool sched_idle;						/* scheduler waits for requests */
+static long long sched_wakeup;				/* time_us() an idle scheduler was signaled */
+static __thread struct lm_queue *thread_queue;	/* submission queue of the calling thread */
+
+/* Real-time settings of the transport thread, see lm_set_realtime() */
+static struct lm_realtime sched_rt = { 0, -1, false };
+
+/* 	Lateness of the transport thread: waking up for a request submitted
+	while idle (protected by mutex_sched) and sending a frame delayed by the
+	pacer (protected by mutex_usb) */
+static const long jitter_limits[JITTER_BUCKETS] = { 50, 100, 500, 1000, 5000 };
+static struct jitter jitter_wakeup = { "wakeup" };
+static struct jitter jitter_pacer  = { "pacer" };
+
+/* USB transfer trace mapped into memory, protected by mutex_usb */
+static struct lm_trace_header *trace;
+static size_t trace_size;
+
+
+/* ======================================================================== */
+/* Prototypes */
+/* ======================================================================== */
+
+static void lm_log(int priority, const char *format, ...);
+static long long time_us(void);
+static void sleep_until(long long deadline);
+static void jitter_record(struct jitter *jitter, long long late);
+static int  jitter_stats(const struct jitter *jitter, char *buf, size_t len);
+static void pacer_refill(struct pacer *pacer, long long now);
+static long long pacer_charge(const unsigned char *device_data, long long now);
+static void trace_add(int direction, const unsigned char *data, bool fexpectdata, long long started, int result, int retries, long long paced);
+static int  usb_transfer(struct lm_device *dev, struct usb_request *req);
+static int  sim_transfer(struct lm_device *dev, unsigned char *device_data, bool fexpectdata);
+static int  sched_start(struct lm_device *dev);
+static void usb_submit(struct lm_queue *queue, struct usb_request *reqs, int count);
+static void usb_wait(struct lm_queue *queue, struct usb_request *req);
+static int  usb_results(const struct usb_request *reqs, int count, struct lm_result *results);
+static long usb_cost(const unsigned char *device_data);
+static void *usb_scheduler(void *arg);
+static void sched_prefault(void);
+static void sched_realtime(void);
+static void mutex_inherit(pthread_mutex_t *mutex);
+static struct lm_queue *current_queue(void);
+static bool dev_open(const struct lm_device *dev);
+
+
+/* ======================================================================== */
+/* Helper Functions */
+/* ======================================================================== */
+
+static void lm_log(int priority, const char *format, ...)
+{
+	va_list args;
+
+	if( lm_log_function == NULL ) {
+		return;
+	}
+	va_start(args, format);
+	lm_log_function(priority, format, args);
+	va_end(args);
+}
+
+/* Returns a monotonic timestamp in microseconds */
+static long long time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/* Sleep until the time_us() <deadline>, an absolute deadline does not add
+   the time spent before the sleep to the delay */
+static void sleep_until(long long deadline)
+{
+	struct timespec ts;
+
+	ts.tv_sec = deadline / 1000000LL;
+	ts.tv_nsec = (deadline % 1000000LL) * 1000;
+	while( clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR );
+}
+
+/* Count a lateness of <late> us, the caller holds the mutex of <jitter> */
+static void jitter_record(struct jitter *jitter, long long late)
+{
+	int i;
+
+	if( late < 0 ) {
+		late = 0;
+	}
+	jitter->count++;
+	jitter->total += late;
+	if( late > jitter->max ) {
+		jitter->max = late;
+	}
+	for(i=0; i<JITTER_BUCKETS && late > jitter_limits[i]; i++) {
+		jitter->late[i]++;
+	}
+}
+
+/* Write <jitter> as text line into <buf>, the caller holds its mutex */
+static int jitter_stats(const struct jitter *jitter, char *buf, size_t len)
+{
+	int pos;
+	int i;
+
+	pos = snprintf(buf, len, "JITTER %-6s n %lu, avg %lld us, max %lld us, late",
+				   jitter->name, jitter->count,
+				   (jitter->count > 0) ? jitter->total / (long long)jitter->count : 0LL, jitter->max);
+	for(i=0; i<JITTER_BUCKETS && pos >= 0 && (size_t)pos < len; i++) {
+		pos += snprintf(buf + pos, len - pos, "%s>%ld us %lu", (i > 0) ? ", " : " ", jitter_limits[i], jitter->late[i]);
+	}
+	if( pos >= 0 && (size_t)pos < len ) {
+		pos += snprintf(buf + pos, len - pos, "\r\n");
+	}
+	return pos;
+}
+
+
+/* ======================================================================== */
+/* USB Functions */
+/* ======================================================================== */
+
+/* Add the airtime budget earned since the last refill, the bucket holds
+   at most the airtime allowed within one duty cycle period */
+static void pacer_refill(struct pacer *pacer, long long now)
+{
+	double max = (double)pacer->duty * PACER_WINDOW * 1000.0;
+
+	if( pacer->updated == 0 ) {
+		pacer->tokens = max;
+	}
+	else {
+		pacer->tokens += (double)(now - pacer->updated) * pacer->duty / 1000.0;
+		if( pacer->tokens > max ) {
+			pacer->tokens = max;
+		}
+	}
+	pacer->updated = now;
+}
+
+/* Delay of an RF frame at <now> until the previous frame is off air and the
+   protocol family has enough duty cycle budget left. Its airtime is charged
+   right away, the bucket refills during the delay. Non RF frames (clock,
+   temperature, scenes) pass unchanged. The caller must hold mutex_usb and
+   sleep the returned delay (us) without it */
+static long long pacer_charge(const unsigned char *device_data, long long now)
+{
+	struct pacer *pacer;
+	long long wait;
+
+	for(pacer = pacers; pacer->name != NULL && pacer->frametype != device_data[0]; pacer++);
+	if( pacer->name == NULL ) {
+		return 0;
+	}
+
+	pacer_refill(pacer, now);
+	wait = radio_busy_until - now;
+	if( pacer->tokens < pacer->airtime ) {
+		long long budget = (long long)((pacer->airtime - pacer->tokens) * 1000.0 / pacer->duty);
+		if( budget > wait ) {
+			wait = budget;
+		}
+	}
+	if( wait > 0 ) {
+		lm_log(LOG_DEBUG, "pacer %s: delay frame %lld us", pacer->name, wait);
+		pacer->delayed++;
+		pacer->waited += wait;
+	}
+	else {
+		wait = 0;
+	}
+	pacer->tokens -= pacer->airtime;
+	pacer->frames++;
+	radio_busy_until = now + wait + pacer->airtime;
+	return wait;
+}
+
+/* Append one transfer to the trace, if any. The caller must hold mutex_usb */
+static void trace_add(int direction, const unsigned char *data, bool fexpectdata, long long started, int result, int retries, long long paced)
+{
+	struct lm_trace_record *rec;
+
+	if( trace == NULL ) {
+		return;
+	}
+	rec = (struct lm_trace_record *)(trace + 1) + trace->count % trace->capacity;
+	rec->time = started;
+	rec->duration = (int32_t)(time_us() - started);
+	rec->paced = (int32_t)paced;
+	rec->result = result;
+	rec->direction = direction;
+	rec->retries = (retries < 255) ? retries : 255;
+	rec->fexpectdata = fexpectdata;
+	rec->reserved = 0;
+	memcpy(rec->data, data, LM_FRAME_LEN);
+	/* a reader of the live file sees only complete records */
+	__atomic_store_n(&trace->count, trace->count + 1, __ATOMIC_RELEASE);
+}
+
+/* Transfer the raw data of <req> to jbmedia Light Manager Pro(+), the RF
+   pacer delay is already over. The caller must hold mutex_usb */
+static int usb_transfer(struct lm_device *dev, struct usb_request *req)
+{
+	libusb_device_handle* dev_handle = dev->handle;
+	unsigned char *device_data = req->data;
+	bool fexpectdata = req->fexpectdata;
+	long long started;
+	int retries;
+	int retry;
+	int actual;
+	int ret;
+	int err = LM_OK;
+
+	/* closed meanwhile, the handle is gone */
+	if( !dev->open ) {
+		return LM_ENODEV;
+	}
+	if( dev->simulated ) {
+		unsigned char sent[LM_FRAME_LEN];
+
+		memcpy(sent, device_data, LM_FRAME_LEN);
+		started = time_us();
+		err = sim_transfer(dev, device_data, fexpectdata);
+		trace_add(LM_TRACE_OUT, sent, fexpectdata, started, err, 0, req->paced);
+		if( fexpectdata ) {
+			trace_add(LM_TRACE_IN, device_data, fexpectdata, started, err, 0, 0);
+		}
+		return err;
+	}
+	started = time_us();
+	retries = req->retries;
+	retry = USB_MAX_RETRY;
+	ret = EXIT_FAILURE;
+	while( ret!=0 && retry>0 ) {
+		lm_log(LOG_DEBUG, "usb_send(0x01) (%02x %02x %02x %02x %02x %02x %02x %02x)", device_data[0], device_data[1], device_data[2], device_data[3], device_data[4], device_data[5], device_data[6], device_data[7] );
+		ret = libusb_interrupt_transfer(dev_handle, (0x01 | LIBUSB_ENDPOINT_OUT), device_data, 8, &actual, USB_TIMEOUT);
+		lm_log(LOG_DEBUG, "usb_send(0x01) transferred: %d, returns %d (%02x %02x %02x %02x %02x %02x %02x %02x)", actual, ret, device_data[0], device_data[1], device_data[2], device_data[3], device_data[4], device_data[5], device_data[6], device_data[7] );
+		retry--;
+		if( ret!=0 && retry>0 ) {
+			usleep( USB_WAIT_ON_ERROR*1000L );
+			req->retries++;
+		}
+	}
+	if( ret!=0 && retry==0 ) {
+		err = ret;
+	}
+	trace_add(LM_TRACE_OUT, device_data, fexpectdata, started, ret, req->retries - retries, req->paced);
+
+	if( fexpectdata ) {
+		started = time_us();
+		retries = req->retries;
+		retry = USB_MAX_RETRY;
+		ret = EXIT_FAILURE;
+		while( ret!=0 && retry>0 ) {
+			lm_log(LOG_DEBUG, "usb_send(0x82) (%02x %02x %02x %02x %02x %02x %02x %02x)", device_data[0], device_data[1], device_data[2], device_data[3], device_data[4], device_data[5], device_data[6], device_data[7] );
+			ret = libusb_interrupt_transfer(dev_handle, (0x82 | LIBUSB_ENDPOINT_IN), device_data, 8, &actual, USB_TIMEOUT);
+			lm_log(LOG_DEBUG, "usb_send(0x82) transferred: %d, returns %d (%02x %02x %02x %02x %02x %02x %02x %02x)", actual, ret, device_data[0], device_data[1], device_data[2], device_data[3], device_data[4], device_data[5], device_data[6], device_data[7] );
+			retry--;
+			if( ret!=0 && retry>0 ) {
+				usleep( USB_WAIT_ON_ERROR*1000L );
+				req->retries++;
+			}
+		}
+		if( ret!=0 && retry==0 ) {
+			err = ret;
+		}
+		trace_add(LM_TRACE_IN, device_data, fexpectdata, started, ret, req->retries - retries, 0);
+	}
+
+	return err;
+}
+
+/* Simulated device transfer: answers temperature and clock requests like
+   a Light Manager, everything else is accepted.
+   The caller must hold mutex_usb */
+static int sim_transfer(struct lm_device *dev, unsigned char *device_data, bool fexpectdata)
+{
+	struct tm timeinfo;
+	time_t now;
+
+	usleep(fexpectdata ? 2 * SIM_USB_TIME : SIM_USB_TIME);
+	time(&now);
+	localtime_r(&now, &timeinfo);
+	now = timegm(&timeinfo);
+
+	/* set clock: 08 ss mm hh dd MM ww yy (BCD) */
+	if( device_data[0] == 0x08 ) {
+		struct tm set;
+
+#define BCD(x)	(((x) >> 4) * 10 + ((x) & 0x0f))
+		memset(&set, 0, sizeof(set));
+		set.tm_sec  = BCD(device_data[1]);
+		set.tm_min  = BCD(device_data[2]);
+		set.tm_hour = BCD(device_data[3]);
+		set.tm_mday = BCD(device_data[4]);
+		set.tm_mon  = BCD(device_data[5]) - 1;
+		set.tm_year = BCD(device_data[7]) + 100;
+#undef BCD
+		dev->simclock = timegm(&set) - now;
+	}
+	if( fexpectdata ) {
+		switch( device_data[0] ) {
+			case 0x0c:			/* temperature */
+				memset(device_data, 0, LM_FRAME_LEN);
+				device_data[0] = 0xfd;
+				device_data[1] = SIM_TEMP;
+				break;
+			case 0x09:			/* clock: ss mm hh dd MM ww yy 00 */
+				now += dev->simclock;
+				gmtime_r(&now, &timeinfo);
+				device_data[0] = timeinfo.tm_sec;
+				device_data[1] = timeinfo.tm_min;
+				device_data[2] = timeinfo.tm_hour;
+				device_data[3] = timeinfo.tm_mday;
+				device_data[4] = timeinfo.tm_mon + 1;
+				device_data[5] = (timeinfo.tm_wday == 0) ? 7 : timeinfo.tm_wday;
+				device_data[6] = timeinfo.tm_year - 100;
+				device_data[7] = 0;
+				break;
+			default:
+				break;
+		}
+	}
+	return LM_OK;
+}
+
+/* Append <count> requests to the client <queue>, the requests must stay valid
+   until they are done (see usb_wait()) */
+static void usb_submit(struct lm_queue *queue, struct usb_request *reqs, int count)
+{
+	long long now = time_us();
+	int i;
+
+	if( count <= 0 ) {
+		return;
+	}
+	for(i=0; i<count; i++) {
+		reqs[i].done = false;
+		reqs[i].submitted = now;
+		reqs[i].next = (i+1 < count) ? &reqs[i+1] : NULL;
+	}
+
+	pthread_mutex_lock(&mutex_sched);
+	if( queue->head == NULL ) {
+		queue->head = reqs;
+		/* queue becomes active: append to the round robin list */
+		queue->next = NULL;
+		if( sched_active == NULL ) {
+			sched_active = queue;
+		}
+		else {
+			sched_active_tail->next = queue;
+		}
+		sched_active_tail = queue;
+	}
+	else {
+		queue->tail->next = reqs;
+	}
+	queue->tail = &reqs[count-1];
+	if( sched_idle && sched_wakeup == 0 ) {
+		sched_wakeup = time_us();
+	}
+	pthread_cond_signal(&cond_sched);
+	pthread_mutex_unlock(&mutex_sched);
+}
+
+/* Wait until <req> of <queue> is done, requests of one queue are served in order */
+static void usb_wait(struct lm_queue *queue, struct usb_request *req)
+{
+	pthread_mutex_lock(&mutex_sched);
+	while( !req->done ) {
+		pthread_cond_wait(&queue->cond, &mutex_sched);
+	}
+	pthread_mutex_unlock(&mutex_sched);
+}
+
+/* 	Copy the outcome of <count> done <reqs> into <results> (may be NULL),
+	returns the number of frames not sent */
+static int usb_results(const struct usb_request *reqs, int count, struct lm_result *results)
+{
+	int failed = 0;
+	int i;
+
+	for(i=0; i<count; i++) {
+		if( reqs[i].result != LM_OK ) {
+			failed++;
+		}
+		if( results != NULL ) {
+			results[i].status = reqs[i].result;
+			results[i].submitted = reqs[i].submitted;
+			results[i].started = reqs[i].started;
+			results[i].finished = reqs[i].finished;
+		}
+	}
+	return failed;
+}
+
+/* Scheduler cost of a frame: RF airtime or USB_COST for device local frames */
+static long usb_cost(const unsigned char *device_data)
+{
+	struct pacer *pacer;
+
+	for(pacer = pacers; pacer->name != NULL; pacer++) {
+		if( pacer->frametype == device_data[0] ) {
+			return pacer->airtime;
+		}
+	}
+	return USB_COST;
+}
+
+/* 	USB scheduler thread: the only thread talking to the device.
+	Serves the active client queues by deficit round robin, each queue gets
+	USB_QUANTUM airtime per round, so a client streaming a large batch cannot
+	delay a single command of another client by more than one round.
+*/
+static void *usb_scheduler(void *arg)
+{
+	struct lm_device *dev = (struct lm_device *)arg;
+	struct lm_queue *queue;
+	struct usb_request *req;
+	long cost;
+
+	sched_realtime();
+	pthread_mutex_lock(&mutex_sched);
+	while(true) {
+		while( sched_active == NULL ) {
+			sched_idle = true;
+			pthread_cond_wait(&cond_sched, &mutex_sched);
+		}
+		sched_idle = false;
+		if( sched_wakeup != 0 ) {
+			jitter_record(&jitter_wakeup, time_us() - sched_wakeup);
+			sched_wakeup = 0;
+		}
+		queue = sched_active;
+		if( !queue->inturn ) {
+			queue->deficit += USB_QUANTUM;
+			queue->inturn = true;
+		}
+		req = queue->head;
+		cost = usb_cost(req->data);
+		if( cost > queue->deficit ) {
+			if( queue->next == NULL ) {
+				/* only active queue: next round starts right away */
+				queue->deficit += USB_QUANTUM;
+				continue;
+			}
+			/* quantum used up, move to the end of the round */
+			queue->inturn = false;
+			sched_active = queue->next;
+			queue->next = NULL;
+			sched_active_tail->next = queue;
+			sched_active_tail = queue;
+			continue;
+		}
+		queue->deficit -= cost;
+		queue->head = req->next;
+		if( queue->head == NULL ) {
+			/* queue drained: leave the round robin list */
+			queue->tail = NULL;
+			queue->deficit = 0;
+			queue->inturn = false;
+			sched_active = queue->next;
+			if( sched_active == NULL ) {
+				sched_active_tail = NULL;
+			}
+			queue->next = NULL;
+		}
+		pthread_mutex_unlock(&mutex_sched);
+
+		/* the pacer delay is slept without mutex_usb, this is the only
+		   thread sending, so nothing can take the charged airtime */
+		pthread_mutex_lock(&mutex_usb);
+		req->started = time_us();
+		req->paced = (dev->open && dev->paced) ? pacer_charge(req->data, req->started) : 0;
+		pthread_mutex_unlock(&mutex_usb);
+		if( req->paced > 0 ) {
+			sleep_until(req->started + req->paced);
+		}
+		pthread_mutex_lock(&mutex_usb);
+		if( req->paced > 0 ) {
+			jitter_record(&jitter_pacer, time_us() - (req->started + req->paced));
+		}
+		req->result = usb_transfer(dev, req);
+		req->finished = time_us();
+		pthread_mutex_unlock(&mutex_usb);
+		if( req->result == LM_OK && !req->fexpectdata && dev->hook != NULL ) {
+			dev->hook(req->data, dev->hookarg);
+		}
+
+		pthread_mutex_lock(&mutex_sched);
+		sched_served++;
+		/* requests of a burst wait one after the other, count each wait once */
+		queue->timing.queued += req->started - ((req->submitted > queue->finished) ? req->submitted : queue->finished);
+		queue->finished = req->finished;
+		queue->timing.paced += req->paced;
+		queue->timing.usb += req->finished - req->started - req->paced;
+		queue->timing.frames++;
+		queue->timing.retries += req->retries;
+		req->done = true;
+		pthread_cond_broadcast(&queue->cond);
+	}
+	return NULL;
+}
+
+/* Touch the stack the scheduler loop will use, so locked memory has it
+   resident before the first frame */
+static void __attribute__((noinline)) sched_prefault(void)
+{
+	volatile unsigned char stack[RT_STACK_PREFAULT];
+	size_t i;
+
+	for(i=0; i<sizeof(stack); i+=4096) {
+		stack[i] = 0;
+	}
+}
+
+/* 	Apply the real-time settings to the calling transport thread. Failures
+	are logged, the thread keeps running with the default scheduling */
+static void sched_realtime(void)
+{
+	int rc;
+
+	if( sched_rt.cpu >= 0 ) {
+		cpu_set_t set;
+
+		CPU_ZERO(&set);
+		CPU_SET(sched_rt.cpu, &set);
+		if( (rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) != 0 ) {
+			lm_log(LOG_WARNING, "Cannot pin USB scheduler thread to CPU %d: %s", sched_rt.cpu, strerror(rc));
+		}
+	}
+	if( sched_rt.priority > 0 ) {
+		struct sched_param param;
+
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = sched_rt.priority;
+		if( (rc = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)) != 0 ) {
+			lm_log(LOG_WARNING, "Cannot set SCHED_FIFO priority %d of USB scheduler thread: %s", sched_rt.priority, strerror(rc));
+		}
+	}
+	if( sched_rt.lockmemory ) {
+		sched_prefault();
+		if( mlockall(MCL_CURRENT | MCL_FUTURE) != 0 ) {
+			lm_log(LOG_WARNING, "Cannot lock memory: %s", strerror(errno));
+		}
+	}
+	if( sched_rt.priority > 0 || sched_rt.cpu >= 0 || sched_rt.lockmemory ) {
+		lm_log(LOG_INFO, "USB scheduler thread real-time: priority %d, CPU %d, memory %slocked",
+			   sched_rt.priority, sched_rt.cpu, sched_rt.lockmemory ? "" : "not ");
+	}
+}
+
+/* 	Reinitialise the unused <mutex> with priority inheritance, so a client
+	thread holding it is boosted while the real-time transport thread waits */
+static void mutex_inherit(pthread_mutex_t *mutex)
+{
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	if( pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT) == 0 ) {
+		pthread_mutex_destroy(mutex);
+		pthread_mutex_init(mutex, &attr);
+	}
+	pthread_mutexattr_destroy(&attr);
+}
+
+/* Submission queue of the calling thread */
+static struct lm_queue *current_queue(void)
+{
+	return (thread_queue != NULL) ? thread_queue : &default_queue;
+}
+
+/* 	Returns true if <dev> is open. Requests queued before it is closed
+	fail in usb_transfer(), so this lock free check is sufficient */
+static bool dev_open(const struct lm_device *dev)
+{
+	return dev != NULL && __atomic_load_n(&dev->open, __ATOMIC_ACQUIRE);
+}
+
+/* Start the scheduler thread serving all client submission queues,
+   it stays alive over close/open. returns LM_OK or -1 */
+static int sched_start(struct lm_device *dev)
+{
+	int rc = 0;
+
+	pthread_mutex_lock(&mutex_sched);
+	if( !sched_running ) {
+		pthread_t thread_id;
+		pthread_attr_t attr;
+
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		if( sched_rt.lockmemory ) {
+			/* locked memory includes the whole stack */
+			pthread_attr_setstacksize(&attr, RT_STACK_SIZE);
+		}
+		rc = pthread_create(&thread_id, &attr, usb_scheduler, dev);
+		pthread_attr_destroy(&attr);
+		sched_running = (rc == 0);
+	}
+	pthread_mutex_unlock(&mutex_sched);
+	if( rc != 0 ) {
+		lm_log(LOG_ERR, "Cannot start USB scheduler thread");
+		return -1;
+	}
+	return LM_OK;
+}
+
+
+/* ======================================================================== */
+/* API */
+/* ======================================================================== */
+
+int lm_version(void)
+{
+	return LM_API_VERSION;
+}
+
+void lm_set_log(lm_log_fn log)
+{
+	lm_log_function = log;
+}
+
+int lm_set_realtime(const struct lm_realtime *rt)
+{
+	int rc = LM_OK;
+
+	pthread_mutex_lock(&mutex_sched);
+	if( sched_running ) {
+		rc = -1;
+	}
+	else {
+		sched_rt = *rt;
+	}
+	pthread_mutex_unlock(&mutex_sched);
+	if( rc != LM_OK ) {
+		lm_log(LOG_ERR, "USB scheduler thread already running, real-time settings not applied");
+	}
+	else if( rt->priority > 0 ) {
+		/* no other thread uses the library before the first open */
+		mutex_inherit(&mutex_usb);
+		mutex_inherit(&mutex_sched);
+	}
+	return rc;
+}
+
+lm_device *lm_open(void)
+{
+	struct lm_device *dev = &device;
+	int rc;
+
+	/* USB connection */
+	pthread_mutex_lock(&mutex_usb);
+	if( dev->open ) {
+		lm_log(LOG_ERR, "USB device already open");
+		pthread_mutex_unlock(&mutex_usb);
+		return NULL;
+	}
+	dev->context = NULL;
+	lm_log(LOG_DEBUG, "try to init libusb");
+	rc = libusb_init(&dev->context);
+	if (rc < 0) {
+		lm_log(LOG_ERR, "libusb init error %i", rc);
+		pthread_mutex_unlock(&mutex_usb);
+		return NULL;
+	}
+	lm_log(LOG_DEBUG, "libusb initialized");
+
+	dev->handle = libusb_open_device_with_vid_pid(dev->context, LM_VENDOR_ID, LM_PRODUCT_ID); /* VendorID and ProductID in decimal */
+	if (dev->handle == NULL ) {
+		lm_log(LOG_ERR, "Cannot open USB device (vendor 0x%04x, product 0x%04x)", LM_VENDOR_ID, LM_PRODUCT_ID);
+		libusb_exit(dev->context);
+		pthread_mutex_unlock(&mutex_usb);
+		return NULL;
+	}
+	if (libusb_kernel_driver_active(dev->handle, 0) == 1) {
+		lm_log(LOG_DEBUG, "Kernel driver active");
+		if (libusb_detach_kernel_driver(dev->handle, 0) == 0) {
+			lm_log(LOG_DEBUG, "Kernel driver detached!");
+		} else {
+			lm_log(LOG_DEBUG, "Kernel driver not detached!");
+		}
+	} else {
+		lm_log(LOG_DEBUG, "Kernel driver not active");
+	}
+
+	rc = libusb_claim_interface(dev->handle, 0);
+	if (rc < 0) {
+		lm_log(LOG_ERR, "Error: Cannot claim interface");
+		libusb_close(dev->handle);
+		libusb_exit(dev->context);
+		pthread_mutex_unlock(&mutex_usb);
+		return NULL;
+	}
+	dev->simulated = false;
+	dev->paced = false;
+	__atomic_store_n(&dev->open, true, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&mutex_usb);
+
+	if( sched_start(dev) != LM_OK ) {
+		lm_close(dev);
+		return NULL;
+	}
+	return dev;
+}
+
+lm_device *lm_open_sim(bool fpaced)
+{
+	struct lm_device *dev = &device;
+
+	pthread_mutex_lock(&mutex_usb);
+	if( dev->open ) {
+		lm_log(LOG_ERR, "USB device already open");
+		pthread_mutex_unlock(&mutex_usb);
+		return NULL;
+	}
+	dev->context = NULL;
+	dev->handle = NULL;
+	dev->simulated = true;
+	dev->paced = fpaced;
+	dev->simclock = 0;
+	__atomic_store_n(&dev->open, true, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&mutex_usb);
+	lm_log(LOG_INFO, "Simulated Light Manager opened (RF pacing %s)", fpaced ? "on" : "off");
+
+	if( sched_start(dev) != LM_OK ) {
+		lm_close(dev);
+		return NULL;
+	}
+	return dev;
+}
+
+int lm_close(lm_device *dev)
+{
+	int rc;
+
+	pthread_mutex_lock(&mutex_usb);
+	if( dev == NULL || !dev->open ) {
+		pthread_mutex_unlock(&mutex_usb);
+		return -1;
+	}
+	if( dev->simulated ) {
+		__atomic_store_n(&dev->open, false, __ATOMIC_RELEASE);
+		pthread_mutex_unlock(&mutex_usb);
+		return LM_OK;
+	}
+	rc = libusb_release_interface(dev->handle, 0);
+	if (rc != 0) {
+		lm_log(LOG_ERR, "Cannot release interface");
+		pthread_mutex_unlock(&mutex_usb);
+		return rc;
+	}
+	__atomic_store_n(&dev->open, false, __ATOMIC_RELEASE);
+	libusb_close(dev->handle);
+	libusb_exit(dev->context);
+	dev->handle = NULL;
+	dev->context = NULL;
+	pthread_mutex_unlock(&mutex_usb);
+	return LM_OK;
+}
+
+int lm_set_paced(lm_device *dev, bool fpaced)
+{
+	if( !dev_open(dev) ) {
+		return LM_ENODEV;
+	}
+	pthread_mutex_lock(&mutex_usb);
+	dev->paced = fpaced;
+	pthread_mutex_unlock(&mutex_usb);
+	lm_log(LOG_INFO, "RF pacing %s", fpaced ? "on" : "off");
+	return LM_OK;
+}
+
+void lm_set_frame_hook(lm_device *dev, lm_frame_fn hook, void *arg)
+{
+	if( !dev_open(dev) ) {
+		return;
+	}
+	pthread_mutex_lock(&mutex_usb);
+	dev->hook = hook;
+	dev->hookarg = arg;
+	pthread_mutex_unlock(&mutex_usb);
+}
+
+int lm_trace_open(const char *path, long records)
+{
+	struct lm_trace_header *header;
+	struct lm_trace_header *old;
+	struct timespec rt;
+	size_t size;
+	size_t oldsize;
+	int fd;
+	int rc;
+
+	if( records <= 0 ) {
+		return -1;
+	}
+	size = sizeof(*header) + (size_t)records * sizeof(struct lm_trace_record);
+	if( (fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0 ) {
+		lm_log(LOG_ERR, "Cannot open trace file %s: %s", path, strerror(errno));
+		return -1;
+	}
+	/* allocate the blocks now, a full disk must not fault the transport thread */
+	if( (rc = posix_fallocate(fd, 0, size)) != 0 ) {
+		lm_log(LOG_ERR, "Cannot allocate %zu bytes for trace file %s: %s", size, path, strerror(rc));
+		close(fd);
+		return -1;
+	}
+	header = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if( header == MAP_FAILED ) {
+		lm_log(LOG_ERR, "Cannot map trace file %s: %s", path, strerror(errno));
+		return -1;
+	}
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, LM_TRACE_MAGIC, sizeof(LM_TRACE_MAGIC));
+	header->version = LM_TRACE_VERSION;
+	header->recsize = sizeof(struct lm_trace_record);
+	header->capacity = records;
+	header->monotonic = time_us();
+	clock_gettime(CLOCK_REALTIME, &rt);
+	header->realtime = (int64_t)rt.tv_sec * 1000000LL + rt.tv_nsec / 1000;
+
+	pthread_mutex_lock(&mutex_usb);
+	old = trace;
+	oldsize = trace_size;
+	trace = header;
+	trace_size = size;
+	pthread_mutex_unlock(&mutex_usb);
+	if( old != NULL ) {
+		munmap(old, oldsize);
+	}
+	lm_log(LOG_INFO, "Tracing USB transfers to %s (%ld records)", path, records);
+	return LM_OK;
+}
+
+void lm_trace_close(void)
+{
+	struct lm_trace_header *old;
+	size_t oldsize;
+
+	pthread_mutex_lock(&mutex_usb);
+	old = trace;
+	oldsize = trace_size;
+	trace = NULL;
+	trace_size = 0;
+	pthread_mutex_unlock(&mutex_usb);
+	if( old != NULL ) {
+		msync(old, oldsize, MS_SYNC);
+		munmap(old, oldsize);
+	}
+}
+
+lm_queue *lm_queue_new(lm_device *dev)
+{
+	struct lm_queue *queue;
+
+	if( !dev_open(dev) ) {
+		return NULL;
+	}
+	if( (queue = calloc(1, sizeof(*queue))) != NULL ) {
+		pthread_cond_init(&queue->cond, NULL);
+	}
+	return queue;
+}
+
+/* The queue must not have pending requests */
+void lm_queue_free(lm_queue *queue)
+{
+	if( queue == NULL ) {
+		return;
+	}
+	if( thread_queue == queue ) {
+		thread_queue = NULL;
+	}
+	pthread_cond_destroy(&queue->cond);
+	free(queue->reqs);
+	free(queue);
+}
+
+void lm_thread_queue(lm_queue *queue)
+{
+	thread_queue = queue;
+}
+
+int lm_queue_reserve(lm_queue *queue, int count)
+{
+	struct usb_request *newreqs;
+
+	if( count <= queue->reqsize ) {
+		return LM_OK;
+	}
+	if( (newreqs = realloc(queue->reqs, count * sizeof(*newreqs))) == NULL ) {
+		return -1;
+	}
+	/* touch it now, not on the first burst */
+	memset(newreqs, 0, count * sizeof(*newreqs));
+	queue->reqs = newreqs;
+	queue->reqsize = count;
+	return LM_OK;
+}
+
+void lm_queue_timing(lm_queue *queue, struct lm_timing *timing)
+{
+	pthread_mutex_lock(&mutex_sched);
+	*timing = queue->timing;
+	memset(&queue->timing, 0, sizeof(queue->timing));
+	pthread_mutex_unlock(&mutex_sched);
+}
+
+int lm_submit(lm_device *dev, unsigned char (*frames)[LM_FRAME_LEN], int count, struct lm_result *results)
+{
+	struct lm_queue *queue = current_queue();
+	struct usb_request single;
+	struct usb_request *reqs = &single;
+	int failed;
+	int i;
+
+	if( count <= 0 ) {
+		return 0;
+	}
+	if( !dev_open(dev) ) {
+		for(i=0; results != NULL && i<count; i++) {
+			memset(&results[i], 0, sizeof(results[i]));
+			results[i].status = LM_ENODEV;
+		}
+		return count;
+	}
+	if( count > 1 ) {
+		/* a queue belongs to one thread, the shared default queue does not */
+		if( queue == &default_queue ) {
+			if( (reqs = malloc(count * sizeof(*reqs))) == NULL ) {
+				return count;
+			}
+		}
+		else {
+			if( count > queue->reqsize ) {
+				struct usb_request *newreqs;
+
+				if( (newreqs = realloc(queue->reqs, count * sizeof(*reqs))) == NULL ) {
+					return count;
+				}
+				queue->reqs = newreqs;
+				queue->reqsize = count;
+			}
+			reqs = queue->reqs;
+		}
+	}
+	memset(reqs, 0, count * sizeof(*reqs));
+	for(i=0; i<count; i++) {
+		reqs[i].data = frames[i];
+		reqs[i].fexpectdata = false;
+	}
+	usb_submit(queue, reqs, count);
+	usb_wait(queue, &reqs[count-1]);
+	failed = usb_results(reqs, count, results);
+	if( reqs != &single && reqs != queue->reqs ) {
+		free(reqs);
+	}
+	return failed;
+}
+
+lm_burst *lm_submit_start(lm_device *dev, unsigned char (*frames)[LM_FRAME_LEN], int count)
+{
+	struct lm_burst *burst;
+	int i;
+
+	if( count <= 0 || !dev_open(dev) ) {
+		return NULL;
+	}
+	/* zeroed: the requests of lm_submit() are reused, these are not */
+	if( (burst = calloc(1, sizeof(*burst) + count * sizeof(burst->reqs[0]))) == NULL ) {
+		return NULL;
+	}
+	burst->queue = current_queue();
+	burst->count = count;
+	for(i=0; i<count; i++) {
+		burst->reqs[i].data = frames[i];
+		burst->reqs[i].fexpectdata = false;
+	}
+	usb_submit(burst->queue, burst->reqs, count);
+	return burst;
+}
+
+int lm_submit_finish(lm_burst *burst, struct lm_result *results)
+{
+	int failed;
+
+	if( burst == NULL ) {
+		return 0;
+	}
+	usb_wait(burst->queue, &burst->reqs[burst->count-1]);
+	failed = usb_results(burst->reqs, burst->count, results);
+	free(burst);
+	return failed;
+}
+
+int lm_transfer(lm_device *dev, unsigned char *frame, bool fexpectdata)
+{
+	struct lm_queue *queue = current_queue();
+	struct usb_request req;
+
+	if( !dev_open(dev) ) {
+		return LM_ENODEV;
+	}
+	memset(&req, 0, sizeof(req));
+	req.data = frame;
+	req.fexpectdata = fexpectdata;
+	usb_submit(queue, &req, 1);
+	usb_wait(queue, &req);
+
+	return req.result;
+}
+
+int lm_get_temp(lm_device *dev, double *celsius)
+{
+	unsigned char usbcmd[LM_FRAME_LEN];
+	int rc;
+
+	memset(usbcmd, 0, sizeof(usbcmd));
+	usbcmd[0] = 0x0c;
+	if( (rc = lm_transfer(dev, usbcmd, true)) != LM_OK ) {
+		return rc;
+	}
+	if( usbcmd[0] != 0xfd ) {
+		return LM_EVALUE;
+	}
+	*celsius = (double)usbcmd[1] / 2;
+	return LM_OK;
+}
+
+/* Get jbmedia Light Manager Pro(+) time into <timeinfo>, returns LM_OK on success
+   otherwise the libusb error code */
+int lm_read_clock(lm_device *dev, struct tm *timeinfo)
+{
+	unsigned char usbcmd[LM_FRAME_LEN];
+	int rc;
+
+	memset(usbcmd, 0, sizeof(usbcmd));
+	usbcmd[0] = 0x09;
+	if( (rc = lm_transfer(dev, usbcmd, true)) != LM_OK ) {
+		return rc;
+	}
+
+	/* ss mm hh dd MM ww yy 00 */
+	memset(timeinfo, 0, sizeof(*timeinfo));
+	timeinfo->tm_sec  = usbcmd[0];
+	timeinfo->tm_min  = usbcmd[1];
+	timeinfo->tm_hour = usbcmd[2];
+	timeinfo->tm_mday = usbcmd[3];
+	timeinfo->tm_mon  = usbcmd[4]-1;
+	timeinfo->tm_wday = usbcmd[5] % 7;
+	timeinfo->tm_year = usbcmd[6] + 100;
+	timeinfo->tm_isdst = -1;
+
+	lm_log(LOG_DEBUG, "Device timestamp returned %02d-%02d-%02d %02d:%02d:%02d", usbcmd[6], usbcmd[4], usbcmd[3], usbcmd[2], usbcmd[1], usbcmd[0]);
+	return LM_OK;
+}
+
+time_t lm_get_clock(lm_device *dev)
+{
+	struct tm timeinfo;
+	struct tm local;
+  	time_t now;
+
+	if( lm_read_clock(dev, &timeinfo) != LM_OK ) {
+		return -1;
+	}
+	time(&now);
+	localtime_r(&now, &local);
+	timeinfo.tm_isdst = local.tm_isdst;
+	return mktime(&timeinfo);
+}
+
+/* Set jbmedia Light Manager Pro(+) time to value within struct 'timeinfo' */
+int lm_set_clock(lm_device *dev, const struct tm *timeinfo)
+{
+	unsigned char usbcmd[LM_FRAME_LEN];
+	int rc;
+	int i;
+
+	memset(usbcmd, 0, sizeof(usbcmd));
+	usbcmd[0] = 0x08;
+	usbcmd[1] = timeinfo->tm_sec;
+	usbcmd[2] = timeinfo->tm_min;
+	usbcmd[3] = timeinfo->tm_hour;
+	usbcmd[4] = timeinfo->tm_mday;
+	usbcmd[5] = timeinfo->tm_mon+1;
+	usbcmd[6] = (timeinfo->tm_wday==0)?7:timeinfo->tm_wday;
+	usbcmd[7] = timeinfo->tm_year-100;
+	lm_log(LOG_DEBUG, "Device time set to %02d-%02d-%02d %02d:%02d:%02d", usbcmd[7], usbcmd[5], usbcmd[4], usbcmd[3], usbcmd[2], usbcmd[1]);
+
+	for(i=1; i<8;i++) {
+		usbcmd[i] = ((usbcmd[i]/10)*0x10) + (usbcmd[i]%10);
+	}
+	if( (rc = lm_transfer(dev, usbcmd, false)) != LM_OK ) {
+		return rc;
+	}
+
+	memset(usbcmd, 0, sizeof(usbcmd));
+	usbcmd[2] = 0x0d;
+	if( (rc = lm_transfer(dev, usbcmd, false)) != LM_OK ) {
+		return rc;
+	}
+
+	memset(usbcmd, 0, sizeof(usbcmd));
+	usbcmd[0] = 0x06;
+	usbcmd[1] = 0x02;
+	usbcmd[2] = 0x01;
+	usbcmd[3] = 0x02;
+	return lm_transfer(dev, usbcmd, false);
+}
+
+bool lm_busy(lm_device *dev)
+{
+	bool busy;
+
+	if( !dev_open(dev) ) {
+		return false;
+	}
+	pthread_mutex_lock(&mutex_sched);
+	busy = (sched_active != NULL);
+	pthread_mutex_unlock(&mutex_sched);
+	return busy;
+}
+
+int lm_stats(lm_device *dev, char *buf, size_t len)
+{
+	struct pacer *pacer;
+	struct lm_queue *queue;
+	struct usb_request *req;
+	int queues = 0;
+	int pending = 0;
+	size_t pos = 0;
+
+	if( len > 0 ) {
+		*buf = '\0';
+	}
+	if( !dev_open(dev) ) {
+		return LM_ENODEV;
+	}
+	pthread_mutex_lock(&mutex_usb);
+	if( !dev->paced ) {
+		pos += snprintf(buf + pos, len - pos, "PACER off\r\n");
+	}
+	for(pacer = pacers; dev->paced && pacer->name != NULL && pos < len; pacer++) {
+		pacer_refill(pacer, time_us());
+		pos += snprintf(buf + pos, len - pos, "PACER %-4s budget %.2f/%.2f s, airtime %ld ms, duty %.1f%%, frames %lu, delayed %lu, waited %lld ms\r\n",
+						pacer->name,
+						pacer->tokens / 1000000.0, (double)pacer->duty * PACER_WINDOW / 1000.0,
+						pacer->airtime / 1000, pacer->duty / 10.0,
+						pacer->frames, pacer->delayed, pacer->waited / 1000);
+	}
+	pthread_mutex_unlock(&mutex_usb);
+
+	pthread_mutex_lock(&mutex_sched);
+	for(queue = sched_active; queue != NULL; queue = queue->next) {
+		queues++;
+		for(req = queue->head; req != NULL; req = req->next) {
+			pending++;
+		}
+	}
+	if( pos < len ) {
+		pos += snprintf(buf + pos, len - pos, "SCHED active queues %d, pending frames %d, served %lu\r\n", queues, pending, sched_served);
+	}
+	if( pos < len ) {
+		pos += jitter_stats(&jitter_wakeup, buf + pos, len - pos);
+	}
+	pthread_mutex_unlock(&mutex_sched);
+
+	pthread_mutex_lock(&mutex_usb);
+	if( pos < len ) {
+		pos += jitter_stats(&jitter_pacer, buf + pos, len - pos);
+	}
+	if( trace != NULL && pos < len ) {
+		pos += snprintf(buf + pos, len - pos, "TRACE records %llu, capacity %llu\r\n",
+						(unsigned long long)trace->count, (unsigned long long)trace->capacity);
+	}
+	pthread_mutex_unlock(&mutex_usb);
+	return (pos < len) ? (int)pos : (int)len - 1;
+}
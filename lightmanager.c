@@ -112,6 +112,96 @@
 			- fix compiler warnings
 			- fix InterTechno dim value (issue #7)
 
+	2.04.0028
+			+ Batch transactions: BEGIN starts a batch, following device commands are
+			  queued and COMMIT validates the whole batch before sending it as one
+			  gapless burst, replying with a per-command result vector (ABORT discards)
+			- Command parsing is now thread safe (strtok_r)
+			+ RF transmit pacing: frames are spaced by their on-air time and limited
+			  by a duty cycle token bucket per protocol family (FS20, InterTechno,
+			  IKEA Koppla, Uniroll)
+			+ New command GET STATS (pacer budget)
+			+ Fair device access: each client has its own submission queue, a USB
+			  scheduler thread serves all queues by deficit round robin
+			+ Parameter -A implemented: device alias file, e.g. "kitchen.ceiling FS20 1121"
+			  allows the command "kitchen.ceiling ON", reloaded on SIGHUP
+			+ Device groups (alias with several devices separated by ';') and address
+			  ranges (e.g. "FS20 1111-1144 OFF", "IT A 1-16 DIP OFF") are expanded into
+			  one burst of frames without duplicate addresses
+			+ Device state table (last command sent to each device), new command GET STATE
+			+ Event stream of device state changes and temperature readings:
+			  HTTP Server-Sent Events on http://<server>/events and TCP command SUBSCRIBE
+			+ Background temperature sampler (parameter -T) with in-memory history at
+			  raw, 1 minute and 1 hour resolution, new commands GET TEMP HISTORY and
+			  GET TEMP MIN|MAX|AVG [window]
+			+ Device state journal (parameter -J): memory mapped append-only journal
+			  of sent frames, compacted into a snapshot, restores the device state
+			  table at startup
+			* Frame encoding moved into the table driven codec module lmcodec.c
+			- InterTechno percentage dim values, unknown FS20/IT commands and IT
+			  <learn> parameters are rejected instead of sending a wrong frame
+			* USB transport, RF pacer and scheduler moved into liblightmanager
+			  (lightmanager.h), usable by other programs as static or shared library
+			- SET CLOCK reported an error although the clock was set
+			+ Device clock synchronization (-C, -O): offset and drift are tracked
+			  with single clock reads, the clock is only set beyond the max offset
+			  and checked right after DST transitions, GET CLOCK needs no USB read
+			* SET CLOCK AUTO only sets the clock if it is off by more than -O
+			+ Request latency per processing stage (accept, receive, parse, queue,
+			  pacer, usb, write): TIMING ON|OFF command, HTTP header X-Timing: 1
+			  returns Server-Timing, statistics in GET STATS
+			+ Simulated device without USB hardware (-N paced|unpaced) and load
+			  generator lmload (make lmload)
+			* Strings of a request (command copies, error messages, url decoding)
+			  are allocated from a per-session arena released after each request,
+			  allocation counters in GET STATS
+			- Command string leaked on QUIT and EXIT
+			* Responses are written into a per-connection output buffer, HTML
+			  line breaks are inserted while copying, messages of any length
+			- HTML help text: markup characters escaped, '%' printed correctly;
+			  help is built once
+			+ JSON responses: command FORMAT JSON|TEXT, HTTP header Accept:
+			  application/json, one object per command with command, status, error
+			  and value
+			+ REST routes GET /api/temp, GET /api/state, POST /api/fs20/<addr>/<action>
+			  and POST /api/it/<code>/<ch>[/<action>] besides /cmd=
+			+ Web UI under / built into the binary (ui/, mkui.sh), gzip compressed,
+			  with ETag and cacheable for a year except index
+			+ Parameter -R prio[:cpu]: real-time USB thread (SCHED_FIFO, CPU
+			  affinity, locked memory), scheduling jitter within GET STATS
+			+ Parameter -L: admission limits of connections, queued frames per
+			  client and in total, output buffer and listen backlog. Clients over
+			  the limit get BUSY (HTTP 503)
+			* Slow clients no longer block the output of all others
+			* Input read by a ring buffer per connection: several lines within one
+			  read, lines split over reads, max line length (-L line=), HTTP
+			  bodies by Content-Length
+			+ Command PIPELINE ON|OFF: device commands are sent while the next
+			  lines are parsed, replies in order, optional request tags '@<tag>'
+			+ Parameter -a accepts IPv6 and may be repeated, default dual-stack
+			  '::'. Parameter -P: acceptor threads per address, each with its own
+			  socket (SO_REUSEPORT). Accept queue and drops within GET STATS
+			+ Parameter -M: MQTT 3.1.1 bridge, commands from <prefix>/<device>/set,
+			  states and temperature published retained with QoS 1
+			+ Parameter -t file[:records]: binary trace of all USB transfers in a
+			  memory mapped file, replayed by lmreplay (make lmreplay)
+			* Device clock synchronization (-C) is off by default and suspended
+			  after SET CLOCK <time> until SET CLOCK AUTO
+			- Ranges starting at 65-90 or 97-122 (e.g. SCENE 65-70, FS20 2112-2114)
+			  were expanded as InterTechno letters; group expansion uses one alias
+			  table even if reloaded meanwhile
+			- Non-device commands inside BEGIN were queued and aborted the whole
+			  batch at COMMIT; they are now rejected when sent
+			- SUBSCRIBE given with -c blocked forever, it needs a client connection
+			* Background temperature sampling (-T) is off by default
+			- Journal records appended during a compaction were lost if the daemon
+			  stopped after the new snapshot was written
+			* RF transmit pacing is off by default, enable it with -r (the airtimes
+			  are estimates)
+			- HTTP replies escape '<', '>' and '&' of the command output and error
+			  messages
+			- SUBSCRIBE ends on input sent along with it (same line or segment)
+
 */
 
 // prevent warnings for 'strptime'
@@ -128,13 +218,25 @@
 #include <stdbool.h>
 #include <netdb.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
 #include <syslog.h>
 #include <signal.h>
 #include <errno.h>
 #include <pthread.h>
 #include <sys/stat.h>
-#include <libusb-1.0/libusb.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <malloc.h>
+#include "lightmanager.h"
+#include "lmui.h"
 
 
 /* ======================================================================== */
@@ -142,8 +244,8 @@
 /* ======================================================================== */
 
 /* Program name and version */
-#define VERSION				"2.3"
-#define BUILD				"0027"
+#define VERSION				"2.4"
+#define BUILD				"0028"
 #define PROGNAME			"Linux Lightmanager"
 
 /* Some macros */
@@ -159,19 +261,71 @@ if(expr) { \
 }
 
 
-#define LM_VENDOR_ID		0x16c0		/* jbmedia Light-Manager (Pro) USB vendor */
-#define LM_PRODUCT_ID		0x0a32		/* jbmedia Light-Manager (Pro) USB product ID */
-
-#define USB_MAX_RETRY		5			/* max number of retries on usb error */
-#define USB_TIMEOUT			250			/* timeout in ms for usb transfer */
-#define USB_WAIT_ON_ERROR	250			/* delay between unsuccessful usb retries */
-
 #define INPUT_BUFFER_MAXLEN	1024		/* TCP commmand string buffer size */
 #define MSG_BUFFER_MAXLEN	2048		/* TCP return message string buffer size */
+#define OUT_BUFFER_SIZE		4096		/* Connection output buffer size */
 
 #define CMD_DELIMITER		",;&"		/* Command line command delimiter */
 #define MAX_CMDS			500			/* Max number of commands per command line */
 #define TOKEN_DELIMITER 	" ,;\t\v\f" /* Command line token delimiter */
+#define BATCH_MAX_CMDS		8192		/* Max number of commands per batch */
+#define EXPAND_MAX_FRAMES	4096		/* Max number of frames of one group or range command */
+#define EXPAND_MAX_DEPTH	4			/* Max nesting of aliases within groups */
+#define RANGE_MAX			256			/* Max number of addresses of one range */
+#define THREAD_STACK_SIZE	(256*1024)	/* stack of each thread if memory is locked (-R) */
+#define ARENA_SIZE			8192		/* Initial size of a request arena */
+#define ARENA_MAX			65536		/* Max size a request arena grows to */
+#define ROUTE_MAX_NODES		64			/* Max number of REST route trie nodes */
+#define ROUTE_MAX_PARAMS	4			/* Max number of parameters of a route */
+#define UI_MAX_AGE			31536000	/* Cache lifetime in s of fingerprinted UI files */
+#define REJECT_WAIT			10			/* Time in ms a rejected client may take to send its request */
+#define REJECT_MAX			256			/* Max rejected connections waiting for their reply */
+#define OUTPUT_TIMEOUT		10			/* Time in s a client may not read its output before it is dropped */
+#define LISTEN_MAX_ADDRS	8			/* Max number of listen addresses (-a) */
+#define LISTEN_MAX_ACCEPTORS	16		/* Max number of acceptor threads per address (-P) */
+#define LINE_TOOLONG		(-4)		/* line_read(): line exceeds the max line length */
+#define LINE_NONE			(-5)		/* line_read(): no complete line received yet */
+#define PIPELINE_DEPTH		16			/* Max device commands in flight per pipelined connection */
+#define PIPELINE_TAG_MAX	15			/* Max length of a request tag "@<tag>" */
+#define LINE_RING(r, i)		((r)->ring[(i) & ((r)->size - 1)])
+
+#define STATE_MAX_DEVICES	1024		/* Max number of devices within the state table */
+#define EVENT_RING_SIZE		256			/* Number of events kept for subscribers */
+#define EVENT_MAXLEN		256			/* Max length of one encoded event */
+#define EVENT_KEEPALIVE		15			/* Keep alive interval of idle event streams (s) */
+#define EVENT_STATE			0x01		/* Event types */
+#define EVENT_TEMP			0x02
+#define EVENT_ALL			(EVENT_STATE | EVENT_TEMP)
+
+#define TEMP_RAW_SIZE		1024		/* Temperature history: number of raw samples */
+#define TEMP_MINUTE_SIZE	1440		/* number of 1 minute aggregates (1 day) */
+#define TEMP_HOUR_SIZE		2160		/* number of 1 hour aggregates (90 days) */
+#define TEMP_WINDOW			3600		/* Default window for MIN/MAX/AVG/HISTORY (s) */
+
+#define CLOCK_DRIFT_MIN		3600		/* Min time between two offsets for a drift estimate (s) */
+#define CLOCK_RECHECK_MIN	60			/* Min time between two clock checks (s) */
+#define CLOCK_MAXAGE		86400		/* GET CLOCK reads the device if the offset is older (s) */
+
+#define JOURNAL_RECORDS		32768		/* Journal capacity (records) */
+#define JOURNAL_COMPACT		(JOURNAL_RECORDS / 2)	/* Compact journal when filled up to */
+#define JOURNAL_SYNC		5			/* Interval for flushing the journal to disk (s) */
+#define JOURNAL_MAGIC		"LMJRNL01"
+#define SNAPSHOT_MAGIC		"LMSNAP01"
+
+#define MQTT_PORT			1883		/* Default MQTT broker port */
+#define MQTT_KEEPALIVE		60			/* MQTT keep alive interval (s) */
+#define MQTT_RETRY			5			/* Delay before reconnecting to the broker (s) */
+#define MQTT_INFLIGHT		64			/* Max QoS 1 publications not acknowledged */
+#define MQTT_MSG_MAX		256			/* Max size of one publication packet */
+#define MQTT_PACKET_MAX		4096		/* Max size of a received packet */
+#define MQTT_BATCH_MS		10			/* Time events are collected into one send (ms) */
+#define MQTT_CONNECT		0x10		/* MQTT 3.1.1 packet types */
+#define MQTT_CONNACK		0x20
+#define MQTT_PUBLISH		0x30
+#define MQTT_PUBACK			0x40
+#define MQTT_SUBSCRIBE		0x80
+#define MQTT_SUBACK			0x90
+#define MQTT_PINGREQ		0xc0
 
 
 /* program parameter defaults */
@@ -181,11 +335,364 @@ if(expr) { \
 #define DEF_PORT		3456
 #define DEF_HOUSECODE	0x0000
 #define DEF_PIDFILE		"/var/run/lightmanager.pid"
+#define DEF_ALIASFILE	""
+#define DEF_TEMPPERIOD	0				/* Temperature sample period (s), 0 = disabled */
+#define DEF_JOURNALFILE	""
+#define DEF_CLOCKPERIOD	0				/* Device clock check period (s), 0 = disabled */
+#define DEF_CLOCKOFFSET	2				/* Max device clock offset before correction (s) */
+#define DEF_SIMULATE	""				/* Simulated device: "" = none, "paced" or "unpaced" */
+#define DEF_PACED		false			/* RF duty cycle pacing of the USB device */
+#define DEF_RTPRIORITY	0				/* SCHED_FIFO priority of the USB thread, 0 = no real-time */
+#define DEF_MAXCONN		64				/* Max concurrent client connections */
+#define DEF_MAXCLIENT	BATCH_MAX_CMDS	/* Max queued commands (frames) per client */
+#define DEF_MAXTOTAL	16384			/* Max queued frames of all clients */
+#define DEF_MAXOUTPUT	65536			/* Socket send buffer per client (bytes) */
+#define DEF_BACKLOG		64				/* TCP listen backlog */
+#define DEF_MAXLINE		4096			/* Max length of an input line or HTTP request */
+#define DEF_ACCEPTORS	2				/* Accepting threads per listen address */
+#define DEF_MQTTPREFIX	"lm"			/* Topic prefix of the MQTT bridge */
+#define DEF_TRACEFILE	""				/* USB transfer trace file, "" = none */
+#define DEF_TRACERECORDS 1048576		/* Records of the trace file (32 bytes each) */
 
 
 /* Several output flags for handle_input() and sub-functions */
 #define HANDLE_INPUT_NOOK	0   // SET to '1' if the additional successful "OK" at the end of a command will be suppressed
 #define HANDLE_INPUT_HTML	2	// SET if output should be in HTML format
+#define HANDLE_INPUT_JSON	4	// SET if output should be in JSON format
+
+/* JSON object state of the current command within the output buffer */
+#define JSON_NONE			0			/* no object open */
+#define JSON_OBJECT			1			/* object opened, no value written */
+#define JSON_VALUE			2			/* within the value string */
+
+/* Kind of an address range token, see parse_range() */
+#define RANGE_NONE			0			/* no range */
+#define RANGE_NUMBER		1			/* e.g. 1-16 */
+#define RANGE_LETTER		2			/* InterTechno code, e.g. A-D */
+#define RANGE_FS20			3			/* FS20 addresses, e.g. 1111-1144 */
+
+
+/* ======================================================================== */
+/* Types */
+/* ======================================================================== */
+/* Allocation that did not fit into the block of an arena */
+struct arena_chunk {
+	struct arena_chunk *next;
+	max_align_t data[];
+};
+
+/* 	Memory for the strings of one request, released as a whole by
+	arena_reset(). Allocations beyond the block go into heap chunks, the
+	next reset grows the block to the peak (up to ARENA_MAX) so repeated
+	requests of the same kind need no malloc at all */
+struct arena {
+	char *base;					/* block, NULL until the first reset or arena_init() */
+	size_t size;
+	size_t used;
+	size_t spilled;				/* bytes within chunks */
+	struct arena_chunk *chunks;
+	unsigned long allocs;		/* since the last reset */
+	unsigned long bytes;
+	unsigned long mallocs;
+};
+
+/* Device commands queued between BEGIN and COMMIT */
+struct batch {
+	bool active;				/* BEGIN received, commands are queued */
+	int  count;					/* number of queued commands */
+	int  size;					/* allocated entries within cmds */
+	char **cmds;				/* queued command strings */
+	struct arena arena;			/* holds cmds and the command strings */
+};
+
+/* Device alias "name" -> command prefix (e.g. "FS20 1121") or
+   group "name" -> several prefixes/aliases separated by ';' */
+struct alias {
+	const char *name;			/* NULL for an empty slot */
+	const char *expansion;
+	unsigned int hash;
+};
+
+/* Immutable alias hash index, replaced as a whole on reload */
+struct alias_table {
+	unsigned int mask;			/* number of slots - 1 */
+	unsigned int count;			/* number of aliases */
+	struct alias *slots;		/* open addressing, linear probing */
+	char *strings;				/* alias file content holding all names and expansions */
+};
+
+/* Last known state of one device */
+struct device_state {
+	unsigned int key;			/* frame type and address, 0 for an empty slot */
+	char device[24];			/* e.g. "FS20 1121", "IT C 7 LEARN" */
+	char state[16];				/* e.g. "ON", "DIM 8" */
+	time_t changed;
+};
+
+/* Event encoded once for all subscribers: an SSE frame
+   "id: <seq>\nevent: <type>\ndata: <json>\n\n", json is a part of it */
+struct event {
+	unsigned long seq;
+	int type;					/* EVENT_xxx */
+	int len;					/* length of the SSE frame */
+	int json;					/* offset of the JSON data */
+	int jsonlen;
+	char data[EVENT_MAXLEN];
+};
+
+/* Journal file layout: header followed by JOURNAL_RECORDS records. Records
+   are valid while seq counts up from 1 and check matches, so a torn or
+   stale record (older generation) ends the journal. */
+struct journal_header {
+	char magic[8];
+	uint32_t generation;		/* matches the snapshot the records follow */
+	uint32_t recsize;
+	char reserved[48];
+};
+
+struct journal_record {
+	uint32_t seq;
+	uint32_t check;
+	int64_t time;
+	uint8_t frame[8];
+};
+
+/* Snapshot file: header followed by <count> device states */
+struct snapshot_header {
+	char magic[8];
+	uint32_t generation;
+	uint32_t count;
+	uint32_t recsize;
+	uint32_t covered;			/* journal records of the previous generation within */
+	char reserved[40];
+};
+
+/* Temperature sample or aggregate, values in device units (0.5 C) */
+struct temp_sample {
+	time_t time;				/* sample time or start of the interval */
+	short min;
+	short max;
+	long sum;
+	int count;
+};
+
+/* Ring buffer of temperature samples with a fixed resolution */
+struct temp_ring {
+	const char *name;
+	int interval;				/* resolution (s), 0 for raw samples */
+	int size;
+	int head;					/* index of the next sample */
+	int count;
+	struct temp_sample *samples;
+};
+
+/* Tracked offset of the device clock against the host local wall clock */
+struct clock_track {
+	bool valid;					/* offset measured since the last write */
+	double offset;				/* device - host (s) */
+	long long measured;			/* time_us() of the measurement */
+	long gmtoff;				/* host UTC offset at the measurement (s) */
+	double base_offset;			/* first offset after the last write or DST change */
+	long long base;				/* its time_us(), 0 if none */
+	double drift;				/* offset change rate (s/s) */
+	int hourbias;				/* DST shift the device adds itself when set (s) */
+	bool manual;				/* set to a user time, not synchronized until SET CLOCK AUTO */
+	unsigned long reads;
+	unsigned long writes;
+	unsigned long predicted;
+	unsigned long dstchanges;
+	unsigned long skipped;
+};
+
+/* Processing stages of a request (one input line) */
+enum stage {
+	STAGE_ACCEPT = 0,			/* accept() until the client thread runs */
+	STAGE_RECEIVE,				/* first byte until the line is complete */
+	STAGE_PARSE,				/* processing not waiting for the device or socket */
+	STAGE_QUEUE,				/* waiting for the USB scheduler */
+	STAGE_PACER,				/* delayed by the RF pacer */
+	STAGE_USB,					/* USB transfers including retries */
+	STAGE_WRITE,				/* sending the response */
+	STAGE_TOTAL,
+	STAGE_MAX
+};
+
+/* Latency breakdown of the current request of a session */
+struct timing {
+	bool report;				/* TIMING ON: append the breakdown to each response */
+	bool capture;				/* collect the response in <out> instead of sending it */
+	long long accepted;			/* accept() until the client thread ran (us), 0 after the first request */
+	long long received;			/* first byte of the request, 0 if not measured */
+	long long started;			/* request line complete */
+	long long stage[STAGE_MAX];	/* time per stage (us) */
+	int frames;
+	int retries;
+	char *out;					/* captured response */
+	size_t outlen;
+	size_t outsize;
+};
+
+/* Aggregated latency of one stage */
+struct stage_stats {
+	unsigned long count;
+	long long sum;
+	long long max;
+	unsigned long hist[32];		/* log2 buckets (us) */
+};
+
+/* Output of a connection, sent when full or by out_flush() */
+struct outbuf {
+	int fd;						/* socket the buffered data belongs to */
+	size_t len;
+	int json;					/* JSON_xxx */
+	int jsonnl;					/* line breaks of the value held back */
+	const char *jsoncmd;		/* command of the JSON object */
+	const char *jsontag;		/* request tag of the JSON object, NULL if none */
+	bool jsonarray;				/* objects are elements of an array (HTTP) */
+	int jsonitems;				/* objects written */
+	char data[OUT_BUFFER_SIZE];
+};
+
+/* Input of a connection: ring buffer framed into lines */
+struct linereader {
+	char *ring;
+	size_t size;				/* power of 2 */
+	size_t head;				/* stream offset of the next byte received */
+	size_t tail;				/* stream offset of the first unread byte */
+	size_t scan;				/* the end of the message is searched from here */
+	size_t max;					/* max line length */
+	size_t msglen;				/* HTTP request: length once the header is complete */
+	bool http;					/* the message at tail is an HTTP request */
+	bool cr;					/* the last line ended with CR, skip a LF */
+	bool discard;				/* drop the rest of an overlong line */
+	char *line;					/* the line returned by line_read() */
+};
+
+/* Device command of a pipelined connection, sent but not answered yet */
+struct pipeslot {
+	char tag[PIPELINE_TAG_MAX+1];	/* "" if untagged */
+	char *command;				/* for the reply, max line length */
+	unsigned char (*frames)[8];	/* stay valid until the burst is done */
+	int size;					/* allocated frames */
+	int count;
+	lm_burst *burst;			/* NULL if not sent, <error> is the reply */
+	char error[128];
+	bool busy;
+};
+
+/* PIPELINE ON: device commands are sent while the next lines are parsed */
+struct pipeline {
+	bool active;
+	char tag[PIPELINE_TAG_MAX+1];	/* tag of the current line */
+	char prefix[PIPELINE_TAG_MAX+3];	/* "@<tag> " before its status lines */
+	size_t cmdsize;				/* size of pipeslot.command */
+	struct pipeslot slot[PIPELINE_DEPTH];
+	int head;					/* oldest slot */
+	int count;
+};
+
+/* Client state kept over all input lines of one connection */
+struct session {
+	struct batch batch;
+	lm_queue *queue;			/* submission queue of this client */
+	struct timing timing;
+	struct arena arena;			/* request arena, reset after each input line */
+	struct outbuf out;
+	bool json;					/* FORMAT JSON */
+	struct linereader reader;	/* input of a TCP connection */
+	struct pipeline pipeline;
+};
+
+/* HTTP methods of REST routes */
+enum method {
+	METHOD_GET = 0,
+	METHOD_POST,
+	METHOD_MAX
+};
+
+/* HTTP request matched by a REST route */
+struct route_request {
+	int method;
+	char *params[ROUTE_MAX_PARAMS];	/* segments matching "{name}", in order */
+	int nparams;
+	char *query;				/* after '?', NULL if none */
+	const char *body;			/* NULL if none */
+};
+
+/* 	Route handler, returns 0 if the response was written, otherwise the
+	HTTP error status with <errormsg> set */
+typedef int (*route_fn)(int socket_handle, struct route_request *req, char **errormsg);
+
+/* Node of the REST route trie, one per path segment */
+struct route_node {
+	const char *segment;		/* literal segment, NULL for a parameter */
+	char name[24];
+	struct route_node *child;	/* first child, literals before the parameter */
+	struct route_node *next;	/* next sibling */
+	route_fn handler[METHOD_MAX];
+};
+
+/* Embedded web UI file, generated by mkui.sh into lmui.h */
+struct asset {
+	const char *path;
+	const char *contenttype;
+	const char *etag;			/* quoted, strong */
+	bool immutable;				/* fingerprinted name, cacheable for good */
+	const unsigned char *data;	/* gzip compressed */
+	size_t size;
+};
+
+/* QoS 1 publication kept until the broker acknowledges it */
+struct mqtt_msg {
+	unsigned int id;			/* packet id */
+	bool acked;
+	int len;
+	unsigned char data[MQTT_MSG_MAX];	/* PUBLISH packet */
+};
+
+/* MQTT bridge, protected by mutex */
+struct mqtt {
+	int fd;						/* broker connection, -1 if none */
+	pthread_mutex_t mutex;		/* also keeps the packets of both threads apart */
+	pthread_cond_t cond;		/* signaled on acknowledges */
+	unsigned int nextid;
+	struct mqtt_msg inflight[MQTT_INFLIGHT];	/* ring of unacknowledged publications */
+	int head;
+	int count;
+	unsigned char sendbuf[MQTT_INFLIGHT * MQTT_MSG_MAX];
+	time_t lastsend;
+	unsigned long connects;
+	unsigned long published;
+	unsigned long lost;			/* events dropped while the publications stuck */
+	unsigned long received;		/* commands */
+	unsigned long failed;
+};
+
+/* Admission limits, see parameter -L */
+struct limits {
+	int connections;			/* concurrent client connections */
+	int client;					/* queued commands (frames) per client */
+	int total;					/* queued frames of all clients */
+	int output;					/* socket send buffer per client (bytes) */
+	int backlog;				/* TCP listen backlog */
+	int line;					/* input line or HTTP request length */
+};
+
+/* Listening socket of one acceptor thread */
+struct listener {
+	int fd;
+	char name[INET6_ADDRSTRLEN + 8];	/* "addr:port" or "[addr]:port" */
+	int acceptor;				/* 1..acceptors of the address */
+	int backlog;				/* effective, see net.core.somaxconn */
+	atomic_ulong accepted;
+	atomic_uint queuemax;		/* longest accept queue seen after an accept() */
+};
+
+/* Client thread argument */
+struct client {
+	int fd;
+	long long accepted;			/* time_us() of accept() */
+};
 
 
 /* ======================================================================== */
@@ -196,19 +703,128 @@ bool fDaemon;
 bool fDebug;
 bool fsyslog;
 unsigned int port;
-unsigned long s_addr;
+char listenaddrs[LISTEN_MAX_ADDRS][INET6_ADDRSTRLEN];
+int listenaddrcount;
+int acceptors;
 unsigned int housecode;
 char pidfile[512];
+char aliasfile[512];
+unsigned int tempperiod;
+char journalfile[512];
+unsigned int clockperiod;
+unsigned int clockoffset;
+char simulate[16];
+bool fpaced;
+int rtpriority;
+int rtcpu;
+struct limits limits;
+char mqtthost[256];
+char mqttport[8];
+char mqttprefix[64];
+char tracefile[512];
+long tracerecords;
+
+/* Admission control counters */
+atomic_int connections;
+atomic_int queued_frames;
+atomic_ulong rejected_connections;
+atomic_ulong busy_commands;
+__thread int thread_queued;			/* frames queued by the session of the calling thread */
+
+/* Rejected connections handed to tcp_server_rejecter(), protected by mutex_reject */
+pthread_mutex_t mutex_reject = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t cond_reject = PTHREAD_COND_INITIALIZER;
+pthread_once_t reject_once = PTHREAD_ONCE_INIT;
+int reject_queue[REJECT_MAX];
+int reject_count;
 
 /* TCP */
 fd_set socks;
+struct listener listeners[LISTEN_MAX_ADDRS * LISTEN_MAX_ACCEPTORS];
+int listener_count;
+
+/* MQTT bridge, see parameter -M */
+struct mqtt mqtt = { .fd = -1, .mutex = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
 
 /* Resources */
 pthread_mutex_t mutex_socks = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t mutex_usb   = PTHREAD_MUTEX_INITIALIZER;
-
-libusb_device_handle *dev_handle;
-libusb_context *usbContext;
+lm_device *dev_handle;
+
+/* Device state table, protected by mutex_state */
+pthread_mutex_t mutex_state = PTHREAD_MUTEX_INITIALIZER;
+struct device_state states[STATE_MAX_DEVICES];
+int state_count;
+
+/* Event ring shared by all subscribers, protected by mutex_events */
+pthread_mutex_t mutex_events = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t  cond_events  = PTHREAD_COND_INITIALIZER;
+struct event events[EVENT_RING_SIZE];
+unsigned long event_seq = 1;			/* sequence number of the next event */
+
+/* Device state journal, appends are protected by mutex_state */
+struct journal_header *journal;			/* mmap'ed journal file, NULL if disabled */
+struct journal_record *journal_records;
+int journal_head;						/* index of the next record */
+unsigned long journal_compactions;
+unsigned long journal_dropped;
+int journal_restored;					/* devices restored at startup */
+long long journal_restore_us;
+
+/* Temperature history, protected by mutex_temp */
+pthread_mutex_t mutex_temp = PTHREAD_MUTEX_INITIALIZER;
+struct temp_sample temp_raw[TEMP_RAW_SIZE];
+struct temp_sample temp_minute[TEMP_MINUTE_SIZE];
+struct temp_sample temp_hour[TEMP_HOUR_SIZE];
+struct temp_ring temp_rings[] = {
+	{ "RAW",    0,    TEMP_RAW_SIZE,    0, 0, temp_raw    },
+	{ "MINUTE", 60,   TEMP_MINUTE_SIZE, 0, 0, temp_minute },
+	{ "HOUR",   3600, TEMP_HOUR_SIZE,   0, 0, temp_hour   },
+};
+unsigned long temp_samples;
+unsigned long temp_skipped;
+
+/* Device clock synchronization, protected by mutex_clock */
+pthread_mutex_t mutex_clock = PTHREAD_MUTEX_INITIALIZER;
+struct clock_track clock_track;
+
+/* Device aliases, readers never lock: the table pointer is replaced by the
+   reload thread which frees the old table after all readers left it */
+struct alias_table *_Atomic alias_current;
+atomic_uint alias_epoch;
+atomic_int  alias_readers[2];			/* readers per epoch parity */
+unsigned long alias_reloads;
+sem_t alias_reload_sem;
+
+/* Request latency per stage, protected by mutex_timing */
+pthread_mutex_t mutex_timing = PTHREAD_MUTEX_INITIALIZER;
+struct stage_stats stage_stats[STAGE_MAX];
+const char *stage_names[STAGE_MAX] = { "accept", "receive", "parse", "queue", "pacer", "usb", "write", "total" };
+__thread struct timing *thread_timing;		/* timing of the session of the calling thread */
+
+/* REST route trie, built by route_init() at startup and read only afterwards */
+struct route_node route_nodes[ROUTE_MAX_NODES];
+int route_count;
+
+/* Web UI files */
+const struct asset assets[] = { UI_ASSETS };
+
+/* Output buffer of the session of the calling thread */
+__thread struct outbuf *thread_out;
+
+/* Help text, see help_build() */
+pthread_once_t help_once = PTHREAD_ONCE_INIT;
+char *help_text;
+size_t help_textlen;
+char *help_html;
+size_t help_htmllen;
+
+/* Request arenas, counters of all released requests */
+__thread struct arena *thread_arena;		/* request arena of the session of the calling thread */
+atomic_ulong arena_requests;
+atomic_ulong arena_allocs;
+atomic_ulong arena_bytes;
+atomic_ulong arena_mallocs;
+atomic_ulong arena_peak;
 
 
 
@@ -219,7 +835,6 @@ libusb_context *usbContext;
 int  stricmp(const char *s1, const char *s2);
 int  strnicmp(const char *s1, const char *s2, size_t n);
 char *stristr(const char *str1, const char *str2);
-char *str_replace(const char *string, const char *substr, const char *replacement);
 char *itoa(int value, char* result, int base);
 char *ltrim(char *const s);
 char *rtrim(char *const s);
@@ -232,32 +847,184 @@ const char *itofs20(char *buf, int code, char *separator);
 /* USB Functions */
 int  usb_connect(void);
 int  usb_release(void);
-int  usb_send(libusb_device_handle* dev_handle, unsigned char* device_data, bool fexpectdata);
-int  set_time(libusb_device_handle* dev_handle, struct tm *timeinfo);
-time_t get_time(libusb_device_handle* dev_handle);
-
 /* Helper Functions */
 void debug(int priority, const char *format, ...);
+void debug_va(int priority, const char *format, va_list args);
+void thread_attr_init(pthread_attr_t *attr);
+long long time_us(void);
 FILE *openfile(const char* filename, const char* mode);
 void closefile(FILE	*filehandle);
 void createpidfile(const char *pidfile, pid_t pid);
 void removepidfile(const char *pidfile);
 void cleanup(int sig);
 void endfunc(int sig);
+int  out_flush(struct outbuf *out);
+int  out_append(struct outbuf *out, const char *data, size_t len);
+int  out_zerocopy(struct outbuf *out, const void *data, size_t len);
+int  out_json(struct outbuf *out, const char *data, size_t len);
+int  json_open(struct outbuf *out);
+int  json_close(int socket_handle, const char *status, const char *error);
+int  out_write(int socket_handle, const char *data, size_t len, int flags);
 int  write_to_client(int socket_handle, int flags, const char *format, ...);
+void help_build(void);
 void client_cmd_help(int socket_handle, int flags);
 int  cmdcompare(const char * cs, const char * ct);
 char from_hex(char ch);
 char *url_decode(char *str);
-void request_header(int socket_handle, int response, const char *responsetext);
+void request_header(int socket_handle, int response, const char *responsetext, const char *contenttype, const char *extra);
 void html_header(int socket_handle, const char *title);
 void html_footer(int socket_handle);
-int  handle_input(char* input, libusb_device_handle* dev_handle, int socket_handle, int flags);
+char *seterror(const char *format, ...);
+bool parse_action(const char *token, int *action, int *value);
+int  encode_device_cmd(char *ptr, char **saveptr, unsigned char *usbcmd, char **errormsg);
+bool is_device_cmd(const char *cmd, size_t len);
+int  parse_range(const char *token, size_t len, bool ffs20, int *lo, int *hi);
+int  encode_expand(const struct alias_table *table, const char *command, unsigned char (*frames)[8], int maxframes, char **errormsg, int depth);
+int  frames_unique(unsigned char (*frames)[8], int count);
+int  encode_command(const char *command, unsigned char (*frames)[8], int maxframes, char **errormsg);
+void batch_reset(struct batch *batch);
+int  batch_add(struct batch *batch, const char *command);
+int  batch_commit(struct batch *batch, lm_device *dev_handle, int socket_handle, int flags, char **errormsg);
+void session_init(struct session *session);
+void session_free(struct session *session);
+int  handle_input(char* input, lm_device *dev_handle, int socket_handle, int flags, struct session *session);
+
+/* REST routes */
+const char *http_reason(int status);
+int  route_add(int method, const char *pattern, route_fn handler);
+void route_init(void);
+void route_reply(int socket_handle, int status, const char *error);
+int  route_dispatch(int socket_handle, int method, char *path, const char *body);
+int  route_temp(int socket_handle, struct route_request *req, char **errormsg);
+int  route_state(int socket_handle, struct route_request *req, char **errormsg);
+int  route_send(int socket_handle, enum lm_protocol protocol, unsigned long addr, const char *action, char **errormsg);
+int  route_fs20(int socket_handle, struct route_request *req, char **errormsg);
+int  route_it(int socket_handle, struct route_request *req, char **errormsg);
+
+/* Static web UI */
+const struct asset *asset_find(const char *path);
+int  static_serve(int socket_handle, const struct asset *asset, const char *ifnonematch, bool fgzip);
+
+/* Device aliases */
+unsigned int alias_hash(const char *name, size_t len);
+struct alias_table *alias_load(const char *filename);
+void alias_free(struct alias_table *table);
+struct alias_table *alias_read_lock(int *slot);
+void alias_read_unlock(int slot);
+const struct alias *alias_lookup(const struct alias_table *table, const char *name, size_t len);
+int  alias_reload(void);
+void *alias_reload_thread(void *arg);
+void alias_sighup(int sig);
+void alias_stats(int socket_handle, int flags);
+
+/* Device state and events */
+int  state_set(const unsigned char *frame, time_t changed, char *device, size_t devlen, char *state, size_t statelen);
+void state_update(const unsigned char *frame, void *arg);
+void state_list(int socket_handle, int flags);
+void event_publish(int type, const char *format, ...);
+int  event_stream(int socket_handle, const struct linereader *reader, int types, bool fsse, unsigned long lastid);
+
+/* Device state journal */
+uint32_t journal_check(uint32_t generation, const struct journal_record *rec);
+void journal_append(const unsigned char *frame, time_t now);
+void journal_rebase(uint32_t generation, int mark);
+int  journal_open(const char *filename);
+int  snapshot_load(const char *filename, uint32_t *generation, uint32_t *covered);
+int  journal_compact(void);
+void journal_stats(int socket_handle, int flags);
+void *journal_thread(void *arg);
+
+/* Temperature history */
+int  temp_read(lm_device *dev_handle, int *value);
+void temp_record(int value, time_t now);
+long parse_duration(const char *str);
+struct temp_ring *temp_ring_for(long window);
+int  temp_query(long window, int *min, int *max, double *avg);
+void temp_history(int socket_handle, int flags, struct temp_ring *ring, long window);
+void temp_stats(int socket_handle, int flags);
+void *temp_sampler(void *arg);
+
+/* Clock synchronization */
+double clock_host(long *gmtoff);
+int  clock_measure(lm_device *dev_handle);
+int  clock_write(lm_device *dev_handle);
+int  clock_sync(lm_device *dev_handle, bool force);
+int  clock_device(lm_device *dev_handle, time_t *devtime);
+void clock_invalidate(bool manual);
+void clock_resume(void);
+void clock_stats(int socket_handle, int flags);
+void *clock_sync_thread(void *arg);
+
+/* Request timing */
+void timing_start(struct session *session);
+void timing_stop(struct session *session);
+void timing_record(struct session *session);
+int  timing_format(const struct timing *timing, char *buf, size_t len, bool http);
+int  timing_capture(struct timing *timing, const char *msg, size_t len);
+int  timing_flush(struct timing *timing, int socket_handle);
+void timing_stats(int socket_handle, int flags);
+
+/* Request arena */
+int  arena_init(struct arena *arena, size_t size);
+void *arena_alloc(struct arena *arena, size_t len);
+char *arena_strdup(struct arena *arena, const char *str);
+char *arena_vprintf(struct arena *arena, const char *format, va_list args);
+void arena_reset(struct arena *arena);
+void arena_free(struct arena *arena);
+void arena_stats(int socket_handle, int flags);
+
+/* MQTT bridge */
+int  mqtt_parse(const char *arg);
+size_t mqtt_header(unsigned char *buf, int type, size_t remaining);
+size_t mqtt_string(unsigned char *buf, const char *str, size_t len);
+int  mqtt_send(int fd, const void *buf, size_t len);
+int  mqtt_recv(int fd, void *buf, size_t len);
+int  mqtt_read(int fd, int *type, unsigned char *buf, size_t size, size_t *len, unsigned int *packetid);
+int  mqtt_connect(bool *present);
+int  mqtt_enqueue(const char *topic, const char *payload, bool retain);
+int  mqtt_transmit(int first, bool dup);
+void mqtt_acked(unsigned int id);
+int  mqtt_command(const char *topic, size_t tlen, const char *payload, size_t plen);
+void *mqtt_thread(void *arg);
+bool mqtt_topic(const struct event *ev, char *topic, size_t tsize, char *payload, size_t psize);
+bool mqtt_json(const char *json, size_t len, const char *name, char *value, size_t size);
+void *mqtt_publisher(void *arg);
+void mqtt_stats(int socket_handle, int flags);
+
+/* Admission control */
+int  limits_parse(const char *arg);
+int  admit_reserve(int count, char **errormsg);
+void admit_release(int count);
+int  admit_submit(unsigned char (*frames)[8], int count, struct lm_result *results, char **errormsg);
+void tcp_server_reject(int fd);
+void tcp_server_reject_reply(int fd);
+void tcp_server_reject_start(void);
+void *tcp_server_rejecter(void *arg);
+void limits_stats(int socket_handle, int flags);
+
+/* Pipelined commands */
+int  pipeline_init(struct pipeline *pipe, size_t maxline);
+void pipeline_free(struct pipeline *pipe);
+char *pipeline_tag(struct session *session, char *line);
+bool pipeline_device(const char *command);
+void pipeline_submit(struct session *session, int socket_handle, const char *command, unsigned char (*frames)[8], int count, const char *error);
+int  pipeline_finish(struct session *session, int socket_handle);
+int  pipeline_drain(struct session *session, int socket_handle);
 
 /* TCP socket thread functions */
-int  tcp_server_init(int port);
-int  tcp_server_connect(int listen_sock, struct sockaddr_in *psock);
-int  recbuffer(int s, void *buf, size_t len, int flags);
+int  tcp_server_init(const char *addr, int port);
+int  tcp_server_listen(int port);
+int  tcp_server_connect(int listen_sock, char *peer, size_t len);
+void tcp_server_queue(struct listener *listener);
+void *tcp_server_accept(void *arg);
+int  tcp_server_drops(unsigned long *overflows, unsigned long *drops);
+void tcp_server_stats(int socket_handle, int flags);
+int  line_init(struct linereader *reader, size_t max);
+void line_free(struct linereader *reader);
+void line_copy(const struct linereader *reader, size_t from, char *dst, size_t len);
+bool line_frame(struct linereader *reader, size_t *len, size_t *consume);
+int  line_read(struct linereader *reader, int s, bool fwait);
+bool line_pending(const struct linereader *reader);
 void tcp_server_handle_client_end(int rc, int client_fd);
 void *tcp_server_handle_client(void *arg);
 
@@ -322,45 +1089,6 @@ char *stristr(const char *str1, const char *str2) {
 	return NULL;
 }
 
-/*
- * Create a new string with [substr] being replaced by [replacement] in [string]
- * Returns the new string, or NULL if out of memory.
- * The caller is responsible for free the new string memory
- */
-char *str_replace ( const char *string, const char *substr, const char *replacement )
-{
-	char *tok = NULL;
-	char *newstr = NULL;
-	char *oldstr = NULL;
-	char *head = NULL;
-
-	/* if either substr or replacement is NULL, simply duplicate string */
-	if ( substr == NULL || replacement == NULL ) {
-		return strdup (string);
-	}
-
-	newstr = strdup (string);
-	head = newstr;
-	while ( (tok = strstr ( head, substr ))) {
-		oldstr = newstr;
-		newstr = malloc ( strlen ( oldstr ) - strlen ( substr ) + strlen ( replacement ) + 1 );
-
-		if ( newstr == NULL ){
-			free (oldstr);
-			return NULL;
-		}
-		memcpy ( newstr, oldstr, tok - oldstr );
-		memcpy ( newstr + (tok - oldstr), replacement, strlen ( replacement ) );
-		memcpy ( newstr + (tok - oldstr) + strlen( replacement ), tok + strlen ( substr ), strlen ( oldstr ) - strlen ( substr ) - ( tok - oldstr ) );
-		memset ( newstr + strlen ( oldstr ) - strlen ( substr ) + strlen ( replacement ) , 0, 1 );
-
-		head = newstr + (tok - oldstr) + strlen( replacement );
-		free (oldstr);
-	}
-	return newstr;
-}
-
-
 /** * C++ version 0.4 char* style "itoa":
 	* Written by Luks Chmela
 	* Released under GPLv3.
@@ -515,50 +1243,37 @@ const char *itofs20(char *buf, int code, char *separator)
 /* USB Functions */
 /* ======================================================================== */
 
-/* Connects to a jbmedia Light Manager Pro(+) */
+/* Connects to a jbmedia Light Manager Pro(+) using liblightmanager */
 int usb_connect(void)
 {
-	int rc;
-
-	/* USB connection */
-	pthread_mutex_lock(&mutex_usb);
-	usbContext = NULL;
-	debug(LOG_DEBUG, "try to init libusb");
-	rc = libusb_init(&usbContext);
-	if (rc < 0) {
-		debug(LOG_ERR, "libusb init error %i", rc);
-		pthread_mutex_unlock(&mutex_usb);
-		return EXIT_FAILURE;
+	lm_set_log(debug_va);
+	if( rtpriority > 0 ) {
+		struct lm_realtime rt;
+
+		/* each malloc arena reserves 64 MiB, locked like all other memory */
+		mallopt(M_ARENA_MAX, 2);
+		rt.priority = rtpriority;
+		rt.cpu = rtcpu;
+		rt.lockmemory = true;
+		lm_set_realtime(&rt);
 	}
-	debug(LOG_DEBUG, "libusb initialized");
-
-	dev_handle = libusb_open_device_with_vid_pid(usbContext, LM_VENDOR_ID, LM_PRODUCT_ID); /* VendorID and ProductID in decimal */
-	if (dev_handle == NULL ) {
-		debug(LOG_ERR, "Cannot open USB device (vendor 0x%04x, product 0x%04x)", LM_VENDOR_ID, LM_PRODUCT_ID);
-		libusb_exit(usbContext);
-		pthread_mutex_unlock(&mutex_usb);
+	if( *tracefile && lm_trace_open(tracefile, tracerecords) != LM_OK ) {
 		return EXIT_FAILURE;
 	}
-	if (libusb_kernel_driver_active(dev_handle, 0) == 1) {
-		debug(LOG_DEBUG, "Kernel driver active");
-		if (libusb_detach_kernel_driver(dev_handle, 0) == 0) {
-			debug(LOG_DEBUG, "Kernel driver detached!");
-		} else {
-			debug(LOG_DEBUG, "Kernel driver not detached!");
-		}
-	} else {
-		debug(LOG_DEBUG, "Kernel driver not active");
+	if( *simulate ) {
+		dev_handle = lm_open_sim(stricmp(simulate, "unpaced") != 0);
 	}
-
-	rc = libusb_claim_interface(dev_handle, 0);
-	if (rc < 0) {
-		debug(LOG_ERR, "Error: Cannot claim interface\n");
-		libusb_close(dev_handle);
-		libusb_exit(usbContext);
-		pthread_mutex_unlock(&mutex_usb);
+	else {
+		dev_handle = lm_open();
+	}
+	if( dev_handle == NULL ) {
+		lm_trace_close();
 		return EXIT_FAILURE;
 	}
-	pthread_mutex_unlock(&mutex_usb);
+	if( fpaced ) {
+		lm_set_paced(dev_handle, true);
+	}
+	lm_set_frame_hook(dev_handle, state_update, NULL);
 	return EXIT_SUCCESS;
 }
 
@@ -566,135 +1281,10 @@ int usb_connect(void)
 /* Release connection to a jbmedia Light Manager Pro(+) */
 int usb_release(void)
 {
-	int rc;
-
-	pthread_mutex_lock(&mutex_usb);
-	rc = libusb_release_interface(dev_handle, 0);
-	if (rc != 0) {
-		debug(LOG_ERR, "Cannot release interface\n");
-		pthread_mutex_unlock(&mutex_usb);
-		return EXIT_FAILURE;
-	}
-	libusb_close(dev_handle);
-	libusb_exit(usbContext);
-	pthread_mutex_unlock(&mutex_usb);
-	return EXIT_SUCCESS;
-}
-
-/* Send raw data to jbmedia Light Manager Pro(+) */
-int usb_send(libusb_device_handle* dev_handle, unsigned char* device_data, bool fexpectdata)
-{
-	int retry;
-	int actual;
-	int ret;
-	int err = EXIT_SUCCESS;
-
-	pthread_mutex_lock(&mutex_usb);
-	retry = USB_MAX_RETRY;
-	ret = EXIT_FAILURE;
-	while( ret!=0 && retry>0 ) {
-		debug(LOG_DEBUG, "usb_send(0x01) (%02x %02x %02x %02x %02x %02x %02x %02x)", device_data[0], device_data[1], device_data[2], device_data[3], device_data[4], device_data[5], device_data[6], device_data[7] );
-		ret = libusb_interrupt_transfer(dev_handle, (0x01 | LIBUSB_ENDPOINT_OUT), device_data, 8, &actual, USB_TIMEOUT);
-		debug(LOG_DEBUG, "usb_send(0x01) transferred: %d, returns %d (%02x %02x %02x %02x %02x %02x %02x %02x)", actual, ret, device_data[0], device_data[1], device_data[2], device_data[3], device_data[4], device_data[5], device_data[6], device_data[7] );
-		retry--;
-		if( ret!=0 && retry>0 ) {
-			usleep( USB_WAIT_ON_ERROR*1000L );
-		}
-	}
-	if( ret!=0 && retry==0 ) {
-		err = ret;
-	}
-
-	if( fexpectdata ) {
-		retry = USB_MAX_RETRY;
-		ret = EXIT_FAILURE;
-		while( ret!=0 && retry>0 ) {
-			debug(LOG_DEBUG, "usb_send(0x82) (%02x %02x %02x %02x %02x %02x %02x %02x)", device_data[0], device_data[1], device_data[2], device_data[3], device_data[4], device_data[5], device_data[6], device_data[7] );
-			ret = libusb_interrupt_transfer(dev_handle, (0x82 | LIBUSB_ENDPOINT_IN), device_data, 8, &actual, USB_TIMEOUT);
-			debug(LOG_DEBUG, "usb_send(0x82) transferred: %d, returns %d (%02x %02x %02x %02x %02x %02x %02x %02x)", actual, ret, device_data[0], device_data[1], device_data[2], device_data[3], device_data[4], device_data[5], device_data[6], device_data[7] );
-			retry--;
-			if( ret!=0 && retry>0 ) {
-				usleep( USB_WAIT_ON_ERROR*1000L );
-			}
-		}
-		if( ret!=0 && retry==0 ) {
-			err = ret;
-		}
-	}
-
-	pthread_mutex_unlock(&mutex_usb);
-
-	return err;
-}
-
-/* Set jbmedia Light Manager Pro(+) time to value within struct 'timeinfo' */
-int set_time(libusb_device_handle* dev_handle, struct tm *timeinfo)
-{
-	int i;
-	static char usbcmd[8];
-
-	memset(usbcmd, 0, sizeof(usbcmd));
-
-	usbcmd[0] = 0x08;
-	usbcmd[1] = timeinfo->tm_sec;
-	usbcmd[2] = timeinfo->tm_min;
-	usbcmd[3] = timeinfo->tm_hour;
-	usbcmd[4] = timeinfo->tm_mday;
-	usbcmd[5] = timeinfo->tm_mon+1;
-	usbcmd[6] = (timeinfo->tm_wday==0)?7:timeinfo->tm_wday;
-	usbcmd[7] = timeinfo->tm_year-100;
-	debug(LOG_DEBUG, "Device time set to %02d-%02d-%02d %02d:%02d:%02d", usbcmd[7], usbcmd[5], usbcmd[4], usbcmd[3], usbcmd[2], usbcmd[1]);
-
-	for(i=1; i<8;i++) {
-		usbcmd[i] = ((usbcmd[i]/10)*0x10) + (usbcmd[i]%10);
-	}
-	if( usb_send(dev_handle, (unsigned char *)usbcmd, false) != EXIT_SUCCESS ) {
-		return 0;
-	}
-
-	memset(usbcmd, 0, sizeof(usbcmd));
-	usbcmd[2] = 0x0d;
-	if( usb_send(dev_handle, (unsigned char *)usbcmd, false) != EXIT_SUCCESS ) {
-		return 0;
-	}
-
-	memset(usbcmd, 0, sizeof(usbcmd));
-	usbcmd[0] = 0x06;
-	usbcmd[1] = 0x02;
-	usbcmd[2] = 0x01;
-	usbcmd[3] = 0x02;
-	if( usb_send(dev_handle, (unsigned char *)usbcmd, false) != EXIT_SUCCESS ) {
-		return 0;
-	}
-}
-
-/* Get jbmedia Light Manager Pro(+) time, returns time_t on success otherwise -1 */
-time_t get_time(libusb_device_handle* dev_handle)
-{
-	static char usbcmd[8];
-	struct tm timeinfo;
-  	time_t now;
-  	struct tm * currenttime;
-
-	memset(usbcmd, 0, sizeof(usbcmd));
-	usbcmd[0] = 0x09;
-	if( usb_send(dev_handle, (unsigned char *)usbcmd, true) != EXIT_SUCCESS ) {
-		return -1;
-	}
-	time(&now);
-	currenttime = localtime(&now);
-	memcpy(&timeinfo, currenttime, sizeof(timeinfo));
-
-	/* ss mm hh dd MM ww yy 00 */
-	timeinfo.tm_sec  = usbcmd[0];
-	timeinfo.tm_min  = usbcmd[1];
-	timeinfo.tm_hour = usbcmd[2];
-	timeinfo.tm_mday = usbcmd[3];
-	timeinfo.tm_mon  = usbcmd[4]-1;
-	timeinfo.tm_year = usbcmd[6] + 100;
+	int rc = lm_close(dev_handle);
 
-	debug(LOG_DEBUG, "Device timestamp returned %02d-%02d-%02d %02d:%02d:%02d", usbcmd[6], usbcmd[4], usbcmd[3], usbcmd[2], usbcmd[1], usbcmd[0]);
-	return mktime(&timeinfo);
+	lm_trace_close();
+	return (rc == LM_OK) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 
@@ -707,6 +1297,13 @@ void debug(int priority, const char *format, ...)
 	va_list args;
 
 	va_start(args, format);
+	debug_va(priority, format, args);
+	va_end(args);
+}
+
+/* debug() with a va_list, also the log function of liblightmanager */
+void debug_va(int priority, const char *format, va_list args)
+{
 	if( priority == LOG_DEBUG ) {
 		if( fDebug ) {
 			if( fsyslog ) {
@@ -720,19 +1317,43 @@ void debug(int priority, const char *format, ...)
 	}
 	else {
 		if( fsyslog ) {
+			va_list copy;
+
+			va_copy(copy, args);
 			vsyslog(priority, format, args);
 			/* Additional output errors to stderr */
 			if( priority == LOG_ERR ) {
-				vfprintf(stderr, format, args);
+				vfprintf(stderr, format, copy);
 				fputs("\n", stdout);
 			}
+			va_end(copy);
 		}
 		else {
 			vfprintf(stdout, format, args);
 			fputs("\n", stdout);
 		}
 	}
-	va_end(args);
+}
+
+/* 	Attributes of a detached thread. With a real-time USB thread the whole
+	process memory is locked, so the stack is bounded to THREAD_STACK_SIZE
+	instead of the default 8 MiB per thread */
+void thread_attr_init(pthread_attr_t *attr)
+{
+	pthread_attr_init(attr);
+	pthread_attr_setdetachstate(attr, PTHREAD_CREATE_DETACHED);
+	if( rtpriority > 0 ) {
+		pthread_attr_setstacksize(attr, THREAD_STACK_SIZE);
+	}
+}
+
+/* Returns a monotonic timestamp in microseconds */
+long long time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
 }
 
 FILE *openfile(const char* filename, const char* mode)
@@ -807,126 +1428,487 @@ void dummyfunc(int sig)
 {
 }
 
-int write_to_client(int socket_handle, int flags, const char *format, ...)
+/* 	Send the content of <out> to its socket (stdout for socket 0), or
+	append it to the captured response while the timing of the session
+	captures. returns 0 on success, otherwise -1 */
+int out_flush(struct outbuf *out)
 {
-	va_list args;
-	char msg[MSG_BUFFER_MAXLEN];
-	char *sendmsg;
-	int rc=0;
+	long long start;
+	size_t sent = 0;
+	int rc = 0;
 
-	va_start (args, format);
-	vsprintf (msg, format, args);
-	if( socket_handle != 0 ) {
-		pthread_mutex_lock(&mutex_socks);
-		if( flags & HANDLE_INPUT_HTML ) {
-			if( (sendmsg = str_replace(msg, "\r\n", "<br />\r\n")) != NULL ) {
-				rc = send(socket_handle, sendmsg, strlen(sendmsg), 0);
-				free(sendmsg);
+	if( out->len == 0 ) {
+		return 0;
+	}
+	if( out->fd == 0 ) {
+		fwrite(out->data, 1, out->len, stdout);
+		out->len = 0;
+		return 0;
+	}
+	if( thread_timing != NULL && thread_timing->capture ) {
+		rc = timing_capture(thread_timing, out->data, out->len);
+		out->len = 0;
+		return (rc < 0) ? -1 : 0;
+	}
+	/* a socket is only written by its client thread, a slow client blocks no one else */
+	start = (thread_timing != NULL) ? time_us() : 0;
+	while( sent < out->len && (rc = send(out->fd, out->data + sent, out->len - sent, MSG_NOSIGNAL)) > 0 ) {
+		sent += rc;
+	}
+	if( thread_timing != NULL ) {
+		thread_timing->stage[STAGE_WRITE] += time_us() - start;
+	}
+	out->len = 0;
+	return (rc < 0) ? -1 : 0;
+}
+
+/* 	Send the content of <out> followed by <len> bytes of <data> with one
+	sendmsg(), <data> is not copied into the buffer.
+	returns 0 on success, otherwise -1 */
+int out_zerocopy(struct outbuf *out, const void *data, size_t len)
+{
+	struct iovec iov[2];
+	struct msghdr msg;
+	long long start;
+	ssize_t rc = 0;
+
+	if( out->fd == 0 || (thread_timing != NULL && thread_timing->capture) ) {
+		return (out_append(out, data, len) < 0) ? -1 : out_flush(out);
+	}
+	iov[0].iov_base = out->data;
+	iov[0].iov_len = out->len;
+	iov[1].iov_base = (void *)data;
+	iov[1].iov_len = len;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+	start = (thread_timing != NULL) ? time_us() : 0;
+	while( iov[0].iov_len + iov[1].iov_len > 0 && (rc = sendmsg(out->fd, &msg, MSG_NOSIGNAL)) > 0 ) {
+		size_t sent = rc;
+		size_t head = (sent < iov[0].iov_len) ? sent : iov[0].iov_len;
+
+		iov[0].iov_base = (char *)iov[0].iov_base + head;
+		iov[0].iov_len -= head;
+		iov[1].iov_base = (char *)iov[1].iov_base + (sent - head);
+		iov[1].iov_len -= sent - head;
+	}
+	if( thread_timing != NULL ) {
+		thread_timing->stage[STAGE_WRITE] += time_us() - start;
+	}
+	out->len = 0;
+	return (rc < 0) ? -1 : 0;
+}
+
+/* Copy <len> bytes of <data> into <out>, sending it whenever it is full */
+int out_append(struct outbuf *out, const char *data, size_t len)
+{
+	while( len > 0 ) {
+		size_t chunk = sizeof(out->data) - out->len;
+
+		if( chunk == 0 ) {
+			if( out_flush(out) < 0 ) {
+				return -1;
+			}
+			continue;
+		}
+		if( chunk > len ) {
+			chunk = len;
+		}
+		memcpy(out->data + out->len, data, chunk);
+		out->len += chunk;
+		data += chunk;
+		len -= chunk;
+	}
+	return 0;
+}
+
+/* 	Append <len> bytes of <data> as JSON string content. Line breaks are
+	held back until more text follows, so a value has no trailing one */
+int out_json(struct outbuf *out, const char *data, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+	const char *end = data + len;
+
+	while( data < end ) {
+		const char *span = data;
+		char esc[8];
+		size_t n = 0;
+
+		while( data < end && (unsigned char)*data >= 0x20 && (unsigned char)*data < 0x80 && *data != '"' && *data != '\\' ) {
+			data++;
+		}
+		if( data > span ) {
+			for(; out->jsonnl > 0; out->jsonnl--) {
+				if( out_append(out, "\\n", 2) < 0 ) {
+					return -1;
+				}
+			}
+			if( out_append(out, span, data - span) < 0 ) {
+				return -1;
+			}
+		}
+		if( data >= end ) {
+			break;
+		}
+		switch( *data ) {
+			case '\r':
+				break;
+			case '\n':
+				out->jsonnl++;
+				break;
+			case '"':
+			case '\\':
+				esc[n++] = '\\';
+				esc[n++] = *data;
+				break;
+			case '\t':
+				esc[n++] = '\\';
+				esc[n++] = 't';
+				break;
+			default:
+				/* control chars and Latin-1 */
+				n = sprintf(esc, "\\u00%c%c", hex[(unsigned char)*data >> 4], hex[*data & 0x0f]);
+				break;
+		}
+		data++;
+		if( n > 0 ) {
+			for(; out->jsonnl > 0; out->jsonnl--) {
+				if( out_append(out, "\\n", 2) < 0 ) {
+					return -1;
+				}
+			}
+			if( out_append(out, esc, n) < 0 ) {
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+/* 	Open the JSON object of the current command of <out>, a comma
+	separates it from the previous one within an array */
+int json_open(struct outbuf *out)
+{
+	const char *cmd = (out->jsoncmd != NULL) ? out->jsoncmd : "";
+	const char *end = cmd + strlen(cmd);
+
+	while( isspace((unsigned char)*cmd) ) {
+		cmd++;
+	}
+	while( end > cmd && isspace((unsigned char)end[-1]) ) {
+		end--;
+	}
+	if( out->jsonarray && out->jsonitems > 0 && out_append(out, ",", 1) < 0 ) {
+		return -1;
+	}
+	out->json = JSON_OBJECT;
+	if( out->jsontag != NULL ) {
+		if( out_append(out, "{\"tag\":\"", 8) < 0 || out_json(out, out->jsontag, strlen(out->jsontag)) < 0 || out_append(out, "\",", 2) < 0 ) {
+			return -1;
+		}
+	}
+	else if( out_append(out, "{", 1) < 0 ) {
+		return -1;
+	}
+	if( out_append(out, "\"command\":\"", 11) < 0 || out_json(out, cmd, end - cmd) < 0 || out_append(out, "\"", 1) < 0 ) {
+		return -1;
+	}
+	return 0;
+}
+
+/* 	Close the JSON object of the current command with <status> and
+	<error> (NULL for none), opening it first if nothing was written */
+int json_close(int socket_handle, const char *status, const char *error)
+{
+	struct outbuf *out = thread_out;
+	const char *sep;
+
+	if( out == NULL ) {
+		return -1;
+	}
+	if( out->len > 0 && out->fd != socket_handle ) {
+		out_flush(out);
+	}
+	out->fd = socket_handle;
+	if( out->json == JSON_NONE && json_open(out) < 0 ) {
+		return -1;
+	}
+	out->jsonnl = 0;
+	sep = (out->json == JSON_VALUE) ? "\",\"status\":\"" : ",\"value\":null,\"status\":\"";
+	if( out_append(out, sep, strlen(sep)) < 0 || out_append(out, status, strlen(status)) < 0 ) {
+		return -1;
+	}
+	if( error != NULL ) {
+		if( out_append(out, "\",\"error\":\"", 11) < 0 || out_json(out, error, strlen(error)) < 0 || out_append(out, "\"}\r\n", 4) < 0 ) {
+			return -1;
+		}
+	}
+	else if( out_append(out, "\",\"error\":null}\r\n", 17) < 0 ) {
+		return -1;
+	}
+	out->json = JSON_NONE;
+	out->jsonitems++;
+	return 0;
+}
+
+/* 	Append <len> bytes of <data> to the output buffer of the calling thread.
+	HANDLE_INPUT_HTML within <flags> escapes '<', '>' and '&' and turns line
+	breaks "\r\n" into "<br />\r\n" while copying, markup must be written
+	without it. HANDLE_INPUT_JSON writes the data into the
+	value of the JSON object of the current command. A full buffer is sent,
+	the rest stays until out_flush(). Threads without a session send through
+	a buffer on the stack.
+	returns <len> or -1 if sending failed */
+int out_write(int socket_handle, const char *data, size_t len, int flags)
+{
+	struct outbuf local;
+	struct outbuf *out = thread_out;
+	const char *end = data + len;
+
+	if( out == NULL ) {
+		local.len = 0;
+		out = &local;
+		flags &= ~HANDLE_INPUT_JSON;
+	}
+	else if( out->len > 0 && out->fd != socket_handle ) {
+		out_flush(out);
+	}
+	out->fd = socket_handle;
+
+	if( flags & HANDLE_INPUT_JSON ) {
+		if( out->json == JSON_NONE && json_open(out) < 0 ) {
+			return -1;
+		}
+		if( out->json == JSON_OBJECT ) {
+			if( out_append(out, ",\"value\":\"", 10) < 0 ) {
+				return -1;
 			}
+			out->json = JSON_VALUE;
+		}
+		return (out_json(out, data, len) < 0) ? -1 : (int)len;
+	}
+	while( data < end ) {
+		const char *piece = data;
+		size_t n;
+
+		if( !(flags & HANDLE_INPUT_HTML) ) {
+			n = end - data;
+			data = end;
+		}
+		else if( *data == '\r' && data + 1 < end && data[1] == '\n' ) {
+			piece = "<br />\r\n";
+			n = 8;
+			data += 2;
+		}
+		else if( *data == '<' || *data == '>' || *data == '&' ) {
+			piece = (*data == '<') ? "&lt;" : ((*data == '>') ? "&gt;" : "&amp;");
+			n = strlen(piece);
+			data++;
 		}
 		else {
-			rc = send(socket_handle, msg, strlen(msg), 0);
+			const char *brk;
+
+			for(brk = data + 1; brk < end && *brk != '\r' && *brk != '<' && *brk != '>' && *brk != '&'; brk++);
+			n = brk - data;
+			data = brk;
+		}
+		if( out_append(out, piece, n) < 0 ) {
+			return -1;
 		}
-		pthread_mutex_unlock(&mutex_socks);
 	}
-	else {
-		fputs(msg, stdout);
+	if( out == &local && out_flush(out) < 0 ) {
+		return -1;
+	}
+	return len;
+}
+
+/* 	Write a formatted message to client, plain text is formatted right into
+	the output buffer. Messages of any length are possible, those not fitting
+	into MSG_BUFFER_MAXLEN are formatted into the request arena.
+	returns the length of the message or -1 if sending failed */
+int write_to_client(int socket_handle, int flags, const char *format, ...)
+{
+	va_list args;
+	char msg[MSG_BUFFER_MAXLEN];
+	char *text = msg;
+	int len;
+
+	if( thread_out != NULL && (flags & (HANDLE_INPUT_HTML | HANDLE_INPUT_JSON)) == 0 &&
+		(thread_out->len == 0 || thread_out->fd == socket_handle) ) {
+		struct outbuf *out = thread_out;
+		size_t avail = sizeof(out->data) - out->len;
+
+		va_start (args, format);
+		len = vsnprintf(out->data + out->len, avail, format, args);
+		va_end (args);
+		if( len >= 0 && (size_t)len < avail ) {
+			out->fd = socket_handle;
+			out->len += len;
+			return len;
+		}
 	}
+
+	va_start (args, format);
+	len = vsnprintf(msg, sizeof(msg), format, args);
 	va_end (args);
+	if( len < 0 ) {
+		return -1;
+	}
+	if( (size_t)len >= sizeof(msg) ) {
+		va_start (args, format);
+		text = arena_vprintf(thread_arena, format, args);
+		va_end (args);
+		if( text == NULL ) {
+			text = msg;
+			len = sizeof(msg) - 1;
+		}
+	}
+	return out_write(socket_handle, text, len, flags);
+}
 
-	return rc;
+/* 	Build the plain and the HTML help text once, the HTML text has the
+	command list as <pre> block with escaped markup characters */
+void help_build(void)
+{
+	static const char commands[] =
+		"Light Manager commands\r\n"
+		"    GET CLOCK|TIME    Read the current device date and time\r\n"
+		"    GET HOUSECODE     Read the current FS20 housecode\r\n"
+		"    GET TEMP          Read the current device temperature sensor\r\n"
+		"    GET STATS         Read the daemon statistics (RF pacer, scheduler)\r\n"
+		"    GET STATE         Read the last state sent to each device\r\n"
+		"    GET TEMP MIN|MAX|AVG [window]\r\n"
+		"                      Min, max or average temperature within the last\r\n"
+		"                      <window> (e.g. 90s, 15m, 2h, 7d, default 1h)\r\n"
+		"    GET TEMP HISTORY [RAW|MINUTE|HOUR] [window]\r\n"
+		"                      Recorded temperature samples within <window>\r\n"
+		"    SUBSCRIBE [STATE|TEMP|ALL]\r\n"
+		"                      Stream device state changes and temperature\r\n"
+		"                      readings as lines 'EVENT <json>' until the next\r\n"
+		"                      input line. HTTP clients use http://<server>/events\r\n"
+		"                      (Server-Sent Events, optional ?type=state|temp)\r\n"
+		"    TIMING ON|OFF     Append the latency of each request per processing\r\n"
+		"                      stage (us). HTTP clients send a header 'X-Timing: 1'\r\n"
+		"                      to get a Server-Timing response header\r\n"
+		"    PIPELINE ON|OFF   Pipelined mode without prompt: device commands are\r\n"
+		"                      sent while the next lines are read, the replies\r\n"
+		"                      follow in order. A line may start with a tag\r\n"
+		"                      '@<tag>' which precedes each of its status lines\r\n"
+		"    SET HOUSECODE addr Set the FS20 housecode where\r\n"
+		"                        adr  FS20 housecode (11111111-44444444)\r\n"
+		"    SET CLOCK|TIME [time|AUTO]\r\n"
+		"                      Set the device clock to system time or to <time>\r\n"
+		"                      where time format is MMDDhhmm[[CC]YY][.ss]\r\n"
+		"                      Use AUTO to correct it only if it is off by more\r\n"
+		"                      than the max offset (-O), compensating the device\r\n"
+		"                      automatic DST correction. A <time> suspends the\r\n"
+		"                      clock synchronization (-C) until SET CLOCK AUTO.\r\n"
+		"\r\n"
+		"Device commands\r\n"
+		"    FS20 addr cmd     Send a FS20 command where\r\n"
+		"                        adr  FS20 address using the format ggss (1111-4444)\r\n"
+		"                        cmd  one of the following command:\r\n"
+		"                             ON|UP|OPEN      Switches ON or open a jalousie\r\n"
+		"                             OFF|DOWN|CLOSE  Switches OFF or close a jalousie\r\n"
+		"                             +|BRIGHT        regulate dimmer one step up\r\n"
+		"                             +|DARK          regulate dimmer one step down\r\n"
+		"                             <dim>           is a absolute or percentage dim\r\n"
+		"                                             value:\r\n"
+		"                                             for absolute dim use 0 (min=off)\r\n"
+		"                                             to 16 (max)\r\n"
+		"                                             for percentage dim use 0% (off) to\r\n"
+		"                                             100% (max)\r\n"
+		"    IT code addr learn cmd    Send an InterTechno command where\r\n"
+		"                               code InterTechno housecode (A-P)\r\n"
+		"                               addr InterTechno channel (1-16)\r\n"
+		"                               learn one of the following commands\r\n"
+		"                                   LEARN       for InterTechno code learning devices\r\n"
+		"                                   DIP         for InterTechno standard devices with\r\n"
+		"                                               DIP-switches\r\n"
+		"                               cmd  one of the following command\r\n"
+		"                                    ON|UP|OPEN     Switches ON or open a jalousie\r\n"
+		"                                    OFF|DOWN|CLOSE Switches OFF or close a jalousie\r\n"
+		"                                    +|BRIGHT       regulate dimmer one step up\r\n"
+		"                                    +|DARK         regulate dimmer one step down\r\n"
+		"                                    <dim>          is a absolute or percentage dim\r\n"
+		"                                                   value:\r\n"
+		"                                                   for absolute dim use 0 (min=off)\r\n"
+		"                                                   to 248 (max)\r\n"
+		"                                                   for percentage dim use 0% (off) to\r\n"
+		"                                                   100% (max) in steps of 6,25%\r\n"
+		"    IKEA code addr cmd  Send an IKEA Koppla command where\r\n"
+		"                          code IKEA Koppla systemcode (1-16)\r\n"
+		"                          addr IKEA Koppla channel (1-10)\r\n"
+		"                          cmd  one of the following commands\r\n"
+		"                             ON|UP           Switches ON = dimming level 100%\r\n"
+		"                             OFF|DOWN        Switches OFF = dimming level 0%\r\n"
+		"                             +|BRIGHT        regulate dimmer one step up\r\n"
+		"                             +|DARK          regulate dimmer one step down\r\n"
+		"                             <dim>           is a percentage dim value:\r\n"
+		"                                             for percentage dim use 0% (min/off) to\r\n"
+		"                                             90% (max/on) in steps of 10%\r\n"
+		"                             +|FAST|INSTANT  regulate dimmer for fast dimming mode\r\n"
+		"                             +|SLOW|GRADUAL  regulate dimmer for slow dimming mode\r\n"
+		"    UNIROLL addr cmd  Send an Uniroll command where\r\n"
+		"                        adr  Uniroll jalousie number (1-100)\r\n"
+		"                        cmd  Command UP|+|DOWN|-|STOP\r\n"
+		"    SCENE scn         Activate scene <scn> (1-254)\r\n"
+		"    alias cmd         Send <cmd> to the device or group named <alias>\r\n"
+		"                      within the alias file (see parameter -A)\r\n"
+		"    Device addresses can be given as range, e.g. FS20 1111-1144 OFF or\r\n"
+		"    IT A 1-16 DIP OFF, all frames are sent as one burst\r\n"
+		"\r\n"
+		"System commands\r\n"
+		"    ? or HELP         Prints this help\r\n"
+		"    VERSION           Prints program name and version\r\n"
+		"    VERBOSE           Be verbose (command and result output)\r\n"
+		"    QUIET             Be quiet (no command and result output)\r\n"
+		"    FORMAT JSON|TEXT  Reply one JSON object per command with the fields\r\n"
+		"                      command, status (OK|ERROR|QUEUED|BUSY), error and value\r\n"
+		"                      (command output). HTTP clients send a header\r\n"
+		"                      'Accept: application/json' to get an array of them\r\n"
+		"    EXIT              Disconnect and exit server program\r\n"
+		"    QUIT              Disconnect\r\n"
+		"    WAIT ms           Wait for <ms> milliseconds\r\n"
+		"    BEGIN             Start a batch, following device commands are queued\r\n"
+		"    COMMIT            Validate all queued commands and send them as one\r\n"
+		"                      burst, prints result vector <n> OK|ERROR <usec>\r\n"
+		"    ABORT             Discard the queued batch\r\n";
+	const char *p;
+	char *q;
+	int len;
+
+	if( (help_text = malloc(256 + sizeof(commands))) != NULL ) {
+		len = sprintf(help_text, "\r\n%s v%s (build %s) help\r\n\r\n", PROGNAME, VERSION, BUILD);
+		memcpy(help_text + len, commands, sizeof(commands));
+		help_textlen = len + sizeof(commands) - 1;
+	}
+	/* worst case: every char becomes an entity */
+	if( (help_html = malloc(256 + sizeof(commands) * 5)) != NULL ) {
+		q = help_html + sprintf(help_html, "<br />\r\n%s v%s (build %s) help<br />\r\n<br />\r\n<pre>", PROGNAME, VERSION, BUILD);
+		for(p = commands; *p; p++) {
+			switch( *p ) {
+				case '<': q = stpcpy(q, "&lt;"); break;
+				case '>': q = stpcpy(q, "&gt;"); break;
+				case '&': q = stpcpy(q, "&amp;"); break;
+				default:  *q++ = *p; break;
+			}
+		}
+		q = stpcpy(q, "</pre>\r\n");
+		help_htmllen = q - help_html;
+	}
 }
 
+/* Writes the prebuilt help text to client */
 void client_cmd_help(int socket_handle, int flags)
 {
-	write_to_client(socket_handle, flags,
-					 	"\r\n"
-					 	"%s v%s (build %s) help\r\n"
-						"\r\n"
-					, PROGNAME, VERSION, BUILD);
-	write_to_client(socket_handle, flags & ~HANDLE_INPUT_HTML,
-						"%s"
-						"Light Manager commands\r\n"
-						"    GET CLOCK|TIME    Read the current device date and time\r\n"
-						"    GET HOUSECODE     Read the current FS20 housecode\r\n"
-						"    GET TEMP          Read the current device temperature sensor\r\n"
-						"    SET HOUSECODE addr Set the FS20 housecode where\r\n"
-						"                        adr  FS20 housecode (11111111-44444444)\r\n"
-						"    SET CLOCK|TIME [time|AUTO]\r\n"
-						"                      Set the device clock to system time or to <time>\r\n"
-						"                      where time format is MMDDhhmm[[CC]YY][.ss]\r\n"
-						"                      Use AUTO to avoid device automatic correction.\r\n"
-						"\r\n"
-						,(flags & HANDLE_INPUT_HTML)?"<pre>":"");
-	write_to_client(socket_handle, flags & ~HANDLE_INPUT_HTML,
-						"Device commands\r\n"
-						"    FS20 addr cmd     Send a FS20 command where\r\n"
-						"                        adr  FS20 address using the format ggss (1111-4444)\r\n"
-						"                        cmd  one of the following command:\r\n"
-						"                             ON|UP|OPEN      Switches ON or open a jalousie\r\n"
-						"                             OFF|DOWN|CLOSE  Switches OFF or close a jalousie\r\n"
-						"                             +|BRIGHT        regulate dimmer one step up\r\n"
-						"                             +|DARK          regulate dimmer one step down\r\n"
-						"                             <dim>           is a absolute or percentage dim\r\n"
-						"                                             value:\r\n"
-						"                                             for absolute dim use 0 (min=off)\r\n"
-						"                                             to 16 (max)\r\n"
-						"                                             for percentage dim use 0% (off) to\r\n"
-						"                                             100% (max)\r\n"
-						,(flags & HANDLE_INPUT_HTML)?"<pre>":"");
-	write_to_client(socket_handle, flags & ~HANDLE_INPUT_HTML,
-						"    IT code addr learn cmd    Send an InterTechno command where\r\n"
-						"                               code InterTechno housecode (A-P)\r\n"
-						"                               addr InterTechno channel (1-16)\r\n"
-						"                               learn one of the following commands\r\n"
-						"                                   LEARN       for InterTechno code learning devices\r\n"	
-						"                                   DIP         for InterTechno standard devices with\r\n"
-						"                                               DIP-switches\r\n"
-						"                               cmd  one of the following command\r\n"
-						"                                    ON|UP|OPEN     Switches ON or open a jalousie\r\n"
-						"                                    OFF|DOWN|CLOSE Switches OFF or close a jalousie\r\n"
-						"                                    +|BRIGHT       regulate dimmer one step up\r\n"
-						"                                    +|DARK         regulate dimmer one step down\r\n"
-						"                                    <dim>          is a absolute or percentage dim\r\n"
-						"                                                   value:\r\n"
-						"                                                   for absolute dim use 0 (min=off)\r\n"
-						"                                                   to 248 (max)\r\n"
-						"                                                   for percentage dim use 0% (off) to\r\n"
-						"                                                   100% (max) in steps of 6,25%\r\n"
-						,(flags & HANDLE_INPUT_HTML)?"<pre>":"");
-	write_to_client(socket_handle, flags & ~HANDLE_INPUT_HTML,
-						"    IKEA code addr cmd  Send an IKEA Koppla command where\r\n"
-						"                          code IKEA Koppla systemcode (1-16)\r\n"
-						"                          addr IKEA Koppla channel (1-10)\r\n"
-						"                          cmd  one of the following commands\r\n"
-						"                             ON|UP           Switches ON = dimming level 100%\r\n"
-						"                             OFF|DOWN        Switches OFF = dimming level 0%\r\n"
-						"                             +|BRIGHT        regulate dimmer one step up\r\n"
-						"                             +|DARK          regulate dimmer one step down\r\n"
-						"                             <dim>           is a percentage dim value:\r\n"
-						"                                             for percentage dim use 0% (min/off) to\r\n"
-						"                                             90% (max/on) in steps of 10%\r\n"
-						"                             +|FAST|INSTANT  regulate dimmer for fast dimming mode\r\n"
-						"                             +|SLOW|GRADUAL  regulate dimmer for slow dimming mode\r\n"
-						,(flags & HANDLE_INPUT_HTML)?"<pre>":"");
-	write_to_client(socket_handle, flags & ~HANDLE_INPUT_HTML,
-						"    UNIROLL addr cmd  Send an Uniroll command where\r\n"
-						"                        adr  Uniroll jalousie number (1-100)\r\n"
-						"                        cmd  Command UP|+|DOWN|-|STOP\r\n"
-						"    SCENE scn         Activate scene <scn> (1-254)\r\n"
-						"\r\n"
-						);
-	write_to_client(socket_handle, flags & ~HANDLE_INPUT_HTML,
-						"System commands\r\n"
-						"    ? or HELP         Prints this help\r\n"
-						"    VERSION           Prints program name and version\r\n"
-						"    VERBOSE           Be verbose (command and result output)\r\n"
-						"    QUIET             Be quiet (no command and result output)\r\n"
-						"    EXIT              Disconnect and exit server program\r\n"
-						"    QUIT              Disconnect\r\n"
-						"    WAIT ms           Wait for <ms> milliseconds\r\n"
-						"%s"
-						,(flags & HANDLE_INPUT_HTML)?"</pre>":"");
+	pthread_once(&help_once, help_build);
+	if( (flags & HANDLE_INPUT_HTML) && help_html != NULL ) {
+		out_write(socket_handle, help_html, help_htmllen, 0);
+	}
+	else if( help_text != NULL ) {
+		out_write(socket_handle, help_text, help_textlen, flags & HANDLE_INPUT_JSON);
+	}
 }
 
 
@@ -942,10 +1924,10 @@ char from_hex(char ch) {
 }
 
 /* Returns a url-decoded version of str */
-/* IMPORTANT: be sure to free() the returned string after use */
+/* The string is allocated from the request arena, it is valid until the request is done */
 char *url_decode(char *str) {
 	char *pstr = str;
-	char *buf = malloc(strlen(str) + 1);
+	char *buf = arena_alloc(thread_arena, strlen(str) + 1);
 	char *pbuf = buf;
 
 	if( buf == NULL ) {
@@ -971,8 +1953,10 @@ char *url_decode(char *str) {
 	return buf;
 }
 
-/* Writes a html request header to client using <socket_handle> */
-void request_header(int socket_handle, int response, const char *responsetext)
+/* 	Writes a html request header to client using <socket_handle>
+	<contenttype> defaults to text/html if NULL,
+	<extra> are additional header lines (may be NULL) */
+void request_header(int socket_handle, int response, const char *responsetext, const char *contenttype, const char *extra)
 {
   	time_t now;
   	struct tm * currenttime;
@@ -991,13 +1975,16 @@ void request_header(int socket_handle, int response, const char *responsetext)
 		"Cache-Control: no-store, no-cache, must-revalidate, post-check=0, pre-check=0\r\n"
 		"Pragma: no-cache\r\n"
 		"Connection: close\r\n"
-		"Content-Type: text/html\r\n"
+		"Content-Type: %s\r\n"
+		"%s"
 		"\r\n"
 		,response, responsetext
 		,buffer
 		,PROGNAME, VERSION, BUILD
 		,buffer
-		,"en");
+		,"en"
+		,(contenttype != NULL) ? contenttype : "text/html; charset=ISO-8859-1"
+		,(extra != NULL) ? extra : "");
 }
 
 /* Writes a html header to client using <socket_handle> */
@@ -1023,77 +2010,834 @@ void html_footer(int socket_handle)
 			);
 }
 
+/* Returns the formatted error message allocated from the request arena */
 char *seterror(const char *format, ...)
 {
 	va_list args;
 	char *errormsg;
 
-	errormsg = malloc(strlen(format)+1024);
-	if ( errormsg != NULL ) {
-		va_start (args, format);
-		vsprintf (errormsg, format, args);
-		va_end (args);
-	}
+	va_start (args, format);
+	errormsg = arena_vprintf(thread_arena, format, args);
+	va_end (args);
 
 	return errormsg;
 }
 
-/* 	handle command input either via TCP socket or by a given string.
-	if socket_handle is 0, then results will be given via stdout
-	otherwise it will be sent back via TCP to the socket client
-	returns:
-		 0: successful, normal
-		-1: successful, client want to disconnect
-		-2: successful, client want to disconnect and quit the server
-		-3: successful http request
+/* 	Parse a command verb or dim level <token> into <action> and <value>
+	returns false if <token> is neither a verb nor a number
 */
-int handle_input(char* input, libusb_device_handle* dev_handle, int socket_handle, int flags)
+bool parse_action(const char *token, int *action, int *value)
 {
+	char *end;
+	long level;
 
-	static char usbcmd[8];
-	char cmd_delimiter[] = CMD_DELIMITER;
-	char *cmds[MAX_CMDS];
+	if( (*action = lm_verb(token, strlen(token))) >= 0 ) {
+		return true;
+	}
+	errno = 0;
+	level = strtol(token, &end, 10);
+	if( errno != 0 || end == token ) {
+		return false;
+	}
+	*action = LM_ACT_DIM;
+	if( *end == '%' ) {
+		*action = LM_ACT_DIM_PERCENT;
+		end++;
+	}
+	*value = (level >= 0 && level <= 100) ? (int)level : -1;
+	return *end == '\0';
+}
 
+/* 	Encode a device command (FS20, UNI, IKEA, IT or SCENE) into the 8 byte
+	device frame <usbcmd> without sending it.
+	<ptr> is the command keyword, the command parameters are read using the
+	strtok_r() state <saveptr>. Only the parameters are parsed here, the
+	frame is built by the codec (lmcodec.c).
+	returns:
+		 1: frame encoded within <usbcmd>
+		 0: <ptr> is not a device command
+		-1: wrong command syntax, <errormsg> contains the reason
+*/
+int encode_device_cmd(char *ptr, char **saveptr, unsigned char *usbcmd, char **errormsg)
+{
 	char tok_delimiter[] = TOKEN_DELIMITER;
-	int i;
-	char *ptr;
-	bool fcmdok;
-	bool quiet = false;
+	enum lm_protocol protocol;
+	unsigned long addr;
+	int action = LM_ACT_ACTIVATE;
+	int value = -1;
+	int rc;
+
+	memset(usbcmd, 0, 8);
+
+	/* FS20 devices */
+	if (cmdcompare(ptr, "FS20") == 0) {
+		char *cp;
+		int fs20addr;
+
+		protocol = LM_PROTO_FS20;
+		/* next token: addr */
+ 		ptr = strtok_r(NULL, tok_delimiter, saveptr);
+ 		if( ptr==NULL ) {
+			*errormsg = seterror("missing <addr> parameter");
+			return -1;
+		}
+		if( (fs20addr = fs20toi(ptr, &cp)) < 0 ) {
+			*errormsg = seterror("%s: wrong <addr> parameter", ptr);
+			return -1;
+		}
+		addr = LM_FS20_ADDR(housecode, fs20addr);
+ 	}
+	/* Uniroll devices */
+	else if (cmdcompare(ptr, "UNI") == 0) {
+		long channel;
+
+		protocol = LM_PROTO_UNI;
+		/* next token: addr */
+ 		ptr = strtok_r(NULL, tok_delimiter, saveptr);
+ 		if( ptr==NULL ) {
+			*errormsg = seterror("missing <addr> parameter");
+			return -1;
+		}
+		errno = 0;
+		channel = strtol(ptr, NULL, 10);
+		if( errno != 0 || channel < 1 || channel > 16 ) {
+			*errormsg = seterror("%s: wrong <addr> parameter", ptr);
+			return -1;
+		}
+		addr = LM_UNI_ADDR(channel);
+	}
+	/* IKEA devices */
+	else if (cmdcompare(ptr, "IKEA") == 0 || cmdcompare(ptr, "KOPPLA") == 0) {
+		long code;
+		long channel;
+
+		protocol = LM_PROTO_IKEA;
+		/* next token: code */
+ 		ptr = strtok_r(NULL, tok_delimiter, saveptr);
+ 		if( ptr==NULL ) {
+			*errormsg = seterror("missing <code> parameter");
+			return -1;
+		}
+		errno = 0;
+		code = strtol(ptr, NULL, 10);
+		if( errno != 0 || code < 1 || code > 16 ) {
+			*errormsg = seterror("<code> parameter out of range (must be within '1' to '16')");
+			return -1;
+		}
+		/* next token: addr */
+ 		ptr = strtok_r(NULL, tok_delimiter, saveptr);
+ 		if( ptr==NULL ) {
+			*errormsg = seterror("missing <addr> parameter");
+			return -1;
+		}
+		errno = 0;
+		channel = strtol(ptr, NULL, 10);
+		if( errno != 0 || channel < 1 || channel > 10 ) {
+			*errormsg = seterror("%s: <addr> parameter out of range (must be within 1 to 10)", ptr);
+			return -1;
+		}
+		addr = LM_IKEA_ADDR(code, channel);
+	}
+	/* InterTechno devices */
+	else if (cmdcompare(ptr, "IT") == 0 || cmdcompare(ptr, "InterTechno") == 0) {
+		int code;
+		long channel;
+		int learn;
+
+		protocol = LM_PROTO_IT;
+		/* next token: code */
+ 		ptr = strtok_r(NULL, tok_delimiter, saveptr);
+ 		if( ptr==NULL ) {
+			*errormsg = seterror("missing <code> parameter");
+			return -1;
+		}
+		if( toupper(*ptr)<'A' || toupper(*ptr)>'P' || ptr[1] != '\0' ) {
+			*errormsg = seterror("<code> parameter out of range (must be within 'A' to 'P')");
+			return -1;
+		}
+		code = toupper(*ptr) - 'A';
+		/* next token: addr */
+ 		ptr = strtok_r(NULL, tok_delimiter, saveptr);
+ 		if( ptr==NULL ) {
+			*errormsg = seterror("missing <addr> parameter");
+			return -1;
+		}
+		errno = 0;
+		channel = strtol(ptr, NULL, 10);
+		if( errno != 0 || channel < 1 || channel > 16 ) {
+			*errormsg = seterror("%s: <addr> parameter out of range (must be within 1 to 16)", ptr);
+			return -1;
+		}
+		/* next token: learn */
+ 		ptr = strtok_r(NULL, tok_delimiter, saveptr);
+ 		if( ptr==NULL ) {
+			*errormsg = seterror("missing <learn> parameter");
+			return -1;
+		}
+		if (cmdcompare(ptr, "LEARN") == 0 ) {
+			learn = 1;	/* code learning devices */
+		} else if (cmdcompare(ptr, "DIP") == 0 ) {
+			learn = 0;	/* standard devices with DIP-switches */
+		} else {
+			*errormsg = seterror("wrong <learn> parameter '%s' (must be LEARN or DIP)", ptr);
+			return -1;
+		}
+		addr = LM_IT_ADDR(code, channel, learn);
+	}
+ 	/* Scene commands */
+	else if (cmdcompare(ptr, "SCENE") == 0) {
+		long scene;
+
+		protocol = LM_PROTO_SCENE;
+ 		ptr = strtok_r(NULL, tok_delimiter, saveptr);
+		if( ptr == NULL ) {
+			*errormsg = seterror("missing parameter");
+			return -1;
+		}
+		scene = strtol(ptr, NULL, 10);
+		if( scene < 1 || scene > 254 ) {
+			*errormsg = seterror("parameter <s> out of range (must be within range 1-254)");
+			return -1;
+		}
+		addr = LM_SCENE_ADDR(scene);
+ 	}
+	else {
+		return 0;
+	}
+
+	if( protocol != LM_PROTO_SCENE ) {
+		/* next token: cmd */
+		ptr = strtok_r(NULL, tok_delimiter, saveptr);
+		if( ptr==NULL ) {
+			*errormsg = seterror("missing <cmd> parameter");
+			return -1;
+		}
+		if( !parse_action(ptr, &action, &value) ) {
+			*errormsg = seterror("unknown <cmd> parameter '%s'", ptr);
+			return -1;
+		}
+		/* IKEA: optional dim level (0-9 or 0%-90%) for the dimming mode */
+		if( protocol == LM_PROTO_IKEA && action != LM_ACT_DIM && action != LM_ACT_DIM_PERCENT ) {
+			char *level = strtok_r(NULL, tok_delimiter, saveptr);
+
+			if( level != NULL ) {
+				int dimaction;
+
+				if( !parse_action(level, &dimaction, &value) || (dimaction != LM_ACT_DIM && dimaction != LM_ACT_DIM_PERCENT) ) {
+					*errormsg = seterror("Wrong dim level '%s'", level);
+					return -1;
+				}
+				if( dimaction == LM_ACT_DIM_PERCENT ) {
+					value = lm_percent_level(protocol, value);
+				}
+			}
+		}
+	}
+
+	rc = lm_encode(protocol, addr, action, value, usbcmd);
+	if( rc == LM_EVALUE ) {
+		*errormsg = seterror("Wrong dim level (must be within 0-%d or 0\%-100\%)", lm_dim_max(protocol));
+		return -1;
+	}
+	else if( rc != LM_OK ) {
+		*errormsg = seterror("wrong <cmd> parameter '%s' (%s)", ptr, lm_strerror(rc));
+		return -1;
+	}
+	return 1;
+}
+
+/* Returns true if the <len> chars of <cmd> are a device command keyword */
+bool is_device_cmd(const char *cmd, size_t len)
+{
+	static const char *devicecmds[] = { "FS20", "IT", "InterTechno", "IKEA", "KOPPLA", "UNI", "SCENE", NULL };
+	const char **dev;
+
+	for(dev = devicecmds; *dev != NULL; dev++) {
+		if( strlen(*dev) == len && strnicmp(cmd, *dev, len) == 0 ) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* 	Parse an address range token "<lo>-<hi>" of length <len>, where lo and hi
+	are numbers, letters (InterTechno code) or if <ffs20> is set FS20 addresses
+	(e.g. 1111-1144)
+	returns the RANGE_xxx kind of a valid range, otherwise RANGE_NONE
+*/
+int parse_range(const char *token, size_t len, bool ffs20, int *lo, int *hi)
+{
+	const char *sep = memchr(token, '-', len);
+	size_t lolen, hilen;
+	size_t i;
+	int kind;
+
+	if( sep == NULL || sep == token || sep == token + len - 1 ) {
+		return RANGE_NONE;
+	}
+	lolen = sep - token;
+	hilen = len - lolen - 1;
+	if( ffs20 ) {
+		char addr[5];
+
+		if( lolen != 4 || hilen != 4 ) {
+			return RANGE_NONE;
+		}
+		for(i=0; i<len; i++) {
+			if( i != lolen && (token[i] < '1' || token[i] > '4') ) {
+				return RANGE_NONE;
+			}
+		}
+		memcpy(addr, token, 4);
+		addr[4] = '\0';
+		*lo = fs20toi(addr, NULL);
+		memcpy(addr, sep + 1, 4);
+		*hi = fs20toi(addr, NULL);
+		kind = RANGE_FS20;
+	}
+	else if( lolen == 1 && hilen == 1 && isalpha(token[0]) && isalpha(sep[1]) ) {
+		*lo = toupper(token[0]);
+		*hi = toupper(sep[1]);
+		kind = RANGE_LETTER;
+	}
+	else {
+		for(i=0; i<len; i++) {
+			if( i != lolen && !isdigit(token[i]) ) {
+				return RANGE_NONE;
+			}
+		}
+		*lo = atoi(token);
+		*hi = atoi(sep + 1);
+		kind = RANGE_NUMBER;
+	}
+	return (*lo <= *hi) ? kind : RANGE_NONE;
+}
+
+/* 	Encode a device command into <frames>, expanding aliases, groups and one
+	address range token, e.g. "floor1 OFF" or "FS20 1111-1144 OFF".
+	<table> is the alias table of the whole expansion (may be NULL)
+	returns:
+		>0: number of frames encoded
+		 0: <command> is not a device command
+		-1: wrong command syntax, <errormsg> contains the reason
+*/
+int encode_expand(const struct alias_table *table, const char *command, unsigned char (*frames)[8], int maxframes, char **errormsg, int depth)
+{
+	char tok_delimiter[] = TOKEN_DELIMITER;
+	char buf[INPUT_BUFFER_MAXLEN];
+	const struct alias *alias;
+	const char *name;
+	const char *token;
+	size_t len;
+	int count = 0;
+	int lo, hi;
+	int i;
+	int kind = RANGE_NONE;
+
+	name = command + strspn(command, tok_delimiter);
+	len = strcspn(name, tok_delimiter);
+	if( len == 0 ) {
+		return 0;
+	}
+	/* an expanded command is never longer than the command itself */
+	if( strlen(command) >= sizeof(buf) ) {
+		if( !is_device_cmd(name, len) && alias_lookup(table, name, len) == NULL ) {
+			return 0;
+		}
+		*errormsg = seterror("command too long (max %d chars)", (int)sizeof(buf) - 1);
+		return -1;
+	}
+
+	/* Alias or group */
+	if( (alias = alias_lookup(table, name, len)) != NULL ) {
+		const char *member = alias->expansion;
+
+		if( depth >= EXPAND_MAX_DEPTH ) {
+			*errormsg = seterror("group '%s' nested too deep", alias->name);
+			count = -1;
+		}
+		while( count >= 0 && *member != '\0' ) {
+			size_t mlen = strcspn(member, ";");
+			int rc;
+
+			if( snprintf(buf, sizeof(buf), "%.*s%s", (int)mlen, member, name + len) >= (int)sizeof(buf) ) {
+				*errormsg = seterror("command too long");
+				count = -1;
+			}
+			else if( (rc = encode_expand(table, buf, frames + count, maxframes - count, errormsg, depth + 1)) <= 0 ) {
+				if( rc == 0 ) {
+					*errormsg = seterror("'%.*s' of '%s' is not a device", (int)mlen, member, alias->name);
+				}
+				count = -1;
+			}
+			else {
+				count += rc;
+				member += mlen;
+				member += (*member == ';');
+			}
+		}
+		return count;
+	}
+
+	if( !is_device_cmd(name, len) ) {
+		return 0;
+	}
+
+	/* Find an address range token, the FS20 address is the first parameter */
+	for(token = name + len, i = 0; *(token += strspn(token, tok_delimiter)) != '\0'; token += len, i++) {
+		len = strcspn(token, tok_delimiter);
+		if( (kind = parse_range(token, len, i == 0 && strnicmp(name, "FS20", 4) == 0, &lo, &hi)) != RANGE_NONE ) {
+			break;
+		}
+	}
+	if( *token == '\0' ) {
+		token = NULL;
+		lo = hi = 0;
+	}
+	else {
+		const char *next;
+		size_t nextlen;
+		int nlo, nhi;
+
+		if( hi - lo >= RANGE_MAX ) {
+			*errormsg = seterror("range '%.*s' too large (max %d addresses)", (int)len, token, RANGE_MAX);
+			return -1;
+		}
+		for(next = token + len; *(next += strspn(next, tok_delimiter)) != '\0'; next += nextlen) {
+			nextlen = strcspn(next, tok_delimiter);
+			if( parse_range(next, nextlen, false, &nlo, &nhi) != RANGE_NONE ) {
+				*errormsg = seterror("only one address range per command allowed");
+				return -1;
+			}
+		}
+	}
+
+	for(i = lo; i <= hi; i++) {
+		char *ptr;
+		char *saveptr;
+		int rc;
+
+		if( count >= maxframes ) {
+			*errormsg = seterror("too many devices (max %d)", EXPAND_MAX_FRAMES);
+			return -1;
+		}
+		if( token == NULL ) {
+			strncpy(buf, command, sizeof(buf)-1);
+			buf[sizeof(buf)-1] = '\0';
+		}
+		else if( kind == RANGE_LETTER ) {
+			snprintf(buf, sizeof(buf), "%.*s%c%s", (int)(token - command), command, i, token + len);
+		}
+		else if( kind == RANGE_FS20 ) {
+			snprintf(buf, sizeof(buf), "%.*s%c%c%c%c%s", (int)(token - command), command,
+					 '1' + ((i>>6) & 3), '1' + ((i>>4) & 3), '1' + ((i>>2) & 3), '1' + (i & 3), token + len);
+		}
+		else {
+			snprintf(buf, sizeof(buf), "%.*s%d%s", (int)(token - command), command, i, token + len);
+		}
+		ptr = strtok_r(buf, tok_delimiter, &saveptr);
+		if( (rc = encode_device_cmd(ptr, &saveptr, frames[count], errormsg)) <= 0 ) {
+			return rc;
+		}
+		count++;
+	}
+	return count;
+}
+
+/* Remove duplicate frames keeping the order of first occurrence, returns the new count */
+int frames_unique(unsigned char (*frames)[8], int count)
+{
+	int set[EXPAND_MAX_FRAMES * 2];
+	unsigned int mask;
+	int unique = 0;
+	int i;
+
+	if( count < 2 || count > EXPAND_MAX_FRAMES ) {
+		return count;
+	}
+	for(mask = 16; mask < (unsigned int)count * 2; mask <<= 1);
+	memset(set, -1, mask-- * sizeof(int));
+	for(i=0; i<count; i++) {
+		unsigned int h = 2166136261u;
+		unsigned int j;
+		int k;
+
+		for(k=0; k<8; k++) {
+			h = (h ^ frames[i][k]) * 16777619u;
+		}
+		for(j = h & mask; set[j] >= 0 && memcmp(frames[set[j]], frames[i], 8) != 0; j = (j + 1) & mask);
+		if( set[j] < 0 ) {
+			if( unique != i ) {
+				memcpy(frames[unique], frames[i], 8);
+			}
+			set[j] = unique++;
+		}
+	}
+	return unique;
+}
+
+/* 	Encode a device command including aliases, groups and ranges into
+	<frames> without duplicates, returns like encode_expand()
+*/
+int encode_command(const char *command, unsigned char (*frames)[8], int maxframes, char **errormsg)
+{
+	int slot;
+	int count;
+
+	/* one table for all levels, a reload must not mix old and new groups */
+	count = encode_expand(alias_read_lock(&slot), command, frames, maxframes, errormsg, 0);
+	alias_read_unlock(slot);
+	return (count > 1) ? frames_unique(frames, count) : count;
+}
+
+/* Discard all queued commands and close the batch */
+void batch_reset(struct batch *batch)
+{
+	arena_reset(&batch->arena);
+	batch->active = false;
+	batch->count = 0;
+	batch->size = 0;
+	batch->cmds = NULL;
+}
+
+/* Queue a copy of <command>, returns 0 on success, otherwise -1 */
+int batch_add(struct batch *batch, const char *command)
+{
+	char *copy;
+
+	if( batch->count >= limits.client ) {
+		return -1;
+	}
+	if( batch->count >= batch->size ) {
+		int size = batch->size ? batch->size * 2 : 64;
+		char **cmds = arena_alloc(&batch->arena, size * sizeof(char *));
+
+		if( cmds == NULL ) {
+			return -1;
+		}
+		if( batch->count > 0 ) {
+			memcpy(cmds, batch->cmds, batch->count * sizeof(char *));
+		}
+		batch->cmds = cmds;
+		batch->size = size;
+	}
+	if( (copy = arena_strdup(&batch->arena, command)) == NULL ) {
+		return -1;
+	}
+	batch->cmds[batch->count++] = copy;
+	return 0;
+}
+
+/* 	Validate and send all queued commands of <batch>.
+	Nothing is sent if any command is invalid, otherwise the frames of all
+	commands are submitted at once to the client queue so the scheduler sends
+	them back-to-back, then the per-command result vector
+	"<index> OK|ERROR <usec>" is written to the client.
+	The batch is closed afterwards.
+	returns 0 if all frames were sent, otherwise -1 and <errormsg> is set,
+	-2 if nothing was sent because of the admission limits
+*/
+int batch_commit(struct batch *batch, lm_device *dev_handle, int socket_handle, int flags, char **errormsg)
+{
+	unsigned char expanded[EXPAND_MAX_FRAMES][8];
+	unsigned char (*frames)[8] = NULL;
+	struct lm_result *reqs = NULL;
+	int *first;					/* first frame of each command, first[count] = total */
+	int size = 0;
+	int total = 0;
+	int failed = 0;
+	bool busy = false;
+	int i, j;
+
+	/* everything lives until the end of the request in the request arena */
+	if( (first = arena_alloc(thread_arena, (batch->count + 1) * sizeof(int))) == NULL ) {
+		*errormsg = seterror("out of memory");
+		goto commit_end;
+	}
+
+	/* Encode the whole batch before anything will be sent */
+	for(i=0; i<batch->count; i++) {
+		char *cmderror = NULL;
+		int rc;
+
+		first[i] = total;
+		rc = encode_command(batch->cmds[i], expanded, EXPAND_MAX_FRAMES, &cmderror);
+		if( rc <= 0 ) {
+			*errormsg = seterror("command %d '%s': %s", i+1, batch->cmds[i],
+								 (rc == 0) ? "not a device command" : ((cmderror != NULL) ? cmderror : "<unknown>"));
+			goto commit_end;
+		}
+		/* frames grow by doubling within the arena, only the used part is copied */
+		if( total + rc > size ) {
+			unsigned char (*newframes)[8];
+
+			size = (size * 2 > total + rc) ? size * 2 : ((total + rc > 64) ? total + rc : 64);
+			if( (newframes = arena_alloc(thread_arena, size * sizeof(*frames))) == NULL ) {
+				*errormsg = seterror("out of memory");
+				goto commit_end;
+			}
+			if( total > 0 ) {
+				memcpy(newframes, frames, total * sizeof(*frames));
+			}
+			frames = newframes;
+		}
+		memcpy(frames + total, expanded, rc * sizeof(*frames));
+		total += rc;
+	}
+	first[batch->count] = total;
+
+	/* Submit all frames at once and wait for the last one */
+	if( total > 0 ) {
+		if( (reqs = arena_alloc(thread_arena, total * sizeof(*reqs))) == NULL ) {
+			*errormsg = seterror("out of memory");
+			goto commit_end;
+		}
+		if( admit_submit(frames, total, reqs, errormsg) < 0 ) {
+			busy = true;
+			goto commit_end;
+		}
+	}
+
+	/* Result vector, written in chunks to keep the number of sends low */
+	{
+		char out[MSG_BUFFER_MAXLEN / 2];
+		int len = 0;
+
+		for(i=0; i<batch->count; i++) {
+			bool ok = true;
+
+			for(j=first[i]; j<first[i+1]; j++) {
+				ok &= (reqs[j].status == LM_OK);
+			}
+			failed += !ok;
+		}
+		len = snprintf(out, sizeof(out), "%d commands, %d frames, %d failed, %lld us\r\n", batch->count, total, failed,
+					   (total > 0) ? reqs[total-1].finished - reqs[0].submitted : 0LL);
+		for(i=0; i<batch->count; i++) {
+			bool ok = true;
+
+			for(j=first[i]; j<first[i+1]; j++) {
+				ok &= (reqs[j].status == LM_OK);
+			}
+			if( len > (int)sizeof(out) - 32 ) {
+				write_to_client(socket_handle, flags, "%s", out);
+				len = 0;
+			}
+			len += snprintf(out + len, sizeof(out) - len, "%d %s %lld\r\n", i+1, ok ? "OK" : "ERROR",
+							reqs[first[i+1]-1].finished - reqs[first[i]].started);
+		}
+		write_to_client(socket_handle, flags, "%s", out);
+	}
+	if( failed ) {
+		*errormsg = seterror("%d of %d commands not sent (USB communication error)", failed, batch->count);
+	}
+
+commit_end:
+	batch_reset(batch);
+	return (*errormsg == NULL) ? 0 : (busy ? -2 : -1);
+}
+
+/* Initialize the state of a new client connection */
+void session_init(struct session *session)
+{
+	memset(session, 0, sizeof(*session));
+	session->queue = lm_queue_new(dev_handle);
+	if( rtpriority > 0 && session->queue != NULL ) {
+		/* group and range commands do not allocate */
+		lm_queue_reserve(session->queue, EXPAND_MAX_FRAMES);
+	}
+	lm_thread_queue(session->queue);
+	thread_timing = &session->timing;
+	arena_init(&session->arena, ARENA_SIZE);
+	thread_arena = &session->arena;
+	thread_out = &session->out;
+}
+
+/* Release all resources of a client connection */
+void session_free(struct session *session)
+{
+	arena_free(&session->batch.arena);
+	arena_free(&session->arena);
+	line_free(&session->reader);
+	pipeline_free(&session->pipeline);
+	if( thread_arena == &session->arena ) {
+		thread_arena = NULL;
+	}
+	out_flush(&session->out);
+	if( thread_out == &session->out ) {
+		thread_out = NULL;
+	}
+	lm_queue_free(session->queue);
+	session->queue = NULL;
+	free(session->timing.out);
+	session->timing.out = NULL;
+	if( thread_timing == &session->timing ) {
+		thread_timing = NULL;
+	}
+}
+
+/* 	handle command input either via TCP socket or by a given string.
+	if socket_handle is 0, then results will be given via stdout
+	otherwise it will be sent back via TCP to the socket client
+	returns:
+		 0: successful, normal
+		-1: successful, client want to disconnect
+		-2: successful, client want to disconnect and quit the server
+		-3: successful http request
+*/
+int handle_input(char* input, lm_device *dev_handle, int socket_handle, int flags, struct session *session)
+{
+
+	unsigned char usbcmd[8];
+	unsigned char frames[EXPAND_MAX_FRAMES][8];
+	char cmd_delimiter[] = CMD_DELIMITER;
+	char *cmds[MAX_CMDS+1];
+
+	char tok_delimiter[] = TOKEN_DELIMITER;
+	int i;
+	int rc;
+	char *ptr;
+	char *saveptr;
+	bool fcmdok;
+	bool quiet = false;
 
 	debug(LOG_DEBUG, "Handle Input '%s'", input);
-	if( stristr(input,"GET")==input && stristr(input,"HTTP/1.")!=NULL ) {
+	if( (stristr(input,"GET")==input || strnicmp(input,"POST ",5)==0) && stristr(input,"HTTP/1.")!=NULL ) {
 		char *newinput;
+		unsigned long lastid = 0;
+		bool ftiming;
+		bool fjson = false;
+		int method = (strnicmp(input,"POST ",5)==0) ? METHOD_POST : METHOD_GET;
+		char *body;
+		char ifnonematch[128] = "";
+		bool fgzip = true;
+		const struct asset *asset;
+
+		/* header lines get lost below, keep what we need */
+		if( (ptr = stristr(input, "Last-Event-ID:")) != NULL ) {
+			lastid = strtoul(ptr + 14, NULL, 10);
+		}
+		ftiming = (stristr(input, "X-Timing:") != NULL);
+		if( (ptr = stristr(input, "\nAccept:")) != NULL ) {
+			char *eol = strpbrk(ptr + 1, "\r\n");
+			char *json = stristr(ptr, "application/json");
+
+			fjson = (json != NULL && (eol == NULL || json < eol));
+		}
+		if( (ptr = stristr(input, "\nIf-None-Match:")) != NULL ) {
+			size_t len = strcspn(ptr + 15, "\r\n");
+
+			if( len >= sizeof(ifnonematch) ) {
+				len = sizeof(ifnonematch) - 1;
+			}
+			memcpy(ifnonematch, ptr + 15, len);
+			ifnonematch[len] = '\0';
+			trim(ifnonematch);
+		}
+		if( (ptr = stristr(input, "\nAccept-Encoding:")) != NULL ) {
+			char *eol = strpbrk(ptr + 1, "\r\n");
+			char *gzip = stristr(ptr, "gzip");
 
+			fgzip = (gzip != NULL && (eol == NULL || gzip < eol));
+		}
+		/* the body (Content-Length) follows the empty line */
+		if( (body = strstr(input, "\r\n\r\n")) != NULL ) {
+			body += 4;
+		}
 		*stristr(input,"HTTP/1.") = '\0';
 		input = stristr(input,"/");
 		if( input!=NULL ) {
 			input = trim(input);
 			debug(LOG_DEBUG, "Handle HTTP request '%s'", input);
+			if( strncmp(input, "/api/", 5) == 0 ) {
+				return route_dispatch(socket_handle, method, input, body);
+			}
+			if( method == METHOD_GET && (asset = asset_find(input)) != NULL ) {
+				return static_serve(socket_handle, asset, ifnonematch, fgzip);
+			}
+			if( strcmp(input, "/events") == 0 || strncmp(input, "/events?", 8) == 0 ) {
+				int types = EVENT_ALL;
+
+				if( stristr(input, "type=state") ) {
+					types = EVENT_STATE;
+				}
+				else if( stristr(input, "type=temp") ) {
+					types = EVENT_TEMP;
+				}
+				write_to_client(socket_handle, 0,
+					"HTTP/1.1 200 OK\r\n"
+					"Server: %s WEB %s (build %s)\r\n"
+					"Cache-Control: no-cache\r\n"
+					"Connection: keep-alive\r\n"
+					"Content-Type: text/event-stream\r\n"
+					"\r\n"
+					"retry: 3000\n\n"
+					,PROGNAME, VERSION, BUILD);
+				/* a stream is no request with a latency */
+				session->timing.received = 0;
+				out_flush(&session->out);
+				event_stream(socket_handle, NULL, types, true, lastid);
+				return -3;
+			}
 			if( stristr(input,"/cmd=") ) {
 				input = stristr(input,"/cmd=")+5;
 				if( (ptr = url_decode(input)) ) {
-					request_header(socket_handle, 200, "OK");
-					html_header(socket_handle, "Lightmanager");
-					handle_input(ptr, dev_handle, socket_handle, HANDLE_INPUT_HTML);
-					html_footer(socket_handle);
-					free(ptr);
+					const char *contenttype = fjson ? "application/json" : NULL;
+
+					/* with timing the breakdown goes into the header: send the response afterwards */
+					if( ftiming ) {
+						session->timing.capture = true;
+					}
+					else {
+						request_header(socket_handle, 200, "OK", contenttype, NULL);
+					}
+					if( fjson ) {
+						/* an array of one object per command */
+						session->json = true;
+						session->out.jsonarray = true;
+						session->out.jsonitems = 0;
+						write_to_client(socket_handle, 0, "[");
+						handle_input(ptr, dev_handle, socket_handle, 0, session);
+						write_to_client(socket_handle, 0, "]\r\n");
+					}
+					else {
+						html_header(socket_handle, "Lightmanager");
+						handle_input(ptr, dev_handle, socket_handle, HANDLE_INPUT_HTML, session);
+						html_footer(socket_handle);
+					}
+					if( ftiming ) {
+						char header[256];
+
+						out_flush(&session->out);
+						session->timing.capture = false;
+						timing_stop(session);
+						strcpy(header, "Server-Timing: ");
+						timing_format(&session->timing, header + strlen(header), sizeof(header) - strlen(header) - 2, true);
+						strcat(header, "\r\n");
+						request_header(socket_handle, 200, "OK", contenttype, header);
+						out_flush(&session->out);
+						timing_flush(&session->timing, socket_handle);
+					}
 					return -3;
 				}
 			}
 		}
-		request_header(socket_handle, 400, "Bad Request");
+		if( fjson ) {
+			request_header(socket_handle, 400, "Bad Request", "application/json", NULL);
+			write_to_client(socket_handle, 0, "{\"status\":\"ERROR\",\"error\":\"Bad Request, use http://<server>/cmd=<command>[&<command>[...]]\"}\r\n");
+			return -3;
+		}
+		request_header(socket_handle, 400, "Bad Request", NULL, NULL);
 		html_header(socket_handle, "Error 400 - Bad Request");
-		write_to_client(socket_handle, HANDLE_INPUT_HTML,
-			"<h1>Error 400 - Bad Request</h1>\r\n"
-			"The request cannot be fulfilled due to bad syntax.\r\n"
-			"\r\n"
-			"Usage&colon; <pre>http&colon;//&lt;server&gt;/cmd=<span style=\"color:blue;\">command</span>[&amp;<span style=\"color:blue;\">command</span>[...]]</pre>\r\n"
-			"\r\n"
-			"For possible commands see help below\r\n"
-			"<pre>\r\n"
+		write_to_client(socket_handle, 0,
+			"<h1>Error 400 - Bad Request</h1><br />\r\n"
+			"The request cannot be fulfilled due to bad syntax.<br />\r\n"
+			"<br />\r\n"
+			"Usage&colon; <pre>http&colon;//&lt;server&gt;/cmd=<span style=\"color:blue;\">command</span>[&amp;<span style=\"color:blue;\">command</span>[...]]</pre><br />\r\n"
+			"<br />\r\n"
+			"For possible commands see help below<br />\r\n"
 			);
-		client_cmd_help(socket_handle, 0);
-		write_to_client(socket_handle, 0,"</pre>\r\n");
+		client_cmd_help(socket_handle, HANDLE_INPUT_HTML);
 		html_footer(socket_handle);
 		return -3;
 	}
@@ -1102,28 +2846,97 @@ int handle_input(char* input, libusb_device_handle* dev_handle, int socket_handl
 	debug(LOG_DEBUG, "Handle input '%s'", input);
 
 	i = 0;
-	cmds[i] = strtok(input, cmd_delimiter);
+	cmds[i] = strtok_r(input, cmd_delimiter, &saveptr);
 	while( i<MAX_CMDS && cmds[i]!=NULL ) {
-		cmds[++i] = strtok(NULL, cmd_delimiter);
+		cmds[++i] = strtok_r(NULL, cmd_delimiter, &saveptr);
 	}
 	i = 0;
 	while( i<MAX_CMDS && cmds[i]!=NULL ) {
 		char *command = cmds[i++];
 		char *cmdexec;
 		char *errormsg;
+		char *original;
+		bool queued = false;
+		bool replied = false;
+		bool busy = false;
 
 		debug(LOG_DEBUG, "Handle cmd '%s'", command);
 
 		fcmdok = true;
-		cmdexec = strdup(command);
+		cmdexec = arena_strdup(thread_arena, command);
 		errormsg = NULL;
+		flags = session->json ? (flags & ~HANDLE_INPUT_HTML) | HANDLE_INPUT_JSON : (flags & ~HANDLE_INPUT_JSON);
+		session->out.jsoncmd = cmdexec;
+		/* untokenized copy for encode_command(), as long as the line */
+		original = arena_strdup(thread_arena, command);
 
 		memset(usbcmd, 0, sizeof(usbcmd));
 
-		ptr = strtok(command, tok_delimiter);
+		ptr = strtok_r(command, tok_delimiter, &saveptr);
+		if( original == NULL ) {
+			errormsg = seterror("out of memory");
+			fcmdok = false;
+			ptr = NULL;
+		}
+
+		/* pipelined replies go out in order: other commands wait for those in flight */
+		if( ptr != NULL && session->pipeline.count > 0 && (session->batch.active || !pipeline_device(original)) ) {
+			pipeline_drain(session, socket_handle);
+		}
 
 		if( ptr != NULL ) {
-			if (cmdcompare(ptr, "HELP") == 0 || cmdcompare(ptr, "H") == 0 || cmdcompare(ptr, "?") == 0) {
+			/* Open batch: queue everything except batch and session control commands */
+			if ( session->batch.active &&
+				 cmdcompare(ptr, "BEGIN") != 0 && cmdcompare(ptr, "COMMIT") != 0 && cmdcompare(ptr, "ABORT") != 0 &&
+				 cmdcompare(ptr, "QUIT") != 0 && cmdcompare(ptr, "Q") != 0 &&
+				 cmdcompare(ptr, "EXIT") != 0 && cmdcompare(ptr, "E") != 0 ) {
+				char *cmderror = NULL;
+
+				/* only device commands can be batched, reject anything else right here */
+				if( (rc = encode_command(original, frames, EXPAND_MAX_FRAMES, &cmderror)) <= 0 ) {
+					errormsg = (rc == 0) ? seterror("not a device command, not queued")
+										 : seterror("%s, not queued", (cmderror != NULL) ? cmderror : "<unknown>");
+					fcmdok = false;
+				}
+				else if( cmdexec != NULL && batch_add(&session->batch, trim(cmdexec)) == 0 ) {
+					queued = true;
+				}
+				else {
+					atomic_fetch_add(&busy_commands, 1);
+					errormsg = seterror("batch full (max %d commands)", limits.client);
+					fcmdok = false;
+					busy = true;
+				}
+			}
+			else if (cmdcompare(ptr, "BEGIN") == 0) {
+				if( session->batch.active ) {
+					errormsg = seterror("batch already started");
+					fcmdok = false;
+				}
+				else {
+					session->batch.active = true;
+				}
+			}
+			else if (cmdcompare(ptr, "COMMIT") == 0) {
+				if( !session->batch.active ) {
+					errormsg = seterror("no batch started");
+					fcmdok = false;
+				}
+				else if( (rc = batch_commit(&session->batch, dev_handle, socket_handle, flags, &errormsg)) != 0 ) {
+					fcmdok = false;
+					busy = (rc == -2);
+				}
+			}
+			else if (cmdcompare(ptr, "ABORT") == 0) {
+				if( !session->batch.active ) {
+					errormsg = seterror("no batch started");
+					fcmdok = false;
+				}
+				else {
+					batch_reset(&session->batch);
+				}
+			}
+			else if (cmdcompare(ptr, "HELP") == 0 || cmdcompare(ptr, "H") == 0 || cmdcompare(ptr, "?") == 0) {
 				client_cmd_help(socket_handle, flags);
 			}
 			else if (cmdcompare(ptr, "VERSION") == 0) {
@@ -1135,401 +2948,141 @@ int handle_input(char* input, libusb_device_handle* dev_handle, int socket_handl
 			else if (cmdcompare(ptr, "QUIET") == 0) {
 				quiet = true;
 			}
-			/* FS20 devices */
-			else if (cmdcompare(ptr, "FS20") == 0) {
-				char *cp;
-				int addr;
-				int cmd = -1;
-
-				/* next token: addr */
-		 		ptr = strtok(NULL, tok_delimiter);
-		 		if( ptr!=NULL ) {
-					int addr = fs20toi(ptr, &cp);
-					if ( addr >= 0 ) {
-						/* next token: cmd */
-				 		ptr = strtok(NULL, tok_delimiter);
-				 		if( ptr!=NULL ) {
-							if (cmdcompare(ptr, "ON") == 0 || cmdcompare(ptr, "UP") == 0  || cmdcompare(ptr, "OPEN") == 0) {
-								cmd = 0x11;
-							} else if (cmdcompare(ptr, "OFF") == 0 || cmdcompare(ptr, "DOWN") == 0  || cmdcompare(ptr, "CLOSE") == 0) {
-								cmd = 0x00;
-							} else if (cmdcompare(ptr, "TOGGLE") == 0) {
-								cmd = 0x12;
-							} else if (cmdcompare(ptr, "BRIGHT") == 0 || cmdcompare(ptr, "+") == 0 ) {
-								cmd = 0x13;
-							} else if (cmdcompare(ptr, "DARK") == 0 || cmdcompare(ptr, "-") == 0 ) {
-								cmd = 0x14;
-							}
-							/* dimming case */
-							else {
-								errno = 0;
-								int dim_value = strtol(ptr, NULL, 10);
-								if( *(ptr+strlen(ptr)-1)=='\%' ) {
-									dim_value = (16 * dim_value) / 100;
-								}
-								if (errno != 0 || dim_value < 0 || dim_value > 16) {
-									cmd = -2;
-									errormsg = seterror("Wrong dim level (must be within 0-16 or 0\%-100\%)");
-									fcmdok = false;
-								}
-								else {
-									cmd = 0x01 * dim_value;
-								}
-							}
-							if (cmd >= 0) {
-								usbcmd[0] = 0x01;
-								usbcmd[1] = (unsigned char) (housecode >> 8);   /* Housecode high byte */
-								usbcmd[2] = (unsigned char) (housecode & 0xff); /* Housecode low byte */
-								usbcmd[3] = addr;
-								usbcmd[4] = cmd;
-								usbcmd[6] = 0x03;
-								if( usb_send(dev_handle, (unsigned char *)usbcmd, false) != EXIT_SUCCESS ) {
-									errormsg = seterror("USB communication error");
-									fcmdok = false;
-								}
-							}
-							else if (cmd == -1 ) {
-								errormsg = seterror("unknown <cmd> parameter '%s'", ptr);
-								fcmdok = false;
-							}
-						}
-						else {
-							errormsg = seterror("missing <cmd> parameter");
-							fcmdok = false;
-						}
-					}
-					else {
-						errormsg = seterror("%s: wrong <addr> parameter", ptr);
-						fcmdok = false;
-					}
-				}
-				else {
-					errormsg = seterror("missing <addr> parameter");
-					fcmdok = false;
+			else if (cmdcompare(ptr, "FORMAT") == 0) {
+				/* next token: JSON|TEXT, the reply is already in the new format */
+		 		ptr = strtok_r(NULL, tok_delimiter, &saveptr);
+				if( ptr != NULL && cmdcompare(ptr, "JSON") == 0 ) {
+					session->json = true;
 				}
-		 	}
-			/* Uniroll devices */
-			else if (cmdcompare(ptr, "UNI") == 0) {
-				int addr;
-				int cmd = -1;
-
-				/* next token: addr */
-		 		ptr = strtok(NULL, tok_delimiter);
-		 		if( ptr!=NULL ) {
-					errno = 0;
-					int addr = strtol(ptr, NULL, 10);
-					if (errno == 0 && addr >=1 && addr <= 16) {
-						/* next token: cmd */
-				 		ptr = strtok(NULL, tok_delimiter);
-				 		if( ptr!=NULL ) {
-							if (cmdcompare(ptr, "STOP") == 0) {
-								cmd = 0x02;
-							} else if (cmdcompare(ptr, "UP") == 0 || cmdcompare(ptr, "+") == 0 ) {
-								cmd = 0x01;
-							} else if (cmdcompare(ptr, "DOWN") == 0 || cmdcompare(ptr, "-") == 0 ) {
-								cmd = 0x04;
-							}
-							if (cmd >= 0) {
-								/* 15 jj 74 cc 00 00 00 00 */
-								usbcmd[0] = 0x15;
-								usbcmd[1] = addr-1;
-								usbcmd[2] = 0x74;
-								usbcmd[3] = cmd;
-								if( usb_send(dev_handle, (unsigned char *)usbcmd, false) != EXIT_SUCCESS ) {
-									errormsg = seterror("USB communication error");
-									fcmdok = false;
-								}
-							}
-							else {
-								errormsg = seterror("wrong <cmd> parameter '%s'", ptr);
-								fcmdok = false;
-							}
-						}
-						else {
-							errormsg = seterror("missing <cmd> parameter");
-							fcmdok = false;
-						}
-					}
-					else {
-						errormsg = seterror("%s: wrong <addr> parameter", ptr);
-						fcmdok = false;
-					}
+				else if( ptr != NULL && cmdcompare(ptr, "TEXT") == 0 ) {
+					session->json = false;
 				}
 				else {
-					errormsg = seterror("missing <addr> parameter");
+					errormsg = seterror("wrong parameter, use JSON or TEXT");
 					fcmdok = false;
 				}
-		 	}
-			/* IKEA devices */
-			else if (cmdcompare(ptr, "IKEA") == 0 || cmdcompare(ptr, "KOPPLA") == 0) {
-				int code;
-				int addr;
-				int cmd = -1;
-
-				/* next token: code */
-		 		ptr = strtok(NULL, tok_delimiter);
-		 		if( ptr!=NULL ) {
-					errno = 0;
-					int code = strtol(ptr, NULL, 10);
-						code--;
-						if(errno == 0 && code >= 0 && code <= 15) {
-		 				/* next token: addr */
-				 		ptr = strtok(NULL, tok_delimiter);
-				 		if( ptr!=NULL ) {
-							errno = 0;
-							int addr = strtol(ptr, NULL, 10);
-							if (errno == 0 && addr >= 1 && addr <= 10) {
-								if (addr == 10){
-									addr = 0;
-								}
-								/* next token: cmd */
-						 		ptr = strtok(NULL, tok_delimiter);
-						 		if( ptr!=NULL ) {
-						 			int maincmd = 0x00;
-									if (cmdcompare(ptr, "ON") == 0 || cmdcompare(ptr, "UP") == 0 ) {
-										cmd = 0x30;
-									} else if (cmdcompare(ptr, "OFF") == 0 || cmdcompare(ptr, "DOWN") == 0 ) {
-										cmd = 0x3A;
-									} else if (cmdcompare(ptr, "TOGGLE") == 0 ) {
-										cmd = 0x1F;
-									} else if (cmdcompare(ptr, "BRIGHT") == 0 || cmdcompare(ptr, "+") == 0 ) {
-										cmd = 0x00;
-									} else if (cmdcompare(ptr, "DARK") == 0 || cmdcompare(ptr, "-") == 0 ) {
-										cmd = 0x40;
-									} else if (cmdcompare(ptr, "SLOW") == 0  || cmdcompare(ptr, "GRADUAL") == 0 ){
-										cmd = 0x30; // command for slow dimming mode (gradual dimming)
-									} else if (cmdcompare(ptr, "FAST") == 0  || cmdcompare(ptr, "INSTANT") == 0 ){
-										cmd = 0x10; // command for fast dimming mode (instant dimming)
-									}
-									/* dimming case */
-									/* next token: dimming value */ // dim level 0-90% in steps of 10%
-									ptr = strtok(NULL, tok_delimiter);
-									if( ptr!=NULL ) {
-										errno = 0;
-										int dim_value = strtol(ptr, NULL, 10);
-											if( *(ptr+strlen(ptr)-1)=='\%' ) {
-												dim_value = (10 * dim_value) / 100;
-											}
-											if (errno != 0 || dim_value < 0 || dim_value > 9) { //if (errno != 0 || dim_value < 0 || dim_value > 10) {
-													cmd = -2;
-													errormsg = seterror("Wrong dim level (must be within 0-90\%)");
-													fcmdok = false;
-											}
-											if (dim_value == 9) { // ON = Level 9 or 90% 
-												dim_value = 0x00; // Dim value for completely ON
-											} else if (dim_value == 0) { // OFF = Level 0 or 0%
-												dim_value = 0x0A;  // Dim value for completely OFF
-											}
-											
-											cmd = cmd * 0x01 + dim_value;
-									}
-									if (cmd >= 0) {
-										usbcmd[0] = 0x13;
-										usbcmd[1] = code  * 0x10 + addr;
-										usbcmd[2] = cmd;
-										usbcmd[3] = 0x02;
-										if( usb_send(dev_handle, (unsigned char *)usbcmd, false) != EXIT_SUCCESS ) {
-											errormsg = seterror("USB communication error");
-											fcmdok = false;
-										}
-									}
-									else {
-										errormsg = seterror("wrong <cmd> parameter '%s'", ptr);
-										fcmdok = false;
-									}
-								}
-								else {
-									errormsg = seterror("missing <cmd> parameter");
-									fcmdok = false;
-								}
-							}
-							else {
-								errormsg = seterror("%s: <addr> parameter out of range (must be within 1 to 10)", ptr);
-								fcmdok = false;
-							}
-						}
-						else {
-							errormsg = seterror("missing <addr> parameter");
-							fcmdok = false;
-						}
-					}
-					else {
-						errormsg = seterror("<code> parameter out of range (must be within '1' to '16')");
-						fcmdok = false;
-					}
+				flags = session->json ? (flags & ~HANDLE_INPUT_HTML) | HANDLE_INPUT_JSON : (flags & ~HANDLE_INPUT_JSON);
+			}
+			/* Device commands */
+			else if( (rc = encode_command(original, frames, EXPAND_MAX_FRAMES, &errormsg)) != 0 ) {
+				if( session->pipeline.active ) {
+					/* replied by pipeline_finish() */
+					pipeline_submit(session, socket_handle, (cmdexec != NULL) ? cmdexec : "<unknown>", frames, rc,
+									(rc > 0) ? NULL : ((errormsg != NULL) ? errormsg : "<unknown>"));
+					replied = true;
 				}
-				else {
-					errormsg = seterror("missing <code> parameter");
+				else if( rc < 0 ) {
 					fcmdok = false;
 				}
-		 	}
-			/* InterTechno devices */
-			else if (cmdcompare(ptr, "IT") == 0 || cmdcompare(ptr, "InterTechno") == 0) {
-				int code;
-				int addr;
-				int learn;
-				int cmd = -1;
-
-				/* next token: code */
-		 		ptr = strtok(NULL, tok_delimiter);
-		 		if( ptr!=NULL ) {
-		 			if( toupper(*ptr)>='A' && toupper(*ptr)<='Z' ) {
-		 				code = toupper(*ptr) - 'A';
-						/* next token: addr */
-				 		ptr = strtok(NULL, tok_delimiter);
-				 		if( ptr!=NULL ) {
-							errno = 0;
-							int addr = strtol(ptr, NULL, 10);
-							if (errno == 0 && addr >=1 && addr <= 16) {
-								/* next token: learn */
-						 		ptr = strtok(NULL, tok_delimiter);
-						 		if( ptr!=NULL ) {
-									errno = 0;
-									if (cmdcompare(ptr, "LEARN") == 0 ) {
-										learn = 0x01;
-									} else if (cmdcompare(ptr, "DIP") == 0 ) {
-										learn = 0x00;
-									}
-										/* next token: cmd */
-										ptr = strtok(NULL, tok_delimiter);
-										if( ptr!=NULL ) {
-											int maincmd = 0x06; /*	0x06 default for all commands except dim
-																	0x05 for dim, then cmd is the dim level (0-250) */
-											if (cmdcompare(ptr, "ON") == 0 || cmdcompare(ptr, "UP") == 0  || cmdcompare(ptr, "OPEN") == 0) {
-												cmd = 0x01;
-											} else if (cmdcompare(ptr, "OFF") == 0 || cmdcompare(ptr, "DOWN") == 0  || cmdcompare(ptr, "CLOSE") == 0) {
-												cmd = 0x00;
-											} else if (cmdcompare(ptr, "TOGGLE") == 0 ) {
-												cmd = 0x02;
-											} else if (cmdcompare(ptr, "BRIGHT") == 0 || cmdcompare(ptr, "+") == 0 ) {
-												cmd = 0x05;
-											} else if (cmdcompare(ptr, "DARK") == 0 || cmdcompare(ptr, "-") == 0 ) {
-												cmd = 0x06;
-											}
-											/* dimming case */
-											else {
-												errno = 0;
-												maincmd = 0x05;
-												int dim_value = strtol(ptr, NULL, 10);
-												/* dim value are the 4 msb, dim command has also bit 3 set (0x08)
-												 * dim cmd is build on binary 
-												 * xxxx1000 where xxxx are the dimming value 0-15
-												 */
-												if( *(ptr+strlen(ptr)-1)=='\%' ) {
-													dim_value = (248 * dim_value) / 100;
-													cmd = (( ((15 * dim_value) / 100) & 0x0f)<<4) | 0x08;
-												}
-												if (errno != 0 || dim_value < 0 || dim_value > 15) {
-													cmd = -2;
-													errormsg = seterror("Wrong dim level (must be within 0-15 or 0\%-100\%)");
-													fcmdok = false;
-												}
-												else {
-													cmd = ((dim_value & 0x0f)<<4) | 0x08;
-												}
-											}
-											if (cmd >= 0) {
-												usbcmd[0] = 0x05;
-												usbcmd[1] = code * 0x10 + (addr - 1);
-												usbcmd[2] = cmd;
-												usbcmd[3] = maincmd;
-												usbcmd[4] = learn; // 0x01 flag for code learning devices, 0x00 flag for standard devices (DIP-switches) */
-												if( usb_send(dev_handle, (unsigned char *)usbcmd, false) != EXIT_SUCCESS ) {
-													errormsg = seterror("USB communication error");
-													fcmdok = false;
-												}
-											}
-											else {
-												errormsg = seterror("wrong <cmd> parameter '%s'", ptr);
-												fcmdok = false;
-											}
-										}
-										else {
-											errormsg = seterror("missing <cmd> parameter");
-											fcmdok = false;
-										}
-									}
-									else {
-										errormsg = seterror("missing <learn> parameter");
-										fcmdok = false;
-									}
-								}
-							else {
-								errormsg = seterror("%s: <addr> parameter out of range (must be within 1 to 16)", ptr);
-								fcmdok = false;
-							}
-						}
-						else {
-							errormsg = seterror("missing <addr> parameter");
-							fcmdok = false;
-						}
-					}
-					else {
-						errormsg = seterror("<code> parameter out of range (must be within 'A' to 'P')");
-						fcmdok = false;
-					}
-				}
-				else {
-					errormsg = seterror("missing <code> parameter");
+				else if( (rc = admit_submit(frames, rc, NULL, &errormsg)) < 0 ) {
 					fcmdok = false;
+					busy = true;
 				}
-			}
-		 	/* Scene commands */
-			else if (cmdcompare(ptr, "SCENE") == 0) {
-				long int scene;
-
-		 		ptr = strtok(NULL, tok_delimiter);
-				if( ptr != NULL ) {
-					scene = strtol(ptr, NULL, 10);
-					if( scene >= 1 && scene<=254 ) {
-						usbcmd[0] = 0x0f;
-						usbcmd[1] = 0x01 * scene;
-						if( usb_send(dev_handle, (unsigned char *)usbcmd, false) != EXIT_SUCCESS ) {
-							errormsg = seterror("USB communication error");
-							fcmdok = false;
-						}
-					}
-					else {
-						errormsg = seterror("parameter <s> out of range (must be within range 1-254)");
-						fcmdok = false;
-					}
-				}
-				else {
-					errormsg = seterror("missing parameter");
+				else if( rc != 0 ) {
+					errormsg = seterror("USB communication error (%d frames not sent)", rc);
 					fcmdok = false;
 				}
-		 	}
+			}
 		 	/* Get commands */
 			else if (cmdcompare(ptr, "GET") == 0) {
 				/* next token GET device */
-		 		ptr = strtok(NULL, tok_delimiter);
+		 		ptr = strtok_r(NULL, tok_delimiter, &saveptr);
 		 		if( ptr!=NULL ) {
 					if (cmdcompare(ptr, "CLOCK") == 0 ||
 						cmdcompare(ptr, "TIME") == 0) {
-						struct tm * currenttime;
+						struct tm currenttime;
 						time_t devtime;
+						char buf[32];
 
-						devtime = get_time(dev_handle);
-						if( devtime == -1 ) {
+						if( clock_device(dev_handle, &devtime) != EXIT_SUCCESS ) {
 							errormsg = seterror("USB communication error");
 							fcmdok = false;
 						}
 						else {
-							currenttime = localtime(&devtime);
-							write_to_client(socket_handle, flags, "%s\r\n", asctime(currenttime) );
+							gmtime_r(&devtime, &currenttime);
+							write_to_client(socket_handle, flags, "%s\r\n", asctime_r(&currenttime, buf) );
 						}
 					} else if ( cmdcompare(ptr, "TEMP") == 0 || cmdcompare(ptr, "TEMPERATURE") == 0 ) {
-						usbcmd[0] = 0x0c;
-						if( usb_send(dev_handle, (unsigned char *)usbcmd, true) != EXIT_SUCCESS ) {
-							errormsg = seterror("USB communication error");
-							fcmdok = false;
+						const char *unit = (flags & HANDLE_INPUT_HTML)?" \xb0""C":"";
+						int value;
+
+						/* next token: history query (optional) */
+				 		ptr = strtok_r(NULL, tok_delimiter, &saveptr);
+						if( ptr == NULL ) {
+							if( temp_read(dev_handle, &value) != EXIT_SUCCESS ) {
+								errormsg = seterror("USB communication error");
+								fcmdok = false;
+							}
+							else {
+								write_to_client(socket_handle, flags, "%.1f%s\r\n", (float)value/2, unit);
+							}
+						}
+						else if( cmdcompare(ptr, "HISTORY") == 0 ) {
+							struct temp_ring *ring = &temp_rings[1];
+							long window = TEMP_WINDOW;
+
+							/* next tokens: resolution and window (both optional) */
+					 		while( fcmdok && (ptr = strtok_r(NULL, tok_delimiter, &saveptr)) != NULL ) {
+								if( cmdcompare(ptr, "RAW") == 0 ) {
+									ring = &temp_rings[0];
+								} else if( cmdcompare(ptr, "MINUTE") == 0 ) {
+									ring = &temp_rings[1];
+								} else if( cmdcompare(ptr, "HOUR") == 0 ) {
+									ring = &temp_rings[2];
+								} else if( (window = parse_duration(ptr)) < 0 ) {
+									errormsg = seterror("wrong window '%s' (e.g. 90s, 15m, 2h, 7d)", ptr);
+									fcmdok = false;
+								}
+							}
+							if( fcmdok ) {
+								temp_history(socket_handle, flags, ring, window);
+							}
+						}
+						else if( cmdcompare(ptr, "MIN") == 0 || cmdcompare(ptr, "MAX") == 0 || cmdcompare(ptr, "AVG") == 0 ) {
+							char *what = ptr;
+							long window = TEMP_WINDOW;
+							int min, max;
+							double avg;
+
+							/* next token: window (optional) */
+					 		ptr = strtok_r(NULL, tok_delimiter, &saveptr);
+							if( ptr != NULL && (window = parse_duration(ptr)) < 0 ) {
+								errormsg = seterror("wrong window '%s' (e.g. 90s, 15m, 2h, 7d)", ptr);
+								fcmdok = false;
+							}
+							else if( temp_query(window, &min, &max, &avg) == 0 ) {
+								errormsg = seterror("no temperature samples within the last %ld s%s", window,
+													(tempperiod == 0) ? " (sampling is off, see -T)" : "");
+								fcmdok = false;
+							}
+							else {
+								write_to_client(socket_handle, flags, "%.1f%s\r\n",
+									(cmdcompare(what, "MIN") == 0) ? (double)min/2 : (cmdcompare(what, "MAX") == 0) ? (double)max/2 : avg/2, unit);
+							}
 						}
-						else if( usbcmd[0]==0xfd ) {
-							write_to_client(socket_handle, flags, "%.1f%s\r\n", (float)usbcmd[1]/2, (flags & HANDLE_INPUT_HTML)?" &deg;C":"");
+						else {
+							errormsg = seterror("unknown parameter '%s'", ptr);
+							fcmdok = false;
 						}
+					} else if (cmdcompare(ptr, "STATE") == 0 || cmdcompare(ptr, "STATES") == 0 ) {
+						state_list(socket_handle, flags);
 					} else if (cmdcompare(ptr, "HOUSECODE") == 0 ) {
 						char buf[64];
 						write_to_client(socket_handle, flags, "%s\r\n", itofs20(buf, housecode, NULL));
+					} else if (cmdcompare(ptr, "STATS") == 0 || cmdcompare(ptr, "STATISTICS") == 0 ) {
+						char stats[MSG_BUFFER_MAXLEN];
+
+						lm_stats(dev_handle, stats, sizeof(stats));
+						write_to_client(socket_handle, flags, "%s", stats);
+						alias_stats(socket_handle, flags);
+						temp_stats(socket_handle, flags);
+						clock_stats(socket_handle, flags);
+						timing_stats(socket_handle, flags);
+						arena_stats(socket_handle, flags);
+						journal_stats(socket_handle, flags);
+						limits_stats(socket_handle, flags);
+						tcp_server_stats(socket_handle, flags);
+						mqtt_stats(socket_handle, flags);
 					}
 					else {
 						errormsg = seterror("unknown parameter '%s'", ptr);
@@ -1543,7 +3096,7 @@ int handle_input(char* input, libusb_device_handle* dev_handle, int socket_handl
 		 	}
 		 	/* Set commands */
 			else if (cmdcompare(ptr, "SET") == 0) {
-		 		ptr = strtok(NULL, tok_delimiter);
+		 		ptr = strtok_r(NULL, tok_delimiter, &saveptr);
 		 		/* next token SET device */
 		 		if( ptr!=NULL ) {
 					if (cmdcompare(ptr, "CLOCK") == 0 ||
@@ -1551,13 +3104,14 @@ int handle_input(char* input, libusb_device_handle* dev_handle, int socket_handl
 					  	time_t now;
 					  	struct tm * currenttime;
 						struct tm timeinfo;
+						bool fset = true;
 
 				        time(&now);
 				        currenttime = localtime(&now);
 				        memcpy(&timeinfo, currenttime, sizeof(timeinfo));
 
 				        /* next token new time (optional) */
-				 		ptr = strtok(NULL, tok_delimiter);
+				 		ptr = strtok_r(NULL, tok_delimiter, &saveptr);
 				 		if( ptr!=NULL ) {
 							switch( strlen(ptr) ) {
 								case 8:		/* MMDDhhmm */
@@ -1582,35 +3136,14 @@ int handle_input(char* input, libusb_device_handle* dev_handle, int socket_handl
 									if ( (strlen(ptr)==4 && cmdcompare(ptr, "AUTO") == 0) ||
 										 (strlen(ptr)==14 && cmdcompare(ptr, "AUTOCORRECTION") == 0) ) {
 
-										/* First check if some hour transition is done by device */
-										timeinfo.tm_sec = 0;
-							 			if( set_time(dev_handle, &timeinfo) != 0 ) {
+										/* Only written if off by more than the threshold,
+										   an hour shift done by the device is compensated */
+										fset = false;
+										clock_resume();
+										if( clock_sync(dev_handle, false) != EXIT_SUCCESS ) {
 											errormsg = seterror("USB communication error");
 											fcmdok = false;
 										}
-										else {
-											/* Read back time set */
-											time_t devtime;
-											devtime = get_time(dev_handle);
-											if( devtime == -1 ) {
-												errormsg = seterror("USB communication error");
-												fcmdok = false;
-											}
-											else {
-												int diff;
-												/* Compare hour of time set with hour of time returned */
-												currenttime = localtime(&devtime);
-												diff = (timeinfo.tm_hour-currenttime->tm_hour);
-												debug(LOG_DEBUG, "Device timestamp hour diff: %d", diff );
-										        time(&now);
-										        currenttime = localtime(&now);
-												if( diff != 0 ) {
-											        currenttime->tm_hour += diff;
-													debug(LOG_DEBUG, "Hour corrected to %02d", currenttime->tm_hour);
-												}
-										        memcpy(&timeinfo, currenttime, sizeof(timeinfo));
-											}
-										}
 									}
 									else {
 										errormsg = seterror("wrong parameter, use time format 'MMDDhhmm[[CC]YY][.ss]' or keyword 'AUTO'");
@@ -1619,16 +3152,18 @@ int handle_input(char* input, libusb_device_handle* dev_handle, int socket_handl
 									break;
 							}
 				 		}
-				 		if( fcmdok == true ) {
-				 			if( set_time(dev_handle, &timeinfo) != 0 ) {
+				 		if( fcmdok == true && fset == true ) {
+				 			if( lm_set_clock(dev_handle, &timeinfo) != LM_OK ) {
 								errormsg = seterror("USB communication error");
 								fcmdok = false;
 							}
+							/* a user time suspends the background synchronization */
+							clock_invalidate(ptr != NULL);
 				 		}
 				 	}
 					else if (cmdcompare(ptr, "HOUSECODE") == 0 ) {
 				        /* next token new housecode */
-				 		ptr = strtok(NULL, tok_delimiter);
+				 		ptr = strtok_r(NULL, tok_delimiter, &saveptr);
 				 		if( ptr!=NULL ) {
 				 			int newhc = fs20toi(ptr, NULL);
 				 			if ( newhc>= 0 ) {
@@ -1658,7 +3193,7 @@ int handle_input(char* input, libusb_device_handle* dev_handle, int socket_handl
 			else if (cmdcompare(ptr, "WAIT") == 0) {
 				long int ms;
 
-		 		ptr = strtok(NULL, tok_delimiter);
+		 		ptr = strtok_r(NULL, tok_delimiter, &saveptr);
 				if( ptr != NULL ) {
 					ms = strtol(ptr, NULL, 10);
 					usleep(ms*1000L);
@@ -1668,6 +3203,87 @@ int handle_input(char* input, libusb_device_handle* dev_handle, int socket_handl
 					fcmdok = false;
 				}
 		 	}
+			else if (cmdcompare(ptr, "SUBSCRIBE") == 0) {
+				int types = EVENT_ALL;
+
+				/* next token: event type (optional) */
+		 		ptr = strtok_r(NULL, tok_delimiter, &saveptr);
+				if( ptr != NULL && cmdcompare(ptr, "STATE") == 0 ) {
+					types = EVENT_STATE;
+				}
+				else if( ptr != NULL && (cmdcompare(ptr, "TEMP") == 0 || cmdcompare(ptr, "TEMPERATURE") == 0) ) {
+					types = EVENT_TEMP;
+				}
+				else if( ptr != NULL && cmdcompare(ptr, "ALL") != 0 ) {
+					errormsg = seterror("unknown parameter '%s'", ptr);
+					fcmdok = false;
+				}
+				if( fcmdok && (flags & HANDLE_INPUT_HTML) ) {
+					errormsg = seterror("use http://<server>/events for HTTP clients");
+					fcmdok = false;
+				}
+				/* events are streamed to a client, not to the command line (-c) */
+				if( fcmdok && socket_handle <= 0 ) {
+					errormsg = seterror("SUBSCRIBE needs a client connection");
+					fcmdok = false;
+				}
+				if( fcmdok ) {
+					/* confirm before streaming, any client input ends the subscription */
+					if( flags & HANDLE_INPUT_JSON ) {
+						json_close(socket_handle, "OK", NULL);
+					}
+					else {
+						write_to_client(socket_handle, flags, "%s: OK\r\n", (cmdexec != NULL)?cmdexec:"SUBSCRIBE");
+					}
+					replied = true;
+					session->timing.received = 0;
+					if( out_flush(&session->out) < 0 ) {
+						return -1;
+					}
+					/* further commands of the line are input as well and end it right away */
+					if( (i >= MAX_CMDS || cmds[i] == NULL) && event_stream(socket_handle, &session->reader, types, false, 0) < 0 ) {
+						return -1;
+					}
+				}
+			}
+			else if (cmdcompare(ptr, "TIMING") == 0) {
+				/* next token: ON|OFF */
+		 		ptr = strtok_r(NULL, tok_delimiter, &saveptr);
+				if( ptr != NULL && cmdcompare(ptr, "ON") == 0 ) {
+					session->timing.report = true;
+				}
+				else if( ptr != NULL && cmdcompare(ptr, "OFF") == 0 ) {
+					session->timing.report = false;
+				}
+				else {
+					errormsg = seterror("wrong parameter, use ON or OFF");
+					fcmdok = false;
+				}
+			}
+			else if (cmdcompare(ptr, "PIPELINE") == 0) {
+				/* next token: ON|OFF, commands in flight are already answered */
+		 		ptr = strtok_r(NULL, tok_delimiter, &saveptr);
+				if( (flags & HANDLE_INPUT_HTML) || session->out.jsonarray ) {
+					errormsg = seterror("not available for HTTP clients");
+					fcmdok = false;
+				}
+				else if( ptr != NULL && cmdcompare(ptr, "ON") == 0 ) {
+					if( pipeline_init(&session->pipeline, limits.line) != EXIT_SUCCESS ) {
+						errormsg = seterror("out of memory");
+						fcmdok = false;
+					}
+					else {
+						session->pipeline.active = true;
+					}
+				}
+				else if( ptr != NULL && cmdcompare(ptr, "OFF") == 0 ) {
+					session->pipeline.active = false;
+				}
+				else {
+					errormsg = seterror("wrong parameter, use ON or OFF");
+					fcmdok = false;
+				}
+			}
 			else if (cmdcompare(ptr, "QUIT") == 0 || cmdcompare(ptr, "Q") == 0) {
 				debug(LOG_DEBUG, "Client QUIT requested");
 				return -1; //exit
@@ -1677,112 +3293,3385 @@ int handle_input(char* input, libusb_device_handle* dev_handle, int socket_handl
 				return -2; //end
 			}
 			else {
-				errormsg = seterror("unknown command '%s'", ptr);
-				fcmdok = false;
+				errormsg = seterror("unknown command '%s'", ptr);
+				fcmdok = false;
+			}
+		}
+
+		/* Output executed command, in JSON always as one object per command */
+		if( (flags & HANDLE_INPUT_JSON) && !replied ) {
+			json_close(socket_handle, queued ? "QUEUED" : (fcmdok ? "OK" : (busy ? "BUSY" : "ERROR")), fcmdok ? NULL : ((errormsg != NULL) ? errormsg : "<unknown>"));
+		}
+		else if( !queued && !replied && !quiet && (flags & HANDLE_INPUT_NOOK)==0 ) {
+			/* Output status */
+			write_to_client(socket_handle, flags, "%s%s: %s%s\r\n", session->pipeline.prefix, (cmdexec != NULL)?cmdexec:"<unknown>", (fcmdok)?"OK":(busy ? "BUSY - " : "ERROR - "), (fcmdok)?"":((errormsg != NULL)?errormsg:"<unknown>") );
+		}
+		/* send the reply before the next command, which may take a while */
+		if( i<MAX_CMDS && cmds[i]!=NULL ) {
+			out_flush(&session->out);
+		}
+	}
+
+	return 0;
+}
+
+
+/* ======================================================================== */
+/* REST routes */
+/* ======================================================================== */
+
+/* Reason phrase of HTTP <status> */
+const char *http_reason(int status)
+{
+	switch( status ) {
+		case 200: return "OK";
+		case 400: return "Bad Request";
+		case 404: return "Not Found";
+		case 405: return "Method Not Allowed";
+		case 500: return "Internal Server Error";
+		case 503: return "Service Unavailable";
+		default:  return "Error";
+	}
+}
+
+/* 	Add the route <pattern> for <method> to the trie, a segment "{name}"
+	matches any segment and passes it as parameter to <handler>.
+	returns EXIT_SUCCESS or EXIT_FAILURE if the node pool is exhausted */
+int route_add(int method, const char *pattern, route_fn handler)
+{
+	struct route_node *node = &route_nodes[0];
+	const char *seg = pattern;
+
+	if( route_count == 0 ) {
+		route_count = 1;			/* root */
+	}
+	while( *seg ) {
+		struct route_node *child;
+		size_t len;
+		bool param;
+
+		while( *seg == '/' ) {
+			seg++;
+		}
+		if( *seg == '\0' ) {
+			break;
+		}
+		len = strcspn(seg, "/");
+		param = (*seg == '{');
+		for(child = node->child; child != NULL; child = child->next) {
+			if( param ? child->segment == NULL : (child->segment != NULL && strlen(child->segment) == len && strncmp(child->segment, seg, len) == 0) ) {
+				break;
+			}
+		}
+		if( child == NULL ) {
+			if( route_count >= ROUTE_MAX_NODES || (!param && len >= sizeof(child->name)) ) {
+				return EXIT_FAILURE;
+			}
+			child = &route_nodes[route_count++];
+			if( !param ) {
+				memcpy(child->name, seg, len);
+				child->segment = child->name;
+				child->next = node->child;
+				node->child = child;
+			}
+			else {
+				/* literals first, the parameter is only taken if no literal matches */
+				struct route_node **last = &node->child;
+
+				while( *last != NULL ) {
+					last = &(*last)->next;
+				}
+				*last = child;
+			}
+		}
+		node = child;
+		seg += len;
+	}
+	node->handler[method] = handler;
+	return EXIT_SUCCESS;
+}
+
+/* Build the route trie, called once at startup */
+void route_init(void)
+{
+	static const struct {
+		int method;
+		const char *pattern;
+		route_fn handler;
+	} routes[] = {
+		{ METHOD_GET,  "/api/temp",                    route_temp  },
+		{ METHOD_GET,  "/api/state",                   route_state },
+		{ METHOD_POST, "/api/fs20/{addr}/{action}",    route_fs20  },
+		{ METHOD_POST, "/api/it/{code}/{ch}",          route_it    },
+		{ METHOD_POST, "/api/it/{code}/{ch}/{action}", route_it    },
+	};
+	size_t i;
+
+	for(i=0; i<sizeof(routes)/sizeof(routes[0]); i++) {
+		if( route_add(routes[i].method, routes[i].pattern, routes[i].handler) != EXIT_SUCCESS ) {
+			debug(LOG_ERR, "Route '%s' not added, increase ROUTE_MAX_NODES", routes[i].pattern);
+		}
+	}
+}
+
+/* 	Writes the JSON response {"status":..,"error":..} with HTTP <status>,
+	<error> is NULL on success */
+void route_reply(int socket_handle, int status, const char *error)
+{
+	request_header(socket_handle, status, http_reason(status), "application/json", NULL);
+	if( error == NULL ) {
+		write_to_client(socket_handle, 0, "{\"status\":\"OK\",\"error\":null}\r\n");
+	}
+	else if( thread_out != NULL ) {
+		write_to_client(socket_handle, 0, "{\"status\":\"ERROR\",\"error\":\"");
+		out_json(thread_out, error, strlen(error));
+		write_to_client(socket_handle, 0, "\"}\r\n");
+	}
+}
+
+/* 	Match the request <path> (modified) against the route trie and run its
+	handler. Unknown paths get 404, known paths without a handler for
+	<method> 405. returns -3 like handle_input() for HTTP requests */
+int route_dispatch(int socket_handle, int method, char *path, const char *body)
+{
+	struct route_node *node = &route_nodes[0];
+	struct route_request req;
+	char *errormsg = NULL;
+	char *saveptr;
+	char *seg;
+	int status;
+
+	memset(&req, 0, sizeof(req));
+	req.method = method;
+	req.body = body;
+	if( (req.query = strchr(path, '?')) != NULL ) {
+		*req.query++ = '\0';
+	}
+	if( (path = url_decode(path)) == NULL ) {
+		route_reply(socket_handle, 500, "out of memory");
+		return -3;
+	}
+	for(seg = strtok_r(path, "/", &saveptr); seg != NULL && node != NULL; seg = strtok_r(NULL, "/", &saveptr)) {
+		struct route_node *child;
+
+		for(child = node->child; child != NULL; child = child->next) {
+			if( child->segment == NULL ) {
+				if( req.nparams >= ROUTE_MAX_PARAMS ) {
+					child = NULL;
+				}
+				else {
+					req.params[req.nparams++] = seg;
+				}
+				break;
+			}
+			if( strcmp(child->segment, seg) == 0 ) {
+				break;
+			}
+		}
+		node = child;
+	}
+	if( node == NULL || (node->handler[METHOD_GET] == NULL && node->handler[METHOD_POST] == NULL) ) {
+		route_reply(socket_handle, 404, "no such resource");
+		return -3;
+	}
+	if( node->handler[method] == NULL ) {
+		route_reply(socket_handle, 405, (method == METHOD_GET) ? "use POST" : "use GET");
+		return -3;
+	}
+	if( (status = node->handler[method](socket_handle, &req, &errormsg)) != 0 ) {
+		route_reply(socket_handle, status, (errormsg != NULL) ? errormsg : http_reason(status));
+	}
+	return -3;
+}
+
+/* GET /api/temp: current device temperature */
+int route_temp(int socket_handle, struct route_request *req, char **errormsg)
+{
+	int value;
+
+	if( temp_read(dev_handle, &value) != EXIT_SUCCESS ) {
+		*errormsg = seterror("USB communication error");
+		return 500;
+	}
+	request_header(socket_handle, 200, "OK", "application/json", NULL);
+	write_to_client(socket_handle, 0, "{\"temp\":%.1f,\"time\":%ld}\r\n", (float)value/2, (long)time(NULL));
+	return 0;
+}
+
+/* GET /api/state: last state sent to each device */
+int route_state(int socket_handle, struct route_request *req, char **errormsg)
+{
+	int count = 0;
+	int i;
+
+	request_header(socket_handle, 200, "OK", "application/json", NULL);
+	write_to_client(socket_handle, 0, "[");
+	pthread_mutex_lock(&mutex_state);
+	for(i=0; i<STATE_MAX_DEVICES; i++) {
+		if( states[i].key != 0 ) {
+			write_to_client(socket_handle, 0, "%s{\"device\":\"%s\",\"state\":\"%s\",\"changed\":%ld}",
+							(count++ > 0) ? ",\r\n" : "", states[i].device, states[i].state, (long)states[i].changed);
+		}
+	}
+	pthread_mutex_unlock(&mutex_state);
+	write_to_client(socket_handle, 0, "]\r\n");
+	return 0;
+}
+
+/* 	Encode and send one frame, <action> is a verb or dim level.
+	returns 0 if sent, otherwise the HTTP status */
+int route_send(int socket_handle, enum lm_protocol protocol, unsigned long addr, const char *action, char **errormsg)
+{
+	unsigned char frame[1][8];
+	int act;
+	int value = -1;
+	int rc;
+
+	if( action == NULL || !parse_action(action, &act, &value) ) {
+		*errormsg = seterror("unknown action '%s'", (action != NULL) ? action : "");
+		return 400;
+	}
+	if( (rc = lm_encode(protocol, addr, act, value, frame[0])) != LM_OK ) {
+		*errormsg = seterror("action '%s': %s", action, lm_strerror(rc));
+		return 400;
+	}
+	if( (rc = admit_submit(frame, 1, NULL, errormsg)) < 0 ) {
+		return 503;
+	}
+	if( rc != 0 ) {
+		*errormsg = seterror("USB communication error");
+		return 500;
+	}
+	route_reply(socket_handle, 200, NULL);
+	return 0;
+}
+
+/* POST /api/fs20/{addr}/{action} */
+int route_fs20(int socket_handle, struct route_request *req, char **errormsg)
+{
+	int fs20addr;
+
+	if( strlen(req->params[0]) != 4 || strspn(req->params[0], "1234") != 4 ||
+		(fs20addr = fs20toi(req->params[0], NULL)) < 0 ) {
+		*errormsg = seterror("%s: wrong address (1111-4444)", req->params[0]);
+		return 400;
+	}
+	return route_send(socket_handle, LM_PROTO_FS20, LM_FS20_ADDR(housecode, fs20addr), req->params[1], errormsg);
+}
+
+/* 	POST /api/it/{code}/{ch}[/{action}], without {action} the request body
+	is the action. Query "learn" addresses code learning devices */
+int route_it(int socket_handle, struct route_request *req, char **errormsg)
+{
+	const char *code = req->params[0];
+	char *action = req->params[2];
+	char body[32];
+	long channel;
+	bool learn = (req->query != NULL && strstr(req->query, "learn") != NULL);
+
+	if( toupper(*code) < 'A' || toupper(*code) > 'P' || code[1] != '\0' ) {
+		*errormsg = seterror("%s: wrong code (A-P)", code);
+		return 400;
+	}
+	errno = 0;
+	channel = strtol(req->params[1], NULL, 10);
+	if( errno != 0 || channel < 1 || channel > 16 ) {
+		*errormsg = seterror("%s: wrong channel (1-16)", req->params[1]);
+		return 400;
+	}
+	if( action == NULL && req->body != NULL ) {
+		strncpy(body, req->body, sizeof(body)-1);
+		body[sizeof(body)-1] = '\0';
+		action = trim(body);
+	}
+	return route_send(socket_handle, LM_PROTO_IT, LM_IT_ADDR(toupper(*code) - 'A', channel, learn), action, errormsg);
+}
+
+
+/* ======================================================================== */
+/* Static web UI */
+/* ======================================================================== */
+
+/* Returns the embedded UI file of the request <path> or NULL */
+const struct asset *asset_find(const char *path)
+{
+	size_t len = strcspn(path, "?#");
+	size_t i;
+
+	for(i=0; i<sizeof(assets)/sizeof(assets[0]); i++) {
+		if( strlen(assets[i].path) == len && strncmp(assets[i].path, path, len) == 0 ) {
+			return &assets[i];
+		}
+	}
+	return NULL;
+}
+
+/* 	Send the embedded UI file <asset>, 304 if <ifnonematch> contains its
+	ETag. The file is stored gzip compressed, clients not accepting it
+	(<fgzip> false) get 406. returns -3 like handle_input() */
+int static_serve(int socket_handle, const struct asset *asset, const char *ifnonematch, bool fgzip)
+{
+	time_t now;
+	char date[50];
+	char cache[64] = "no-cache";
+	bool fmatch = (strstr(ifnonematch, asset->etag) != NULL || strcmp(ifnonematch, "*") == 0);
+
+	if( !fgzip && !fmatch ) {
+		request_header(socket_handle, 406, "Not Acceptable", "text/plain", NULL);
+		write_to_client(socket_handle, 0, "gzip content encoding required\r\n");
+		return -3;
+	}
+	if( asset->immutable ) {
+		snprintf(cache, sizeof(cache), "public, max-age=%d, immutable", UI_MAX_AGE);
+	}
+	time(&now);
+	strftime(date, sizeof(date), "%a %b %d %X %Y GMT", gmtime(&now));
+	write_to_client(socket_handle, 0,
+		"HTTP/1.1 %s\r\n"
+		"Date: %s\r\n"
+		"Server: %s WEB %s (build %s)\r\n"
+		"Cache-Control: %s\r\n"
+		"ETag: %s\r\n"
+		"Vary: Accept-Encoding\r\n"
+		"Connection: close\r\n"
+		,fmatch ? "304 Not Modified" : "200 OK"
+		,date
+		,PROGNAME, VERSION, BUILD
+		,cache
+		,asset->etag);
+	if( fmatch ) {
+		write_to_client(socket_handle, 0, "\r\n");
+		return -3;
+	}
+	write_to_client(socket_handle, 0,
+		"Content-Type: %s\r\n"
+		"Content-Encoding: gzip\r\n"
+		"Content-Length: %zu\r\n"
+		"\r\n"
+		,asset->contenttype, asset->size);
+	if( thread_out != NULL ) {
+		out_zerocopy(thread_out, asset->data, asset->size);
+	}
+	return -3;
+}
+
+
+/* ======================================================================== */
+/* Device aliases */
+/* ======================================================================== */
+
+/* Case insensitive FNV-1a hash of <len> chars of <name> */
+unsigned int alias_hash(const char *name, size_t len)
+{
+	unsigned int hash = 2166136261u;
+
+	while( len-- ) {
+		hash ^= (unsigned char)tolower(*name++);
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/* 	Load the alias file <filename> into a new alias table
+	File format, one alias or group per line, '#' starts a comment:
+		<name> <device command prefix>
+		<name> <alias or prefix>; <alias or prefix>[; ...]
+	e.g.
+		kitchen.ceiling  FS20 1121
+		hall.lamp        IT C 7 LEARN
+		floor1           kitchen.ceiling; hall.lamp; FS20 1211-1214
+	returns the new table or NULL on error
+*/
+struct alias_table *alias_load(const char *filename)
+{
+	struct alias_table *table;
+	char tok_delimiter[] = TOKEN_DELIMITER;
+	FILE *fp;
+	long size;
+	char *line, *next;
+	unsigned int slots;
+	unsigned int lines;
+	int lineno = 0;
+
+	if( (fp = fopen(filename, "r")) == NULL ) {
+		debug(LOG_ERR, "Cannot open alias file '%s': %s", filename, strerror(errno));
+		return NULL;
+	}
+	table = calloc(1, sizeof(*table));
+	if( table == NULL || fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0 ||
+		(table->strings = malloc(size + 1)) == NULL || fread(table->strings, 1, size, fp) != (size_t)size ) {
+		debug(LOG_ERR, "Cannot read alias file '%s'", filename);
+		fclose(fp);
+		alias_free(table);
+		return NULL;
+	}
+	fclose(fp);
+	table->strings[size] = '\0';
+
+	/* size the index for a load factor of at most 50% */
+	for(line = table->strings, lines = 1; (line = strchr(line, '\n')) != NULL; line++, lines++);
+	for(slots = 16; slots < lines * 2; slots <<= 1);
+	table->mask = slots - 1;
+	table->slots = calloc(slots, sizeof(struct alias));
+	if( table->slots == NULL ) {
+		alias_free(table);
+		return NULL;
+	}
+
+	for(line = table->strings; line != NULL; line = next) {
+		char *name, *expansion;
+		unsigned int i;
+
+		lineno++;
+		if( (next = strchr(line, '\n')) != NULL ) {
+			*next++ = '\0';
+		}
+		line[strcspn(line, "#")] = '\0';
+		name = trim(line);
+		if( *name == '\0' ) {
+			continue;
+		}
+		expansion = name + strcspn(name, tok_delimiter);
+		if( *expansion != '\0' ) {
+			*expansion++ = '\0';
+		}
+		expansion = trim(expansion);
+		if( *expansion == '\0' ) {
+			debug(LOG_ERR, "%s: %d: alias '%s' without definition", filename, lineno, name);
+			alias_free(table);
+			return NULL;
+		}
+		if( alias_lookup(table, name, strlen(name)) != NULL ) {
+			debug(LOG_WARNING, "%s: %d: alias '%s' already defined, ignored", filename, lineno, name);
+			continue;
+		}
+		table->count++;
+		if( table->count > slots / 2 ) {
+			debug(LOG_ERR, "%s: too many aliases", filename);
+			alias_free(table);
+			return NULL;
+		}
+		for(i = alias_hash(name, strlen(name)) & table->mask; table->slots[i].name != NULL; i = (i + 1) & table->mask);
+		table->slots[i].name = name;
+		table->slots[i].expansion = expansion;
+		table->slots[i].hash = alias_hash(name, strlen(name));
+	}
+
+	/* every definition member must be a device command or another alias */
+	for(slots = 0; slots <= table->mask; slots++) {
+		const char *member = table->slots[slots].expansion;
+
+		while( member != NULL && *member != '\0' ) {
+			size_t len;
+
+			member += strspn(member, tok_delimiter);
+			len = strcspn(member, tok_delimiter);
+			if( !is_device_cmd(member, len) && alias_lookup(table, member, len) == NULL ) {
+				debug(LOG_ERR, "%s: alias '%s': '%.*s' is neither a device command nor an alias",
+					  filename, table->slots[slots].name, (int)len, member);
+				alias_free(table);
+				return NULL;
+			}
+			member += strcspn(member, ";");
+			member += (*member == ';');
+		}
+	}
+	return table;
+}
+
+void alias_free(struct alias_table *table)
+{
+	if( table != NULL ) {
+		free(table->slots);
+		free(table->strings);
+		free(table);
+	}
+}
+
+/* Enter a read side critical section and return the current table (may be NULL) */
+struct alias_table *alias_read_lock(int *slot)
+{
+	*slot = atomic_load(&alias_epoch) & 1;
+	atomic_fetch_add(&alias_readers[*slot], 1);
+	return atomic_load(&alias_current);
+}
+
+void alias_read_unlock(int slot)
+{
+	atomic_fetch_sub(&alias_readers[slot], 1);
+}
+
+/* Find alias <name> of length <len> within <table>, returns NULL if not found */
+const struct alias *alias_lookup(const struct alias_table *table, const char *name, size_t len)
+{
+	unsigned int hash;
+	unsigned int i;
+
+	if( table == NULL || table->slots == NULL ) {
+		return NULL;
+	}
+	hash = alias_hash(name, len);
+	for(i = hash & table->mask; table->slots[i].name != NULL; i = (i + 1) & table->mask) {
+		if( table->slots[i].hash == hash && strnicmp(table->slots[i].name, name, len) == 0 &&
+			table->slots[i].name[len] == '\0' ) {
+			return &table->slots[i];
+		}
+	}
+	return NULL;
+}
+
+/* 	(Re)load the alias file and publish the new table. The old table is freed
+	as soon as all readers which may still use it have left, this is done by
+	waiting for both reader counters once after new readers were steered to
+	the other counter.
+	returns EXIT_SUCCESS or EXIT_FAILURE (current table stays active)
+*/
+int alias_reload(void)
+{
+	struct alias_table *table;
+	struct alias_table *old;
+	int i;
+
+	if( (table = alias_load(aliasfile)) == NULL ) {
+		return EXIT_FAILURE;
+	}
+	old = atomic_exchange(&alias_current, table);
+	for(i=0; i<2; i++) {
+		int slot = atomic_fetch_add(&alias_epoch, 1) & 1;
+
+		while( atomic_load(&alias_readers[slot]) > 0 ) {
+			usleep(1000);
+		}
+	}
+	alias_free(old);
+	alias_reloads++;
+	debug(LOG_INFO, "%u aliases loaded from '%s'", table->count, aliasfile);
+	return EXIT_SUCCESS;
+}
+
+/* Alias reload thread, woken up by SIGHUP */
+void *alias_reload_thread(void *arg)
+{
+	while(true) {
+		if( sem_wait(&alias_reload_sem) == 0 ) {
+			alias_reload();
+		}
+	}
+	return NULL;
+}
+
+void alias_sighup(int sig)
+{
+	sem_post(&alias_reload_sem);
+}
+
+/* Writes the alias table state to client */
+void alias_stats(int socket_handle, int flags)
+{
+	const struct alias_table *table;
+	int slot;
+
+	table = alias_read_lock(&slot);
+	write_to_client(socket_handle, flags, "ALIAS %u aliases, %u slots, %lu reloads\r\n",
+					(table != NULL) ? table->count : 0, (table != NULL) ? table->mask + 1 : 0, alias_reloads);
+	alias_read_unlock(slot);
+}
+
+
+/* ======================================================================== */
+/* Device state and events */
+/* ======================================================================== */
+
+/* 	Store the state set by <frame> into the state table, mutex_state must be held.
+	returns 1 if the state changed (relative commands like toggle, dim steps and
+	scenes always change it), 0 if not and -1 if the frame addresses no device
+*/
+int state_set(const unsigned char *frame, time_t changed, char *device, size_t devlen, char *state, size_t statelen)
+{
+	struct device_state *entry = NULL;
+	unsigned int key;
+	int rc;
+	int i;
+
+	if( !lm_decode(frame, &key, device, devlen, state, statelen) ) {
+		return -1;
+	}
+	for(i = (key * 2654435761u) % STATE_MAX_DEVICES; states[i].key != 0 && states[i].key != key; i = (i + 1) % STATE_MAX_DEVICES);
+	if( states[i].key == 0 && state_count < STATE_MAX_DEVICES - 1 ) {
+		entry = &states[i];
+		entry->key = key;
+		snprintf(entry->device, sizeof(entry->device), "%s", device);
+		state_count++;
+	}
+	else if( states[i].key == key ) {
+		entry = &states[i];
+	}
+	rc = (entry == NULL) || strcmp(entry->state, state) != 0 ||
+		 strcmp(state, "TOGGLE") == 0 || strcmp(state, "BRIGHT") == 0 || strcmp(state, "DARK") == 0 || frame[0] == 0x0f;
+	if( entry != NULL ) {
+		snprintf(entry->state, sizeof(entry->state), "%s", state);
+		entry->changed = changed;
+	}
+	return rc;
+}
+
+/* Record the state set by a sent <frame>, journal it and publish an event on changes */
+void state_update(const unsigned char *frame, void *arg)
+{
+	char device[sizeof(states[0].device)];
+	char state[sizeof(states[0].state)];
+	time_t now;
+	int rc;
+
+	time(&now);
+	pthread_mutex_lock(&mutex_state);
+	rc = state_set(frame, now, device, sizeof(device), state, sizeof(state));
+	if( rc >= 0 ) {
+		journal_append(frame, now);
+	}
+	pthread_mutex_unlock(&mutex_state);
+
+	if( rc > 0 ) {
+		event_publish(EVENT_STATE, "{\"device\":\"%s\",\"state\":\"%s\",\"time\":%ld}", device, state, (long)now);
+	}
+}
+
+/* Writes all known device states to client */
+void state_list(int socket_handle, int flags)
+{
+	char out[MSG_BUFFER_MAXLEN / 2];
+	int len = 0;
+	int i;
+
+	pthread_mutex_lock(&mutex_state);
+	for(i=0; i<STATE_MAX_DEVICES; i++) {
+		if( states[i].key != 0 ) {
+			char changed[32];
+
+			if( len > (int)sizeof(out) - 80 ) {
+				write_to_client(socket_handle, flags, "%s", out);
+				len = 0;
+			}
+			strftime(changed, sizeof(changed), "%Y-%m-%d %H:%M:%S", localtime(&states[i].changed));
+			len += snprintf(out + len, sizeof(out) - len, "%-20s %-12s %s\r\n", states[i].device, states[i].state, changed);
+		}
+	}
+	pthread_mutex_unlock(&mutex_state);
+	if( len > 0 ) {
+		write_to_client(socket_handle, flags, "%s", out);
+	}
+}
+
+/* Encode an event of <type> with JSON data <format> once into the ring and
+   wake up all subscribers */
+void event_publish(int type, const char *format, ...)
+{
+	struct event *ev;
+	va_list args;
+	int len;
+
+	pthread_mutex_lock(&mutex_events);
+	ev = &events[event_seq % EVENT_RING_SIZE];
+	ev->seq = event_seq;
+	ev->type = type;
+	len = snprintf(ev->data, sizeof(ev->data), "id: %lu\nevent: %s\ndata: ", ev->seq, (type == EVENT_TEMP) ? "temp" : "state");
+	ev->json = len;
+	va_start(args, format);
+	len += vsnprintf(ev->data + len, sizeof(ev->data) - len, format, args);
+	va_end(args);
+	if( len > (int)sizeof(ev->data) - 3 ) {
+		len = sizeof(ev->data) - 3;
+	}
+	ev->jsonlen = len - ev->json;
+	memcpy(ev->data + len, "\n\n", 3);
+	ev->len = len + 2;
+	event_seq++;
+	pthread_cond_broadcast(&cond_events);
+	pthread_mutex_unlock(&mutex_events);
+}
+
+/* 	Stream events of <types> to client until it disconnects or (TCP only)
+	sends new input, either into the socket or already received by
+	<reader> (may be NULL). <fsse> selects SSE framing, otherwise each
+	event is sent as line "EVENT <json>". Streaming starts after event
+	<lastid> if it is still within the ring, otherwise with the next new event.
+	returns 0 if the client sent input, -1 if the client is gone
+*/
+int event_stream(int socket_handle, const struct linereader *reader, int types, bool fsse, unsigned long lastid)
+{
+	unsigned long cursor;
+	time_t lastsend;
+
+	pthread_mutex_lock(&mutex_events);
+	cursor = (lastid > 0 && lastid < event_seq && event_seq - lastid <= EVENT_RING_SIZE) ? lastid + 1 : event_seq;
+	pthread_mutex_unlock(&mutex_events);
+	time(&lastsend);
+
+	while(true) {
+		struct event batch[16];
+		struct timespec timeout;
+		int count = 0;
+		int i;
+		char c;
+
+		/* client input or disconnect ends the stream */
+		if( !fsse && reader != NULL && line_pending(reader) ) {
+			return 0;
+		}
+		if( socket_handle != 0 ) {
+			int rc = recv(socket_handle, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+
+			if( rc == 0 || (rc < 0 && errno != EAGAIN && errno != EWOULDBLOCK) ) {
+				return -1;
+			}
+			if( rc > 0 && !fsse ) {
+				return 0;
+			}
+		}
+
+		/* copy pending events, sending happens outside of the lock */
+		pthread_mutex_lock(&mutex_events);
+		if( cursor == event_seq ) {
+			clock_gettime(CLOCK_REALTIME, &timeout);
+			timeout.tv_sec += 1;
+			pthread_cond_timedwait(&cond_events, &mutex_events, &timeout);
+		}
+		if( event_seq - cursor > EVENT_RING_SIZE ) {
+			/* subscriber too slow, skip lost events */
+			cursor = event_seq - EVENT_RING_SIZE;
+		}
+		while( cursor < event_seq && count < (int)(sizeof(batch) / sizeof(batch[0])) ) {
+			struct event *ev = &events[cursor++ % EVENT_RING_SIZE];
+
+			if( ev->type & types ) {
+				memcpy(&batch[count++], ev, sizeof(*ev));
+			}
+		}
+		pthread_mutex_unlock(&mutex_events);
+
+		for(i=0; i<count; i++) {
+			struct iovec iov[3];
+			struct msghdr msg;
+
+			memset(&msg, 0, sizeof(msg));
+			if( fsse ) {
+				iov[0].iov_base = batch[i].data;
+				iov[0].iov_len  = batch[i].len;
+				msg.msg_iovlen = 1;
+			}
+			else {
+				iov[0].iov_base = "EVENT ";
+				iov[0].iov_len  = 6;
+				iov[1].iov_base = batch[i].data + batch[i].json;
+				iov[1].iov_len  = batch[i].jsonlen;
+				iov[2].iov_base = "\r\n";
+				iov[2].iov_len  = 2;
+				msg.msg_iovlen = 3;
+			}
+			msg.msg_iov = iov;
+			if( socket_handle != 0 ) {
+				if( sendmsg(socket_handle, &msg, MSG_NOSIGNAL) < 0 ) {
+					return -1;
+				}
+			}
+			else {
+				fwrite(iov[0].iov_base, iov[0].iov_len, 1, stdout);
+				if( !fsse ) {
+					fwrite(iov[1].iov_base, iov[1].iov_len, 1, stdout);
+					fwrite(iov[2].iov_base, iov[2].iov_len, 1, stdout);
+				}
+				fflush(stdout);
+			}
+			time(&lastsend);
+		}
+
+		/* SSE comment as keep alive, detects dead clients */
+		if( fsse && time(NULL) - lastsend >= EVENT_KEEPALIVE ) {
+			if( send(socket_handle, ": keepalive\n\n", 13, MSG_NOSIGNAL) < 0 ) {
+				return -1;
+			}
+			time(&lastsend);
+		}
+	}
+	return -1;
+}
+
+
+/* ======================================================================== */
+/* Device state journal */
+/* ======================================================================== */
+
+/* Record checksum (FNV-1a), binds a record to its journal generation */
+uint32_t journal_check(uint32_t generation, const struct journal_record *rec)
+{
+	const unsigned char *p = (const unsigned char *)&rec->time;
+	uint32_t hash = 2166136261u ^ generation;
+	size_t i;
+
+	hash = (hash ^ rec->seq) * 16777619u;
+	for(i=0; i<sizeof(rec->time) + sizeof(rec->frame); i++) {
+		hash = (hash ^ p[i]) * 16777619u;
+	}
+	return hash;
+}
+
+/* 	Append a sent frame to the journal, mutex_state must be held.
+	Only writes into the mapping, flushing is left to journal_thread().
+*/
+void journal_append(const unsigned char *frame, time_t now)
+{
+	struct journal_record *rec;
+
+	if( journal == NULL ) {
+		return;
+	}
+	if( journal_head >= JOURNAL_RECORDS ) {
+		journal_dropped++;
+		return;
+	}
+	rec = &journal_records[journal_head];
+	rec->time = now;
+	memcpy(rec->frame, frame, sizeof(rec->frame));
+	rec->seq = ++journal_head;
+	rec->check = journal_check(journal->generation, rec);
+}
+
+/* 	Restart the journal as <generation> with its records from <mark> on,
+	the ones before are within the snapshot. mutex_state must be held
+*/
+void journal_rebase(uint32_t generation, int mark)
+{
+	int i;
+
+	journal->generation = generation;
+	for(i=mark; i<journal_head; i++) {
+		struct journal_record *rec = &journal_records[i - mark];
+
+		*rec = journal_records[i];
+		rec->seq = i - mark + 1;
+		rec->check = journal_check(generation, rec);
+	}
+	journal_head -= mark;
+	if( journal_head < JOURNAL_RECORDS ) {
+		journal_records[journal_head].seq = 0;
+	}
+}
+
+/* 	Load the snapshot <filename> into the state table, mutex_state must be held.
+	<covered> receives how many journal records of the previous generation
+	the snapshot contains.
+	returns EXIT_SUCCESS or EXIT_FAILURE if there is no valid snapshot
+*/
+int snapshot_load(const char *filename, uint32_t *generation, uint32_t *covered)
+{
+	struct snapshot_header header;
+	FILE *fp;
+	uint32_t i;
+
+	if( (fp = fopen(filename, "rb")) == NULL ) {
+		return EXIT_FAILURE;
+	}
+	if( fread(&header, sizeof(header), 1, fp) != 1 ||
+		memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+		header.recsize != sizeof(struct device_state) ) {
+		debug(LOG_WARNING, "Snapshot %s is invalid, ignored", filename);
+		fclose(fp);
+		return EXIT_FAILURE;
+	}
+	for(i=0; i<header.count && state_count < STATE_MAX_DEVICES - 1; i++) {
+		struct device_state entry;
+		int slot;
+
+		if( fread(&entry, sizeof(entry), 1, fp) != 1 ) {
+			break;
+		}
+		entry.device[sizeof(entry.device)-1] = '\0';
+		entry.state[sizeof(entry.state)-1] = '\0';
+		for(slot = (entry.key * 2654435761u) % STATE_MAX_DEVICES; states[slot].key != 0 && states[slot].key != entry.key; slot = (slot + 1) % STATE_MAX_DEVICES);
+		if( states[slot].key == 0 ) {
+			state_count++;
+		}
+		states[slot] = entry;
+	}
+	fclose(fp);
+	*generation = header.generation;
+	*covered = header.covered;
+	return EXIT_SUCCESS;
+}
+
+/* 	Map the journal <filename> (created if missing), restore the state table
+	from snapshot <filename>.snap plus the journal records of the same generation
+	returns EXIT_SUCCESS or EXIT_FAILURE
+*/
+int journal_open(const char *filename)
+{
+	char snapfile[sizeof(journalfile) + 8];
+	size_t size = sizeof(struct journal_header) + JOURNAL_RECORDS * sizeof(struct journal_record);
+	uint32_t generation = 0;
+	uint32_t covered = 0;
+	long long start = time_us();
+	struct stat st;
+	void *map;
+	int fd;
+
+	snprintf(snapfile, sizeof(snapfile), "%s.snap", filename);
+	if( (fd = open(filename, O_RDWR | O_CREAT, 0644)) < 0 ) {
+		debug(LOG_ERR, "Could not open journal %s (%s)", filename, strerror(errno));
+		return EXIT_FAILURE;
+	}
+	if( fstat(fd, &st) != 0 || ((size_t)st.st_size != size && ftruncate(fd, size) != 0) ) {
+		debug(LOG_ERR, "Could not size journal %s (%s)", filename, strerror(errno));
+		close(fd);
+		return EXIT_FAILURE;
+	}
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if( map == MAP_FAILED ) {
+		debug(LOG_ERR, "Could not map journal %s (%s)", filename, strerror(errno));
+		return EXIT_FAILURE;
+	}
+	journal = (struct journal_header *)map;
+	journal_records = (struct journal_record *)(journal + 1);
+
+	pthread_mutex_lock(&mutex_state);
+	snapshot_load(snapfile, &generation, &covered);
+	if( memcmp(journal->magic, JOURNAL_MAGIC, sizeof(journal->magic)) == 0 &&
+		journal->recsize == sizeof(struct journal_record) &&
+		journal->generation + 1 == generation ) {
+		/* stopped within journal_compact() after the snapshot was renamed,
+		   the records after the first <covered> ones are not within it */
+		for(journal_head = 0; journal_head < JOURNAL_RECORDS; journal_head++) {
+			struct journal_record *rec = &journal_records[journal_head];
+
+			if( rec->seq != (uint32_t)journal_head + 1 || rec->check != journal_check(journal->generation, rec) ) {
+				break;
+			}
+		}
+		debug(LOG_WARNING, "Journal %s: compaction was interrupted, %d records kept", filename,
+			  (covered < (uint32_t)journal_head) ? journal_head - (int)covered : 0);
+		journal_rebase(generation, (covered < (uint32_t)journal_head) ? (int)covered : journal_head);
+	}
+	else if( memcmp(journal->magic, JOURNAL_MAGIC, sizeof(journal->magic)) != 0 ||
+		journal->recsize != sizeof(struct journal_record) ||
+		journal->generation != generation ) {
+		/* new journal or its records are already within the snapshot */
+		memset(journal, 0, sizeof(*journal));
+		memcpy(journal->magic, JOURNAL_MAGIC, sizeof(journal->magic));
+		journal->recsize = sizeof(struct journal_record);
+		journal->generation = generation;
+		journal_records[0].seq = 0;
+	}
+	/* replay the journal tail */
+	for(journal_head = 0; journal_head < JOURNAL_RECORDS; journal_head++) {
+		struct journal_record *rec = &journal_records[journal_head];
+		char device[sizeof(states[0].device)];
+		char state[sizeof(states[0].state)];
+
+		if( rec->seq != (uint32_t)journal_head + 1 || rec->check != journal_check(generation, rec) ) {
+			break;
+		}
+		state_set(rec->frame, (time_t)rec->time, device, sizeof(device), state, sizeof(state));
+	}
+	journal_restored = state_count;
+	pthread_mutex_unlock(&mutex_state);
+	journal_restore_us = time_us() - start;
+	debug(LOG_INFO, "Journal %s: %d devices restored (generation %u, %d records) in %lld us",
+		  filename, journal_restored, generation, journal_head, journal_restore_us);
+	return EXIT_SUCCESS;
+}
+
+/* 	Write the state table into a new snapshot and restart the journal with
+	the records appended meanwhile. The snapshot is written outside of
+	mutex_state so sending is never blocked by disk I/O.
+	returns EXIT_SUCCESS or EXIT_FAILURE
+*/
+int journal_compact(void)
+{
+	static struct device_state copy[STATE_MAX_DEVICES];
+	struct snapshot_header header;
+	char snapfile[sizeof(journalfile) + 8];
+	char tmpfile[sizeof(journalfile) + 16];
+	uint32_t generation;
+	int mark;
+	int count = 0;
+	int i;
+	FILE *fp;
+
+	pthread_mutex_lock(&mutex_state);
+	for(i=0; i<STATE_MAX_DEVICES; i++) {
+		if( states[i].key != 0 ) {
+			copy[count++] = states[i];
+		}
+	}
+	mark = journal_head;
+	generation = journal->generation + 1;
+	pthread_mutex_unlock(&mutex_state);
+
+	snprintf(snapfile, sizeof(snapfile), "%s.snap", journalfile);
+	snprintf(tmpfile, sizeof(tmpfile), "%s.snap.tmp", journalfile);
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.generation = generation;
+	header.count = count;
+	header.recsize = sizeof(struct device_state);
+	header.covered = mark;
+	if( (fp = fopen(tmpfile, "wb")) == NULL ) {
+		debug(LOG_ERR, "Could not write snapshot %s (%s)", tmpfile, strerror(errno));
+		return EXIT_FAILURE;
+	}
+	if( fwrite(&header, sizeof(header), 1, fp) != 1 ||
+		(count > 0 && fwrite(copy, sizeof(copy[0]), count, fp) != (size_t)count) ||
+		fflush(fp) != 0 || fsync(fileno(fp)) != 0 ) {
+		debug(LOG_ERR, "Could not write snapshot %s (%s)", tmpfile, strerror(errno));
+		fclose(fp);
+		unlink(tmpfile);
+		return EXIT_FAILURE;
+	}
+	fclose(fp);
+	if( rename(tmpfile, snapfile) != 0 ) {
+		debug(LOG_ERR, "Could not rename snapshot %s (%s)", tmpfile, strerror(errno));
+		unlink(tmpfile);
+		return EXIT_FAILURE;
+	}
+
+	/* the old journal generation is obsolete now, keep the records
+	   appended after the copy was taken (journal_open() does the same
+	   if we stop before) */
+	pthread_mutex_lock(&mutex_state);
+	journal_rebase(generation, mark);
+	journal_compactions++;
+	pthread_mutex_unlock(&mutex_state);
+	msync(journal, sizeof(*journal) + JOURNAL_RECORDS * sizeof(struct journal_record), MS_SYNC);
+	debug(LOG_DEBUG, "Journal compacted: %d devices, generation %u", count, generation);
+	return EXIT_SUCCESS;
+}
+
+/* Writes the journal state to client */
+void journal_stats(int socket_handle, int flags)
+{
+	if( journal == NULL ) {
+		return;
+	}
+	pthread_mutex_lock(&mutex_state);
+	write_to_client(socket_handle, flags, "JOURNAL generation %u, %d/%d records, %lu compactions, %lu dropped, %d devices restored in %lld us\r\n",
+					journal->generation, journal_head, JOURNAL_RECORDS, journal_compactions, journal_dropped, journal_restored, journal_restore_us);
+	pthread_mutex_unlock(&mutex_state);
+}
+
+/* Journal maintenance thread: periodic asynchronous flush and compaction */
+void *journal_thread(void *arg)
+{
+	size_t size = sizeof(struct journal_header) + JOURNAL_RECORDS * sizeof(struct journal_record);
+	int synced = 0;
+
+	while(true) {
+		int head;
+
+		sleep(JOURNAL_SYNC);
+		pthread_mutex_lock(&mutex_state);
+		head = journal_head;
+		pthread_mutex_unlock(&mutex_state);
+		if( head >= JOURNAL_COMPACT ) {
+			journal_compact();
+			synced = 0;
+		}
+		else if( head != synced ) {
+			msync(journal, size, MS_ASYNC);
+			synced = head;
+		}
+	}
+	return NULL;
+}
+
+
+/* ======================================================================== */
+/* Temperature history */
+/* ======================================================================== */
+
+/* 	Read the device temperature sensor into <value> (0.5 C units),
+	records it within the history and publishes it to subscribers
+	returns EXIT_SUCCESS or EXIT_FAILURE
+*/
+int temp_read(lm_device *dev_handle, int *value)
+{
+	double celsius;
+	time_t now;
+
+	if( lm_get_temp(dev_handle, &celsius) != LM_OK ) {
+		return EXIT_FAILURE;
+	}
+	*value = (int)(celsius * 2 + 0.5);
+	time(&now);
+	temp_record(*value, now);
+	event_publish(EVENT_TEMP, "{\"temp\":%.1f,\"time\":%ld}", (float)*value/2, (long)now);
+	return EXIT_SUCCESS;
+}
+
+/* Store a sample into the raw ring and fold it into the aggregates */
+void temp_record(int value, time_t now)
+{
+	size_t i;
+
+	pthread_mutex_lock(&mutex_temp);
+	for(i=0; i<sizeof(temp_rings)/sizeof(temp_rings[0]); i++) {
+		struct temp_ring *ring = &temp_rings[i];
+		time_t start = (ring->interval > 0) ? now - (now % ring->interval) : now;
+		struct temp_sample *last = &ring->samples[(ring->head + ring->size - 1) % ring->size];
+
+		if( ring->interval > 0 && ring->count > 0 && last->time == start ) {
+			if( value < last->min ) last->min = value;
+			if( value > last->max ) last->max = value;
+			last->sum += value;
+			last->count++;
+		}
+		else {
+			struct temp_sample *sample = &ring->samples[ring->head];
+
+			sample->time = start;
+			sample->min = sample->max = value;
+			sample->sum = value;
+			sample->count = 1;
+			ring->head = (ring->head + 1) % ring->size;
+			if( ring->count < ring->size ) {
+				ring->count++;
+			}
+		}
+	}
+	temp_samples++;
+	pthread_mutex_unlock(&mutex_temp);
+}
+
+/* Convert a duration like 90, 90s, 15m, 2h or 7d into seconds, -1 on error */
+long parse_duration(const char *str)
+{
+	char *end;
+	long value;
+
+	errno = 0;
+	value = strtol(str, &end, 10);
+	if( errno != 0 || end == str || value <= 0 ) {
+		return -1;
+	}
+	switch( toupper(*end) ) {
+		case '\0':
+		case 'S':	break;
+		case 'M':	value *= 60; break;
+		case 'H':	value *= 3600; break;
+		case 'D':	value *= 86400; break;
+		default:	return -1;
+	}
+	return value;
+}
+
+/* Returns the finest resolution ring still covering <window> seconds */
+struct temp_ring *temp_ring_for(long window)
+{
+	size_t i;
+
+	for(i=0; i<sizeof(temp_rings)/sizeof(temp_rings[0]) - 1; i++) {
+		int interval = (temp_rings[i].interval > 0) ? temp_rings[i].interval : (tempperiod > 0 ? tempperiod : 60);
+
+		if( (long)temp_rings[i].size * interval >= window ) {
+			break;
+		}
+	}
+	return &temp_rings[i];
+}
+
+/* 	Min, max and average over the last <window> seconds
+	returns the number of samples used, 0 if there are none
+*/
+int temp_query(long window, int *min, int *max, double *avg)
+{
+	struct temp_ring *ring = temp_ring_for(window);
+	time_t since = time(NULL) - window;
+	long sum = 0;
+	int count = 0;
+	int i;
+
+	*min = INT_MAX;
+	*max = INT_MIN;
+	pthread_mutex_lock(&mutex_temp);
+	for(i=1; i<=ring->count; i++) {
+		struct temp_sample *sample = &ring->samples[(ring->head + ring->size - i) % ring->size];
+
+		/* aggregates overlapping the window start are taken as a whole */
+		if( sample->time + ring->interval < since ) {
+			break;
+		}
+		if( sample->min < *min ) *min = sample->min;
+		if( sample->max > *max ) *max = sample->max;
+		sum += sample->sum;
+		count += sample->count;
+	}
+	pthread_mutex_unlock(&mutex_temp);
+	*avg = (count > 0) ? (double)sum / count : 0.0;
+	return count;
+}
+
+/* Writes the samples of <ring> within the last <window> seconds to client, oldest first */
+void temp_history(int socket_handle, int flags, struct temp_ring *ring, long window)
+{
+	char out[MSG_BUFFER_MAXLEN / 2];
+	time_t since = time(NULL) - window;
+	int len = 0;
+	int first;
+	int i;
+
+	pthread_mutex_lock(&mutex_temp);
+	for(first=ring->count; first>0; first--) {
+		if( ring->samples[(ring->head + ring->size - first) % ring->size].time + ring->interval >= since ) {
+			break;
+		}
+	}
+	for(i=first; i>0; i--) {
+		struct temp_sample *sample = &ring->samples[(ring->head + ring->size - i) % ring->size];
+		char stime[32];
+
+		if( len > (int)sizeof(out) - 80 ) {
+			write_to_client(socket_handle, flags, "%s", out);
+			len = 0;
+		}
+		strftime(stime, sizeof(stime), "%Y-%m-%d %H:%M:%S", localtime(&sample->time));
+		if( ring->interval > 0 ) {
+			len += snprintf(out + len, sizeof(out) - len, "%s avg %.1f min %.1f max %.1f (%d)\r\n", stime,
+							(double)sample->sum / sample->count / 2, (float)sample->min/2, (float)sample->max/2, sample->count);
+		}
+		else {
+			len += snprintf(out + len, sizeof(out) - len, "%s %.1f\r\n", stime, (float)sample->min/2);
+		}
+	}
+	pthread_mutex_unlock(&mutex_temp);
+	if( len > 0 ) {
+		write_to_client(socket_handle, flags, "%s", out);
+	}
+}
+
+/* Writes the temperature sampler state to client */
+void temp_stats(int socket_handle, int flags)
+{
+	pthread_mutex_lock(&mutex_temp);
+	write_to_client(socket_handle, flags, "TEMP period %u s, %lu samples, %lu skipped, %d/%d/%d raw/minute/hour kept\r\n",
+					tempperiod, temp_samples, temp_skipped, temp_rings[0].count, temp_rings[1].count, temp_rings[2].count);
+	pthread_mutex_unlock(&mutex_temp);
+}
+
+/* 	Background temperature sampler thread. It has its own scheduler queue
+	and backs off while client commands are waiting for the radio, for at
+	most one period, so sampling never delays interactive commands.
+*/
+void *temp_sampler(void *arg)
+{
+	struct session session;
+
+	session_init(&session);
+	debug(LOG_DEBUG, "temp_sampler() started, period %u s", tempperiod);
+	while(true) {
+		unsigned int waited;
+		int value;
+
+		sleep(tempperiod);
+		for(waited = 0; waited < tempperiod && lm_busy(dev_handle); waited++) {
+			sleep(1);
+		}
+		if( waited >= tempperiod || temp_read(dev_handle, &value) != EXIT_SUCCESS ) {
+			pthread_mutex_lock(&mutex_temp);
+			temp_skipped++;
+			pthread_mutex_unlock(&mutex_temp);
+		}
+	}
+	session_free(&session);
+	return NULL;
+}
+
+
+/* ======================================================================== */
+/* Clock synchronization */
+/* ======================================================================== */
+
+/* 	Host local wall clock in seconds (broken down local time taken as UTC),
+	directly comparable with the device clock which knows no time zones.
+	<gmtoff> (may be NULL) receives the current UTC offset of the host.
+*/
+double clock_host(long *gmtoff)
+{
+	struct timespec ts;
+	struct tm local;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	localtime_r(&ts.tv_sec, &local);
+	if( gmtoff != NULL ) {
+		*gmtoff = local.tm_gmtoff;
+	}
+	return (double)timegm(&local) + ts.tv_nsec / 1e9;
+}
+
+/* 	Measure the device clock offset with a single clock read and update
+	the drift estimate.
+	returns EXIT_SUCCESS or EXIT_FAILURE
+*/
+int clock_measure(lm_device *dev_handle)
+{
+	struct tm devtime;
+	double offset;
+	double drift;
+	long gmtoff;
+	long long now;
+
+	if( lm_read_clock(dev_handle, &devtime) != LM_OK ) {
+		return EXIT_FAILURE;
+	}
+	now = time_us();
+	/* The device reports full seconds, on average it is half a second further */
+	offset = (double)timegm(&devtime) + 0.5 - clock_host(&gmtoff);
+
+	pthread_mutex_lock(&mutex_clock);
+	clock_track.reads++;
+	if( clock_track.valid && gmtoff != clock_track.gmtoff ) {
+		/* DST transition of the host: the offset jumps, this is no drift */
+		clock_track.dstchanges++;
+		clock_track.base = 0;
+		debug(LOG_INFO, "Host UTC offset changed from %+ld s to %+ld s, device clock offset %+.1f s",
+			  clock_track.gmtoff, gmtoff, offset);
+	}
+	if( clock_track.base == 0 ) {
+		clock_track.base = now;
+		clock_track.base_offset = offset;
+	}
+	else if( now - clock_track.base >= CLOCK_DRIFT_MIN * 1000000LL ) {
+		clock_track.drift = (offset - clock_track.base_offset) * 1e6 / (now - clock_track.base);
+	}
+	clock_track.valid = true;
+	clock_track.offset = offset;
+	clock_track.measured = now;
+	clock_track.gmtoff = gmtoff;
+	drift = clock_track.drift;
+	pthread_mutex_unlock(&mutex_clock);
+
+	debug(LOG_DEBUG, "Device clock offset %+.1f s, drift %+.1f ppm", offset, drift * 1e6);
+	return EXIT_SUCCESS;
+}
+
+/* 	Set the device clock to the host local time. The write is done at the
+	start of a second so the device seconds run in phase with the host.
+	Some devices add a DST hour on their own when set: the clock is read
+	back and such a shift is compensated for this and all later writes.
+	returns EXIT_SUCCESS or EXIT_FAILURE
+*/
+int clock_write(lm_device *dev_handle)
+{
+	int attempt;
+
+	for(attempt = 0; attempt < 2; attempt++) {
+		struct tm timeinfo;
+		double host;
+		time_t target;
+		int hours;
+
+		host = clock_host(NULL);
+		usleep((useconds_t)((1.0 - (host - (long long)host)) * 1000000));
+		pthread_mutex_lock(&mutex_clock);
+		target = (time_t)host + 1 + clock_track.hourbias;
+		clock_track.writes++;
+		clock_track.valid = false;
+		clock_track.base = 0;
+		pthread_mutex_unlock(&mutex_clock);
+
+		gmtime_r(&target, &timeinfo);
+		if( lm_set_clock(dev_handle, &timeinfo) != LM_OK || clock_measure(dev_handle) != EXIT_SUCCESS ) {
+			return EXIT_FAILURE;
+		}
+
+		pthread_mutex_lock(&mutex_clock);
+		hours = (int)((clock_track.offset + ((clock_track.offset < 0) ? -1800 : 1800)) / 3600);
+		clock_track.hourbias -= hours * 3600;
+		pthread_mutex_unlock(&mutex_clock);
+		if( hours == 0 ) {
+			break;
+		}
+		debug(LOG_INFO, "Device clock shifted itself by %+d h when set, compensating", hours);
+	}
+	return EXIT_SUCCESS;
+}
+
+/* 	Check the device clock with one read and correct it if it is off by
+	more than <clockoffset> seconds, or always if <force>.
+	returns EXIT_SUCCESS or EXIT_FAILURE
+*/
+int clock_sync(lm_device *dev_handle, bool force)
+{
+	double offset;
+
+	if( clock_measure(dev_handle) != EXIT_SUCCESS ) {
+		return EXIT_FAILURE;
+	}
+	pthread_mutex_lock(&mutex_clock);
+	offset = clock_track.offset;
+	pthread_mutex_unlock(&mutex_clock);
+
+	if( !force && offset <= clockoffset && -offset <= clockoffset ) {
+		return EXIT_SUCCESS;
+	}
+	debug(LOG_INFO, "Device clock off by %+.1f s, setting it", offset);
+	return clock_write(dev_handle);
+}
+
+/* 	Current device clock as local wall clock seconds (use gmtime_r() to
+	break it down), predicted from the tracked offset and drift. The device
+	is only read if there is no usable offset: none measured yet, older
+	than CLOCK_MAXAGE or measured before a DST transition of the host.
+	returns EXIT_SUCCESS or EXIT_FAILURE
+*/
+int clock_device(lm_device *dev_handle, time_t *devtime)
+{
+	int attempt;
+
+	for(attempt = 0; attempt < 2; attempt++) {
+		long gmtoff;
+		double host = clock_host(&gmtoff);
+		long long now = time_us();
+		bool usable;
+
+		pthread_mutex_lock(&mutex_clock);
+		usable = clock_track.valid && gmtoff == clock_track.gmtoff &&
+				 now - clock_track.measured < CLOCK_MAXAGE * 1000000LL;
+		if( usable ) {
+			*devtime = (time_t)(host + clock_track.offset + clock_track.drift * (now - clock_track.measured) / 1e6);
+			clock_track.predicted++;
+		}
+		pthread_mutex_unlock(&mutex_clock);
+		if( usable ) {
+			return EXIT_SUCCESS;
+		}
+		if( clock_measure(dev_handle) != EXIT_SUCCESS ) {
+			break;
+		}
+	}
+	return EXIT_FAILURE;
+}
+
+/* 	Forget the tracked offset after the device clock was set by SET CLOCK,
+	if <manual> to a user time which the background synchronization keeps
+	until clock_resume() */
+void clock_invalidate(bool manual)
+{
+	pthread_mutex_lock(&mutex_clock);
+	clock_track.valid = false;
+	clock_track.base = 0;
+	clock_track.manual = manual;
+	pthread_mutex_unlock(&mutex_clock);
+}
+
+/* Synchronize the device clock with the host again (SET CLOCK AUTO) */
+void clock_resume(void)
+{
+	pthread_mutex_lock(&mutex_clock);
+	clock_track.manual = false;
+	pthread_mutex_unlock(&mutex_clock);
+}
+
+/* Writes the clock synchronization state to client */
+void clock_stats(int socket_handle, int flags)
+{
+	pthread_mutex_lock(&mutex_clock);
+	write_to_client(socket_handle, flags, "CLOCK period %u s%s, offset %+.1f s, drift %+.1f ppm, bias %+d h, %lu reads, %lu writes, %lu predicted, %lu dst changes, %lu skipped\r\n",
+					clockperiod, clock_track.manual ? " (suspended by SET CLOCK)" : "",
+					clock_track.valid ? clock_track.offset : 0.0, clock_track.drift * 1e6, clock_track.hourbias / 3600,
+					clock_track.reads, clock_track.writes, clock_track.predicted, clock_track.dstchanges, clock_track.skipped);
+	pthread_mutex_unlock(&mutex_clock);
+}
+
+/* 	Background clock synchronization thread. Checks the device clock every
+	<clockperiod> seconds, earlier if the drift will move it beyond the
+	threshold before, and right after a DST transition of the host. Like
+	temp_sampler() it backs off while client commands wait for the radio.
+*/
+void *clock_sync_thread(void *arg)
+{
+	struct session session;
+
+	session_init(&session);
+	debug(LOG_DEBUG, "clock_sync_thread() started, period %u s, max offset %u s", clockperiod, clockoffset);
+	while(true) {
+		unsigned int interval = clockperiod;
+		unsigned int waited;
+		long gmtoff;
+		long now_gmtoff;
+		double offset;
+		double drift;
+		bool manual;
+
+		/* a time set by SET CLOCK stays until SET CLOCK AUTO */
+		pthread_mutex_lock(&mutex_clock);
+		manual = clock_track.manual;
+		pthread_mutex_unlock(&mutex_clock);
+		if( !manual && clock_sync(dev_handle, false) != EXIT_SUCCESS ) {
+			pthread_mutex_lock(&mutex_clock);
+			clock_track.skipped++;
+			pthread_mutex_unlock(&mutex_clock);
+		}
+
+		/* Time until the drift reaches the threshold */
+		pthread_mutex_lock(&mutex_clock);
+		offset = (clock_track.offset < 0) ? -clock_track.offset : clock_track.offset;
+		drift = (clock_track.drift < 0) ? -clock_track.drift : clock_track.drift;
+		pthread_mutex_unlock(&mutex_clock);
+		if( drift > 0 && (clockoffset - offset) / drift < interval ) {
+			interval = ((clockoffset - offset) / drift < CLOCK_RECHECK_MIN) ? CLOCK_RECHECK_MIN : (unsigned int)((clockoffset - offset) / drift);
+		}
+
+		clock_host(&gmtoff);
+		for(waited = 0; waited < interval; waited++) {
+			sleep(1);
+			clock_host(&now_gmtoff);
+			if( now_gmtoff != gmtoff ) {
+				debug(LOG_DEBUG, "Host DST transition, checking device clock");
+				break;
+			}
+		}
+		for(waited = 0; waited < clockperiod && lm_busy(dev_handle); waited++) {
+			sleep(1);
+		}
+	}
+	session_free(&session);
+	return NULL;
+}
+
+
+/* ======================================================================== */
+/* Request timing */
+/* ======================================================================== */
+
+/* 	The request line of <session> is complete: start its processing stages.
+	Time spent so far by the session queue belongs to no request.
+*/
+void timing_start(struct session *session)
+{
+	struct timing *timing = &session->timing;
+	struct lm_timing usb;
+
+	timing->started = time_us();
+	if( timing->received == 0 ) {
+		timing->received = timing->started;
+	}
+	timing->stage[STAGE_RECEIVE] = timing->started - timing->received;
+	timing->stage[STAGE_ACCEPT] = timing->accepted;
+	timing->stage[STAGE_QUEUE] = timing->stage[STAGE_PACER] = timing->stage[STAGE_USB] = 0;
+	timing->stage[STAGE_WRITE] = 0;
+	timing->frames = timing->retries = 0;
+	lm_queue_timing(session->queue, &usb);
+}
+
+/* 	Update the stages of the current request of <session> up to now,
+	may be called more than once per request
+*/
+void timing_stop(struct session *session)
+{
+	struct timing *timing = &session->timing;
+	struct lm_timing usb;
+	long long now = time_us();
+	long long parse;
+
+	lm_queue_timing(session->queue, &usb);
+	if( timing->received == 0 ) {
+		return;
+	}
+	timing->stage[STAGE_QUEUE] += usb.queued;
+	timing->stage[STAGE_PACER] += usb.paced;
+	timing->stage[STAGE_USB] += usb.usb;
+	timing->frames += usb.frames;
+	timing->retries += usb.retries;
+	parse = now - timing->started - timing->stage[STAGE_QUEUE] - timing->stage[STAGE_PACER]
+			- timing->stage[STAGE_USB] - timing->stage[STAGE_WRITE];
+	timing->stage[STAGE_PARSE] = (parse > 0) ? parse : 0;
+	timing->stage[STAGE_TOTAL] = now - timing->received + timing->stage[STAGE_ACCEPT];
+}
+
+/* Add the current request of <session> to the stage statistics and reset it */
+void timing_record(struct session *session)
+{
+	struct timing *timing = &session->timing;
+	int i;
+
+	if( timing->received != 0 ) {
+		pthread_mutex_lock(&mutex_timing);
+		for(i=0; i<STAGE_MAX; i++) {
+			struct stage_stats *stats = &stage_stats[i];
+			long long us = timing->stage[i];
+			int bucket = 0;
+
+			if( i == STAGE_ACCEPT && timing->accepted == 0 ) {
+				continue;
+			}
+			while( bucket < 31 && (1LL << bucket) <= us ) {
+				bucket++;
+			}
+			stats->count++;
+			stats->sum += us;
+			if( us > stats->max ) {
+				stats->max = us;
+			}
+			stats->hist[bucket]++;
+		}
+		pthread_mutex_unlock(&mutex_timing);
+	}
+	timing->accepted = 0;
+	timing->received = 0;
+	memset(timing->stage, 0, sizeof(timing->stage));
+}
+
+/* 	Writes the stages of <timing> into <buf>, as Server-Timing header
+	value (ms) if <http>, otherwise as TIMING line (us).
+	returns the length written
+*/
+int timing_format(const struct timing *timing, char *buf, size_t len, bool http)
+{
+	int pos = 0;
+	int i;
+
+	if( !http ) {
+		pos = snprintf(buf, len, "TIMING");
+	}
+	for(i=0; i<STAGE_MAX && pos >= 0 && (size_t)pos < len; i++) {
+		if( http ) {
+			pos += snprintf(buf + pos, len - pos, "%s%s;dur=%.3f", (i > 0) ? ", " : "", stage_names[i], timing->stage[i] / 1000.0);
+		}
+		else {
+			pos += snprintf(buf + pos, len - pos, " %s %lld", stage_names[i], timing->stage[i]);
+		}
+	}
+	if( !http && pos >= 0 && (size_t)pos < len ) {
+		pos += snprintf(buf + pos, len - pos, " us, %d frames, %d retries", timing->frames, timing->retries);
+	}
+	return ((size_t)pos < len) ? pos : (int)len - 1;
+}
+
+/* Append <msg> to the captured response, returns <len> or -1 */
+int timing_capture(struct timing *timing, const char *msg, size_t len)
+{
+	if( timing->outlen + len > timing->outsize ) {
+		size_t size = (timing->outsize > 0) ? timing->outsize : MSG_BUFFER_MAXLEN;
+		char *out;
+
+		while( size < timing->outlen + len ) {
+			size *= 2;
+		}
+		if( (out = realloc(timing->out, size)) == NULL ) {
+			return -1;
+		}
+		timing->out = out;
+		timing->outsize = size;
+	}
+	memcpy(timing->out + timing->outlen, msg, len);
+	timing->outlen += len;
+	return len;
+}
+
+/* Send the captured response to <socket_handle>, returns EXIT_SUCCESS or EXIT_FAILURE */
+int timing_flush(struct timing *timing, int socket_handle)
+{
+	size_t sent = 0;
+	int rc = 0;
+
+	while( sent < timing->outlen && (rc = send(socket_handle, timing->out + sent, timing->outlen - sent, MSG_NOSIGNAL)) > 0 ) {
+		sent += rc;
+	}
+	timing->outlen = 0;
+	return (rc < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* Writes the latency statistics per stage to client, percentiles are log2 bucket bounds */
+void timing_stats(int socket_handle, int flags)
+{
+	struct stage_stats stats[STAGE_MAX];
+	int i;
+
+	pthread_mutex_lock(&mutex_timing);
+	memcpy(stats, stage_stats, sizeof(stats));
+	pthread_mutex_unlock(&mutex_timing);
+
+	for(i=0; i<STAGE_MAX; i++) {
+		unsigned long seen = 0;
+		long long p50 = 0;
+		long long p99 = 0;
+		int bucket;
+
+		if( stats[i].count == 0 ) {
+			continue;
+		}
+		for(bucket = 0; bucket < 32; bucket++) {
+			seen += stats[i].hist[bucket];
+			if( p50 == 0 && seen * 2 >= stats[i].count ) {
+				p50 = 1LL << bucket;
+			}
+			if( p99 == 0 && seen * 100 >= stats[i].count * 99 ) {
+				p99 = 1LL << bucket;
+			}
+		}
+		write_to_client(socket_handle, flags, "TIMING %-7s %lu requests, avg %lld us, p50 < %lld us, p99 < %lld us, max %lld us\r\n",
+						stage_names[i], stats[i].count, stats[i].sum / (long long)stats[i].count, p50, p99, stats[i].max);
+	}
+}
+
+
+/* ======================================================================== */
+/* Request arena */
+/* ======================================================================== */
+
+/* Allocate the block of <arena>, returns EXIT_SUCCESS or EXIT_FAILURE */
+int arena_init(struct arena *arena, size_t size)
+{
+	memset(arena, 0, sizeof(*arena));
+	if( (arena->base = malloc(size)) == NULL ) {
+		return EXIT_FAILURE;
+	}
+	arena->size = size;
+	arena->mallocs++;
+	return EXIT_SUCCESS;
+}
+
+/* 	Allocate <len> bytes from <arena>, aligned for any type.
+	returns NULL if <arena> is NULL or out of memory */
+void *arena_alloc(struct arena *arena, size_t len)
+{
+	struct arena_chunk *chunk;
+	size_t used;
+
+	if( arena == NULL ) {
+		return NULL;
+	}
+	used = (arena->used + sizeof(max_align_t) - 1) & ~(sizeof(max_align_t) - 1);
+	arena->allocs++;
+	arena->bytes += len;
+	if( used + len <= arena->size ) {
+		arena->used = used + len;
+		return arena->base + used;
+	}
+	if( (chunk = malloc(sizeof(*chunk) + len)) == NULL ) {
+		return NULL;
+	}
+	chunk->next = arena->chunks;
+	arena->chunks = chunk;
+	arena->spilled += len;
+	arena->mallocs++;
+	return chunk->data;
+}
+
+char *arena_strdup(struct arena *arena, const char *str)
+{
+	size_t len = strlen(str) + 1;
+	char *copy;
+
+	if( (copy = arena_alloc(arena, len)) != NULL ) {
+		memcpy(copy, str, len);
+	}
+	return copy;
+}
+
+/* Formats into the free space of <arena> directly, only a message not fitting is formatted twice */
+char *arena_vprintf(struct arena *arena, const char *format, va_list args)
+{
+	va_list copy;
+	size_t used;
+	size_t avail;
+	char *str;
+	int len;
+
+	if( arena == NULL ) {
+		return NULL;
+	}
+	used = (arena->used + sizeof(max_align_t) - 1) & ~(sizeof(max_align_t) - 1);
+	avail = (used < arena->size) ? arena->size - used : 0;
+	va_copy(copy, args);
+	len = vsnprintf((avail > 0) ? arena->base + used : NULL, avail, format, copy);
+	va_end(copy);
+	if( len < 0 ) {
+		return NULL;
+	}
+	if( (size_t)len < avail ) {
+		arena->used = used + len + 1;
+		arena->allocs++;
+		arena->bytes += len + 1;
+		return arena->base + used;
+	}
+	if( (str = arena_alloc(arena, len + 1)) != NULL ) {
+		vsnprintf(str, len + 1, format, args);
+	}
+	return str;
+}
+
+/* 	Release all allocations of <arena> and account them. If chunks were
+	needed the block is grown to the peak, so the next request of the same
+	size is served from the block alone */
+void arena_reset(struct arena *arena)
+{
+	size_t peak = arena->used + arena->spilled;
+	unsigned long max;
+
+	while( arena->chunks != NULL ) {
+		struct arena_chunk *next = arena->chunks->next;
+
+		free(arena->chunks);
+		arena->chunks = next;
+	}
+	if( arena->spilled > 0 && arena->size < ARENA_MAX ) {
+		size_t size = (arena->size > 0) ? arena->size : ARENA_SIZE;
+		char *base;
+
+		while( size < peak + peak / 4 && size < ARENA_MAX ) {
+			size *= 2;
+		}
+		if( (base = malloc(size)) != NULL ) {
+			free(arena->base);
+			arena->base = base;
+			arena->size = size;
+			arena->mallocs++;
+		}
+	}
+
+	if( arena->allocs > 0 ) {
+		atomic_fetch_add(&arena_requests, 1);
+		atomic_fetch_add(&arena_allocs, arena->allocs);
+		atomic_fetch_add(&arena_bytes, arena->bytes);
+	}
+	atomic_fetch_add(&arena_mallocs, arena->mallocs);
+	max = atomic_load(&arena_peak);
+	while( peak > max && !atomic_compare_exchange_weak(&arena_peak, &max, peak) );
+
+	arena->used = 0;
+	arena->spilled = 0;
+	arena->allocs = 0;
+	arena->bytes = 0;
+	arena->mallocs = 0;
+}
+
+/* Release <arena> including its block */
+void arena_free(struct arena *arena)
+{
+	free(arena->base);
+	arena->base = NULL;
+	arena->size = 0;
+	arena->spilled = 0;			/* no growth */
+	arena_reset(arena);
+}
+
+/* Writes the arena allocation counters to client */
+void arena_stats(int socket_handle, int flags)
+{
+	unsigned long requests = atomic_load(&arena_requests);
+	unsigned long allocs = atomic_load(&arena_allocs);
+
+	write_to_client(socket_handle, flags, "ARENA %lu requests, %lu allocations (%.1f per request, %lu bytes), %lu mallocs, peak %lu bytes\r\n",
+					requests, allocs, (requests > 0) ? (double)allocs / requests : 0.0,
+					atomic_load(&arena_bytes), atomic_load(&arena_mallocs), atomic_load(&arena_peak));
+}
+
+
+/* ======================================================================== */
+/* MQTT bridge */
+/* ======================================================================== */
+
+/* 	Parse the broker parameter "<host>[:port][/prefix]" (IPv6 host within
+	brackets). returns EXIT_SUCCESS or EXIT_FAILURE */
+int mqtt_parse(const char *arg)
+{
+	const char *host = arg;
+	const char *end;
+	const char *rest;
+
+	if( *host == '[' ) {
+		host++;
+		if( (end = strchr(host, ']')) == NULL ) {
+			return EXIT_FAILURE;
+		}
+		rest = end + 1;
+	}
+	else {
+		end = host + strcspn(host, ":/");
+		rest = end;
+	}
+	if( end == host || (size_t)(end - host) >= sizeof(mqtthost) ) {
+		return EXIT_FAILURE;
+	}
+	memcpy(mqtthost, host, end - host);
+	mqtthost[end - host] = '\0';
+	snprintf(mqttport, sizeof(mqttport), "%d", MQTT_PORT);
+	if( *rest == ':' ) {
+		size_t len = strcspn(rest + 1, "/");
+
+		if( len == 0 || len >= sizeof(mqttport) || strspn(rest + 1, "0123456789") != len ) {
+			return EXIT_FAILURE;
+		}
+		memcpy(mqttport, rest + 1, len);
+		mqttport[len] = '\0';
+		rest += 1 + len;
+	}
+	if( *rest == '/' ) {
+		if( rest[1] == '\0' || strlen(rest + 1) >= sizeof(mqttprefix) || strpbrk(rest + 1, "+#") != NULL ) {
+			return EXIT_FAILURE;
+		}
+		strcpy(mqttprefix, rest + 1);
+	}
+	else if( *rest != '\0' ) {
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+/* 	Write the fixed header of a packet <type> (with flags) and
+	<remaining> length into <buf>. returns its length */
+size_t mqtt_header(unsigned char *buf, int type, size_t remaining)
+{
+	size_t len = 0;
+
+	buf[len++] = type;
+	do {
+		buf[len] = remaining % 128;
+		remaining /= 128;
+		if( remaining > 0 ) {
+			buf[len] |= 0x80;
+		}
+		len++;
+	} while( remaining > 0 );
+	return len;
+}
+
+/* Write the length prefixed <str> into <buf>, returns the length written */
+size_t mqtt_string(unsigned char *buf, const char *str, size_t len)
+{
+	buf[0] = len >> 8;
+	buf[1] = len & 0xff;
+	memcpy(buf + 2, str, len);
+	return len + 2;
+}
+
+/* 	Send <len> bytes of <buf> to the broker connection <fd>, mqtt.mutex
+	must be held so packets do not interleave. returns 0 or -1 */
+int mqtt_send(int fd, const void *buf, size_t len)
+{
+	const char *data = buf;
+
+	while( len > 0 ) {
+		ssize_t rc = send(fd, data, len, MSG_NOSIGNAL);
+
+		if( rc <= 0 ) {
+			return -1;
+		}
+		data += rc;
+		len -= rc;
+	}
+	time(&mqtt.lastsend);
+	return 0;
+}
+
+/* Receive exactly <len> bytes into <buf>, returns 0 or -1 */
+int mqtt_recv(int fd, void *buf, size_t len)
+{
+	char *data = buf;
+
+	while( len > 0 ) {
+		ssize_t rc = recv(fd, data, len, 0);
+
+		if( rc <= 0 ) {
+			return -1;
+		}
+		data += rc;
+		len -= rc;
+	}
+	return 0;
+}
+
+/* 	Receive the next packet from <fd>: <type> is its first byte, the rest
+	(<len> bytes) goes into <buf>. Of packets larger than <size> only the
+	first <size> bytes are kept, the packet id of such a PUBLISH goes into
+	<packetid> (may be NULL) so it can be acknowledged.
+	returns 0, 1 if the packet was truncated or -1 if the connection failed */
+int mqtt_read(int fd, int *type, unsigned char *buf, size_t size, size_t *len, unsigned int *packetid)
+{
+	unsigned char byte;
+	size_t remaining = 0;
+	int shift = 0;
+
+	if( mqtt_recv(fd, &byte, 1) < 0 ) {
+		return -1;
+	}
+	*type = byte;
+	do {
+		if( shift > 21 || mqtt_recv(fd, &byte, 1) < 0 ) {
+			return -1;
+		}
+		remaining |= (size_t)(byte & 0x7f) << shift;
+		shift += 7;
+	} while( byte & 0x80 );
+	if( remaining > size ) {
+		bool fid = ((*type & 0xf0) == MQTT_PUBLISH && (*type & 0x06) != 0);
+		unsigned char skip[512];
+		unsigned char *dst = buf;
+		unsigned int id = 0;
+		size_t idpos = 0;
+		size_t pos = 0;
+
+		debug(LOG_WARNING, "MQTT packet of %zu bytes skipped", remaining);
+		*len = size;
+		while( pos < remaining ) {
+			size_t chunk = remaining - pos;
+			size_t i;
+
+			if( chunk > ((dst == buf) ? size : sizeof(skip)) ) {
+				chunk = (dst == buf) ? size : sizeof(skip);
+			}
+			if( mqtt_recv(fd, dst, chunk) < 0 ) {
+				return -1;
+			}
+			if( dst == buf ) {
+				/* PUBLISH: topic length, topic, packet id */
+				idpos = 2 + ((size_t)buf[0] << 8 | buf[1]);
+			}
+			for(i = 0; fid && i < chunk; i++) {
+				if( pos + i == idpos ) {
+					id = (unsigned int)dst[i] << 8;
+				}
+				else if( pos + i == idpos + 1 ) {
+					id |= dst[i];
+				}
+			}
+			pos += chunk;
+			dst = skip;
+		}
+		if( packetid != NULL ) {
+			*packetid = id;
+		}
+		return 1;
+	}
+	*len = remaining;
+	return mqtt_recv(fd, buf, remaining);
+}
+
+/* 	Connect to the broker with a persistent session (clean session off),
+	so the broker keeps the subscriptions and QoS 1 commands while the
+	bridge is away, and subscribe to the command topics.
+	<present> tells if the broker still had the session.
+	returns the socket or -1 */
+int mqtt_connect(bool *present)
+{
+	static const char *filters[] = { "+/set", "+/+/set", "+/+/+/set", "+/+/+/+/set" };
+	unsigned char buf[MQTT_PACKET_MAX];
+	unsigned char body[512];
+	struct addrinfo hints;
+	struct addrinfo *ai, *p;
+	struct timeval timeout;
+	char clientid[24];
+	char host[64];
+	char topic[128];
+	size_t len, hlen, remaining;
+	int type;
+	int fd = -1;
+	int rc;
+	size_t i;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if( (rc = getaddrinfo(mqtthost, mqttport, &hints, &ai)) != 0 ) {
+		debug(LOG_WARNING, "MQTT broker %s: %s", mqtthost, gai_strerror(rc));
+		return -1;
+	}
+	for(p = ai; p != NULL && fd < 0; p = p->ai_next) {
+		if( (fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) >= 0 && connect(fd, p->ai_addr, p->ai_addrlen) != 0 ) {
+			close(fd);
+			fd = -1;
+		}
+	}
+	freeaddrinfo(ai);
+	if( fd < 0 ) {
+		debug(LOG_WARNING, "MQTT broker %s port %s: %s", mqtthost, mqttport, strerror(errno));
+		return -1;
+	}
+	/* the broker answers each PINGREQ, silence means it is gone */
+	timeout.tv_sec = MQTT_KEEPALIVE;
+	timeout.tv_usec = 0;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	timeout.tv_sec = OUTPUT_TIMEOUT;
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	/* a persistent session needs a stable client id */
+	if( gethostname(host, sizeof(host)) != 0 ) {
+		strcpy(host, "localhost");
+	}
+	host[sizeof(host)-1] = '\0';
+	snprintf(clientid, sizeof(clientid), "lm-%.20s", host);
+	snprintf(topic, sizeof(topic), "%s/status", mqttprefix);
+
+	/* CONNECT: will "<prefix>/status" "offline" retained with QoS 1 */
+	len = mqtt_string(body, "MQTT", 4);
+	body[len++] = 4;							/* protocol level 3.1.1 */
+	body[len++] = 0x20 | 0x08 | 0x04;			/* will retain, will QoS 1, will flag */
+	body[len++] = MQTT_KEEPALIVE >> 8;
+	body[len++] = MQTT_KEEPALIVE & 0xff;
+	len += mqtt_string(body + len, clientid, strlen(clientid));
+	len += mqtt_string(body + len, topic, strlen(topic));
+	len += mqtt_string(body + len, "offline", 7);
+	hlen = mqtt_header(buf, MQTT_CONNECT, len);
+	memcpy(buf + hlen, body, len);
+	if( mqtt_send(fd, buf, hlen + len) < 0 || mqtt_read(fd, &type, buf, sizeof(buf), &remaining, NULL) < 0 ||
+		(type & 0xf0) != MQTT_CONNACK || remaining != 2 || buf[1] != 0 ) {
+		debug(LOG_WARNING, "MQTT broker %s refused the connection (%d)", mqtthost, (remaining == 2) ? buf[1] : -1);
+		close(fd);
+		return -1;
+	}
+	*present = (buf[0] & 0x01);
+
+	/* SUBSCRIBE <prefix>/<device>/set with QoS 1 */
+	len = 0;
+	body[len++] = 0;
+	body[len++] = 1;							/* packet id */
+	for(i=0; i<sizeof(filters)/sizeof(filters[0]); i++) {
+		snprintf(topic, sizeof(topic), "%s/%s", mqttprefix, filters[i]);
+		len += mqtt_string(body + len, topic, strlen(topic));
+		body[len++] = 1;
+	}
+	hlen = mqtt_header(buf, MQTT_SUBSCRIBE | 0x02, len);
+	memcpy(buf + hlen, body, len);
+	if( mqtt_send(fd, buf, hlen + len) < 0 ) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* 	Add the QoS 1 publication of <payload> to <topic> to the messages in
+	flight, mqtt.mutex must be held. returns its index or -1 if full */
+int mqtt_enqueue(const char *topic, const char *payload, bool retain)
+{
+	struct mqtt_msg *msg;
+	size_t tlen = strlen(topic);
+	size_t plen = strlen(payload);
+	size_t len;
+	int index;
+
+	if( mqtt.count >= MQTT_INFLIGHT || tlen + plen + 10 > MQTT_MSG_MAX ) {
+		return -1;
+	}
+	index = (mqtt.head + mqtt.count++) % MQTT_INFLIGHT;
+	msg = &mqtt.inflight[index];
+	if( ++mqtt.nextid == 0 ) {
+		mqtt.nextid = 1;
+	}
+	msg->id = mqtt.nextid;
+	msg->acked = false;
+	len = mqtt_header(msg->data, MQTT_PUBLISH | 0x02 | (retain ? 0x01 : 0), tlen + plen + 4);
+	len += mqtt_string(msg->data + len, topic, tlen);
+	msg->data[len++] = msg->id >> 8;
+	msg->data[len++] = msg->id & 0xff;
+	memcpy(msg->data + len, payload, plen);
+	msg->len = len + plen;
+	return index;
+}
+
+/* 	Send the messages in flight from the <first> one on within one send,
+	<dup> marks them as sent before. mqtt.mutex must be held.
+	returns 0 or -1 */
+int mqtt_transmit(int first, bool dup)
+{
+	size_t len = 0;
+	int n;
+
+	for(n = (first - mqtt.head + MQTT_INFLIGHT) % MQTT_INFLIGHT; n < mqtt.count; n++) {
+		struct mqtt_msg *msg = &mqtt.inflight[(mqtt.head + n) % MQTT_INFLIGHT];
+
+		if( msg->acked ) {
+			continue;
+		}
+		if( dup ) {
+			msg->data[0] |= 0x08;
+		}
+		memcpy(mqtt.sendbuf + len, msg->data, msg->len);
+		len += msg->len;
+	}
+	return (len > 0) ? mqtt_send(mqtt.fd, mqtt.sendbuf, len) : 0;
+}
+
+/* The broker acknowledged publication <id>, mqtt.mutex must be held */
+void mqtt_acked(unsigned int id)
+{
+	int n;
+
+	for(n=0; n<mqtt.count; n++) {
+		struct mqtt_msg *msg = &mqtt.inflight[(mqtt.head + n) % MQTT_INFLIGHT];
+
+		if( msg->id == id && !msg->acked ) {
+			msg->acked = true;
+			mqtt.published++;
+			break;
+		}
+	}
+	/* acknowledges come in order, others are skipped once the oldest is done */
+	while( mqtt.count > 0 && mqtt.inflight[mqtt.head].acked ) {
+		mqtt.head = (mqtt.head + 1) % MQTT_INFLIGHT;
+		mqtt.count--;
+	}
+	pthread_cond_broadcast(&mqtt.cond);
+}
+
+/* 	Execute the publication <payload> to the command topic
+	"<prefix>/<device levels>/set" as device command "<levels> <payload>",
+	e.g. lm/fs20/1111/set "on" or lm/it/a/1/dip/set "off".
+	returns 0 or -1 if the command failed */
+int mqtt_command(const char *topic, size_t tlen, const char *payload, size_t plen)
+{
+	unsigned char frames[EXPAND_MAX_FRAMES][8];
+	char command[INPUT_BUFFER_MAXLEN];
+	char *errormsg = NULL;
+	size_t prefixlen = strlen(mqttprefix);
+	size_t devlen;
+	size_t i;
+	int rc;
+
+	if( tlen < prefixlen + 6 || strncmp(topic, mqttprefix, prefixlen) != 0 || topic[prefixlen] != '/' ||
+		strncmp(topic + tlen - 4, "/set", 4) != 0 ) {
+		debug(LOG_WARNING, "MQTT topic '%.*s' ignored", (int)tlen, topic);
+		return -1;
+	}
+	devlen = tlen - prefixlen - 5;
+	if( devlen + plen + 2 > sizeof(command) ) {
+		debug(LOG_WARNING, "MQTT command of '%.*s' too long", (int)tlen, topic);
+		return -1;
+	}
+	memcpy(command, topic + prefixlen + 1, devlen);
+	for(i=0; i<devlen; i++) {
+		if( command[i] == '/' ) {
+			command[i] = ' ';
+		}
+	}
+	command[devlen] = ' ';
+	memcpy(command + devlen + 1, payload, plen);
+	command[devlen + 1 + plen] = '\0';
+	debug(LOG_DEBUG, "MQTT command '%s'", command);
+
+	if( (rc = encode_command(command, frames, EXPAND_MAX_FRAMES, &errormsg)) == 0 ) {
+		errormsg = seterror("not a device command");
+		rc = -1;
+	}
+	else if( rc > 0 && (rc = admit_submit(frames, rc, NULL, &errormsg)) > 0 ) {
+		errormsg = seterror("USB communication error (%d frames not sent)", rc);
+	}
+	if( rc != 0 ) {
+		debug(LOG_WARNING, "MQTT command '%s': %s", command, (errormsg != NULL) ? errormsg : "<unknown>");
+		return -1;
+	}
+	return 0;
+}
+
+/* 	Connection thread of the MQTT bridge: (re)connects to the broker,
+	resends the publications not acknowledged and executes the commands
+	received, each acknowledged after it was sent */
+void *mqtt_thread(void *arg)
+{
+	struct session session;
+	unsigned char buf[MQTT_PACKET_MAX];
+
+	session_init(&session);
+	debug(LOG_DEBUG, "mqtt_thread() started, broker %s port %s, prefix %s", mqtthost, mqttport, mqttprefix);
+	while(true) {
+		char topic[128];
+		bool present = false;
+		int fd;
+		int rc;
+
+		if( (fd = mqtt_connect(&present)) < 0 ) {
+			sleep(MQTT_RETRY);
+			continue;
+		}
+		debug(LOG_INFO, "MQTT connected to %s port %s (%s session)", mqtthost, mqttport, present ? "resumed" : "new");
+
+		pthread_mutex_lock(&mqtt.mutex);
+		mqtt.fd = fd;
+		mqtt.connects++;
+		/* retained status, the will replaces it if the bridge goes away */
+		snprintf(topic, sizeof(topic), "%s/status", mqttprefix);
+		buf[0] = MQTT_PUBLISH | 0x01;
+		buf[1] = 2 + strlen(topic) + 6;
+		rc = mqtt_string(buf + 2, topic, strlen(topic));
+		memcpy(buf + 2 + rc, "online", 6);
+		rc = mqtt_send(fd, buf, 2 + rc + 6);
+		if( rc == 0 && mqtt.count > 0 ) {
+			rc = mqtt_transmit(mqtt.head, true);
+		}
+		pthread_mutex_unlock(&mqtt.mutex);
+		pthread_cond_broadcast(&mqtt.cond);
+
+		while( rc == 0 ) {
+			unsigned int packetid = 0;
+			size_t len;
+			int type;
+			int truncated;
+
+			if( (truncated = mqtt_read(fd, &type, buf, sizeof(buf), &len, &packetid)) < 0 ) {
+				rc = -1;
+				break;
+			}
+			switch( type & 0xf0 ) {
+				case MQTT_PUBLISH: {
+					int qos = (type >> 1) & 0x03;
+					size_t tlen = (len >= 2) ? ((size_t)buf[0] << 8 | buf[1]) : len;
+					size_t off = 2 + tlen + ((qos > 0) ? 2 : 0);
+
+					if( !truncated && off > len ) {
+						rc = -1;
+						break;
+					}
+					pthread_mutex_lock(&mqtt.mutex);
+					mqtt.received++;
+					pthread_mutex_unlock(&mqtt.mutex);
+					if( !truncated ) {
+						packetid = (off >= 2) ? (unsigned int)buf[off - 2] << 8 | buf[off - 1] : 0;
+					}
+					/* a truncated command is not executed but acknowledged, the broker would redeliver it forever */
+					if( truncated || mqtt_command((char *)buf + 2, tlen, (char *)buf + off, len - off) < 0 ) {
+						pthread_mutex_lock(&mqtt.mutex);
+						mqtt.failed++;
+						pthread_mutex_unlock(&mqtt.mutex);
+					}
+					arena_reset(&session.arena);
+					/* acknowledged when done: a command is not lost if the bridge dies meanwhile */
+					if( qos > 0 ) {
+						unsigned char ack[4] = { MQTT_PUBACK, 2, packetid >> 8, packetid & 0xff };
+
+						pthread_mutex_lock(&mqtt.mutex);
+						rc = mqtt_send(fd, ack, sizeof(ack));
+						pthread_mutex_unlock(&mqtt.mutex);
+					}
+					break;
+				}
+				case MQTT_PUBACK:
+					if( len >= 2 ) {
+						pthread_mutex_lock(&mqtt.mutex);
+						mqtt_acked((unsigned int)buf[0] << 8 | buf[1]);
+						pthread_mutex_unlock(&mqtt.mutex);
+					}
+					break;
+				case MQTT_SUBACK:
+					if( len > 2 && memchr(buf + 2, 0x80, len - 2) != NULL ) {
+						debug(LOG_WARNING, "MQTT broker %s refused a subscription", mqtthost);
+					}
+					break;
+				default:
+					/* PINGRESP */
+					break;
+			}
+		}
+
+		debug(LOG_WARNING, "MQTT connection to %s lost", mqtthost);
+		pthread_mutex_lock(&mqtt.mutex);
+		mqtt.fd = -1;
+		close(fd);
+		pthread_mutex_unlock(&mqtt.mutex);
+		sleep(MQTT_RETRY);
+	}
+	session_free(&session);
+	return NULL;
+}
+
+/* 	Topic and payload of the state or temperature event <ev>:
+	"<prefix>/<device levels>/state" with the state, e.g. lm/fs20/1111/state
+	"ON", or "<prefix>/temp" with the temperature.
+	returns false if the event has none */
+bool mqtt_topic(const struct event *ev, char *topic, size_t tsize, char *payload, size_t psize)
+{
+	const char *json = ev->data + ev->json;
+	char device[sizeof(states[0].device)];
+	char *ptr;
+
+	if( ev->type == EVENT_TEMP ) {
+		snprintf(topic, tsize, "%s/temp", mqttprefix);
+		return mqtt_json(json, ev->jsonlen, "temp", payload, psize);
+	}
+	if( !mqtt_json(json, ev->jsonlen, "device", device, sizeof(device)) ||
+		!mqtt_json(json, ev->jsonlen, "state", payload, psize) ) {
+		return false;
+	}
+	for(ptr = device; *ptr; ptr++) {
+		*ptr = (*ptr == ' ') ? '/' : tolower((unsigned char)*ptr);
+	}
+	snprintf(topic, tsize, "%s/%s/state", mqttprefix, device);
+	return true;
+}
+
+/* 	Copy the value of field <name> of the flat JSON object <json> of <len>
+	bytes (strings without escapes or numbers) into <value>.
+	returns false if there is no such field */
+bool mqtt_json(const char *json, size_t len, const char *name, char *value, size_t size)
+{
+	const char *end = json + len;
+	const char *ptr;
+	const char *stop;
+	char key[32];
+	size_t n;
+
+	n = snprintf(key, sizeof(key), "\"%s\":", name);
+	if( (ptr = memmem(json, len, key, n)) == NULL ) {
+		return false;
+	}
+	ptr += n;
+	if( ptr < end && *ptr == '"' ) {
+		ptr++;
+		stop = memchr(ptr, '"', end - ptr);
+	}
+	else {
+		for(stop = ptr; stop < end && *stop != ',' && *stop != '}'; stop++);
+	}
+	if( stop == NULL ) {
+		return false;
+	}
+	n = ((size_t)(stop - ptr) < size) ? (size_t)(stop - ptr) : size - 1;
+	memcpy(value, ptr, n);
+	value[n] = '\0';
+	return true;
+}
+
+/* 	Publisher thread of the MQTT bridge: turns state and temperature
+	events into retained QoS 1 publications. The events of a burst (e.g. a
+	group command) are collected for MQTT_BATCH_MS and sent at once. While
+	disconnected up to MQTT_INFLIGHT publications are kept */
+void *mqtt_publisher(void *arg)
+{
+	unsigned long cursor;
+
+	pthread_mutex_lock(&mutex_events);
+	cursor = event_seq;
+	pthread_mutex_unlock(&mutex_events);
+	while(true) {
+		struct event batch[MQTT_INFLIGHT];
+		struct timespec timeout;
+		unsigned long lost = 0;
+		int count = 0;
+		int room;
+		int first = -1;
+		int i;
+
+		pthread_mutex_lock(&mutex_events);
+		if( cursor == event_seq ) {
+			clock_gettime(CLOCK_REALTIME, &timeout);
+			timeout.tv_sec += 1;
+			pthread_cond_timedwait(&cond_events, &mutex_events, &timeout);
+		}
+		count = (cursor != event_seq);
+		pthread_mutex_unlock(&mutex_events);
+		if( count > 0 ) {
+			usleep(MQTT_BATCH_MS * 1000);
+		}
+
+		/* wait for room in flight, meanwhile events may be lost */
+		pthread_mutex_lock(&mqtt.mutex);
+		while( mqtt.count >= MQTT_INFLIGHT ) {
+			clock_gettime(CLOCK_REALTIME, &timeout);
+			timeout.tv_sec += 1;
+			pthread_cond_timedwait(&mqtt.cond, &mqtt.mutex, &timeout);
+		}
+		room = MQTT_INFLIGHT - mqtt.count;
+		pthread_mutex_unlock(&mqtt.mutex);
+
+		count = 0;
+		pthread_mutex_lock(&mutex_events);
+		if( event_seq - cursor > EVENT_RING_SIZE ) {
+			lost = event_seq - cursor - EVENT_RING_SIZE;
+			cursor = event_seq - EVENT_RING_SIZE;
+		}
+		while( cursor < event_seq && count < room ) {
+			memcpy(&batch[count++], &events[cursor++ % EVENT_RING_SIZE], sizeof(batch[0]));
+		}
+		pthread_mutex_unlock(&mutex_events);
+
+		pthread_mutex_lock(&mqtt.mutex);
+		mqtt.lost += lost;
+		for(i=0; i<count; i++) {
+			char topic[128];
+			char payload[32];
+			int index;
+
+			if( mqtt_topic(&batch[i], topic, sizeof(topic), payload, sizeof(payload)) &&
+				(index = mqtt_enqueue(topic, payload, true)) >= 0 && first < 0 ) {
+				first = index;
+			}
+		}
+		if( mqtt.fd >= 0 ) {
+			if( first >= 0 && mqtt_transmit(first, false) < 0 ) {
+				/* the connection thread notices and reconnects */
+				shutdown(mqtt.fd, SHUT_RDWR);
+			}
+			else if( time(NULL) - mqtt.lastsend >= MQTT_KEEPALIVE / 2 ) {
+				unsigned char ping[2] = { MQTT_PINGREQ, 0 };
+
+				if( mqtt_send(mqtt.fd, ping, sizeof(ping)) < 0 ) {
+					shutdown(mqtt.fd, SHUT_RDWR);
+				}
+			}
+		}
+		pthread_mutex_unlock(&mqtt.mutex);
+	}
+	return NULL;
+}
+
+/* Writes the state of the MQTT bridge to client */
+void mqtt_stats(int socket_handle, int flags)
+{
+	if( mqtthost[0] == '\0' ) {
+		return;
+	}
+	pthread_mutex_lock(&mqtt.mutex);
+	write_to_client(socket_handle, flags, "MQTT %s port %s %s, %lu connects, %lu published (%d in flight, %lu lost), %lu commands (%lu failed)\r\n",
+					mqtthost, mqttport, (mqtt.fd >= 0) ? "connected" : "disconnected", mqtt.connects,
+					mqtt.published, mqtt.count, mqtt.lost, mqtt.received, mqtt.failed);
+	pthread_mutex_unlock(&mqtt.mutex);
+}
+
+
+/* ======================================================================== */
+/* Admission control */
+/* ======================================================================== */
+
+/* 	Set the limits of the comma separated <name>=<value> list <arg>,
+	returns EXIT_SUCCESS or EXIT_FAILURE on unknown names or values < 1 */
+int limits_parse(const char *arg)
+{
+	char list[256];
+	char *saveptr;
+	char *item;
+
+	strncpy(list, arg, sizeof(list)-1);
+	list[sizeof(list)-1] = '\0';
+	for(item = strtok_r(list, ",", &saveptr); item != NULL; item = strtok_r(NULL, ",", &saveptr)) {
+		char *value = strchr(item, '=');
+		char *end;
+		long n;
+
+		if( value == NULL ) {
+			debug(LOG_ERR, "wrong limit '%s', use <name>=<value>", item);
+			return EXIT_FAILURE;
+		}
+		*value++ = '\0';
+		n = strtol(value, &end, 10);
+		if( n < 1 || n > INT_MAX || *end != '\0' ) {
+			debug(LOG_ERR, "wrong value of limit %s: '%s'", item, value);
+			return EXIT_FAILURE;
+		}
+		if( stricmp(item, "connections") == 0 ) {
+			limits.connections = n;
+		}
+		else if( stricmp(item, "client") == 0 ) {
+			limits.client = (n < BATCH_MAX_CMDS) ? n : BATCH_MAX_CMDS;
+		}
+		else if( stricmp(item, "total") == 0 ) {
+			limits.total = n;
+		}
+		else if( stricmp(item, "output") == 0 ) {
+			limits.output = n;
+		}
+		else if( stricmp(item, "backlog") == 0 ) {
+			limits.backlog = n;
+		}
+		else if( stricmp(item, "line") == 0 ) {
+			limits.line = n;
+		}
+		else {
+			debug(LOG_ERR, "unknown limit '%s'", item);
+			return EXIT_FAILURE;
+		}
+	}
+	return EXIT_SUCCESS;
+}
+
+/* 	Reserve <count> frames if they fit into the per client and the global
+	limit of queued frames, the client's frames include all its pipelined
+	commands in flight. returns 0 or -1 if the device is too busy,
+	<errormsg> tells which limit was hit */
+int admit_reserve(int count, char **errormsg)
+{
+	if( thread_queued + count > limits.client ) {
+		atomic_fetch_add(&busy_commands, 1);
+		*errormsg = seterror("%d frames, max %d queued per client", thread_queued + count, limits.client);
+		return -1;
+	}
+	if( atomic_fetch_add(&queued_frames, count) + count > limits.total ) {
+		atomic_fetch_sub(&queued_frames, count);
+		atomic_fetch_add(&busy_commands, 1);
+		*errormsg = seterror("max %d frames queued, try again later", limits.total);
+		return -1;
+	}
+	thread_queued += count;
+	return 0;
+}
+
+/* 	Release <count> frames reserved by admit_reserve() once they are sent,
+	called by the thread which reserved them */
+void admit_release(int count)
+{
+	atomic_fetch_sub(&queued_frames, count);
+	thread_queued -= count;
+}
+
+/* 	Submit <count> frames through the queue of the calling thread within
+	the admission limits. returns the number of frames not sent or -1 if
+	nothing was sent because the device is too busy, see admit_reserve() */
+int admit_submit(unsigned char (*frames)[8], int count, struct lm_result *results, char **errormsg)
+{
+	int rc;
+
+	if( admit_reserve(count, errormsg) < 0 ) {
+		return -1;
+	}
+	rc = lm_submit(dev_handle, frames, count, results);
+	admit_release(count);
+	return rc;
+}
+
+/* 	Reject the new connection <fd> over the connection limit without
+	blocking the acceptor: the reply is sent by tcp_server_rejecter(). If
+	too many rejected connections are waiting already, <fd> is closed */
+void tcp_server_reject(int fd)
+{
+	atomic_fetch_add(&rejected_connections, 1);
+	pthread_once(&reject_once, tcp_server_reject_start);
+	pthread_mutex_lock(&mutex_reject);
+	if( reject_count < REJECT_MAX ) {
+		reject_queue[reject_count++] = fd;
+		fd = -1;
+		pthread_cond_signal(&cond_reject);
+	}
+	pthread_mutex_unlock(&mutex_reject);
+	if( fd >= 0 ) {
+		close(fd);
+	}
+}
+
+void tcp_server_reject_start(void)
+{
+	pthread_t thread_id;
+	pthread_attr_t attr;
+
+	thread_attr_init(&attr);
+	if( pthread_create(&thread_id, &attr, tcp_server_rejecter, NULL) != 0 ) {
+		debug(LOG_ERR, "Rejecting thread not started");
+	}
+	pthread_attr_destroy(&attr);
+}
+
+/* 	Rejecting thread: waits for the request of all rejected connections
+	together, up to REJECT_WAIT ms each, then replies and closes them */
+void *tcp_server_rejecter(void *arg)
+{
+	struct pollfd pending[REJECT_MAX];
+	long long deadline[REJECT_MAX];
+	int count = 0;
+	int i;
+
+	while(true) {
+		long long now;
+
+		pthread_mutex_lock(&mutex_reject);
+		while( count == 0 && reject_count == 0 ) {
+			pthread_cond_wait(&cond_reject, &mutex_reject);
+		}
+		now = time_us();
+		while( count < REJECT_MAX && reject_count > 0 ) {
+			pending[count].fd = reject_queue[--reject_count];
+			pending[count].events = POLLIN;
+			deadline[count++] = now + REJECT_WAIT * 1000LL;
+		}
+		pthread_mutex_unlock(&mutex_reject);
+
+		/* new rejections are taken at the latest after REJECT_WAIT */
+		poll(pending, count, REJECT_WAIT);
+		now = time_us();
+		for(i=0; i<count; ) {
+			if( pending[i].revents != 0 || deadline[i] <= now ) {
+				tcp_server_reject_reply(pending[i].fd);
+				pending[i] = pending[--count];
+				deadline[i] = deadline[count];
+			}
+			else {
+				i++;
 			}
 		}
+	}
+	return NULL;
+}
 
-		/* Output executed command */
-		if( !quiet && (flags & HANDLE_INPUT_NOOK)==0 ) {
-			/* Output status */
-			write_to_client(socket_handle, flags, "%s: %s%s\r\n", (cmdexec != NULL)?cmdexec:"<unknown>", (fcmdok)?"OK":"ERROR - ", (fcmdok)?"":((errormsg != NULL)?errormsg:"<unknown>") );
+/* 	Reply to the rejected connection <fd> and close it. HTTP clients send
+	their request at once and get 503, the others a line "BUSY" */
+void tcp_server_reject_reply(int fd)
+{
+	char buf[64];
+	ssize_t len;
+
+	len = recv(fd, buf, sizeof(buf)-1, MSG_DONTWAIT);
+	if( len > 0 && (strnicmp(buf, "GET ", 4) == 0 || strnicmp(buf, "POST ", 5) == 0) ) {
+		request_header(fd, 503, "Service Unavailable", "text/plain", "Retry-After: 1\r\n");
+		write_to_client(fd, 0, "BUSY\r\n");
+	}
+	else {
+		write_to_client(fd, 0, "BUSY\r\n");
+	}
+	/* read what is left, so close() does not reset the connection before the reply */
+	shutdown(fd, SHUT_WR);
+	while( recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0 );
+	close(fd);
+}
+
+/* Writes the admission limits and counters to client */
+void limits_stats(int socket_handle, int flags)
+{
+	write_to_client(socket_handle, flags, "LIMITS connections %d/%d (%lu rejected), queued frames %d/%d (%d per client, %lu busy), output %d bytes, line %d bytes, backlog %d\r\n",
+					atomic_load(&connections), limits.connections, atomic_load(&rejected_connections),
+					atomic_load(&queued_frames), limits.total, limits.client, atomic_load(&busy_commands),
+					limits.output, limits.line, limits.backlog);
+}
+
+
+/* ======================================================================== */
+/* Pipelined commands */
+/* ======================================================================== */
+
+/* 	Prepare <pipe> for commands of up to <maxline> chars, all buffers are
+	allocated once. returns EXIT_SUCCESS or EXIT_FAILURE */
+int pipeline_init(struct pipeline *pipe, size_t maxline)
+{
+	int i;
+
+	for(i=0; i<PIPELINE_DEPTH; i++) {
+		if( pipe->slot[i].command == NULL && (pipe->slot[i].command = malloc(maxline + 1)) == NULL ) {
+			return EXIT_FAILURE;
 		}
-		if( cmdexec != NULL ) {
-			free(cmdexec);
-			cmdexec = NULL;
+	}
+	pipe->cmdsize = maxline + 1;
+	return EXIT_SUCCESS;
+}
+
+/* Wait for the commands still in flight, their replies are dropped */
+void pipeline_free(struct pipeline *pipe)
+{
+	int i;
+
+	for(; pipe->count > 0; pipe->count--) {
+		struct pipeslot *slot = &pipe->slot[pipe->head];
+
+		if( slot->burst != NULL ) {
+			lm_submit_finish(slot->burst, NULL);
+			admit_release(slot->count);
 		}
-		if( errormsg != NULL ) {
-			free(errormsg);
-			errormsg = NULL;
+		pipe->head = (pipe->head + 1) % PIPELINE_DEPTH;
+	}
+	for(i=0; i<PIPELINE_DEPTH; i++) {
+		free(pipe->slot[i].command);
+		free(pipe->slot[i].frames);
+	}
+	memset(pipe, 0, sizeof(*pipe));
+}
+
+/* 	Take the tag "@<tag>" off a <line> of a pipelined connection, it is
+	repeated with each reply of the line. Other connections have no tags.
+	returns the line without the tag */
+char *pipeline_tag(struct session *session, char *line)
+{
+	struct pipeline *pipe = &session->pipeline;
+	size_t len;
+
+	pipe->tag[0] = pipe->prefix[0] = '\0';
+	session->out.jsontag = NULL;
+	if( !pipe->active || *line != '@' ) {
+		return line;
+	}
+	len = strcspn(line + 1, " \t");
+	snprintf(pipe->tag, sizeof(pipe->tag), "%.*s", (int)len, line + 1);
+	snprintf(pipe->prefix, sizeof(pipe->prefix), "@%s ", pipe->tag);
+	session->out.jsontag = pipe->tag;
+	return trim(line + 1 + len);
+}
+
+/* 	Returns true if <command> starts with a device keyword or an alias,
+	the only commands which do not wait for those in flight */
+bool pipeline_device(const char *command)
+{
+	char tok_delimiter[] = TOKEN_DELIMITER;
+	const char *name = command + strspn(command, tok_delimiter);
+	size_t len = strcspn(name, tok_delimiter);
+	bool found;
+	int slot;
+
+	if( is_device_cmd(name, len) ) {
+		return true;
+	}
+	found = (alias_lookup(alias_read_lock(&slot), name, len) != NULL);
+	alias_read_unlock(slot);
+	return found;
+}
+
+/* 	Send the <count> encoded <frames> of <command> without waiting, or
+	queue its <error> (NULL if encoded) as reply. The reply follows by
+	pipeline_finish() in order. A full pipeline waits for its oldest command */
+void pipeline_submit(struct session *session, int socket_handle, const char *command, unsigned char (*frames)[8], int count, const char *error)
+{
+	struct pipeline *pipe = &session->pipeline;
+	struct pipeslot *slot;
+	char *errormsg = NULL;
+
+	if( pipe->count == PIPELINE_DEPTH ) {
+		pipeline_finish(session, socket_handle);
+	}
+	slot = &pipe->slot[(pipe->head + pipe->count++) % PIPELINE_DEPTH];
+	strcpy(slot->tag, pipe->tag);
+	snprintf(slot->command, pipe->cmdsize, "%s", command);
+	slot->count = count;
+	slot->burst = NULL;
+	slot->busy = false;
+	slot->error[0] = '\0';
+	if( error != NULL ) {
+		snprintf(slot->error, sizeof(slot->error), "%s", error);
+		return;
+	}
+	if( admit_reserve(count, &errormsg) < 0 ) {
+		snprintf(slot->error, sizeof(slot->error), "%s", (errormsg != NULL) ? errormsg : "<unknown>");
+		slot->busy = true;
+		return;
+	}
+	if( count > slot->size ) {
+		unsigned char (*newframes)[8] = realloc(slot->frames, count * sizeof(*newframes));
+
+		if( newframes == NULL ) {
+			admit_release(count);
+			strcpy(slot->error, "out of memory");
+			return;
 		}
+		slot->frames = newframes;
+		slot->size = count;
+	}
+	memcpy(slot->frames, frames, count * sizeof(*frames));
+	if( (slot->burst = lm_submit_start(dev_handle, slot->frames, count)) == NULL ) {
+		admit_release(count);
+		strcpy(slot->error, "out of memory");
 	}
+}
+
+/* 	Wait for the oldest command in flight and send its reply.
+	returns 0 or -1 if sending failed */
+int pipeline_finish(struct session *session, int socket_handle)
+{
+	struct pipeline *pipe = &session->pipeline;
+	struct pipeslot *slot;
+	const char *error;
+	const char *status;
+	int rc;
 
+	if( pipe->count == 0 ) {
+		return 0;
+	}
+	slot = &pipe->slot[pipe->head];
+	pipe->head = (pipe->head + 1) % PIPELINE_DEPTH;
+	pipe->count--;
+	if( slot->burst != NULL ) {
+		int failed = lm_submit_finish(slot->burst, NULL);
+
+		slot->burst = NULL;
+		admit_release(slot->count);
+		if( failed != 0 ) {
+			snprintf(slot->error, sizeof(slot->error), "USB communication error (%d frames not sent)", failed);
+		}
+	}
+	error = (slot->error[0] != '\0') ? slot->error : NULL;
+	status = (error == NULL) ? "OK" : (slot->busy ? "BUSY" : "ERROR");
+	if( session->json ) {
+		const char *jsoncmd = session->out.jsoncmd;
+		const char *jsontag = session->out.jsontag;
+
+		session->out.jsoncmd = slot->command;
+		session->out.jsontag = (slot->tag[0] != '\0') ? slot->tag : NULL;
+		rc = json_close(socket_handle, status, error);
+		session->out.jsoncmd = jsoncmd;
+		session->out.jsontag = jsontag;
+	}
+	else {
+		rc = write_to_client(socket_handle, 0, "%s%s%s%s: %s%s%s\r\n",
+							 (slot->tag[0] != '\0') ? "@" : "", slot->tag, (slot->tag[0] != '\0') ? " " : "",
+							 slot->command, status, (error != NULL) ? " - " : "", (error != NULL) ? error : "");
+	}
+	/* stream each reply as soon as it is known */
+	if( rc < 0 || out_flush(&session->out) < 0 ) {
+		return -1;
+	}
 	return 0;
 }
 
+/* 	Wait for all commands in flight and send their replies in order.
+	returns 0 or -1 if sending failed */
+int pipeline_drain(struct session *session, int socket_handle)
+{
+	int rc = 0;
+
+	while( session->pipeline.count > 0 ) {
+		if( pipeline_finish(session, socket_handle) < 0 ) {
+			rc = -1;
+		}
+	}
+	return rc;
+}
+
 
 /* ======================================================================== */
 /* TCP socket thread functions */
 /* ======================================================================== */
 
-int tcp_server_init(int port)
-/* Server (listen) open port - only once
- * in port: TCP server port number
- * return: Socket filedescriptor
- */
+/* 	Open a listening socket on <addr> (IPv4 or IPv6, "::" accepts IPv4 as
+	well) and <port>. Several sockets may listen on the same address, the
+	kernel spreads the connections (SO_REUSEPORT).
+	returns the socket or -1, errno tells why */
+int tcp_server_init(const char *addr, int port)
 {
+	struct addrinfo hints;
+	struct addrinfo *ai;
+	char service[16];
 	int listen_fd;
-	int ret;
-	struct sockaddr_in sock;
 	int yes = 1;
+	int rc;
 
-	listen_fd = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
-	exit_if(listen_fd < 0);
-
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST | AI_NUMERICSERV;
+	snprintf(service, sizeof(service), "%d", port);
+	if( (rc = getaddrinfo(addr, service, &hints, &ai)) != 0 ) {
+		debug(LOG_ERR, "Listen address '%s': %s", addr, gai_strerror(rc));
+		errno = EINVAL;
+		return -1;
+	}
+	listen_fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+	if( listen_fd < 0 ) {
+		freeaddrinfo(ai);
+		return -1;
+	}
 	/* prevent "Error Address already in use" error */
-	ret = setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int));
-	exit_if(ret < 0);
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes));
+	if( ai->ai_family == AF_INET6 ) {
+		/* only the wildcard address is dual-stack */
+		int v6only = (strcmp(addr, "::") != 0);
 
-	memset((char *) &sock, 0, sizeof(sock));
-	sock.sin_family = AF_INET;
-	sock.sin_addr.s_addr = s_addr;
-	sock.sin_port = htons(port);
+		setsockopt(listen_fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+	}
 
 	debug(LOG_DEBUG, "Server bind socket");
-	ret = bind(listen_fd, (struct sockaddr *) &sock, sizeof(sock));
-	exit_if(ret != 0);
-
-	debug(LOG_DEBUG, "Server listening");
-	ret = listen(listen_fd, 5);
-	exit_if(ret < 0);
-
-	debug(LOG_INFO, "Server now listen on port %d", port);
+	rc = bind(listen_fd, ai->ai_addr, ai->ai_addrlen);
+	freeaddrinfo(ai);
+	if( rc != 0 || listen(listen_fd, limits.backlog) != 0 ) {
+		int err = errno;
 
+		close(listen_fd);
+		errno = err;
+		return -1;
+	}
 	return listen_fd;
 }
 
+/* 	Open the sockets of all listen addresses (-a, default "::" or "0.0.0.0"
+	without IPv6), one per address and acceptor thread.
+	returns the number of listeners or -1 if an address fails */
+int tcp_server_listen(int port)
+{
+	int somaxconn = 0;
+	int i, n;
+	FILE *fp;
+
+	if( listenaddrcount == 0 ) {
+		strcpy(listenaddrs[listenaddrcount++], "::");
+	}
+	/* the kernel silently caps the backlog */
+	if( (fp = fopen("/proc/sys/net/core/somaxconn", "r")) != NULL ) {
+		if( fscanf(fp, "%d", &somaxconn) != 1 ) {
+			somaxconn = 0;
+		}
+		fclose(fp);
+	}
+	if( somaxconn > 0 && limits.backlog > somaxconn ) {
+		debug(LOG_WARNING, "Listen backlog %d is capped to net.core.somaxconn %d", limits.backlog, somaxconn);
+	}
+	for(i=0; i<listenaddrcount; i++) {
+		for(n=1; n<=acceptors; n++) {
+			struct listener *listener = &listeners[listener_count];
+			const char *addr = listenaddrs[i];
+
+			listener->fd = tcp_server_init(addr, port);
+			if( listener->fd < 0 && errno == EAFNOSUPPORT && strcmp(addr, "::") == 0 ) {
+				debug(LOG_INFO, "No IPv6, listen on IPv4 only");
+				strcpy(listenaddrs[i], "0.0.0.0");
+				listener->fd = tcp_server_init(addr, port);
+			}
+			if( listener->fd < 0 ) {
+				debug(LOG_ERR, "Cannot listen on %s port %d: %s", addr, port, strerror(errno));
+				for(; listener_count > 0; listener_count--) {
+					close(listeners[listener_count-1].fd);
+				}
+				return -1;
+			}
+			snprintf(listener->name, sizeof(listener->name), strchr(addr, ':') ? "[%s]:%d" : "%s:%d", addr, port);
+			listener->acceptor = n;
+			listener->backlog = (somaxconn > 0 && limits.backlog > somaxconn) ? somaxconn : limits.backlog;
+			atomic_init(&listener->accepted, 0);
+			atomic_init(&listener->queuemax, 0);
+			listener_count++;
+		}
+		debug(LOG_INFO, "Server now listen on %s port %d (%d acceptors)", listenaddrs[i], port, n - 1);
+	}
+	return listener_count;
+}
 
-int tcp_server_connect(int listen_sock, struct sockaddr_in *psock)
+int tcp_server_connect(int listen_sock, char *peer, size_t len)
 /* Client TCP connection - for each client
  * in listen_sock: Socket main filedescriptor to get client connected
+ * out peer: numeric client address
  * return: Client socket filedescriptor or error
  */
 {
 	int fd;
-	struct sockaddr_in sock;
+	struct sockaddr_storage sock;
 	socklen_t socklen;
 
 	socklen = sizeof(sock);
 	fd = accept(listen_sock, (struct sockaddr *) &sock, &socklen);
 	return_if(fd < 0, -1);
 
-	if( psock != NULL ) {
-		memcpy(psock, &sock, socklen);
+	if( peer != NULL ) {
+		if( getnameinfo((struct sockaddr *) &sock, socklen, peer, len, NULL, 0, NI_NUMERICHOST) != 0 ) {
+			snprintf(peer, len, "?");
+		}
+		else if( strncmp(peer, "::ffff:", 7) == 0 ) {
+			/* IPv4 client of a dual-stack socket */
+			memmove(peer, peer + 7, strlen(peer + 7) + 1);
+		}
 	}
 	return fd;
 }
 
-int recbuffer(int s, void *buf, size_t len, int flags)
+/* 	Record the length of the accept queue of <listener> left after an
+	accept(), a long queue means the acceptors do not keep up */
+void tcp_server_queue(struct listener *listener)
 {
-	int rc;
-	int slen;
-	char *str;
+	struct tcp_info info;
+	socklen_t len = sizeof(info);
+
+	/* of a listening socket tcpi_unacked is the accept queue length */
+	if( getsockopt(listener->fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0 ) {
+		unsigned int max = atomic_load(&listener->queuemax);
+
+		while( info.tcpi_unacked > max && !atomic_compare_exchange_weak(&listener->queuemax, &max, info.tcpi_unacked) );
+	}
+}
+
+/* 	Acceptor thread of one <listener> (struct listener *): accepts the
+	clients and starts a thread for each */
+void *tcp_server_accept(void *arg)
+{
+	struct listener *listener = (struct listener *)arg;
+
+	while (true) {
+		char peer[INET6_ADDRSTRLEN];
+		int client_fd;
+		pthread_t thread_id;
+		pthread_attr_t attr;
+		struct client *client;
+		int ret;
+
+		/* Check TCP server listen port (client connect) */
+		client_fd = tcp_server_connect(listener->fd, peer, sizeof(peer));
+		debug(LOG_DEBUG, "tcp_server_connect((%d,...) returns %d", listener->fd, client_fd);
+		if (client_fd < 0) {
+			continue;
+		}
+		atomic_fetch_add(&listener->accepted, 1);
+		tcp_server_queue(listener);
+		debug(LOG_DEBUG, "Client connected from %s to %s (handle=%d)", peer, listener->name, client_fd);
+		if( atomic_fetch_add(&connections, 1) >= limits.connections ) {
+			atomic_fetch_sub(&connections, 1);
+			debug(LOG_WARNING, "Client %s rejected, %d connections", peer, limits.connections);
+			tcp_server_reject(client_fd);
+			continue;
+		}
+		/* bounded output: a client not reading it is dropped */
+		{
+			struct timeval timeout = { OUTPUT_TIMEOUT, 0 };
+
+			setsockopt(client_fd, SOL_SOCKET, SO_SNDBUF, &limits.output, sizeof(limits.output));
+			setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+		}
+		pthread_mutex_lock(&mutex_socks);
+		FD_SET(client_fd, &socks);
+		pthread_mutex_unlock(&mutex_socks);
 
-	memset(buf, 0, len);
-	str = (char *)buf;
-	slen = 0;
-	debug(LOG_DEBUG, "recbuffer(%d, %p, %d, %d) called", s, buf, len, flags);
-	while( (rc=recv(s, str, len, flags)) > 0) {
-		slen += rc;
-		if( rc>0 && *(str+rc-1)=='\r' || *(str+rc-1)=='\n' ) {
-			debug(LOG_DEBUG, "recbuffer() returning due to cr/lf: rc=%d", rc);
-			return slen;
+		/* start thread for client command handling */
+		/* we need to created detached threads (PTHREAD_CREATE_DETACHED),
+		   so its thread ID and other resources can be reused as soon as the thread terminates. */
+		thread_attr_init(&attr);
+		if( (client = malloc(sizeof(*client))) == NULL ) {
+			tcp_server_handle_client_end(0, client_fd);
+			pthread_attr_destroy(&attr);
+			continue;
 		}
-		str += rc;
-		// usleep( 50*1000L );
+		client->fd = client_fd;
+		client->accepted = time_us();
+		ret = pthread_create(&thread_id, &attr, tcp_server_handle_client, client);
+		debug(LOG_DEBUG, "client thread %sstarted (thread_id=%ul)", ret==0?"":"not ", thread_id);
+		if( ret != 0 ) {
+			free(client);
+			tcp_server_handle_client_end(0, client_fd);
+		}
+		pthread_attr_destroy(&attr);
 	}
-	debug(LOG_DEBUG, "recbuffer() returning: rc=%d", rc);
-	return rc;
+	return NULL;
+}
+
+/* 	Read the system wide TCP counters of connections dropped because an
+	accept queue was full (<overflows>) or for any reason (<drops>).
+	returns EXIT_SUCCESS or EXIT_FAILURE if not available */
+int tcp_server_drops(unsigned long *overflows, unsigned long *drops)
+{
+	char names[8192];
+	char values[8192];
+	int found = 0;
+	FILE *fp;
+
+	if( (fp = fopen("/proc/net/netstat", "r")) == NULL ) {
+		return EXIT_FAILURE;
+	}
+	/* pairs of lines "TcpExt: <names>" and "TcpExt: <values>" */
+	while( fgets(names, sizeof(names), fp) != NULL && fgets(values, sizeof(values), fp) != NULL ) {
+		char *nsave, *vsave;
+		char *name, *value;
+
+		if( strncmp(names, "TcpExt:", 7) != 0 ) {
+			continue;
+		}
+		for(name = strtok_r(names, " \n", &nsave), value = strtok_r(values, " \n", &vsave);
+			name != NULL && value != NULL;
+			name = strtok_r(NULL, " \n", &nsave), value = strtok_r(NULL, " \n", &vsave)) {
+			if( strcmp(name, "ListenOverflows") == 0 ) {
+				*overflows = strtoul(value, NULL, 10);
+				found++;
+			}
+			else if( strcmp(name, "ListenDrops") == 0 ) {
+				*drops = strtoul(value, NULL, 10);
+				found++;
+			}
+		}
+		break;
+	}
+	fclose(fp);
+	return (found == 2) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* Writes the accepted connections and accept queue of each listener to client */
+void tcp_server_stats(int socket_handle, int flags)
+{
+	unsigned long overflows, drops;
+	int i;
+
+	for(i=0; i<listener_count; i++) {
+		struct listener *listener = &listeners[i];
+		struct tcp_info info;
+		socklen_t len = sizeof(info);
+		unsigned int queue = 0;
+
+		if( getsockopt(listener->fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0 ) {
+			queue = info.tcpi_unacked;
+		}
+		write_to_client(socket_handle, flags, "LISTEN %s acceptor %d: %lu accepted, accept queue %u/%d (max %u)\r\n",
+						listener->name, listener->acceptor, atomic_load(&listener->accepted),
+						queue, listener->backlog, atomic_load(&listener->queuemax));
+	}
+	if( tcp_server_drops(&overflows, &drops) == EXIT_SUCCESS ) {
+		write_to_client(socket_handle, flags, "LISTEN system wide %lu accept queue overflows, %lu SYN drops\r\n", overflows, drops);
+	}
+}
+
+/* 	Allocate the ring of <reader> for lines of up to <max> bytes, the ring
+	holds at least two of them. returns EXIT_SUCCESS or EXIT_FAILURE */
+int line_init(struct linereader *reader, size_t max)
+{
+	memset(reader, 0, sizeof(*reader));
+	reader->max = max;
+	for(reader->size = 256; reader->size < 2 * max; reader->size *= 2);
+	if( (reader->ring = malloc(reader->size)) == NULL || (reader->line = malloc(max + 1)) == NULL ) {
+		line_free(reader);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+void line_free(struct linereader *reader)
+{
+	free(reader->ring);
+	free(reader->line);
+	reader->ring = NULL;
+	reader->line = NULL;
+}
+
+/* Copy <len> bytes of the ring starting at the stream offset <from> into <dst> */
+void line_copy(const struct linereader *reader, size_t from, char *dst, size_t len)
+{
+	size_t off = from & (reader->size - 1);
+	size_t first = (len < reader->size - off) ? len : reader->size - off;
+
+	memcpy(dst, reader->ring + off, first);
+	memcpy(dst + first, reader->ring, len - first);
+}
+
+/* 	Look for a complete message at the start of the unread data, continuing
+	the search where the last call stopped. A message is a line ended by
+	CR, LF or CR LF, or an HTTP request: the request line, the header up to
+	the empty line and Content-Length bytes of body.
+	returns true and the length of the message and of the data it takes
+	within the ring (including the line break), reader->line holds the
+	message up to the max line length */
+bool line_frame(struct linereader *reader, size_t *len, size_t *consume)
+{
+	if( reader->cr && reader->tail < reader->head ) {
+		/* second half of CR LF */
+		if( LINE_RING(reader, reader->tail) == '\n' ) {
+			reader->tail++;
+		}
+		reader->cr = false;
+		if( reader->scan < reader->tail ) {
+			reader->scan = reader->tail;
+		}
+	}
+	if( !reader->http ) {
+		while( reader->scan < reader->head && LINE_RING(reader, reader->scan) != '\n' && LINE_RING(reader, reader->scan) != '\r' ) {
+			reader->scan++;
+		}
+		if( reader->scan == reader->head ) {
+			return false;
+		}
+		*len = reader->scan - reader->tail;
+		line_copy(reader, reader->tail, reader->line, (*len < reader->max) ? *len : reader->max);
+		reader->line[(*len < reader->max) ? *len : reader->max] = '\0';
+		if( (strnicmp(reader->line, "GET ", 4) != 0 && strnicmp(reader->line, "POST ", 5) != 0) || stristr(reader->line, " HTTP/1.") == NULL ) {
+			*consume = reader->scan - reader->tail + 1;
+			reader->cr = (LINE_RING(reader, reader->scan) == '\r');
+			return true;
+		}
+		reader->http = true;
+	}
+
+	/* HTTP request: the header ends with an empty line */
+	if( reader->msglen == 0 ) {
+		size_t header = 0;
+		char *ptr;
+
+		for(; reader->scan < reader->head; reader->scan++) {
+			size_t p = reader->scan;
+
+			if( LINE_RING(reader, p) != '\n' || p + 1 >= reader->head ) {
+				continue;
+			}
+			if( LINE_RING(reader, p + 1) == '\n' ) {
+				header = p + 2 - reader->tail;
+				break;
+			}
+			if( LINE_RING(reader, p + 1) == '\r' ) {
+				if( p + 2 >= reader->head ) {
+					break;
+				}
+				if( LINE_RING(reader, p + 2) == '\n' ) {
+					header = p + 3 - reader->tail;
+					break;
+				}
+			}
+		}
+		if( header == 0 || header > reader->max ) {
+			return false;
+		}
+		line_copy(reader, reader->tail, reader->line, header);
+		reader->line[header] = '\0';
+		reader->msglen = header;
+		if( (ptr = stristr(reader->line, "\nContent-Length:")) != NULL ) {
+			reader->msglen += strtoul(ptr + 16, NULL, 10);
+		}
+	}
+	if( reader->msglen > reader->max || reader->head - reader->tail < reader->msglen ) {
+		return false;
+	}
+	*len = *consume = reader->msglen;
+	line_copy(reader, reader->tail, reader->line, *len);
+	reader->line[*len] = '\0';
+	reader->http = false;
+	reader->msglen = 0;
+	return true;
+}
+
+/* 	Read the next line (or HTTP request) of socket <s> into reader->line,
+	without the line break. Lines already received are returned without
+	reading, a line split over several reads is carried over.
+	Without <fwait> only what is received already is read.
+	returns the length of the line, LINE_TOOLONG if it exceeds the max line
+	length (dropped up to its end, HTTP requests can not be continued),
+	LINE_NONE if no line is complete without <fwait> or -1 if the connection
+	is closed */
+int line_read(struct linereader *reader, int s, bool fwait)
+{
+	while(true) {
+		size_t len;
+		size_t consume;
+		size_t off;
+		size_t room;
+		int rc;
+
+		if( line_frame(reader, &len, &consume) ) {
+			reader->tail += consume;
+			reader->scan = reader->tail;
+			if( reader->discard ) {
+				/* end of an overlong line */
+				reader->discard = false;
+				continue;
+			}
+			return (len > reader->max) ? LINE_TOOLONG : (int)len;
+		}
+		if( reader->head - reader->tail > reader->max || (reader->http && reader->msglen > reader->max) ) {
+			debug(LOG_DEBUG, "line_read(%d): line longer than %zu bytes", s, reader->max);
+			if( reader->http ) {
+				return LINE_TOOLONG;
+			}
+			reader->tail = reader->scan = reader->head;
+			if( !reader->discard ) {
+				/* reported once per line */
+				reader->discard = true;
+				return LINE_TOOLONG;
+			}
+		}
+		off = reader->head & (reader->size - 1);
+		room = reader->size - (reader->head - reader->tail);
+		if( room > reader->size - off ) {
+			room = reader->size - off;
+		}
+		if( (rc = recv(s, reader->ring + off, room, fwait ? 0 : MSG_DONTWAIT)) <= 0 ) {
+			if( rc < 0 && !fwait && (errno == EAGAIN || errno == EWOULDBLOCK) ) {
+				return LINE_NONE;
+			}
+			debug(LOG_DEBUG, "line_read(%d): recv returns %d", s, rc);
+			return -1;
+		}
+		if( reader->head == reader->tail && thread_timing != NULL ) {
+			thread_timing->received = time_us();
+		}
+		reader->head += rc;
+	}
+}
+
+/* Returns true if <reader> holds received input besides the LF of a CR LF */
+bool line_pending(const struct linereader *reader)
+{
+	size_t tail = reader->tail;
+
+	if( reader->cr && tail < reader->head && LINE_RING(reader, tail) == '\n' ) {
+		tail++;
+	}
+	return tail < reader->head;
 }
 
 void tcp_server_handle_client_end(int rc, int client_fd)
@@ -1793,6 +6682,7 @@ void tcp_server_handle_client_end(int rc, int client_fd)
 	FD_CLR(client_fd, &socks);      /* remove dead client_fd */
 	pthread_mutex_unlock(&mutex_socks);
 	close(client_fd);
+	atomic_fetch_sub(&connections, 1);
 	if( rc == -2 ) {
 		rc = usb_release();
 		exit(rc);
@@ -1805,37 +6695,79 @@ void *tcp_server_handle_client(void *arg)
  * in arg: Client socket filedescriptor
  */
 {
-	char buf[INPUT_BUFFER_MAXLEN];
-	int buflen;
 	int s;
 	int rc;
-	int wfd;
+	struct session session;
+	struct client *client = (struct client *)arg;
 
-	s = (int)((long)arg);
+	session_init(&session);
+	s = client->fd;
+	session.timing.accepted = time_us() - client->accepted;
+	free(client);
 	debug(LOG_DEBUG, "tcp_server_handle_client() thread started with client_fd = %d", s);
+	if( line_init(&session.reader, limits.line) != EXIT_SUCCESS ) {
+		session_free(&session);
+		tcp_server_handle_client_end(0, s);
+		pthread_exit(NULL);
+	}
 	while(true) {
-		memset(buf, 0, sizeof(buf));
-		rc = recbuffer(s, buf, sizeof(buf), 0);
-		if ( rc <= 0 ) {
+		/* pipelined: parse all lines received before waiting for a reply */
+		rc = line_read(&session.reader, s, session.pipeline.count == 0);
+		if ( rc == LINE_NONE ) {
+			if( pipeline_finish(&session, s) < 0 ) {
+				session_free(&session);
+				tcp_server_handle_client_end(0, s);
+				pthread_exit(NULL);
+			}
+		}
+		else if ( rc == LINE_TOOLONG ) {
+			if( session.reader.http ) {
+				request_header(s, 413, "Request Entity Too Large", "text/plain", NULL);
+				write_to_client(s, 0, "Request longer than %zu bytes\r\n", session.reader.max);
+				session_free(&session);
+				tcp_server_handle_client_end(0, s);
+				pthread_exit(NULL);
+			}
+			pipeline_drain(&session, s);
+			if( write_to_client(s, 0, "ERROR - line longer than %zu bytes\r\n%s", session.reader.max, session.pipeline.active ? "" : ">")<0 || out_flush(&session.out)<0 ) {
+				session_free(&session);
+				tcp_server_handle_client_end(0, s);
+				pthread_exit(NULL);
+			}
+		}
+		else if ( rc < 0 ) {
 			debug(LOG_DEBUG, "tcp_server_handle_client() thread will be end due to rc = %d", rc);
+			/* the client may only have shut down its sending side */
+			pipeline_drain(&session, s);
+			session_free(&session);
 			tcp_server_handle_client_end(rc, s);
 			pthread_exit(NULL);
 		}
 		else {
-			rc = handle_input(trim(buf), dev_handle, s, 0);
+			timing_start(&session);
+			rc = handle_input(pipeline_tag(&session, trim(session.reader.line)), dev_handle, s, 0, &session);
+			out_flush(&session.out);
+			timing_stop(&session);
+			if( rc >= 0 && session.timing.report && session.timing.received != 0 && !session.pipeline.active ) {
+				char line[256];
+
+				timing_format(&session.timing, line, sizeof(line), false);
+				write_to_client(s, 0, "%s\r\n", line);
+			}
+			timing_record(&session);
+			arena_reset(&session.arena);
 			if ( rc < 0 ) {
 				if( rc > -3 ) {
 					write_to_client(s, 0, "bye\r\n");
 				}
+				session_free(&session);
 				tcp_server_handle_client_end(rc, s);
 				pthread_exit(NULL);
 			}
-			else {
-				if( write_to_client(s, 0, ">")<0 ) {
-					pthread_mutex_lock(&mutex_socks);
-					FD_CLR(s, &socks);      /* remove dead client_fd */
-					pthread_mutex_unlock(&mutex_socks);
-					close(s);
+			else if( !session.pipeline.active ) {
+				if( write_to_client(s, 0, ">")<0 || out_flush(&session.out)<0 ) {
+					session_free(&session);
+					tcp_server_handle_client_end(0, s);
 					pthread_exit(NULL);
 				}
 			}
@@ -1874,37 +6806,85 @@ void usage(void)
 	printf("\nUsage: lightmanager [OPTION]\n");
 	printf("\n");
 	printf("Options are:\n");
-	printf("    -a addr       Listen on TCP <addr> for command client (default all available)\n");
+	printf("    -A file       Load device aliases from <file>, reloaded on SIGHUP\n");
+	printf("    -a addr       Listen on TCP <addr> (IPv4 or IPv6) for command client, may be\n");
+	printf("                  repeated (default all available, '::' also accepts IPv4)\n");
+	printf("    -C period     Check the device clock every <period> seconds, 0 disables (default %d)\n", DEF_CLOCKPERIOD);
 	printf("    -c cmd        Execute command <cmd> and exit (separate commands by ';' or ',')\n");
 	printf("    -d            Start as daemon (default %s)\n", DEF_DAEMON?"yes":"no");
 	printf("    -f pidfile    PID file name and location (default %s)\n", DEF_PIDFILE);
 	printf("    -g            Debug mode (default %s)\n", DEF_DEBUG?"enabled":"disabled");
 	printf("    -h housecode  Use <housecode> for sending FS20 data (default %s)\n", itofs20(buf, DEF_HOUSECODE, NULL));
+	printf("    -J file       Journal device states to <file>, restored at startup (default none)\n");
+	printf("    -L limits     Admission limits as list of <name>=<value>, clients over a limit\n");
+	printf("                  get BUSY (HTTP 503):\n");
+	printf("                    connections  concurrent connections (default %d)\n", DEF_MAXCONN);
+	printf("                    client       queued commands per client (default %d)\n", DEF_MAXCLIENT);
+	printf("                    total        queued frames of all clients (default %d)\n", DEF_MAXTOTAL);
+	printf("                    output       output buffer per client in bytes, a client not\n");
+	printf("                                 reading for %d s is dropped (default %d)\n", OUTPUT_TIMEOUT, DEF_MAXOUTPUT);
+	printf("                    backlog      TCP listen backlog (default %d)\n", DEF_BACKLOG);
+	printf("                    line         input line or HTTP request length (default %d)\n", DEF_MAXLINE);
+	printf("    -M broker     Bridge to the MQTT broker <host>[:port][/prefix] (default port %d,\n", MQTT_PORT);
+	printf("                  prefix %s): publication \"on\" to <prefix>/fs20/1111/set sends\n", DEF_MQTTPREFIX);
+	printf("                  'FS20 1111 on', states go to <prefix>/fs20/1111/state and the\n");
+	printf("                  temperature to <prefix>/temp (QoS 1, retained, persistent session)\n");
+	printf("    -N mode       Simulate the Light Manager without USB hardware, <mode> paced or\n");
+	printf("                  unpaced (without RF duty cycle pacing), e.g. for lmload\n");
+	printf("    -O offset     Set the device clock if it is off by more than <offset> seconds (default %d)\n", DEF_CLOCKOFFSET);
+	printf("    -P acceptors  Accept clients by <acceptors> threads per listen address, each\n");
+	printf("                  with its own socket (SO_REUSEPORT) (default %d)\n", DEF_ACCEPTORS);
 	printf("    -p port       Listen on TCP <port> for command client (default %d)\n", DEF_PORT);
+	printf("    -r            Pace RF frames by their estimated on-air time and the duty cycle\n");
+	printf("                  limit of each protocol, see GET STATS (default %s)\n", DEF_PACED?"on":"off");
+	printf("    -R prio[:cpu] Run the USB thread with SCHED_FIFO priority <prio> (1-99), pinned\n");
+	printf("                  to <cpu>, and lock the process memory (default no real-time)\n");
 	printf("    -s            Redirect output to syslog instead of stdout (default)\n");
+	printf("    -T period     Sample the temperature every <period> seconds, 0 disables (default %d)\n", DEF_TEMPPERIOD);
+	printf("    -t file[:n]   Trace all USB transfers binary into <file>, the last <n> are kept\n");
+	printf("                  (default %d, 32 bytes each), replay with lmreplay\n", DEF_TRACERECORDS);
 	printf("    -?            Prints this help and exit\n");
 	printf("    -v            Prints version and exit\n");
 }
 
 
 int main(int argc, char * argv[]) {
-	int listen_fd;
 	int rc = 0;
 	pid_t pid, sid;
 	char cmdexec[MSG_BUFFER_MAXLEN];
+	struct session session;
 
 	memset(cmdexec, 0, sizeof(cmdexec));
 	fDaemon = DEF_DAEMON;
 	fDebug = DEF_DEBUG;
 	fsyslog = DEF_SYSLOG;
 	port = DEF_PORT;
-	s_addr = htonl(INADDR_ANY);
+	listenaddrcount = 0;
+	acceptors = DEF_ACCEPTORS;
+	strcpy(mqttprefix, DEF_MQTTPREFIX);
+	strncpy(tracefile, DEF_TRACEFILE, sizeof(tracefile));
+	tracerecords = DEF_TRACERECORDS;
 	housecode = DEF_HOUSECODE;
 	strncpy(pidfile, DEF_PIDFILE, sizeof(pidfile));
+	strncpy(aliasfile, DEF_ALIASFILE, sizeof(aliasfile));
+	tempperiod = DEF_TEMPPERIOD;
+	strncpy(journalfile, DEF_JOURNALFILE, sizeof(journalfile));
+	clockperiod = DEF_CLOCKPERIOD;
+	clockoffset = DEF_CLOCKOFFSET;
+	strncpy(simulate, DEF_SIMULATE, sizeof(simulate));
+	fpaced = DEF_PACED;
+	rtpriority = DEF_RTPRIORITY;
+	rtcpu = -1;
+	limits.connections = DEF_MAXCONN;
+	limits.client = DEF_MAXCLIENT;
+	limits.total = DEF_MAXTOTAL;
+	limits.output = DEF_MAXOUTPUT;
+	limits.backlog = DEF_BACKLOG;
+	limits.line = DEF_MAXLINE;
 
 	while (true)
 	{
-		int result = getopt(argc, argv, "a:c:dgh:p:sv?");
+		int result = getopt(argc, argv, "A:a:C:c:dgh:J:L:M:N:O:P:p:rR:sT:t:v?");
 		if (result == -1) {
 			break; /* end of list */
 		}
@@ -1914,10 +6894,23 @@ int main(int argc, char * argv[]) {
 				debug(LOG_ERR, "missing argument\n");
 				return EXIT_FAILURE;
 				break;
+			case 'A':
+				memset(aliasfile, '\0', sizeof(aliasfile));
+				strncpy(aliasfile, optarg, sizeof(aliasfile)-1);
+				debug(LOG_DEBUG, "Alias file %s", aliasfile);
+				break;
 			case 'a':
-				s_addr = inet_addr(optarg);
+				if( listenaddrcount >= LISTEN_MAX_ADDRS || strlen(optarg) >= sizeof(listenaddrs[0]) ) {
+					debug(LOG_ERR, "Listen address '%s' ignored (max %d addresses)", optarg, LISTEN_MAX_ADDRS);
+					break;
+				}
+				strcpy(listenaddrs[listenaddrcount++], optarg);
 				debug(LOG_DEBUG, "Listen on address %s", optarg);
 				break;
+			case 'C':
+				clockperiod = strtol(optarg, NULL, 10);
+				debug(LOG_DEBUG, "Device clock check period %u s", clockperiod);
+				break;
 			case 'c':
 				if( fDaemon ) {
 					debug(LOG_WARNING, "Starting as daemon with parameter -c is not possible, disable daemon flag");
@@ -1951,14 +6944,93 @@ int main(int argc, char * argv[]) {
 					debug(LOG_DEBUG, "Using housecode %s (%0dd, 0x%04x, FS20=%s)", optarg, housecode, housecode, itofs20(buf, housecode, NULL));
 				}
 				break;
+			case 'J':
+				memset(journalfile, '\0', sizeof(journalfile));
+				strncpy(journalfile, optarg, sizeof(journalfile)-1);
+				debug(LOG_DEBUG, "Journal file %s", journalfile);
+				break;
+			case 'L':
+				if( limits_parse(optarg) != EXIT_SUCCESS ) {
+					return EXIT_FAILURE;
+				}
+				debug(LOG_DEBUG, "Limits %s", optarg);
+				break;
+			case 'M':
+				if( mqtt_parse(optarg) != EXIT_SUCCESS ) {
+					debug(LOG_ERR, "wrong MQTT broker '%s', use <host>[:port][/prefix]", optarg);
+					return EXIT_FAILURE;
+				}
+				debug(LOG_DEBUG, "MQTT broker %s port %s, topic prefix %s", mqtthost, mqttport, mqttprefix);
+				break;
+			case 'N':
+				if( stricmp(optarg, "paced") != 0 && stricmp(optarg, "unpaced") != 0 ) {
+					debug(LOG_ERR, "wrong simulation mode '%s', use paced or unpaced", optarg);
+					return EXIT_FAILURE;
+				}
+				memset(simulate, '\0', sizeof(simulate));
+				strncpy(simulate, optarg, sizeof(simulate)-1);
+				debug(LOG_DEBUG, "Simulated device (%s)", simulate);
+				break;
+			case 'r':
+				fpaced = true;
+				debug(LOG_DEBUG, "RF pacing on");
+				break;
+			case 'O':
+				clockoffset = strtol(optarg, NULL, 10);
+				debug(LOG_DEBUG, "Max device clock offset %u s", clockoffset);
+				break;
+			case 'P':
+				acceptors = strtol(optarg, NULL, 10);
+				if( acceptors < 1 || acceptors > LISTEN_MAX_ACCEPTORS ) {
+					debug(LOG_ERR, "wrong number of acceptors '%s' (1-%d)", optarg, LISTEN_MAX_ACCEPTORS);
+					return EXIT_FAILURE;
+				}
+				debug(LOG_DEBUG, "%d acceptors per listen address", acceptors);
+				break;
 			case 'p':
 				port = strtol(optarg, NULL, 10);
 				debug(LOG_DEBUG, "Using TCP port %d for listening", port);
 				break;
+			case 'R':
+				{
+					char *end;
+
+					rtpriority = strtol(optarg, &end, 10);
+					rtcpu = (*end == ':') ? strtol(end + 1, &end, 10) : -1;
+					if( rtpriority < 1 || rtpriority > 99 || *end != '\0' ) {
+						debug(LOG_ERR, "wrong real-time parameter '%s', use prio[:cpu] with prio 1-99", optarg);
+						return EXIT_FAILURE;
+					}
+					debug(LOG_DEBUG, "Real-time USB thread priority %d, CPU %d", rtpriority, rtcpu);
+				}
+				break;
 			case 's':
 				fsyslog = true;
 				debug(LOG_DEBUG, "Output to syslog");
 				break;
+			case 'T':
+				tempperiod = strtol(optarg, NULL, 10);
+				debug(LOG_DEBUG, "Temperature sample period %u s", tempperiod);
+				break;
+			case 't':
+				{
+					char *colon;
+
+					memset(tracefile, '\0', sizeof(tracefile));
+					strncpy(tracefile, optarg, sizeof(tracefile)-1);
+					if( (colon = strrchr(tracefile, ':')) != NULL ) {
+						char *end;
+
+						*colon = '\0';
+						tracerecords = strtol(colon + 1, &end, 10);
+						if( tracerecords <= 0 || *end != '\0' || *tracefile == '\0' ) {
+							debug(LOG_ERR, "wrong trace parameter '%s', use file[:records]", optarg);
+							return EXIT_FAILURE;
+						}
+					}
+					debug(LOG_DEBUG, "Trace USB transfers to %s (%ld records)", tracefile, tracerecords);
+				}
+				break;
 			case '?': /* unknown parameter */
 				prog_version();
 				usage();
@@ -2009,50 +7081,99 @@ int main(int argc, char * argv[]) {
 
 	createpidfile(pidfile, pid);
 
+	/* Load device aliases, reload them on SIGHUP */
+	if( *aliasfile ) {
+		pthread_t thread_id;
+		pthread_attr_t attr;
+
+		if( alias_reload() != EXIT_SUCCESS ) {
+			cleanup(SIGTERM);
+			return EXIT_FAILURE;
+		}
+		sem_init(&alias_reload_sem, 0, 0);
+		thread_attr_init(&attr);
+		pthread_create(&thread_id, &attr, alias_reload_thread, NULL);
+		pthread_attr_destroy(&attr);
+		signal(SIGHUP,alias_sighup);
+	}
+
+	/* Restore the device states, keep journaling them */
+	if( *journalfile ) {
+		pthread_t thread_id;
+		pthread_attr_t attr;
+
+		if( journal_open(journalfile) != EXIT_SUCCESS ) {
+			cleanup(SIGTERM);
+			return EXIT_FAILURE;
+		}
+		thread_attr_init(&attr);
+		pthread_create(&thread_id, &attr, journal_thread, NULL);
+		pthread_attr_destroy(&attr);
+	}
+
 	rc = usb_connect();
 	if( rc == EXIT_SUCCESS ) {
 
 		/* If command line cmd is given, execute cmd and exit */
 		if( *cmdexec ) {
-			rc = handle_input(trim(cmdexec), dev_handle, 0, HANDLE_INPUT_NOOK);
+			session_init(&session);
+			rc = handle_input(trim(cmdexec), dev_handle, 0, HANDLE_INPUT_NOOK, &session);
+			session_free(&session);
 		}
 		/* otherwise start TCP listing */
 		else {
+			route_init();
 			/* open main TCP listening socket */
-			listen_fd = tcp_server_init(port);
-			debug(LOG_DEBUG, "tcp_server_init(%d) returns %d", port, listen_fd);
-			if( listen_fd >= 0 ) {
+			/* start background temperature sampler */
+			if( tempperiod > 0 ) {
+				pthread_t thread_id;
+				pthread_attr_t attr;
+
+				thread_attr_init(&attr);
+				pthread_create(&thread_id, &attr, temp_sampler, NULL);
+				pthread_attr_destroy(&attr);
+			}
+			/* start background clock synchronization */
+			if( clockperiod > 0 ) {
+				pthread_t thread_id;
+				pthread_attr_t attr;
+
+				thread_attr_init(&attr);
+				pthread_create(&thread_id, &attr, clock_sync_thread, NULL);
+				pthread_attr_destroy(&attr);
+			}
+			/* start the MQTT bridge */
+			if( mqtthost[0] != '\0' ) {
+				pthread_t thread_id;
+				pthread_attr_t attr;
+
+				thread_attr_init(&attr);
+				pthread_create(&thread_id, &attr, mqtt_thread, NULL);
+				pthread_create(&thread_id, &attr, mqtt_publisher, NULL);
+				pthread_attr_destroy(&attr);
+			}
+
+			if( tcp_server_listen(port) > 0 ) {
+				int i;
+
 				FD_ZERO(&socks);
+				for(i=1; i<listener_count; i++) {
+					pthread_t thread_id;
+					pthread_attr_t attr;
 
-				/* main loop */
-				while (true) {
-					struct sockaddr_in sock;
-					int client_fd;
-
-					/* Check TCP server listen port (client connect) */
-					client_fd = tcp_server_connect(listen_fd, &sock);
-					debug(LOG_DEBUG, "tcp_server_connect((%d,...) returns %d", listen_fd, client_fd);
-					if (client_fd >= 0) {
-						pthread_t thread_id;
-						pthread_attr_t attr;
-
-						debug(LOG_DEBUG, "Client connected from %s (handle=%d)", inet_ntoa(sock.sin_addr), client_fd);
-						pthread_mutex_lock(&mutex_socks);
-						FD_SET(client_fd, &socks);
-						pthread_mutex_unlock(&mutex_socks);
-
-						/* start thread for client command handling */
-						pthread_attr_init(&attr);
-						/* we need to created detached threads (PTHREAD_CREATE_DETACHED),
-						   so its thread ID and other resources can be reused as soon as the thread terminates. */
-						pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-						int ret = pthread_create(&thread_id, &attr, tcp_server_handle_client, (void *)(long)client_fd);
-						debug(LOG_DEBUG, "client thread %sstarted (thread_id=%ul)", ret==0?"":"not ", thread_id);
-						pthread_attr_destroy(&attr);
+					thread_attr_init(&attr);
+					if( pthread_create(&thread_id, &attr, tcp_server_accept, &listeners[i]) != 0 ) {
+						debug(LOG_ERR, "Acceptor of %s not started", listeners[i].name);
 					}
+					pthread_attr_destroy(&attr);
 				}
+				/* main loop */
+				tcp_server_accept(&listeners[0]);
 			}
 			rc = usb_release();
+			if( listener_count == 0 ) {
+				rc = EXIT_FAILURE;
+			}
 		}
 	}
 
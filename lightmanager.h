@@ -0,0 +1,206 @@
+/*
+ ============================================================================
+ Name        : lightmanager.h
+ Copyright   : GPL
+ Description : liblightmanager - C API to access and control a jbmedia
+               Light Manager Pro(+) in-process (USB transport, RF pacing,
+               fair scheduling and frame encoding, see lmcodec.h)
+
+               Typical use:
+                   lm_device *dev = lm_open();
+                   unsigned char frame[LM_FRAME_LEN];
+                   lm_encode(LM_PROTO_FS20, LM_FS20_ADDR(0x0000, 0x05), LM_ACT_ON, -1, frame);
+                   lm_submit(dev, &frame, 1, NULL);
+                   lm_close(dev);
+ ============================================================================
+ */
+
+#ifndef LIGHTMANAGER_H
+#define LIGHTMANAGER_H
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include "lmcodec.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* API version, incremented on incompatible changes */
+#define LM_API_VERSION		1
+
+/* Opaque handles */
+typedef struct lm_device lm_device;
+typedef struct lm_queue lm_queue;
+typedef struct lm_burst lm_burst;
+
+/* Result of one submitted frame */
+struct lm_result {
+	int status;					/* LM_OK or a libusb error code */
+	long long submitted;		/* CLOCK_MONOTONIC timestamps (us) */
+	long long started;
+	long long finished;
+};
+
+/* Time spent by the requests of one queue (us), see lm_queue_timing() */
+struct lm_timing {
+	long long queued;			/* waiting for the scheduler */
+	long long paced;			/* delayed by the RF pacer */
+	long long usb;				/* USB transfers including retries */
+	int frames;
+	int retries;
+};
+
+/* Real-time settings of the transport thread, see lm_set_realtime() */
+struct lm_realtime {
+	int priority;				/* SCHED_FIFO priority 1-99, 0 keeps the default scheduling */
+	int cpu;					/* CPU the thread is pinned to, -1 for any */
+	bool lockmemory;			/* lock all process memory with mlockall() */
+};
+
+/* USB transfer trace file, see lm_trace_open() */
+#define LM_TRACE_MAGIC		"LMTRACE"
+#define LM_TRACE_VERSION	1
+#define LM_TRACE_OUT		0			/* frame sent to the device */
+#define LM_TRACE_IN			1			/* device answer read back */
+
+/* 	Trace file header, followed by <capacity> records used as ring buffer:
+	record <count> is written at index count % capacity. All fields are in
+	host byte order */
+struct lm_trace_header {
+	char magic[8];				/* LM_TRACE_MAGIC */
+	uint32_t version;			/* LM_TRACE_VERSION */
+	uint32_t recsize;			/* sizeof(struct lm_trace_record) */
+	uint64_t capacity;			/* records */
+	uint64_t count;				/* records written */
+	int64_t realtime;			/* CLOCK_REALTIME (us) of the monotonic time below */
+	int64_t monotonic;			/* CLOCK_MONOTONIC (us) when the trace was opened */
+	uint8_t reserved[16];
+};
+
+/* One USB transfer of the trace */
+struct lm_trace_record {
+	int64_t time;				/* CLOCK_MONOTONIC (us) the transfer started */
+	int32_t duration;			/* us including retries */
+	int32_t paced;				/* delay by the RF pacer before the transfer (us) */
+	int32_t result;				/* LM_OK or a libusb error code */
+	uint8_t direction;			/* LM_TRACE_OUT or LM_TRACE_IN */
+	uint8_t retries;
+	uint8_t fexpectdata;		/* OUT frame of a request reading the device answer */
+	uint8_t reserved;
+	uint8_t data[LM_FRAME_LEN];
+};
+
+/* Log function, <priority> is a syslog priority */
+typedef void (*lm_log_fn)(int priority, const char *format, va_list args);
+
+/* Called from the transport thread after a device frame was sent */
+typedef void (*lm_frame_fn)(const unsigned char *frame, void *arg);
+
+/* Returns LM_API_VERSION the library was built with */
+int lm_version(void);
+
+/* Set the log function (default: no logging) */
+void lm_set_log(lm_log_fn log);
+
+/* 	Run the transport thread in real time, applied when it starts: call
+	before the first lm_open() or lm_open_sim(). With a priority the
+	library locks use priority inheritance. Locked memory includes the
+	stack of every thread, bound the stack size of the caller's threads.
+	returns LM_OK or -1 if the thread is already running */
+int lm_set_realtime(const struct lm_realtime *rt);
+
+/* 	Open the Light Manager and start its transport thread, RF pacing is
+	off (see lm_set_paced()). Only one device can be open at a time.
+	returns the device or NULL on error */
+lm_device *lm_open(void);
+
+/* 	Open a simulated Light Manager without USB hardware, e.g. for load
+	tests. Transfers take the time of a real USB transfer, the RF pacer
+	applies if <fpaced>, the temperature reads 21.5 degrees and the clock runs
+	with the host. returns the device or NULL on error */
+lm_device *lm_open_sim(bool fpaced);
+
+/* 	Close the device, no request must be pending. returns LM_OK, -1 if the
+	device is not open or a libusb error code */
+int lm_close(lm_device *dev);
+
+/* 	Space RF frames by their estimated on-air time and limit them to the
+	duty cycle of each protocol family (<fpaced>) or send them as fast as
+	the device takes them. returns LM_OK or LM_ENODEV */
+int lm_set_paced(lm_device *dev, bool fpaced);
+
+/* Register <hook> called for every device frame successfully sent */
+void lm_set_frame_hook(lm_device *dev, lm_frame_fn hook, void *arg);
+
+/* 	Record every USB transfer into the file <path> mapped into memory, the
+	file holds up to <records> records and the oldest are overwritten.
+	An open trace is replaced. returns LM_OK or -1 */
+int lm_trace_open(const char *path, long records);
+
+/* Stop recording and close the trace file */
+void lm_trace_close(void);
+
+/* 	Submission queues: the device is shared fairly (deficit round robin)
+	between all queues. A queue is bound to the calling thread by
+	lm_thread_queue(), threads without a queue share a default queue.
+	lm_queue_new() returns NULL if <dev> is not open. */
+lm_queue *lm_queue_new(lm_device *dev);
+void lm_queue_free(lm_queue *queue);
+void lm_thread_queue(lm_queue *queue);
+
+/* 	Preallocate <queue> for bursts of up to <count> frames, so lm_submit()
+	does not allocate. returns LM_OK or -1 */
+int lm_queue_reserve(lm_queue *queue, int count);
+
+/* Get the time spent by the requests of <queue> since the last call */
+void lm_queue_timing(lm_queue *queue, struct lm_timing *timing);
+
+/* 	Send <count> frames as one burst and wait until all are done.
+	<results> (may be NULL) receives the result of each frame, LM_ENODEV
+	if <dev> is not open or closed meanwhile.
+	returns the number of frames not sent */
+int lm_submit(lm_device *dev, unsigned char (*frames)[LM_FRAME_LEN], int count, struct lm_result *results);
+
+/* 	Like lm_submit() without waiting: queue <count> frames as one burst,
+	<frames> must stay valid until lm_submit_finish(). Bursts of a queue
+	are sent in order. returns the burst or NULL on error */
+lm_burst *lm_submit_start(lm_device *dev, unsigned char (*frames)[LM_FRAME_LEN], int count);
+
+/* 	Wait until <burst> is done and release it, <results> (may be NULL)
+	receives the result of each frame. returns the number of frames not sent */
+int lm_submit_finish(lm_burst *burst, struct lm_result *results);
+
+/* 	Send one raw <frame>, if <fexpectdata> the device answer is read back
+	into <frame>. returns LM_OK, LM_ENODEV if <dev> is not open or a libusb
+	error code */
+int lm_transfer(lm_device *dev, unsigned char *frame, bool fexpectdata);
+
+/* Read the device temperature sensor, returns LM_OK on success */
+int lm_get_temp(lm_device *dev, double *celsius);
+
+/* Read the device clock, returns (time_t)-1 on error */
+time_t lm_get_clock(lm_device *dev);
+
+/* 	Read the device clock as local wall clock fields without any DST
+	interpretation (tm_isdst = -1), returns LM_OK or a libusb error code */
+int lm_read_clock(lm_device *dev, struct tm *timeinfo);
+
+/* Set the device clock, returns LM_OK on success */
+int lm_set_clock(lm_device *dev, const struct tm *timeinfo);
+
+/* Returns true while frames of any queue are waiting for the open <dev> */
+bool lm_busy(lm_device *dev);
+
+/* 	Write pacer and scheduler statistics as text lines into <buf>, including
+	the lateness (jitter) of the transport thread waking up for a request
+	and sending a paced frame. returns the length or LM_ENODEV */
+int lm_stats(lm_device *dev, char *buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIGHTMANAGER_H */
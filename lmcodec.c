@@ -0,0 +1,336 @@
+/*
+ ============================================================================
+ Name        : lmcodec.c
+ Copyright   : GPL
+ Description : Light Manager RF frame codec
+               All protocol constants, verbs and dim level conversions are
+               kept within precomputed tables, encoding is a pure function
+               without parsing, locking or allocation.
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include "lmcodec.h"
+
+
+/* ======================================================================== */
+/* Tables */
+/* ======================================================================== */
+
+/* Frame type (first frame byte) of each protocol */
+static const unsigned char frametype[LM_PROTO_MAX] = {
+	[LM_PROTO_FS20]  = 0x01,
+	[LM_PROTO_IT]    = 0x05,
+	[LM_PROTO_IKEA]  = 0x13,
+	[LM_PROTO_UNI]   = 0x15,
+	[LM_PROTO_SCENE] = 0x0f,
+};
+
+/* Command byte of each action, -1 if the protocol does not support it.
+   Dim actions hold the base the dim level is merged into. */
+static const short opcode[LM_PROTO_MAX][LM_ACT_MAX] = {
+	[LM_PROTO_FS20]  = { [LM_ACT_OFF] = 0x00, [LM_ACT_ON] = 0x11, [LM_ACT_TOGGLE] = 0x12, [LM_ACT_BRIGHT] = 0x13, [LM_ACT_DARK] = 0x14,
+						 [LM_ACT_STOP] = -1, [LM_ACT_SLOW] = -1, [LM_ACT_FAST] = -1,
+						 [LM_ACT_DIM] = 0x00, [LM_ACT_DIM_PERCENT] = 0x00, [LM_ACT_ACTIVATE] = -1 },
+	[LM_PROTO_IT]    = { [LM_ACT_OFF] = 0x00, [LM_ACT_ON] = 0x01, [LM_ACT_TOGGLE] = 0x02, [LM_ACT_BRIGHT] = 0x05, [LM_ACT_DARK] = 0x06,
+						 [LM_ACT_STOP] = -1, [LM_ACT_SLOW] = -1, [LM_ACT_FAST] = -1,
+						 [LM_ACT_DIM] = 0x08, [LM_ACT_DIM_PERCENT] = 0x08, [LM_ACT_ACTIVATE] = -1 },
+	[LM_PROTO_IKEA]  = { [LM_ACT_OFF] = 0x3A, [LM_ACT_ON] = 0x30, [LM_ACT_TOGGLE] = 0x1F, [LM_ACT_BRIGHT] = 0x00, [LM_ACT_DARK] = 0x40,
+						 [LM_ACT_STOP] = -1, [LM_ACT_SLOW] = 0x30, [LM_ACT_FAST] = 0x10,
+						 [LM_ACT_DIM] = 0x30, [LM_ACT_DIM_PERCENT] = 0x30, [LM_ACT_ACTIVATE] = -1 },
+	[LM_PROTO_UNI]   = { [LM_ACT_OFF] = 0x04, [LM_ACT_ON] = 0x01, [LM_ACT_TOGGLE] = -1, [LM_ACT_BRIGHT] = 0x01, [LM_ACT_DARK] = 0x04,
+						 [LM_ACT_STOP] = 0x02, [LM_ACT_SLOW] = -1, [LM_ACT_FAST] = -1,
+						 [LM_ACT_DIM] = -1, [LM_ACT_DIM_PERCENT] = -1, [LM_ACT_ACTIVATE] = -1 },
+	[LM_PROTO_SCENE] = { [LM_ACT_OFF] = -1, [LM_ACT_ON] = -1, [LM_ACT_TOGGLE] = -1, [LM_ACT_BRIGHT] = -1, [LM_ACT_DARK] = -1,
+						 [LM_ACT_STOP] = -1, [LM_ACT_SLOW] = -1, [LM_ACT_FAST] = -1,
+						 [LM_ACT_DIM] = -1, [LM_ACT_DIM_PERCENT] = -1, [LM_ACT_ACTIVATE] = 0x00 },
+};
+
+/* Max absolute dim level of each protocol */
+static const signed char dim_max[LM_PROTO_MAX] = {
+	[LM_PROTO_FS20]  = 16,
+	[LM_PROTO_IT]    = 15,
+	[LM_PROTO_IKEA]  = 9,
+	[LM_PROTO_UNI]   = -1,
+	[LM_PROTO_SCENE] = -1,
+};
+
+/* Percent (0-100) to absolute dim level of each protocol */
+static const unsigned char percent_level[LM_PROTO_MAX][101] = {
+	[LM_PROTO_FS20] = {		/* 16 * p / 100 */
+	 0,  0,  0,  0,  0,  0,  0,  1,  1,  1,  1,  1,  1,  2,  2,  2,  2,  2,  2,  3,
+	 3,  3,  3,  3,  3,  4,  4,  4,  4,  4,  4,  4,  5,  5,  5,  5,  5,  5,  6,  6,
+	 6,  6,  6,  6,  7,  7,  7,  7,  7,  7,  8,  8,  8,  8,  8,  8,  8,  9,  9,  9,
+	 9,  9,  9, 10, 10, 10, 10, 10, 10, 11, 11, 11, 11, 11, 11, 12, 12, 12, 12, 12,
+	12, 12, 13, 13, 13, 13, 13, 13, 14, 14, 14, 14, 14, 14, 15, 15, 15, 15, 15, 15,
+	16 },
+	[LM_PROTO_IT] = {		/* 15 * p / 100 */
+	 0,  0,  0,  0,  0,  0,  0,  1,  1,  1,  1,  1,  1,  1,  2,  2,  2,  2,  2,  2,
+	 3,  3,  3,  3,  3,  3,  3,  4,  4,  4,  4,  4,  4,  4,  5,  5,  5,  5,  5,  5,
+	 6,  6,  6,  6,  6,  6,  6,  7,  7,  7,  7,  7,  7,  7,  8,  8,  8,  8,  8,  8,
+	 9,  9,  9,  9,  9,  9,  9, 10, 10, 10, 10, 10, 10, 10, 11, 11, 11, 11, 11, 11,
+	12, 12, 12, 12, 12, 12, 12, 13, 13, 13, 13, 13, 13, 13, 14, 14, 14, 14, 14, 14,
+	15 },
+	[LM_PROTO_IKEA] = {		/* 10% steps, 90% and above is full on */
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+	 2,  2,  2,  2,  2,  2,  2,  2,  2,  2,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,
+	 4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,
+	 6,  6,  6,  6,  6,  6,  6,  6,  6,  6,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,
+	 8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,
+	 9 },
+};
+
+/* Absolute dim level to frame value */
+static const unsigned char it_dim[16] = {	/* level in the 4 msb, bit 3 set */
+	0x08, 0x18, 0x28, 0x38, 0x48, 0x58, 0x68, 0x78,
+	0x88, 0x98, 0xa8, 0xb8, 0xc8, 0xd8, 0xe8, 0xf8
+};
+static const unsigned char ikea_dim[10] = {	/* 0 = off (0x0A), 9 = full on (0x00) */
+	0x0A, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x00
+};
+
+/* Verbs, sorted by name for binary search */
+static const struct {
+	const char *name;
+	unsigned char len;
+	unsigned char action;
+} verbs[] = {
+	{ "+",       1, LM_ACT_BRIGHT },
+	{ "-",       1, LM_ACT_DARK },
+	{ "BRIGHT",  6, LM_ACT_BRIGHT },
+	{ "CLOSE",   5, LM_ACT_OFF },
+	{ "DARK",    4, LM_ACT_DARK },
+	{ "DOWN",    4, LM_ACT_OFF },
+	{ "FAST",    4, LM_ACT_FAST },
+	{ "GRADUAL", 7, LM_ACT_SLOW },
+	{ "INSTANT", 7, LM_ACT_FAST },
+	{ "OFF",     3, LM_ACT_OFF },
+	{ "ON",      2, LM_ACT_ON },
+	{ "OPEN",    4, LM_ACT_ON },
+	{ "SLOW",    4, LM_ACT_SLOW },
+	{ "STOP",    4, LM_ACT_STOP },
+	{ "TOGGLE",  6, LM_ACT_TOGGLE },
+	{ "UP",      2, LM_ACT_ON },
+};
+
+static const char *errors[] = {
+	"OK",
+	"unknown protocol",
+	"address out of range",
+	"action not supported by device",
+	"value out of range",
+	"device not open",
+};
+
+
+/* ======================================================================== */
+/* Encoding */
+/* ======================================================================== */
+
+int lm_encode(enum lm_protocol protocol, unsigned long addr, enum lm_action action, int value, unsigned char *frame)
+{
+	unsigned char cmd;
+	int level = -1;
+
+	if( (unsigned)protocol >= LM_PROTO_MAX ) {
+		return LM_EPROTO;
+	}
+	if( (unsigned)action >= LM_ACT_MAX || opcode[protocol][action] < 0 ) {
+		return LM_EACTION;
+	}
+	cmd = (unsigned char)opcode[protocol][action];
+
+	/* dim level, IKEA takes it with every command */
+	if( action == LM_ACT_DIM_PERCENT ) {
+		if( value < 0 || value > 100 ) {
+			return LM_EVALUE;
+		}
+		level = percent_level[protocol][value];
+	}
+	else if( action == LM_ACT_DIM || (protocol == LM_PROTO_IKEA && value >= 0) ) {
+		if( value < 0 || value > dim_max[protocol] ) {
+			return LM_EVALUE;
+		}
+		level = value;
+	}
+
+	switch( protocol ) {
+		case LM_PROTO_FS20:		/* 01 hh hh aa cc 00 03 00 */
+			if( addr > 0xffffff ) {
+				return LM_EADDR;
+			}
+			memset(frame, 0, LM_FRAME_LEN);
+			frame[1] = (unsigned char)(addr >> 16);
+			frame[2] = (unsigned char)(addr >> 8);
+			frame[3] = (unsigned char)addr;
+			frame[4] = (level >= 0) ? (unsigned char)level : cmd;
+			frame[6] = 0x03;
+			break;
+		case LM_PROTO_IT:		/* 05 ca cc mm ll 00 00 00 */
+			if( addr > 0x1ff ) {
+				return LM_EADDR;
+			}
+			memset(frame, 0, LM_FRAME_LEN);
+			frame[1] = (unsigned char)addr;
+			frame[2] = (level >= 0) ? it_dim[level] : cmd;
+			frame[3] = (level >= 0) ? 0x05 : 0x06;
+			frame[4] = (unsigned char)(addr >> 8);
+			break;
+		case LM_PROTO_IKEA:		/* 13 ca cc 02 00 00 00 00 */
+			if( addr > 0xff || (addr & 0x0f) > 9 ) {
+				return LM_EADDR;
+			}
+			memset(frame, 0, LM_FRAME_LEN);
+			frame[1] = (unsigned char)addr;
+			/* the level is added to the command code as the daemon always did */
+			frame[2] = (level >= 0) ? (unsigned char)(cmd + ikea_dim[level]) : cmd;
+			frame[3] = 0x02;
+			break;
+		case LM_PROTO_UNI:		/* 15 jj 74 cc 00 00 00 00 */
+			if( addr > 15 ) {
+				return LM_EADDR;
+			}
+			memset(frame, 0, LM_FRAME_LEN);
+			frame[1] = (unsigned char)addr;
+			frame[2] = 0x74;
+			frame[3] = cmd;
+			break;
+		case LM_PROTO_SCENE:	/* 0f ss 00 00 00 00 00 00 */
+			if( addr < 1 || addr > 254 ) {
+				return LM_EADDR;
+			}
+			memset(frame, 0, LM_FRAME_LEN);
+			frame[1] = (unsigned char)addr;
+			break;
+		default:
+			return LM_EPROTO;
+	}
+	frame[0] = frametype[protocol];
+	return LM_OK;
+}
+
+int lm_encode_batch(const struct lm_cmd *cmds, int count, unsigned char (*frames)[LM_FRAME_LEN])
+{
+	int i;
+
+	for(i=0; i<count; i++) {
+		if( lm_encode(cmds[i].protocol, cmds[i].addr, cmds[i].action, cmds[i].value, frames[i]) != LM_OK ) {
+			break;
+		}
+	}
+	return i;
+}
+
+
+/* ======================================================================== */
+/* Decoding */
+/* ======================================================================== */
+
+bool lm_decode(const unsigned char *frame, unsigned int *key, char *device, size_t devlen, char *state, size_t statelen)
+{
+	switch( frame[0] ) {
+		case 0x01:	/* FS20 */
+			*key = (0x01u << 24) | (frame[1] << 16) | (frame[2] << 8) | frame[3];
+			snprintf(device, devlen, "FS20 %c%c%c%c", '1' + ((frame[3]>>6) & 3), '1' + ((frame[3]>>4) & 3),
+					 '1' + ((frame[3]>>2) & 3), '1' + (frame[3] & 3));
+			switch( frame[4] ) {
+				case 0x00:	snprintf(state, statelen, "OFF"); break;
+				case 0x11:	snprintf(state, statelen, "ON"); break;
+				case 0x12:	snprintf(state, statelen, "TOGGLE"); break;
+				case 0x13:	snprintf(state, statelen, "BRIGHT"); break;
+				case 0x14:	snprintf(state, statelen, "DARK"); break;
+				default:	snprintf(state, statelen, "DIM %d", frame[4]); break;
+			}
+			return true;
+		case 0x05:	/* InterTechno */
+			*key = (0x05u << 24) | (frame[4] << 8) | frame[1];
+			snprintf(device, devlen, "IT %c %d %s", 'A' + (frame[1] >> 4), (frame[1] & 0x0f) + 1, frame[4] ? "LEARN" : "DIP");
+			if( frame[3] == 0x05 ) {
+				snprintf(state, statelen, "DIM %d", frame[2] >> 4);
+			}
+			else {
+				switch( frame[2] ) {
+					case 0x00:	snprintf(state, statelen, "OFF"); break;
+					case 0x01:	snprintf(state, statelen, "ON"); break;
+					case 0x02:	snprintf(state, statelen, "TOGGLE"); break;
+					case 0x05:	snprintf(state, statelen, "BRIGHT"); break;
+					default:	snprintf(state, statelen, "DARK"); break;
+				}
+			}
+			return true;
+		case 0x13:	/* IKEA Koppla */
+			*key = (0x13u << 24) | frame[1];
+			snprintf(device, devlen, "IKEA %d %d", (frame[1] >> 4) + 1, (frame[1] & 0x0f) ? (frame[1] & 0x0f) : 10);
+			switch( frame[2] ) {
+				case 0x30:	snprintf(state, statelen, "ON"); break;
+				case 0x3A:	snprintf(state, statelen, "OFF"); break;
+				case 0x1F:	snprintf(state, statelen, "TOGGLE"); break;
+				case 0x00:	snprintf(state, statelen, "BRIGHT"); break;
+				case 0x40:	snprintf(state, statelen, "DARK"); break;
+				default:	snprintf(state, statelen, "LEVEL 0x%02x", frame[2]); break;
+			}
+			return true;
+		case 0x15:	/* Uniroll */
+			*key = (0x15u << 24) | frame[1];
+			snprintf(device, devlen, "UNI %d", frame[1] + 1);
+			snprintf(state, statelen, "%s", (frame[3] == 0x01) ? "UP" : (frame[3] == 0x04) ? "DOWN" : "STOP");
+			return true;
+		case 0x0f:	/* Scene */
+			*key = (0x0fu << 24) | frame[1];
+			snprintf(device, devlen, "SCENE %d", frame[1]);
+			snprintf(state, statelen, "ACTIVATED");
+			return true;
+	}
+	return false;
+}
+
+
+/* ======================================================================== */
+/* Helper */
+/* ======================================================================== */
+
+int lm_verb(const char *word, size_t len)
+{
+	int lo = 0;
+	int hi = sizeof(verbs) / sizeof(verbs[0]) - 1;
+
+	while( lo <= hi ) {
+		int mid = (lo + hi) / 2;
+		size_t n = (len < verbs[mid].len) ? len : verbs[mid].len;
+		int cmp = strncasecmp(word, verbs[mid].name, n);
+
+		if( cmp == 0 ) {
+			cmp = (int)len - (int)verbs[mid].len;
+		}
+		if( cmp == 0 ) {
+			return verbs[mid].action;
+		}
+		if( cmp < 0 ) {
+			hi = mid - 1;
+		}
+		else {
+			lo = mid + 1;
+		}
+	}
+	return -1;
+}
+
+int lm_dim_max(enum lm_protocol protocol)
+{
+	return ((unsigned)protocol < LM_PROTO_MAX) ? dim_max[protocol] : -1;
+}
+
+int lm_percent_level(enum lm_protocol protocol, int percent)
+{
+	if( (unsigned)protocol >= LM_PROTO_MAX || dim_max[protocol] < 0 || percent < 0 || percent > 100 ) {
+		return -1;
+	}
+	return percent_level[protocol][percent];
+}
+
+const char *lm_strerror(int rc)
+{
+	return (rc <= 0 && rc >= LM_ENODEV) ? errors[-rc] : "unknown error";
+}
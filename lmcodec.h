@@ -0,0 +1,94 @@
+/*
+ ============================================================================
+ Name        : lmcodec.h
+ Copyright   : GPL
+ Description : Light Manager RF frame codec
+               Pure table driven encoding of device commands into the
+               8 byte USB frames of the jbmedia Light Manager Pro(+)
+ ============================================================================
+ */
+
+#ifndef LMCODEC_H
+#define LMCODEC_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define LM_FRAME_LEN		8
+
+/* Device protocols */
+enum lm_protocol {
+	LM_PROTO_FS20 = 0,
+	LM_PROTO_IT,
+	LM_PROTO_IKEA,
+	LM_PROTO_UNI,
+	LM_PROTO_SCENE,
+	LM_PROTO_MAX
+};
+
+/* Device actions, not every protocol supports every action */
+enum lm_action {
+	LM_ACT_OFF = 0,				/* also DOWN, CLOSE */
+	LM_ACT_ON,					/* also UP, OPEN */
+	LM_ACT_TOGGLE,
+	LM_ACT_BRIGHT,				/* one dim step up (+) */
+	LM_ACT_DARK,				/* one dim step down (-) */
+	LM_ACT_STOP,				/* Uniroll only */
+	LM_ACT_SLOW,				/* IKEA gradual dimming to level <value> */
+	LM_ACT_FAST,				/* IKEA instant dimming to level <value> */
+	LM_ACT_DIM,					/* absolute dim level <value> */
+	LM_ACT_DIM_PERCENT,			/* dim level <value> in percent (0-100) */
+	LM_ACT_ACTIVATE,			/* scene only */
+	LM_ACT_MAX
+};
+
+/* Error codes */
+#define LM_OK				 0
+#define LM_EPROTO			-1			/* unknown protocol */
+#define LM_EADDR			-2			/* address out of range */
+#define LM_EACTION			-3			/* action not supported by protocol */
+#define LM_EVALUE			-4			/* value out of range */
+#define LM_ENODEV			-5			/* device not open */
+
+/* Device address helpers */
+#define LM_FS20_ADDR(housecode, addr)		((((unsigned long)(housecode) & 0xffff) << 8) | ((addr) & 0xff))
+#define LM_IT_ADDR(code, channel, learn)	((((learn) ? 1UL : 0UL) << 8) | (((code) & 0x0f) << 4) | (((channel) - 1) & 0x0f))
+#define LM_IKEA_ADDR(system, channel)		(((((system) - 1) & 0x0f) << 4) | ((channel) % 10))
+#define LM_UNI_ADDR(channel)				((unsigned long)(channel) - 1)
+#define LM_SCENE_ADDR(scene)				((unsigned long)(scene))
+
+/* One command for lm_encode_batch() */
+struct lm_cmd {
+	enum lm_protocol protocol;
+	unsigned long addr;			/* LM_xxx_ADDR() */
+	enum lm_action action;
+	int value;					/* dim level, -1 if none */
+};
+
+/* 	Encode one device command into <frame> (LM_FRAME_LEN bytes).
+	returns LM_OK or LM_Exxx, <frame> is left untouched on errors */
+int lm_encode(enum lm_protocol protocol, unsigned long addr, enum lm_action action, int value, unsigned char *frame);
+
+/* 	Encode <count> commands into <frames>.
+	returns the number of frames encoded, stops at the first invalid
+	command (its index is the return value) */
+int lm_encode_batch(const struct lm_cmd *cmds, int count, unsigned char (*frames)[LM_FRAME_LEN]);
+
+/* 	Decode a device frame into a unique <key>, the <device> address in
+	command syntax and the <state> the frame sets.
+	returns false for frames not addressing a device (clock, temperature...) */
+bool lm_decode(const unsigned char *frame, unsigned int *key, char *device, size_t devlen, char *state, size_t statelen);
+
+/* Action of the verb <word> with <len> chars (case insensitive), -1 if unknown */
+int lm_verb(const char *word, size_t len);
+
+/* Max absolute dim level of <protocol>, -1 if it can not dim */
+int lm_dim_max(enum lm_protocol protocol);
+
+/* Absolute dim level of <percent> (0-100) for <protocol>, -1 if out of range */
+int lm_percent_level(enum lm_protocol protocol, int percent);
+
+/* Text for an LM_Exxx error code */
+const char *lm_strerror(int rc);
+
+#endif /* LMCODEC_H */
@@ -0,0 +1,558 @@
+/*
+ ============================================================================
+ Name        : lmload.c
+ Copyright   : GPL
+ Description : Load generator for the lightmanager daemon
+               Opens N concurrent TCP or HTTP clients and sends a weighted
+               command mix open-loop at a target rate. Latency is measured
+               from the time a command was scheduled, not sent, so a
+               saturated daemon shows up as growing latency instead of a
+               silently lower request rate.
+               Run the daemon with -N unpaced to test without hardware.
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+
+/* ======================================================================== */
+/* Defines */
+/* ======================================================================== */
+
+/* Program name and version */
+#define PROGNAME		"lmload"
+#define VERSION			"1.0"
+
+#define RESPONSE_MAXLEN	65536		/* max response size of one command */
+#define CMD_MAXLEN		128
+
+/* program parameter defaults */
+#define DEF_HOST		"127.0.0.1"
+#define DEF_PORT		3456
+#define DEF_CONNS		4
+#define DEF_RATE		10			/* commands per second over all connections */
+#define DEF_DURATION	10			/* s */
+#define DEF_INTERVAL	1			/* report interval (s) */
+#define DEF_WAIT		10			/* WAIT command parameter (ms) */
+#define DEF_MIX			"FS20=40,IT=20,IKEA=10,TEMP=20,WAIT=10"
+
+
+/* ======================================================================== */
+/* Types */
+/* ======================================================================== */
+
+/* Command kinds of the mix */
+enum kind {
+	KIND_FS20 = 0,
+	KIND_IT,
+	KIND_IKEA,
+	KIND_TEMP,
+	KIND_WAIT,
+	KIND_MAX
+};
+
+/* Latencies collected within one report interval or the whole run */
+struct samples {
+	long long *us;
+	size_t count;
+	size_t size;
+	unsigned long sent;
+	unsigned long errors;
+};
+
+
+/* ======================================================================== */
+/* Global vars */
+/* ======================================================================== */
+/* program parameter variables */
+char host[256];
+unsigned int port;
+unsigned int conns;
+double rate;
+unsigned int duration;
+unsigned int interval;
+unsigned int waitms;
+bool fhttp;
+
+/* Command mix */
+const char *kind_names[KIND_MAX] = { "FS20", "IT", "IKEA", "TEMP", "WAIT" };
+int weights[KIND_MAX];
+int weight_total;
+
+/* Open-loop schedule: command <i> is due at start_us + i / rate */
+struct sockaddr_in server;
+long long start_us;
+long long end_us;
+atomic_ulong next_cmd;
+
+/* Results, protected by mutex_samples */
+pthread_mutex_t mutex_samples = PTHREAD_MUTEX_INITIALIZER;
+struct samples current;
+struct samples total;
+
+
+/* ======================================================================== */
+/* Prototypes */
+/* ======================================================================== */
+long long time_us(void);
+int  parse_mix(const char *str);
+void make_command(char *cmd, size_t len, unsigned int *seed);
+int  tcp_connect(void);
+bool tcp_request(int fd, const char *cmd, char *buf, size_t len);
+bool http_request(const char *cmd, char *buf, size_t len);
+void samples_add(struct samples *samples, long long us, bool ok);
+int  compare_ll(const void *a, const void *b);
+long long percentile(const struct samples *samples, double p);
+void report(const struct samples *samples, double elapsed, double span, bool header);
+void *client_thread(void *arg);
+void usage(void);
+
+
+/* ======================================================================== */
+/* Helper Functions */
+/* ======================================================================== */
+
+/* Returns a monotonic timestamp in microseconds */
+long long time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/* 	Parse a command mix "KIND=weight,..." into weights[]
+	returns 0 or -1 on errors */
+int parse_mix(const char *str)
+{
+	char buf[256];
+	char *saveptr;
+	char *item;
+	int i;
+
+	memset(weights, 0, sizeof(weights));
+	weight_total = 0;
+	strncpy(buf, str, sizeof(buf)-1);
+	buf[sizeof(buf)-1] = '\0';
+	for(item = strtok_r(buf, ",", &saveptr); item != NULL; item = strtok_r(NULL, ",", &saveptr)) {
+		char *value = strchr(item, '=');
+
+		if( value != NULL ) {
+			*value++ = '\0';
+		}
+		for(i=0; i<KIND_MAX && strcasecmp(item, kind_names[i]) != 0; i++);
+		if( i == KIND_MAX ) {
+			fprintf(stderr, "unknown command kind '%s' in mix\n", item);
+			return -1;
+		}
+		weights[i] = (value != NULL) ? atoi(value) : 1;
+		if( weights[i] < 0 ) {
+			fprintf(stderr, "negative weight for '%s'\n", item);
+			return -1;
+		}
+		weight_total += weights[i];
+	}
+	if( weight_total == 0 ) {
+		fprintf(stderr, "empty command mix\n");
+		return -1;
+	}
+	return 0;
+}
+
+/* Random command from the mix into <cmd> */
+void make_command(char *cmd, size_t len, unsigned int *seed)
+{
+	int pick = rand_r(seed) % weight_total;
+	const char *onoff = (rand_r(seed) & 1) ? "ON" : "OFF";
+	int kind;
+
+	for(kind = 0; kind < KIND_MAX - 1 && pick >= weights[kind]; kind++) {
+		pick -= weights[kind];
+	}
+	switch( kind ) {
+		case KIND_FS20:
+			snprintf(cmd, len, "FS20 %d%d%d%d %s", 1 + rand_r(seed) % 4, 1 + rand_r(seed) % 4,
+					 1 + rand_r(seed) % 4, 1 + rand_r(seed) % 4, onoff);
+			break;
+		case KIND_IT:
+			snprintf(cmd, len, "IT %c %d DIP %s", 'A' + rand_r(seed) % 16, 1 + rand_r(seed) % 16, onoff);
+			break;
+		case KIND_IKEA:
+			snprintf(cmd, len, "IKEA %d %d %s", 1 + rand_r(seed) % 16, 1 + rand_r(seed) % 10, onoff);
+			break;
+		case KIND_TEMP:
+			snprintf(cmd, len, "GET TEMP");
+			break;
+		default:
+			snprintf(cmd, len, "WAIT %u", waitms);
+			break;
+	}
+}
+
+
+/* ======================================================================== */
+/* Client Functions */
+/* ======================================================================== */
+
+/* Connect to the daemon, returns the socket or -1 */
+int tcp_connect(void)
+{
+	int fd;
+	int yes = 1;
+
+	if( (fd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ) {
+		return -1;
+	}
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+	if( connect(fd, (struct sockaddr *)&server, sizeof(server)) != 0 ) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* 	Send <cmd> over the TCP command connection <fd> and read the response
+	up to the prompt '>'. returns true if the daemon answered OK */
+bool tcp_request(int fd, const char *cmd, char *buf, size_t len)
+{
+	char line[CMD_MAXLEN + 2];
+	size_t pos = 0;
+	int rc;
+
+	snprintf(line, sizeof(line), "%s\r\n", cmd);
+	if( send(fd, line, strlen(line), MSG_NOSIGNAL) < 0 ) {
+		return false;
+	}
+	while( pos < len - 1 && (rc = recv(fd, buf + pos, len - 1 - pos, 0)) > 0 ) {
+		pos += rc;
+		if( buf[pos-1] == '>' && (pos == 1 || buf[pos-2] == '\n') ) {
+			buf[pos] = '\0';
+			return strstr(buf, ": OK\r\n") != NULL;
+		}
+	}
+	return false;
+}
+
+/* 	Send <cmd> as HTTP request on a new connection and read the response
+	until the daemon closes it. returns true if the daemon answered OK */
+bool http_request(const char *cmd, char *buf, size_t len)
+{
+	char request[3 * CMD_MAXLEN + 64];
+	size_t pos;
+	int fd;
+	int rc;
+
+	pos = snprintf(request, sizeof(request), "GET /cmd=");
+	for(; *cmd && pos < sizeof(request) - 48; cmd++) {
+		if( *cmd == ' ' ) {
+			pos += snprintf(request + pos, sizeof(request) - pos, "%%20");
+		}
+		else {
+			request[pos++] = *cmd;
+		}
+	}
+	snprintf(request + pos, sizeof(request) - pos, " HTTP/1.1\r\nHost: %s\r\n\r\n", host);
+
+	if( (fd = tcp_connect()) < 0 ) {
+		return false;
+	}
+	if( send(fd, request, strlen(request), MSG_NOSIGNAL) < 0 ) {
+		close(fd);
+		return false;
+	}
+	pos = 0;
+	while( pos < len - 1 && (rc = recv(fd, buf + pos, len - 1 - pos, 0)) > 0 ) {
+		pos += rc;
+	}
+	close(fd);
+	buf[pos] = '\0';
+	return strncmp(buf, "HTTP/1.1 200", 12) == 0 && strstr(buf, ": OK") != NULL;
+}
+
+
+/* ======================================================================== */
+/* Statistics */
+/* ======================================================================== */
+
+/* Add one result, the caller must hold mutex_samples */
+void samples_add(struct samples *samples, long long us, bool ok)
+{
+	if( !ok ) {
+		samples->errors++;
+		return;
+	}
+	if( samples->count == samples->size ) {
+		size_t size = (samples->size > 0) ? samples->size * 2 : 1024;
+		long long *newus;
+
+		if( (newus = realloc(samples->us, size * sizeof(*newus))) == NULL ) {
+			return;
+		}
+		samples->us = newus;
+		samples->size = size;
+	}
+	samples->us[samples->count++] = us;
+}
+
+int compare_ll(const void *a, const void *b)
+{
+	long long x = *(const long long *)a;
+	long long y = *(const long long *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* <p> percentile of sorted <samples> (us) */
+long long percentile(const struct samples *samples, double p)
+{
+	if( samples->count == 0 ) {
+		return 0;
+	}
+	return samples->us[(size_t)((samples->count - 1) * p / 100.0 + 0.5)];
+}
+
+/* Print one report line for <samples> collected within <span> seconds */
+void report(const struct samples *samples, double elapsed, double span, bool header)
+{
+	if( header ) {
+		printf("%8s %8s %8s %7s %9s %9s %9s %9s %9s %9s\n",
+			   "time s", "sent", "done", "errors", "cmd/s", "p50 ms", "p90 ms", "p99 ms", "p99.9 ms", "max ms");
+	}
+	printf("%8.1f %8lu %8zu %7lu %9.1f %9.2f %9.2f %9.2f %9.2f %9.2f\n",
+		   elapsed, samples->sent, samples->count, samples->errors,
+		   (span > 0) ? samples->count / span : 0.0,
+		   percentile(samples, 50) / 1000.0, percentile(samples, 90) / 1000.0,
+		   percentile(samples, 99) / 1000.0, percentile(samples, 99.9) / 1000.0,
+		   (samples->count > 0) ? samples->us[samples->count-1] / 1000.0 : 0.0);
+	fflush(stdout);
+}
+
+/* 	Client thread: takes the next due command of the open-loop schedule,
+	waits for its time and sends it. A busy daemon delays the commands of
+	all clients, their latency includes the time they were overdue.
+*/
+void *client_thread(void *arg)
+{
+	unsigned int seed = (unsigned int)(long)arg * 2654435761U ^ (unsigned int)time(NULL);
+	char *buf;
+	int fd = -1;
+
+	if( (buf = malloc(RESPONSE_MAXLEN)) == NULL ) {
+		return NULL;
+	}
+	while(true) {
+		unsigned long i = atomic_fetch_add(&next_cmd, 1);
+		long long due = start_us + (long long)(i * 1000000.0 / rate);
+		long long now = time_us();
+		char cmd[CMD_MAXLEN];
+		bool ok;
+
+		if( due >= end_us ) {
+			break;
+		}
+		if( due > now ) {
+			usleep(due - now);
+		}
+		make_command(cmd, sizeof(cmd), &seed);
+
+		pthread_mutex_lock(&mutex_samples);
+		current.sent++;
+		total.sent++;
+		pthread_mutex_unlock(&mutex_samples);
+
+		if( fhttp ) {
+			ok = http_request(cmd, buf, RESPONSE_MAXLEN);
+		}
+		else {
+			if( fd < 0 ) {
+				fd = tcp_connect();
+			}
+			ok = (fd >= 0) && tcp_request(fd, cmd, buf, RESPONSE_MAXLEN);
+			if( !ok && fd >= 0 ) {
+				/* resynchronize by a new connection */
+				close(fd);
+				fd = -1;
+			}
+		}
+		now = time_us();
+
+		pthread_mutex_lock(&mutex_samples);
+		samples_add(&current, now - due, ok);
+		samples_add(&total, now - due, ok);
+		pthread_mutex_unlock(&mutex_samples);
+	}
+	if( fd >= 0 ) {
+		close(fd);
+	}
+	free(buf);
+	return NULL;
+}
+
+
+/* ======================================================================== */
+/* Program helper functions */
+/* ======================================================================== */
+
+void usage(void)
+{
+	printf("\nUsage: %s [OPTION]\n", PROGNAME);
+	printf("\n");
+	printf("Options are:\n");
+	printf("    -a addr       Daemon address (default %s)\n", DEF_HOST);
+	printf("    -c conns      Number of concurrent client connections (default %d)\n", DEF_CONNS);
+	printf("    -H            Use HTTP requests (one connection per command) instead of TCP\n");
+	printf("    -i interval   Report every <interval> seconds (default %d)\n", DEF_INTERVAL);
+	printf("    -m mix        Command mix as weights of FS20, IT, IKEA, TEMP and WAIT\n");
+	printf("                  (default %s)\n", DEF_MIX);
+	printf("    -p port       Daemon TCP port (default %d)\n", DEF_PORT);
+	printf("    -r rate       Commands per second over all connections (default %d)\n", DEF_RATE);
+	printf("    -t duration   Test duration in seconds (default %d)\n", DEF_DURATION);
+	printf("    -w ms         Parameter of the WAIT command in milliseconds (default %d)\n", DEF_WAIT);
+	printf("    -?            Prints this help and exit\n");
+	printf("    -v            Prints version and exit\n");
+}
+
+
+int main(int argc, char * argv[]) {
+	pthread_t *threads;
+	struct hostent *he;
+	long long next;
+	long long last;
+	unsigned int i;
+	bool header = true;
+
+	strncpy(host, DEF_HOST, sizeof(host));
+	port = DEF_PORT;
+	conns = DEF_CONNS;
+	rate = DEF_RATE;
+	duration = DEF_DURATION;
+	interval = DEF_INTERVAL;
+	waitms = DEF_WAIT;
+	fhttp = false;
+	parse_mix(DEF_MIX);
+
+	while (true)
+	{
+		int result = getopt(argc, argv, "a:c:Hi:m:p:r:t:w:v?");
+		if (result == -1) {
+			break; /* end of list */
+		}
+		switch (result)
+		{
+			case 'a':
+				memset(host, '\0', sizeof(host));
+				strncpy(host, optarg, sizeof(host)-1);
+				break;
+			case 'c':
+				conns = strtol(optarg, NULL, 10);
+				break;
+			case 'H':
+				fhttp = true;
+				break;
+			case 'i':
+				interval = strtol(optarg, NULL, 10);
+				break;
+			case 'm':
+				if( parse_mix(optarg) != 0 ) {
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'p':
+				port = strtol(optarg, NULL, 10);
+				break;
+			case 'r':
+				rate = strtod(optarg, NULL);
+				break;
+			case 't':
+				duration = strtol(optarg, NULL, 10);
+				break;
+			case 'w':
+				waitms = strtol(optarg, NULL, 10);
+				break;
+			case 'v':
+				printf("%s v%s\n", PROGNAME, VERSION);
+				return EXIT_SUCCESS;
+			case '?': /* unknown parameter */
+			default:
+				usage();
+				return EXIT_SUCCESS;
+		}
+	}
+	if( conns == 0 || rate <= 0 || duration == 0 || interval == 0 ) {
+		fprintf(stderr, "connections, rate, duration and interval must be positive\n");
+		return EXIT_FAILURE;
+	}
+
+	memset(&server, 0, sizeof(server));
+	server.sin_family = AF_INET;
+	server.sin_port = htons(port);
+	if( (he = gethostbyname(host)) == NULL ) {
+		fprintf(stderr, "unknown host %s\n", host);
+		return EXIT_FAILURE;
+	}
+	memcpy(&server.sin_addr, he->h_addr_list[0], sizeof(server.sin_addr));
+
+	if( (threads = calloc(conns, sizeof(*threads))) == NULL ) {
+		fprintf(stderr, "out of memory\n");
+		return EXIT_FAILURE;
+	}
+	printf("%s: %u %s connections to %s:%u, %.1f cmd/s for %u s, mix", PROGNAME, conns, fhttp ? "HTTP" : "TCP", host, port, rate, duration);
+	for(i=0; i<KIND_MAX; i++) {
+		if( weights[i] > 0 ) {
+			printf(" %s=%d", kind_names[i], weights[i]);
+		}
+	}
+	printf("\n\n");
+
+	start_us = time_us() + 100000;
+	end_us = start_us + duration * 1000000LL;
+	for(i=0; i<conns; i++) {
+		pthread_create(&threads[i], NULL, client_thread, (void *)(long)i);
+	}
+
+	/* report per interval until the schedule ended and all clients are done */
+	last = start_us;
+	for(next = start_us + interval * 1000000LL; next < end_us + interval * 1000000LL; next += interval * 1000000LL) {
+		struct samples snap;
+		long long now = time_us();
+
+		if( next > now ) {
+			usleep(next - now);
+		}
+		now = time_us();
+		pthread_mutex_lock(&mutex_samples);
+		snap = current;
+		memset(&current, 0, sizeof(current));
+		pthread_mutex_unlock(&mutex_samples);
+
+		qsort(snap.us, snap.count, sizeof(*snap.us), compare_ll);
+		report(&snap, (now - start_us) / 1e6, (now - last) / 1e6, header);
+		header = false;
+		last = now;
+		free(snap.us);
+	}
+	for(i=0; i<conns; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	printf("\nTotal\n");
+	qsort(total.us, total.count, sizeof(*total.us), compare_ll);
+	report(&total, (time_us() - start_us) / 1e6, (time_us() - start_us) / 1e6, true);
+	free(total.us);
+	free(threads);
+	return (total.errors > 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
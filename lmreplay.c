@@ -0,0 +1,486 @@
+/*
+ ============================================================================
+ Name        : lmreplay.c
+ Copyright   : GPL
+ Description : Replay of a USB transfer trace (lightmanager -t) against a
+               Light Manager or the simulated device of liblightmanager.
+               The frames are sent at their original timing or at full
+               speed, so a recorded production workload becomes a
+               repeatable benchmark. The replay may be traced again and
+               both traces listed (-l) for comparison. Frames setting the
+               device clock are skipped unless asked for (-c).
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <syslog.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "lightmanager.h"
+
+
+/* ======================================================================== */
+/* Defines */
+/* ======================================================================== */
+
+/* Program name and version */
+#define PROGNAME		"lmreplay"
+#define VERSION			"1.0"
+
+#define BURST_MAX		64			/* frames submitted as one burst at full speed */
+
+/* program parameter defaults */
+#define DEF_TRACERECORDS 1048576	/* records of the replay trace (-o) */
+
+
+/* ======================================================================== */
+/* Types */
+/* ======================================================================== */
+
+/* Transfer times of the trace or the replay */
+struct times {
+	unsigned long frames;
+	unsigned long failed;
+	long long total;			/* us */
+	long long max;
+};
+
+
+/* ======================================================================== */
+/* Global vars */
+/* ======================================================================== */
+/* program parameter variables */
+bool fclock;
+bool ffull;
+bool flist;
+bool fdebug;
+char simulate[16];
+char outfile[512];
+
+/* The trace file mapped into memory */
+const struct lm_trace_header *header;
+const struct lm_trace_record *records;
+unsigned long first;			/* index of the oldest record */
+unsigned long count;			/* records in the trace */
+
+
+/* ======================================================================== */
+/* Prototypes */
+/* ======================================================================== */
+long long time_us(void);
+void sleep_until(long long deadline);
+void log_va(int priority, const char *format, va_list args);
+int  trace_map(const char *path);
+const struct lm_trace_record *trace_get(unsigned long i);
+bool trace_replay(const struct lm_trace_record *rec);
+void trace_list(void);
+void times_add(struct times *times, long long us, bool ok);
+void times_print(const char *name, const struct times *times);
+int  replay_timed(lm_device *dev, struct times *times, struct times *late);
+int  replay_full(lm_device *dev, struct times *times);
+void usage(void);
+
+
+/* ======================================================================== */
+/* Helper Functions */
+/* ======================================================================== */
+
+/* Returns a monotonic timestamp in microseconds */
+long long time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/* Sleep until the time_us() <deadline> */
+void sleep_until(long long deadline)
+{
+	struct timespec ts;
+
+	ts.tv_sec = deadline / 1000000LL;
+	ts.tv_nsec = (deadline % 1000000LL) * 1000;
+	while( clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR );
+}
+
+/* Log function of liblightmanager, debug messages only with -g */
+void log_va(int priority, const char *format, va_list args)
+{
+	if( priority == LOG_DEBUG && !fdebug ) {
+		return;
+	}
+	vfprintf(stderr, format, args);
+	fprintf(stderr, "\n");
+}
+
+
+/* ======================================================================== */
+/* Trace Functions */
+/* ======================================================================== */
+
+/* 	Map the trace file <path> read-only and check its header
+	returns 0 or -1 on errors */
+int trace_map(const char *path)
+{
+	struct stat st;
+	void *map;
+	int fd;
+
+	if( (fd = open(path, O_RDONLY)) < 0 ) {
+		fprintf(stderr, "cannot open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	if( fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(*header) ) {
+		fprintf(stderr, "%s: not a trace file\n", path);
+		close(fd);
+		return -1;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if( map == MAP_FAILED ) {
+		fprintf(stderr, "cannot map %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	header = map;
+	records = (const struct lm_trace_record *)(header + 1);
+	if( memcmp(header->magic, LM_TRACE_MAGIC, sizeof(LM_TRACE_MAGIC)) != 0 ||
+		header->version != LM_TRACE_VERSION || header->recsize != sizeof(struct lm_trace_record) ||
+		header->capacity == 0 || header->capacity > (st.st_size - sizeof(*header)) / sizeof(struct lm_trace_record) ) {
+		fprintf(stderr, "%s: not a trace file of version %d\n", path, LM_TRACE_VERSION);
+		return -1;
+	}
+	/* a live trace may grow further, replay what is there now */
+	if( header->count > header->capacity ) {
+		first = header->count % header->capacity;
+		count = header->capacity;
+	}
+	else {
+		first = 0;
+		count = header->count;
+	}
+	return 0;
+}
+
+/* Record <i> of the trace in time order */
+const struct lm_trace_record *trace_get(unsigned long i)
+{
+	return &records[(first + i) % header->capacity];
+}
+
+/* 	Returns true if <rec> is a frame to replay: sent to the device and, without
+	-c, not one of the frames of lm_set_clock() (08 ss mm hh dd mm ww yy,
+	00 00 0d 00 00 00 00 00, 06 02 01 02 00 00 00 00), which would set the
+	device clock back to the time of the recording */
+bool trace_replay(const struct lm_trace_record *rec)
+{
+	static const unsigned char clock_commit[2][LM_FRAME_LEN] = {
+		{ 0x00, 0x00, 0x0d, 0x00, 0x00, 0x00, 0x00, 0x00 },
+		{ 0x06, 0x02, 0x01, 0x02, 0x00, 0x00, 0x00, 0x00 },
+	};
+
+	if( rec->direction != LM_TRACE_OUT ) {
+		return false;
+	}
+	return fclock || (rec->data[0] != 0x08 &&
+					  memcmp(rec->data, clock_commit[0], LM_FRAME_LEN) != 0 &&
+					  memcmp(rec->data, clock_commit[1], LM_FRAME_LEN) != 0);
+}
+
+/* Print the trace as text */
+void trace_list(void)
+{
+	unsigned long i;
+	time_t start;
+	char buf[64];
+
+	start = (time_t)(header->realtime / 1000000LL);
+	strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime(&start));
+	printf("Trace opened %s, %lu records (%llu written, capacity %llu)\n",
+		   buf, count, (unsigned long long)header->count, (unsigned long long)header->capacity);
+	printf("%12s %-3s %-23s %6s %4s %9s %9s\n", "time (s)", "dir", "data", "result", "rtry", "usb (us)", "paced (us)");
+	for(i=0; i<count; i++) {
+		const struct lm_trace_record *rec = trace_get(i);
+		const unsigned char *d = rec->data;
+
+		printf("%12.6f %-3s %02x %02x %02x %02x %02x %02x %02x %02x %6d %4u %9d %9d\n",
+			   (rec->time - header->monotonic) / 1e6, (rec->direction == LM_TRACE_OUT) ? "out" : "in",
+			   d[0], d[1], d[2], d[3], d[4], d[5], d[6], d[7],
+			   rec->result, rec->retries, rec->duration, rec->paced);
+	}
+}
+
+
+/* ======================================================================== */
+/* Replay */
+/* ======================================================================== */
+
+/* Add one transfer time */
+void times_add(struct times *times, long long us, bool ok)
+{
+	times->frames++;
+	if( !ok ) {
+		times->failed++;
+	}
+	times->total += us;
+	if( us > times->max ) {
+		times->max = us;
+	}
+}
+
+void times_print(const char *name, const struct times *times)
+{
+	printf("%-10s frames %lu, failed %lu, avg %lld us, max %lld us\n", name, times->frames, times->failed,
+		   (times->frames > 0) ? times->total / (long long)times->frames : 0LL, times->max);
+}
+
+/* 	Send each frame of the trace when it was taken by the USB scheduler
+	originally (transfer start less the pacer delay), relative to the first
+	frame. <late> receives how much later the frames were submitted.
+	returns the number of frames not sent */
+int replay_timed(lm_device *dev, struct times *times, struct times *late)
+{
+	long long start = 0;
+	long long origin = 0;
+	int failed = 0;
+	unsigned long i;
+
+	for(i=0; i<count; i++) {
+		const struct lm_trace_record *rec = trace_get(i);
+		unsigned char frame[LM_FRAME_LEN];
+		long long due;
+		long long now;
+		int rc;
+
+		if( !trace_replay(rec) ) {
+			continue;
+		}
+		if( start == 0 ) {
+			start = time_us();
+			origin = rec->time - rec->paced;
+		}
+		due = start + (rec->time - rec->paced - origin);
+		sleep_until(due);
+		now = time_us();
+		times_add(late, now - due, true);
+
+		memcpy(frame, rec->data, LM_FRAME_LEN);
+		rc = lm_transfer(dev, frame, rec->fexpectdata);
+		times_add(times, time_us() - now, rc == LM_OK);
+		if( rc != LM_OK ) {
+			failed++;
+		}
+	}
+	return failed;
+}
+
+/* 	Send the frames of the trace back to back: consecutive frames without
+	device answer as one burst of up to BURST_MAX frames, like the daemon
+	sends a batch. returns the number of frames not sent */
+int replay_full(lm_device *dev, struct times *times)
+{
+	unsigned char frames[BURST_MAX][LM_FRAME_LEN];
+	struct lm_result results[BURST_MAX];
+	int failed = 0;
+	unsigned long i = 0;
+
+	while( i < count ) {
+		const struct lm_trace_record *rec = trace_get(i);
+		int n = 0;
+		int j;
+
+		if( !trace_replay(rec) ) {
+			i++;
+			continue;
+		}
+		if( rec->fexpectdata ) {
+			long long now = time_us();
+			int rc;
+
+			memcpy(frames[0], rec->data, LM_FRAME_LEN);
+			rc = lm_transfer(dev, frames[0], true);
+			times_add(times, time_us() - now, rc == LM_OK);
+			failed += (rc != LM_OK);
+			i++;
+			continue;
+		}
+		for(; i < count && n < BURST_MAX; i++) {
+			rec = trace_get(i);
+			if( !trace_replay(rec) ) {
+				continue;
+			}
+			if( rec->fexpectdata ) {
+				break;
+			}
+			memcpy(frames[n++], rec->data, LM_FRAME_LEN);
+		}
+		failed += lm_submit(dev, frames, n, results);
+		for(j=0; j<n; j++) {
+			times_add(times, results[j].finished - results[j].started, results[j].status == LM_OK);
+		}
+	}
+	return failed;
+}
+
+
+/* ======================================================================== */
+/* Main */
+/* ======================================================================== */
+
+void usage(void)
+{
+	printf("\nUsage: %s [OPTION] tracefile\n", PROGNAME);
+	printf("\n");
+	printf("Replays the USB transfers recorded by lightmanager -t <tracefile>.\n");
+	printf("\n");
+	printf("Options are:\n");
+	printf("    -c            Replay the frames setting the device clock too, the device\n");
+	printf("                  then gets the time of the recording (default skipped)\n");
+	printf("    -f            Full speed: send the frames back to back, bursts of up to %d\n", BURST_MAX);
+	printf("                  frames (default original timing)\n");
+	printf("    -g            Debug output of liblightmanager\n");
+	printf("    -l            List the trace as text and exit\n");
+	printf("    -N mode       Replay against the simulated Light Manager, <mode> paced or\n");
+	printf("                  unpaced (default USB device)\n");
+	printf("    -o file       Trace the replay into <file>\n");
+	printf("    -?            Prints this help and exit\n");
+	printf("    -v            Prints version and exit\n");
+}
+
+
+int main(int argc, char * argv[]) {
+	struct times times;
+	struct times late;
+	struct times traced;
+	lm_device *dev;
+	long long started;
+	long long elapsed;
+	long long span = 0;
+	long long origin = 0;
+	char stats[4096];
+	unsigned long i;
+	unsigned long skipped = 0;
+	int failed;
+
+	fclock = false;
+	ffull = false;
+	flist = false;
+	fdebug = false;
+	memset(simulate, 0, sizeof(simulate));
+	memset(outfile, 0, sizeof(outfile));
+
+	while (true)
+	{
+		int result = getopt(argc, argv, "cfglN:o:v?");
+		if (result == -1) {
+			break; /* end of list */
+		}
+		switch (result)
+		{
+			case 'c':
+				fclock = true;
+				break;
+			case 'f':
+				ffull = true;
+				break;
+			case 'g':
+				fdebug = true;
+				break;
+			case 'l':
+				flist = true;
+				break;
+			case 'N':
+				if( strcasecmp(optarg, "paced") != 0 && strcasecmp(optarg, "unpaced") != 0 ) {
+					fprintf(stderr, "wrong simulation mode '%s', use paced or unpaced\n", optarg);
+					return EXIT_FAILURE;
+				}
+				strncpy(simulate, optarg, sizeof(simulate)-1);
+				break;
+			case 'o':
+				strncpy(outfile, optarg, sizeof(outfile)-1);
+				break;
+			case 'v':
+				printf("%s v%s\n", PROGNAME, VERSION);
+				return EXIT_SUCCESS;
+			case '?': /* unknown parameter */
+			default:
+				usage();
+				return EXIT_SUCCESS;
+		}
+	}
+	if( optind != argc - 1 ) {
+		usage();
+		return EXIT_FAILURE;
+	}
+	if( trace_map(argv[optind]) != 0 ) {
+		return EXIT_FAILURE;
+	}
+	if( flist ) {
+		trace_list();
+		return EXIT_SUCCESS;
+	}
+
+	/* what the trace took originally */
+	memset(&traced, 0, sizeof(traced));
+	for(i=0; i<count; i++) {
+		const struct lm_trace_record *rec = trace_get(i);
+
+		if( !trace_replay(rec) ) {
+			skipped += (rec->direction == LM_TRACE_OUT);
+			continue;
+		}
+		if( traced.frames == 0 ) {
+			origin = rec->time;
+		}
+		span = rec->time + rec->duration - origin;
+		times_add(&traced, rec->duration, rec->result == LM_OK);
+	}
+	if( traced.frames == 0 ) {
+		fprintf(stderr, "%s: no frames to replay\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+
+	lm_set_log(log_va);
+	if( *outfile && lm_trace_open(outfile, DEF_TRACERECORDS) != LM_OK ) {
+		return EXIT_FAILURE;
+	}
+	dev = *simulate ? lm_open_sim(strcasecmp(simulate, "unpaced") != 0) : lm_open();
+	if( dev == NULL ) {
+		lm_trace_close();
+		return EXIT_FAILURE;
+	}
+	printf("%s: %lu frames of %s (%.3f s), %s, %s\n", PROGNAME, traced.frames, argv[optind], span / 1e6,
+		   ffull ? "full speed" : "original timing", *simulate ? simulate : "USB device");
+	if( skipped > 0 ) {
+		printf("%s: %lu clock frames skipped, replay them with -c\n", PROGNAME, skipped);
+	}
+
+	memset(&times, 0, sizeof(times));
+	memset(&late, 0, sizeof(late));
+	started = time_us();
+	failed = ffull ? replay_full(dev, &times) : replay_timed(dev, &times, &late);
+	elapsed = time_us() - started;
+
+	printf("\nReplayed %lu frames in %.3f s (%.1f frames/s, trace %.1f frames/s)\n", times.frames, elapsed / 1e6,
+		   times.frames * 1e6 / (elapsed > 0 ? elapsed : 1), traced.frames * 1e6 / (span > 0 ? span : 1));
+	times_print("trace", &traced);
+	times_print("replay", &times);
+	if( !ffull ) {
+		times_print("late", &late);
+	}
+	lm_stats(dev, stats, sizeof(stats));
+	printf("\n%s", stats);
+
+	lm_close(dev);
+	lm_trace_close();
+	return (failed > 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
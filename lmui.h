@@ -0,0 +1,152 @@
+/* Generated by mkui.sh from ui/index.html ui/app.js ui/style.css, do not edit */
+
+/* ui/index.html, 1024 bytes */
+static const unsigned char ui_asset0[] = {
+	0x1f,0x8b,0x08,0x00,0x00,0x00,0x00,0x00,0x02,0x03,0x8d,0x54,0x4d,0x8f,0xd3,0x30,
+	0x10,0xbd,0xf7,0x57,0x18,0x4b,0x20,0x90,0x9a,0x75,0x9a,0xee,0xd2,0x22,0x9c,0x1c,
+	0xe8,0x82,0x84,0x84,0x04,0x52,0xf7,0xc2,0xd1,0x8d,0x27,0x89,0xc1,0xb1,0x8d,0xed,
+	0x74,0xb5,0xff,0x1e,0x7f,0xa4,0xdd,0xa5,0x0b,0x12,0x91,0xa2,0x78,0xde,0xcc,0x3c,
+	0xbf,0xf1,0x8c,0x43,0x5f,0xdc,0x7e,0xdd,0xdd,0x7d,0xff,0xf6,0x11,0x0d,0x7e,0x94,
+	0xcd,0x82,0xc6,0x0f,0x92,0x4c,0xf5,0x35,0x06,0x85,0x23,0x00,0x8c,0x87,0xcf,0x08,
+	0x9e,0xa1,0x76,0x60,0xd6,0x81,0xaf,0xf1,0xe4,0xbb,0x62,0x8b,0x4f,0xb0,0x62,0x23,
+	0xd4,0xf8,0x28,0xe0,0xde,0x68,0xeb,0x31,0x6a,0xb5,0xf2,0xa0,0x42,0xd8,0xbd,0xe0,
+	0x7e,0xa8,0x39,0x1c,0x45,0x0b,0x45,0x32,0x96,0x48,0x28,0xe1,0x05,0x93,0x85,0x6b,
+	0x99,0x84,0x7a,0x15,0x49,0xbc,0xf0,0x12,0x9a,0x2f,0xa2,0x0f,0x9b,0x33,0xc5,0x7a,
+	0xb0,0x94,0x64,0x6c,0x41,0xa5,0x50,0x3f,0x91,0x05,0x59,0x63,0xe7,0x1f,0x24,0xb8,
+	0x01,0x20,0xec,0x30,0x58,0xe8,0x6a,0x4c,0x26,0x41,0x12,0x5a,0xac,0xd6,0xdb,0x72,
+	0x73,0xb3,0x5d,0x6f,0xaa,0xab,0xd6,0xb9,0xc8,0x49,0x66,0xdd,0x07,0xcd,0x1f,0xe6,
+	0x2a,0xc0,0x36,0x0b,0x84,0xe8,0xb0,0xba,0xd8,0x2a,0x00,0x11,0x77,0x86,0x29,0x24,
+	0x78,0x8d,0x3d,0x8c,0x06,0x37,0x45,0x81,0x5e,0x71,0xe8,0xdf,0xef,0x28,0x89,0x9e,
+	0x13,0x65,0x24,0xa1,0x23,0x13,0x2a,0xe7,0x40,0xeb,0x85,0x4e,0xeb,0xc8,0x5c,0x35,
+	0xb7,0xa9,0x56,0x17,0x62,0xab,0x19,0xf4,0xec,0x20,0x21,0xf1,0xe6,0x73,0x88,0xea,
+	0x10,0xca,0xae,0xa4,0x91,0x7a,0x1b,0xde,0x61,0x4e,0x0d,0x95,0x0f,0xc9,0xdc,0x7b,
+	0xe6,0x1f,0xad,0xdd,0x10,0x5a,0x02,0xfc,0x6c,0xe7,0x05,0x89,0xa9,0x24,0xd3,0x9c,
+	0x49,0x53,0xc5,0x01,0xcd,0x95,0x27,0x8c,0x24,0x11,0x49,0x31,0x79,0x22,0xf9,0xb9,
+	0xfc,0x3d,0x28,0xfe,0x44,0x7b,0xa7,0xed,0x98,0xa4,0xbb,0x80,0x3f,0xea,0x76,0x20,
+	0x43,0xe2,0xdc,0x76,0x63,0xb5,0xd7,0x67,0x5f,0xf0,0x6a,0x13,0x39,0xd1,0x91,0xc9,
+	0x29,0xb8,0x3b,0x57,0x95,0xb8,0xf9,0xb4,0xaf,0x4a,0x4a,0xb2,0xe7,0x9f,0xa1,0xc2,
+	0xe3,0xe6,0x73,0x98,0x1c,0x7b,0x07,0xed,0xa0,0xf4,0x7f,0xc4,0x17,0x12,0x98,0x55,
+	0x7f,0x64,0xa1,0xd7,0xad,0xe6,0x80,0x92,0x43,0xa8,0xfe,0xcd,0x25,0x4b,0x3c,0x80,
+	0xa8,0xfe,0x6c,0x0b,0x65,0xa6,0x53,0x2d,0x8c,0x73,0x8b,0x91,0x91,0xac,0x85,0x41,
+	0xcb,0xd0,0xeb,0x1a,0xaf,0xc2,0x83,0xb4,0x45,0x1f,0xc8,0x1a,0x87,0x39,0xfc,0x35,
+	0x09,0x0b,0xfc,0xef,0xc9,0xe9,0x2c,0x2f,0xd2,0xb5,0x5a,0x22,0xdd,0x75,0x4b,0xe4,
+	0x75,0xdf,0x4b,0x58,0xa2,0x9b,0xf2,0x25,0x3e,0x15,0x10,0xa3,0x9f,0x51,0x1e,0x26,
+	0xef,0x83,0xdc,0xdc,0x89,0xd9,0x98,0xbb,0x18,0xdb,0x31,0xaf,0x4d,0x6e,0x4b,0x98,
+	0x91,0x29,0x0c,0x14,0x25,0xe6,0xa2,0xb9,0x94,0xe4,0x19,0xa5,0xae,0xb5,0xc2,0x78,
+	0xe4,0x6c,0x9b,0xef,0x0b,0x33,0xa6,0xa8,0x56,0xd7,0xef,0xae,0xcb,0xf2,0xed,0x7a,
+	0x73,0xf5,0x23,0x65,0xe7,0xa0,0x98,0x35,0x5f,0x17,0x92,0xff,0x06,0xbf,0x01,0x14,
+	0x29,0xe6,0x35,0x1e,0x04,0x00,0x00,
+};
+
+/* ui/app.js, 2824 bytes */
+static const unsigned char ui_asset1[] = {
+	0x1f,0x8b,0x08,0x00,0x00,0x00,0x00,0x00,0x02,0x03,0x95,0x56,0x5b,0x4f,0x1b,0x3b,
+	0x10,0x7e,0xe7,0x57,0x8c,0x2c,0x54,0xed,0x42,0xba,0x09,0xf4,0x8d,0x28,0xad,0x0a,
+	0xa5,0x52,0xce,0x41,0x80,0x08,0x7d,0xa2,0x3c,0x38,0xbb,0xb3,0xc9,0x96,0x8d,0xbd,
+	0xb2,0xbd,0x01,0x54,0xf1,0xdf,0x3b,0x63,0xef,0x25,0x09,0x20,0xb5,0x48,0x28,0x5e,
+	0x7b,0x2e,0xdf,0x7c,0x73,0xb1,0x87,0x07,0x70,0x51,0x2c,0x96,0x6e,0x25,0x95,0x5c,
+	0xa0,0x81,0x47,0x9c,0xc3,0x8f,0xe9,0x09,0x64,0xb8,0x2e,0x52,0x04,0xeb,0xa4,0x43,
+	0x0b,0x52,0x65,0xe0,0x70,0x55,0xa1,0x91,0xae,0x36,0x08,0xeb,0x42,0x82,0x5b,0x22,
+	0xdc,0x9c,0xcf,0x6e,0xe1,0xeb,0xf5,0x74,0xb0,0x07,0x00,0x65,0xb1,0x46,0xa8,0xab,
+	0xcc,0x6b,0xb4,0x12,0xb8,0x46,0xe5,0xc8,0x8c,0x41,0xb9,0x82,0xa1,0xff,0xb2,0x70,
+	0x30,0xdc,0x13,0xb5,0x65,0xeb,0xa6,0x48,0x9d,0x18,0xef,0xed,0xad,0xa5,0x69,0x5c,
+	0x5a,0x98,0xc0,0xef,0x17,0xda,0xca,0x6b,0x95,0xba,0x42,0x2b,0xd8,0x8f,0x8a,0x2c,
+	0x86,0xdf,0x60,0x90,0x7c,0x2b,0xc8,0x74,0x5a,0xaf,0xc8,0x4c,0xb2,0x40,0x77,0x5e,
+	0x22,0x2f,0x4f,0x9f,0xa7,0x19,0x0b,0x8d,0xe1,0x65,0x43,0xcf,0xa2,0x9b,0x11,0xfc,
+	0xda,0x46,0x0e,0x9f,0xdc,0x00,0xd0,0x18,0x6d,0xc8,0x10,0x61,0x65,0x77,0x58,0x92,
+	0xa7,0xfd,0x48,0x58,0x2f,0x23,0xe2,0x31,0xed,0x63,0x99,0xb0,0xec,0x99,0x56,0x8e,
+	0x61,0x4f,0x80,0xbf,0x9a,0x83,0xb4,0x94,0xd6,0x5e,0xca,0x15,0xd2,0xb6,0x37,0x05,
+	0x5f,0x40,0xf8,0x85,0x80,0x13,0x10,0x14,0x05,0x39,0x1f,0x1e,0x04,0x4e,0x2a,0xe9,
+	0x96,0xa0,0x73,0x90,0x2d,0x91,0x8a,0x15,0xcb,0xe2,0x01,0x41,0x7c,0x9f,0x1d,0x8f,
+	0xe0,0x88,0xfe,0x04,0x90,0x11,0x31,0xbd,0x85,0x53,0xf8,0x04,0x17,0xe7,0x5f,0x6f,
+	0x2e,0x85,0x27,0x52,0xd5,0x65,0x09,0xb9,0xee,0x19,0x61,0x22,0x89,0x65,0x48,0xa5,
+	0x52,0x9a,0xd8,0x7c,0x2c,0x5c,0xba,0x64,0x16,0xbb,0x58,0x83,0xe4,0x35,0x79,0x8d,
+	0xc2,0xb2,0x8f,0xb3,0x22,0xbc,0x61,0x2f,0xb1,0x55,0x59,0xb8,0x48,0x40,0x08,0xb6,
+	0xc8,0x21,0xaa,0xee,0x46,0xf7,0x30,0x99,0x4c,0x02,0x2a,0x01,0x1f,0x3e,0x40,0x95,
+	0x94,0xa8,0x16,0x04,0x9f,0xb7,0x8f,0xe3,0x96,0x76,0x31,0x94,0x55,0x31,0xcc,0xed,
+	0xf1,0x68,0x28,0xe0,0x10,0xaa,0xbb,0xa3,0xfb,0xd7,0x46,0xa6,0xb7,0xdb,0x26,0x3e,
+	0x4f,0xe0,0xd3,0x8e,0x85,0xc2,0x75,0xfa,0xf4,0x23,0x9a,0x8f,0x63,0x6f,0xac,0x11,
+	0xe4,0xf8,0x3d,0x9b,0x1b,0xa9,0x54,0x59,0xc4,0x9c,0x0e,0x40,0xfa,0x9d,0x3e,0xbc,
+	0x12,0x25,0xa9,0x4c,0x3c,0xe3,0x49,0xa1,0x32,0x7c,0xba,0xca,0x23,0xf1,0xc5,0x6f,
+	0x8b,0x98,0x11,0x8c,0xc6,0x8d,0x68,0x6d,0xca,0x56,0xd0,0x60,0x55,0xca,0x14,0x3b,
+	0xc1,0x01,0x25,0x30,0xee,0xf0,0xa0,0x4a,0x75,0x86,0x3f,0x6e,0xa6,0x67,0x7a,0x55,
+	0x69,0x45,0xa5,0x10,0xb5,0x6e,0x0f,0x21,0x0a,0x1e,0x29,0xf9,0x8d,0xae,0xcf,0x7e,
+	0xbc,0x81,0x3f,0x47,0x4a,0x4f,0x44,0xde,0x06,0x54,0xb5,0x2b,0x74,0x4b,0x9d,0x91,
+	0xc8,0xf5,0xd5,0x8c,0xd8,0x79,0x89,0x39,0xc3,0x90,0x50,0x4a,0x55,0xd4,0xc5,0x17,
+	0x99,0x8d,0x02,0x37,0xc9,0x2f,0xab,0x55,0xc4,0xd5,0xfc,0xbe,0xb0,0x3f,0x08,0xf4,
+	0x9b,0x24,0x94,0x70,0x48,0xc1,0xd5,0xff,0x14,0x48,0x5f,0xfa,0x1c,0x33,0x85,0x75,
+	0x02,0xbc,0x3f,0x6e,0xb4,0xb0,0xe4,0xe6,0x7b,0x2d,0xc3,0xb1,0x9b,0xc4,0xd7,0xf4,
+	0x00,0x9c,0xa9,0xb1,0xd1,0x68,0x71,0xa4,0x92,0x03,0xeb,0x81,0x70,0x95,0xbd,0x67,
+	0x07,0x5b,0x0b,0xa4,0xbd,0x9d,0x4c,0x43,0xc9,0x44,0x13,0xf5,0x29,0x9c,0xeb,0xec,
+	0x39,0xf4,0x62,0x53,0xf0,0x22,0x4e,0xdc,0xa9,0xce,0x0a,0xb4,0x54,0x59,0x0c,0x81,
+	0x25,0x76,0x3a,0x93,0x1b,0x0e,0xe0,0x6a,0xfe,0x0b,0x53,0x97,0x3c,0xe0,0xb3,0x6d,
+	0x0a,0xdf,0xc6,0x89,0xd5,0xc6,0x45,0x71,0x42,0x1d,0x74,0x2e,0xb7,0xf0,0x72,0x13,
+	0xb6,0xdc,0xf9,0x89,0xd3,0xb5,0x86,0xbd,0xe3,0xb3,0xfb,0x71,0x77,0xe4,0x0c,0x9d,
+	0x79,0xb7,0x85,0xb2,0x68,0xdc,0x8d,0x7e,0x8c,0xe2,0xfe,0xd8,0xf7,0xf7,0x64,0xb3,
+	0xed,0xbc,0xed,0x20,0xe0,0x4c,0xa3,0x74,0x86,0x65,0x49,0x40,0xb6,0x81,0xb3,0x60,
+	0x6f,0xc8,0xfa,0x29,0xb3,0xad,0x10,0x4e,0xad,0xdb,0x51,0xcc,0x7c,0x9e,0x1b,0x5d,
+	0x4e,0x7c,0xb3,0xd1,0xe4,0xfd,0x92,0xf3,0xee,0xb6,0xc6,0x94,0xd0,0x4a,0xfc,0x15,
+	0x24,0x7c,0x84,0x6f,0x64,0x89,0x2c,0xba,0x82,0x34,0x0f,0xe0,0x68,0x34,0x1a,0x91,
+	0x94,0xbe,0xd0,0xa9,0x2c,0x71,0x46,0x73,0x5a,0x2d,0x36,0xe3,0x77,0xd9,0x7b,0xb0,
+	0xfd,0x40,0x90,0xcd,0xf8,0xe0,0x4e,0x6e,0xfb,0xbf,0x3f,0x1e,0x86,0x61,0xb7,0x3f,
+	0x24,0x18,0xd6,0x05,0xe6,0xe2,0x40,0xe9,0xe1,0xa4,0x6b,0xab,0x20,0x7f,0xc7,0x31,
+	0x50,0x77,0xea,0x3c,0xe7,0x1f,0xa7,0x17,0x8b,0x12,0xc5,0xfd,0x1b,0xc9,0x95,0x7d,
+	0x57,0xf8,0xa2,0x62,0xc6,0xda,0xab,0x22,0xa5,0xeb,0xc7,0x61,0x73,0x5b,0x44,0x62,
+	0x5e,0x3b,0x47,0x66,0xbb,0x7e,0x98,0xef,0xf0,0x21,0xfb,0x03,0xad,0xd2,0xb2,0x48,
+	0x1f,0x68,0xb3,0xf7,0x14,0xaa,0xbe,0x9f,0x48,0x5c,0xe3,0xad,0x86,0xcb,0x12,0x59,
+	0x55,0x74,0x78,0xb6,0x2c,0xca,0x2c,0x9a,0x77,0x1d,0xc4,0xbf,0xbb,0x9d,0x60,0x97,
+	0xfa,0xf1,0x96,0xae,0xd5,0xc8,0xb1,0x49,0xaa,0x7f,0xbe,0x63,0xc5,0x6e,0x76,0xb8,
+	0x0e,0x56,0x15,0x25,0xe3,0x7b,0xf1,0x84,0x59,0x74,0xe4,0xe7,0x14,0xfc,0xac,0x47,
+	0xa3,0xf9,0xe8,0x4c,0xf8,0x3b,0x8f,0xaf,0x31,0xf2,0x49,0xaa,0x5a,0xd9,0x7a,0xbe,
+	0x2a,0xdc,0x16,0xe0,0x8d,0xdb,0x20,0xe7,0xdb,0x2b,0x71,0xd2,0xd0,0xed,0xd9,0xce,
+	0xc5,0xca,0x68,0xa7,0x59,0x21,0xf1,0xab,0x64,0x2d,0xcb,0x1a,0xbb,0xc3,0x50,0xe9,
+	0x61,0x78,0xfb,0x61,0xed,0x65,0xba,0x01,0xfa,0xf1,0xad,0x01,0x9a,0x27,0x32,0xcb,
+	0x4c,0x30,0x94,0x50,0xf1,0xac,0xa2,0xfe,0xc6,0x09,0xce,0xb8,0x64,0x0b,0xf7,0xb1,
+	0x1d,0xd3,0x6f,0x25,0x1f,0x09,0x8e,0x7f,0x30,0x7c,0xc3,0x5c,0xd6,0xa5,0x0b,0x36,
+	0x36,0x88,0x27,0x2f,0x3e,0xc0,0x2d,0x3f,0x4c,0x31,0xbf,0x1e,0xfc,0x0c,0x0e,0xa8,
+	0x7d,0x97,0x30,0xad,0x7f,0x37,0x73,0x77,0xe5,0xca,0xc2,0xba,0x40,0x20,0xaf,0xde,
+	0xa8,0x3c,0xff,0x3a,0x69,0xe7,0x48,0x96,0x84,0xd5,0x3d,0xbf,0x63,0xc2,0xfb,0xe9,
+	0xa4,0x6d,0x5d,0x1a,0x89,0xd4,0x5e,0xfc,0x99,0x2e,0xa5,0x5a,0x60,0x46,0x75,0xd3,
+	0x94,0x46,0x3b,0x14,0x09,0x3d,0xfd,0x6f,0xa2,0x6f,0x6b,0xe2,0x5f,0xc0,0xb7,0x85,
+	0x15,0xbf,0x1a,0xd9,0xa4,0xc6,0x0e,0xfc,0x83,0xab,0x79,0x8d,0x85,0xfe,0x3f,0xe7,
+	0x8f,0x99,0xae,0x0d,0x27,0xb5,0x79,0xa8,0x71,0x87,0x84,0x15,0xe7,0xd3,0x4b,0x5c,
+	0x10,0x05,0xa8,0x08,0xa9,0x08,0xac,0x0e,0xde,0x2e,0x33,0x1e,0x0f,0xff,0xcd,0xae,
+	0x2e,0x93,0x4a,0x1a,0x8b,0x11,0x26,0xf4,0x2a,0x94,0x3e,0xd0,0x7f,0xe3,0xc9,0x8f,
+	0xa3,0x97,0xd7,0x04,0xbd,0x8b,0xca,0xb3,0xb5,0x0b,0xaa,0x6f,0xb4,0xd7,0x98,0x9a,
+	0x0b,0xea,0x0f,0x7c,0x08,0x66,0x00,0x08,0x0b,0x00,0x00,
+};
+
+/* ui/style.css, 716 bytes */
+static const unsigned char ui_asset2[] = {
+	0x1f,0x8b,0x08,0x00,0x00,0x00,0x00,0x00,0x02,0x03,0x6d,0x91,0xc1,0x6e,0x83,0x30,
+	0x10,0x44,0xef,0xf9,0x8a,0x95,0xa2,0xde,0x42,0x44,0x48,0x2a,0x55,0xf0,0x35,0x06,
+	0xaf,0xc1,0xad,0xb1,0x91,0xbd,0x28,0xa4,0x15,0xff,0xde,0xb5,0x29,0x29,0x89,0x22,
+	0x2e,0x46,0x9e,0xdd,0x79,0x33,0xae,0x9d,0xbc,0xc1,0x0f,0x28,0x67,0x29,0x53,0xa2,
+	0xd7,0xe6,0x56,0x42,0x10,0x36,0x64,0x01,0xbd,0x56,0x15,0xf4,0xc2,0xb7,0xda,0x96,
+	0x90,0x57,0x50,0x8b,0xe6,0xab,0xf5,0x6e,0xb4,0xb2,0x84,0xbd,0xba,0xc4,0xaf,0x82,
+	0xc6,0x19,0xe7,0xf9,0xbf,0x28,0x8a,0x0a,0xe6,0x5d,0x87,0x42,0xa2,0xe7,0x85,0x52,
+	0x87,0xc1,0x08,0x5e,0xa6,0x0c,0x4e,0x15,0x7c,0x8e,0x81,0xb4,0xba,0x65,0x0d,0xfb,
+	0xa0,0x25,0xf6,0x18,0x44,0x83,0x59,0x8d,0x74,0x45,0xb4,0x15,0x08,0xa3,0x5b,0x9b,
+	0x69,0xc2,0x3e,0x94,0xd0,0xb0,0x02,0x7d,0x05,0x83,0x90,0x52,0xdb,0x96,0xcd,0x8f,
+	0xef,0xd8,0xc3,0x09,0xfb,0x27,0x88,0xe2,0xbc,0x21,0x50,0x4a,0x6d,0x08,0xba,0xd3,
+	0x9a,0x2a,0xe8,0x6f,0x2c,0xe1,0x74,0x3c,0xc7,0xf1,0x4d,0x9c,0x79,0xb7,0x67,0xbb,
+	0xe1,0xa5,0x6c,0xde,0xf5,0x42,0x5b,0xbe,0xfa,0x47,0x58,0xec,0xe7,0x5d,0xc0,0x86,
+	0xb4,0x8b,0x77,0x8f,0x7d,0xa8,0x4d,0x59,0x2c,0x8d,0x0e,0x2f,0xf9,0x9d,0x67,0xbc,
+	0xcc,0x0b,0xa9,0x47,0x8e,0x7a,0x19,0xa6,0x04,0x5d,0x3c,0x63,0xfc,0xb9,0x91,0xa8,
+	0x0d,0x46,0xaf,0x65,0x8c,0xb3,0x1a,0x31,0x04,0x56,0xac,0xa7,0x0a,0xae,0x5a,0x52,
+	0xc7,0x23,0x79,0xfe,0x96,0x26,0xba,0x03,0x90,0xe4,0x11,0xc2,0x89,0xb2,0xd4,0x6b,
+	0x09,0x06,0x15,0x3d,0xf0,0x9c,0x23,0x61,0xa4,0xba,0x13,0xd5,0x8e,0xc8,0xf5,0xbc,
+	0x67,0x98,0x20,0x38,0xa3,0x25,0xec,0xa5,0x94,0x69,0xa3,0x3c,0xa6,0xbc,0x6b,0xd1,
+	0xf9,0x07,0x67,0x4b,0xb0,0x57,0xd4,0x6d,0xc7,0x8f,0x59,0x3b,0x93,0x94,0xf5,0xc8,
+	0x3b,0xa2,0x74,0x29,0x22,0xf3,0xcb,0x75,0xbe,0x96,0xaa,0xed,0x30,0xd2,0x01,0x02,
+	0x1a,0x2e,0xf1,0x00,0x77,0xf9,0x36,0x79,0x54,0x6e,0x40,0x8b,0x04,0x7a,0x59,0xe6,
+	0xf7,0x81,0x04,0x8d,0xe1,0x88,0xde,0x3b,0xbf,0x21,0xaa,0xf3,0xf4,0x9e,0xbf,0x7b,
+	0x51,0x19,0xf6,0xcc,0x02,0x00,0x00,
+};
+
+/* { path, content type, ETag, immutable, data, size } */
+#define UI_ASSETS \
+	{ "/", "text/html; charset=utf-8", "\"4081273861\"", false, ui_asset0, sizeof(ui_asset0) }, \
+	{ "/ui/app-2149400637.js", "application/javascript; charset=utf-8", "\"3901538156\"", true, ui_asset1, sizeof(ui_asset1) }, \
+	{ "/ui/style-1380758372.css", "text/css; charset=utf-8", "\"3475623494\"", true, ui_asset2, sizeof(ui_asset2) }, \
+
@@ -0,0 +1,58 @@
+#!/bin/sh
+# Generate lmui.h with the web UI files gzip compressed as C arrays.
+# index.html is served as / and revalidated by its ETag, the other files
+# get their checksum into the name and can be cached for good.
+#
+# usage: mkui.sh ui/index.html ui/app.js ... > lmui.h
+
+set -e
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+# fingerprinted names of all files except index.html
+subst=""
+for f in "$@"; do
+	name=$(basename "$f")
+	[ "$name" = index.html ] && continue
+	sum=$(cksum < "$f" | cut -d' ' -f1)
+	hashed=$(echo "$name" | sed "s/\.\([^.]*\)\$/-$sum.\1/")
+	subst="$subst -e s|\"$name\"|\"/ui/$hashed\"|g"
+	echo "$hashed" > "$tmp/$name.path"
+done
+
+echo "/* Generated by mkui.sh from $*, do not edit */"
+echo
+n=0
+assets=""
+for f in "$@"; do
+	name=$(basename "$f")
+	case "$name" in
+		*.html)	type="text/html; charset=utf-8" ;;
+		*.css)	type="text/css; charset=utf-8" ;;
+		*.js)	type="application/javascript; charset=utf-8" ;;
+		*.svg)	type="image/svg+xml" ;;
+		*.png)	type="image/png" ;;
+		*.ico)	type="image/x-icon" ;;
+		*)		type="application/octet-stream" ;;
+	esac
+	if [ "$name" = index.html ]; then
+		path="/"
+		immutable=false
+		sed $subst "$f" | gzip -9n > "$tmp/gz"
+	else
+		path="/ui/$(cat "$tmp/$name.path")"
+		immutable=true
+		gzip -9n < "$f" > "$tmp/gz"
+	fi
+	etag=$(cksum < "$tmp/gz" | cut -d' ' -f1)
+	echo "/* $f, $(wc -c < "$f" | tr -d ' ') bytes */"
+	echo "static const unsigned char ui_asset$n[] = {"
+	od -An -v -tx1 "$tmp/gz" | sed -e 's/ *\([0-9a-f][0-9a-f]\)/0x\1,/g' -e 's/^/\t/'
+	echo "};"
+	echo
+	assets="$assets	{ \"$path\", \"$type\", \"\\\"$etag\\\"\", $immutable, ui_asset$n, sizeof(ui_asset$n) }, \\
+"
+	n=$((n+1))
+done
+echo "/* { path, content type, ETag, immutable, data, size } */"
+printf '#define UI_ASSETS \\\n%s\n' "$assets"
@@ -0,0 +1,83 @@
+/* Lightmanager web UI: device states and temperature via the REST API,
+   live updates via the event stream /events */
+"use strict";
+
+var devices = {};
+
+function $(id) { return document.getElementById(id); }
+
+function setStatus(text, error) {
+  var el = $("status");
+  el.textContent = text;
+  el.className = error ? "error" : "";
+}
+
+/* REST path of a device name like "FS20 1111" or "IT B 3 LEARN",
+   null for devices the API cannot switch */
+function devicePath(device) {
+  var p = device.split(" ");
+  if (p[0] === "FS20" && p.length === 2) return "/api/fs20/" + p[1];
+  if (p[0] === "IT" && p.length >= 3) return "/api/it/" + p[1] + "/" + p[2];
+  return null;
+}
+
+function send(path, action) {
+  var learn = path.indexOf("?learn") >= 0;
+  var url = path.replace("?learn", "") + "/" + encodeURIComponent(action) + (learn ? "?learn" : "");
+  return fetch(url, { method: "POST" })
+    .then(function (r) { return r.json(); })
+    .then(function (r) {
+      if (r.status === "OK") setStatus(url + ": OK");
+      else setStatus(url + ": " + r.error, true);
+    })
+    .catch(function (e) { setStatus(url + ": " + e, true); });
+}
+
+function render() {
+  var body = $("devices").tBodies[0];
+  body.textContent = "";
+  Object.keys(devices).sort().forEach(function (name) {
+    var d = devices[name];
+    var tr = body.insertRow();
+    var path = devicePath(name);
+    tr.insertCell().textContent = name;
+    var st = tr.insertCell();
+    st.textContent = d.state;
+    if (d.state === "ON") st.className = "on";
+    tr.insertCell().textContent = new Date(d.time * 1000).toLocaleString();
+    var td = tr.insertCell();
+    if (path === null) return;
+    if (/ LEARN$/.test(name)) path += "?learn";
+    ["on", "off", "toggle"].forEach(function (a) {
+      var b = document.createElement("button");
+      b.textContent = a;
+      b.onclick = function () { send(path, a); };
+      td.appendChild(b);
+    });
+  });
+}
+
+function showTemp(t) { $("temp").textContent = t.temp.toFixed(1) + " \u00b0C"; }
+
+$("send").onsubmit = function (e) {
+  var f = e.target;
+  var proto = f.proto.value;
+  var path = "/api/" + proto.replace("-learn", "") + "/" + f.addr.value.trim();
+  if (proto === "it-learn") path += "?learn";
+  e.preventDefault();
+  send(path, f.action.value.trim());
+};
+
+fetch("/api/state").then(function (r) { return r.json(); }).then(function (list) {
+  list.forEach(function (d) { devices[d.device] = { state: d.state, time: d.changed }; });
+  render();
+});
+fetch("/api/temp").then(function (r) { return r.json(); }).then(showTemp).catch(function () {});
+
+var events = new EventSource("/events");
+events.addEventListener("state", function (e) {
+  var d = JSON.parse(e.data);
+  devices[d.device] = { state: d.state, time: d.time };
+  render();
+});
+events.addEventListener("temp", function (e) { showTemp(JSON.parse(e.data)); });